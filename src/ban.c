@@ -14,15 +14,23 @@ addip <ip>
 removeip <ip>
 
 The ip address is specified in dot format, and any unspecified digits will match any value, so you can specify an entire class C network with "addip 192.246.40".
+CIDR notation works as well: "addip 10.0.0.0/12".
 
 Removeip will only remove an address specified exactly the same way.  You cannot addip a subnet, then removeip a single host.
 
+The most specific (longest) matching filter wins, so "addip 10.1.2.3 safe" lets this host in even if "10.1.0.0/16" is banned.
+
 listip
 Prints the current list of filters.
 
 writeip
 Dumps "addip <ip>" commands to listip.cfg so it can be execed at a later date.  The filter lists are not saved and restored by default, because I beleive it would cause too much confusion.
 
+ban_filter <0 or 1>
+
+If 1 (the default), kernel drops datagrams of banned addresses before proxy reads them, linux only.
+Filter is rebuilt when the list changes, if it can't hold all filters then proxy checks the rest as usual.
+
 filterban <0 or 1>
 
 If 1 (the default), then ip addresses matching the current list will be prohibited from entering the game.  This is the default setting.
@@ -35,8 +43,6 @@ If 0, then only addresses matching the list will be allowed.  This lets you easi
 
 #define LISTIP_NAME "qwfwd_listip.cfg"
 
-#define	MAX_IPFILTERS	1024
-
 typedef enum
 {
 	ipft_ban,
@@ -45,43 +51,92 @@ typedef enum
 
 typedef struct
 {
-	unsigned	mask;
-	unsigned	compare;
+	unsigned	mask;		// network byte order
+	unsigned	compare;	// network byte order
 //	int			level;
 	double		time; // for ban expiration
 	ipfiltertype_t type;
 } ipfilter_t;
 
+// filters with contiguous mask (CIDR prefix) live in the trie, so lookup cost does not depend on number of filters.
+// old syntax allows masks like "192.0.40.1" (zero octet matches anything), such filter can't be in the trie,
+// they are rare, so we just check them one by one.
+static iptrie_t		ipfilters;
+static ipfilter_t	**oddfilters;
+static int			numoddfilters;
+static int			maxoddfilters;
+static int			numipfilters;	// all filters
+static double		next_expire;	// nearest ban expiration time, 0 if there is none
+static qbool		filters_changed = true;	// kernel filter should be rebuilt, it drops runts even if we have no filters
 
-static ipfilter_t	ipfilters[MAX_IPFILTERS];
-static int			numipfilters;
+static cvar_t		*ban_filter;
 
 //cvar_t	filterban = {"filterban", "1"};
 
+// number of bits set in the mask
+static int SV_MaskBits (unsigned mask)
+{
+	int bits = 0;
+
+	for ( ; mask; mask &= mask - 1)
+		bits++;
+
+	return bits;
+}
+
+// length of the prefix if mask is contiguous, -1 otherwise
+static int SV_FilterPrefixLen (const ipfilter_t *f)
+{
+	unsigned int inv = ~ntohl(f->mask);
+
+	if (inv & (inv + 1))
+		return -1;
+
+	return SV_MaskBits(f->mask);
+}
+
 /*
 =================
 SV_FilterPacket
+
+Longest matching filter wins, so "safe" filter for host or subnet overrides "ban" of the wider subnet.
 =================
 */
 qbool SV_IsBanned (struct sockaddr_in *addr)
 {
-	int				i;
+	int				i, bits, best_bits = -1;
 	unsigned int	in;
+	ipfilter_t		*f, *best;
 
 	in = addr->sin_addr.s_addr;
 
-	for (i=0 ; i<numipfilters ; i++)
+	if ((best = IPTrie_Lookup(&ipfilters, ntohl(in), &bits)))
+		best_bits = bits;
+
+	for (i = 0; i < numoddfilters; i++)
 	{
-		if ( ipfilters[i].type == ipft_ban && (in & ipfilters[i].mask) == ipfilters[i].compare )
-		{
-			if (developer->integer > 1)
-				Sys_DPrintf("banned %s:%d\n", inet_ntoa(addr->sin_addr), (int)ntohs(addr->sin_port));
+		f = oddfilters[i];
 
-//			return (int)filterban.value;
-			return true;
+		if ((in & f->mask) != f->compare)
+			continue;
+
+		bits = SV_MaskBits(f->mask);
+		if (bits > best_bits || (bits == best_bits && f->type == ipft_safe))
+		{
+			best = f;
+			best_bits = bits;
 		}
 	}
 
+	if ( best && best->type == ipft_ban )
+	{
+		if (developer->integer > 1)
+			Sys_DPrintf("banned %s:%d\n", inet_ntoa(addr->sin_addr), (int)ntohs(addr->sin_port));
+
+//		return (int)filterban.value;
+		return true;
+	}
+
 //	return !(int)filterban.value;
 	return false;
 }
@@ -90,6 +145,8 @@ qbool SV_IsBanned (struct sockaddr_in *addr)
 /*
 =================
 StringToFilter
+
+"a.b.c.d/len" is CIDR prefix, otherwise it is old syntax where unspecified or zero octets match any value.
 =================
 */
 static qbool StringToFilter (char *s, ipfilter_t *f)
@@ -99,6 +156,20 @@ static qbool StringToFilter (char *s, ipfilter_t *f)
 	unsigned char	b[4];
 	unsigned char	m[4];
 
+	if (strchr(s, '/'))
+	{
+		unsigned int prefix;
+		int len;
+
+		if (!IPTrie_ParseCIDR(s, &prefix, &len))
+			return false;
+
+		f->mask = htonl(len ? 0xFFFFFFFFu << (32 - len) : 0);
+		f->compare = htonl(prefix);
+
+		return true;
+	}
+
 	for (i=0 ; i<4 ; i++)
 	{
 		b[i] = 0;
@@ -114,7 +185,7 @@ static qbool StringToFilter (char *s, ipfilter_t *f)
 		}
 
 		j = 0;
-		while (*s >= '0' && *s <= '9')
+		while (*s >= '0' && *s <= '9' && j < (int)sizeof(num) - 1)
 		{
 			num[j++] = *s++;
 		}
@@ -134,6 +205,157 @@ static qbool StringToFilter (char *s, ipfilter_t *f)
 	return true;
 }
 
+// print filter the way StringToFilter() understands it, old syntax if it possible, so older versions can read our listip.cfg
+static char *FilterToString (const ipfilter_t *f, char *buf, size_t size)
+{
+	const unsigned char *b = (const unsigned char *) &f->compare;
+	unsigned char	m[4];
+	int				i;
+
+	for (i = 0; i < 4; i++)
+		m[i] = b[i] ? 255 : 0;
+
+	if (*(unsigned *)m == f->mask)
+		snprintf(buf, size, "%i.%i.%i.%i", b[0], b[1], b[2], b[3]);
+	else
+		snprintf(buf, size, "%i.%i.%i.%i/%i", b[0], b[1], b[2], b[3], SV_FilterPrefixLen(f));
+
+	return buf;
+}
+
+// find filter with exactly the same mask and address
+static ipfilter_t *SV_FindFilter (const ipfilter_t *f)
+{
+	int i, len = SV_FilterPrefixLen(f);
+
+	if (len >= 0)
+		return IPTrie_Find(&ipfilters, ntohl(f->compare), len);
+
+	for (i = 0; i < numoddfilters; i++)
+	{
+		if (oddfilters[i]->mask == f->mask && oddfilters[i]->compare == f->compare)
+			return oddfilters[i];
+	}
+
+	return NULL;
+}
+
+// add filter or replace filter with the same mask and address
+static void SV_AddFilter (const ipfilter_t *f)
+{
+	ipfilter_t	*nf = Sys_malloc(sizeof(*nf)), *old;
+	int			i, len = SV_FilterPrefixLen(f);
+
+	*nf = *f;
+	filters_changed = true;
+
+	if (nf->time && (!next_expire || nf->time < next_expire))
+		next_expire = nf->time;
+
+	if (len >= 0)
+	{
+		if ((old = IPTrie_Insert(&ipfilters, ntohl(nf->compare), len, nf)))
+		{
+			Sys_free(old); // replaced
+		}
+		else
+		{
+			numipfilters++;
+		}
+		return;
+	}
+
+	for (i = 0; i < numoddfilters; i++)
+	{
+		if (oddfilters[i]->mask == nf->mask && oddfilters[i]->compare == nf->compare)
+		{
+			Sys_free(oddfilters[i]);
+			oddfilters[i] = nf;
+			return;
+		}
+	}
+
+	if (numoddfilters == maxoddfilters)
+	{
+		ipfilter_t **list;
+
+		maxoddfilters = maxoddfilters ? maxoddfilters * 2 : 16;
+		list = Sys_malloc(maxoddfilters * sizeof(*list));
+		if (numoddfilters)
+			memcpy(list, oddfilters, numoddfilters * sizeof(*list));
+		Sys_free(oddfilters);
+		oddfilters = list;
+	}
+
+	oddfilters[numoddfilters++] = nf;
+	numipfilters++;
+}
+
+static qbool SV_RemoveFilter (const ipfilter_t *f)
+{
+	ipfilter_t	*old;
+	int			i, len = SV_FilterPrefixLen(f);
+
+	if (len >= 0)
+	{
+		if (!(old = IPTrie_Remove(&ipfilters, ntohl(f->compare), len)))
+			return false;
+
+		Sys_free(old);
+		numipfilters--;
+		filters_changed = true;
+		return true;
+	}
+
+	for (i = 0; i < numoddfilters; i++)
+	{
+		if (oddfilters[i]->mask == f->mask && oddfilters[i]->compare == f->compare)
+		{
+			Sys_free(oddfilters[i]);
+			oddfilters[i] = oddfilters[--numoddfilters];
+			numipfilters--;
+			filters_changed = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+typedef struct
+{
+	ipfilter_t	**list;
+	int			count;
+} filterlist_t;
+
+static void SV_CollectFilter (unsigned int prefix, int len, void *value, void *arg)
+{
+	filterlist_t *fl = (filterlist_t *) arg;
+
+	fl->list[fl->count++] = (ipfilter_t *) value;
+}
+
+// make flat list of all filters, trie ones in address order, then odd ones. caller must free list
+static ipfilter_t **SV_CollectFilters (int *count)
+{
+	filterlist_t fl;
+
+	*count = 0;
+	if (!numipfilters)
+		return NULL;
+
+	fl.list = Sys_malloc(numipfilters * sizeof(*fl.list));
+	fl.count = 0;
+
+	IPTrie_Walk(&ipfilters, SV_CollectFilter, &fl);
+	if (numoddfilters)
+		memcpy(fl.list + fl.count, oddfilters, numoddfilters * sizeof(*fl.list));
+
+	*count = fl.count + numoddfilters;
+
+	return fl.list;
+}
+
 /*
 =================
 SV_AddIP_f
@@ -141,10 +363,9 @@ SV_AddIP_f
 */
 static void SV_AddIP_f (void)
 {
-	int		i;
 	double	t = 0;
 	char	*s;
-	time_t	long_time = time(NULL);
+	time_t	long_time = Sys_Time();
 	ipfilter_t f;
 	ipfiltertype_t ipft = ipft_ban; // default is ban
 
@@ -178,21 +399,7 @@ static void SV_AddIP_f (void)
 	f.time = t;
 	f.type = ipft;
 
-	for (i=0 ; i<numipfilters ; i++)
-		if (ipfilters[i].compare == 0xffffffff || (ipfilters[i].mask == f.mask && ipfilters[i].compare == f.compare))
-			break;		// free spot
-
-	if (i == numipfilters)
-	{
-		if (numipfilters == MAX_IPFILTERS)
-		{
-			Sys_Printf("IP filter list is full\n");
-			return;
-		}
-		numipfilters++;
-	}
-
-	ipfilters[i] = f;
+	SV_AddFilter(&f);
 }
 
 /*
@@ -203,7 +410,6 @@ SV_RemoveIP_f
 static void SV_RemoveIP_f (void)
 {
 	ipfilter_t	f;
-	int			i, j;
 
 	if (!StringToFilter (Cmd_Argv(1), &f))
 	{
@@ -211,19 +417,10 @@ static void SV_RemoveIP_f (void)
 		return;
 	}
 
-	for (i=0 ; i<numipfilters ; i++)
-	{
-		if (ipfilters[i].mask == f.mask && ipfilters[i].compare == f.compare)
-		{
-			for (j=i+1 ; j<numipfilters ; j++)
-				ipfilters[j-1] = ipfilters[j];
-			numipfilters--;
-			Sys_Printf("Removed.\n");
-			return;
-		}
-	}
-
-	Sys_Printf("Didn't find %s.\n", Cmd_Argv(1));
+	if (SV_RemoveFilter(&f))
+		Sys_Printf("Removed.\n");
+	else
+		Sys_Printf("Didn't find %s.\n", Cmd_Argv(1));
 }
 
 /*
@@ -233,26 +430,28 @@ SV_ListIP_f
 */
 static void SV_ListIP_f (void)
 {
-	time_t	long_time = time(NULL);
-	int		i;
-	unsigned char	b[4];
+	time_t	long_time = Sys_Time();
+	int		i, count;
+	char	buf[32];
+	ipfilter_t **list = SV_CollectFilters(&count);
 
 	Sys_Printf("Filter list:\n");
-	for (i=0 ; i<numipfilters ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		*(unsigned *)b = ipfilters[i].compare;
-		Sys_Printf("%3i.%3i.%3i.%3i | ", b[0], b[1], b[2], b[3]);
-		switch((int)ipfilters[i].type)
+		Sys_Printf("%18s | ", FilterToString(list[i], buf, sizeof(buf)));
+		switch((int)list[i]->type)
 		{
 			case ipft_ban:  Sys_Printf(" ban"); break;
 			case ipft_safe: Sys_Printf("safe"); break;
 			default: Sys_Printf("unkn"); break;
 		}
-		if (ipfilters[i].time)
-			Sys_Printf(" | %i s", (int)(ipfilters[i].time-long_time));
+		if (list[i]->time)
+			Sys_Printf(" | %i s", (int)(list[i]->time-long_time));
 
 		Sys_Printf("\n");
 	}
+
+	Sys_free(list);
 }
 
 /*
@@ -263,9 +462,9 @@ SV_WriteIP_f
 static void SV_WriteIP_f (void)
 {
 	FILE	*f;
-	char	name[1024], *s;
-	unsigned char	b[4];
-	int		i;
+	char	name[1024], buf[32], *s;
+	int		i, count;
+	ipfilter_t **list;
 
 	snprintf (name, sizeof(name), "%s", LISTIP_NAME);
 
@@ -278,57 +477,58 @@ static void SV_WriteIP_f (void)
 		return;
 	}
 
+	list = SV_CollectFilters(&count);
+
 	// write safe filters first
-	for (i=0 ; i<numipfilters ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		if(ipfilters[i].type != ipft_safe)
+		if(list[i]->type != ipft_safe)
 			continue;
 
-		*(unsigned *)b = ipfilters[i].compare;
-		fprintf (f, "addip %i.%i.%i.%i safe %.0f\n", b[0], b[1], b[2], b[3], ipfilters[i].time);
+		fprintf (f, "addip %s safe %.0f\n", FilterToString(list[i], buf, sizeof(buf)), list[i]->time);
 	}
 
-	for (i=0 ; i<numipfilters ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		if(ipfilters[i].type == ipft_safe)
+		if(list[i]->type == ipft_safe)
 			continue; // ignore safe, we already save it
 
-		switch((int)ipfilters[i].type)
+		switch((int)list[i]->type)
 		{
 			case ipft_ban:  s = " ban"; break;
 			case ipft_safe: s = "safe"; break;
 			default: s = "unkn"; break;
 		}
-		*(unsigned *)b = ipfilters[i].compare;
-		fprintf (f, "addip %i.%i.%i.%i %s %.0f\n", b[0], b[1], b[2], b[3], s, ipfilters[i].time);
+		fprintf (f, "addip %s %s %.0f\n", FilterToString(list[i], buf, sizeof(buf)), s, list[i]->time);
 	}
 
+	Sys_free(list);
+
 	fclose (f);
 }
 
-static void Do_BanList(ipfiltertype_t ipft)
+static void Do_BanList(ipfilter_t **list, int count, ipfiltertype_t ipft)
 {
-	time_t	long_time = time(NULL);
+	time_t	long_time = Sys_Time();
 	int		i;
-	unsigned char	b[4];
+	char	buf[32];
 
-	for (i=0 ; i<numipfilters ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		if (ipfilters[i].type != ipft)
+		if (list[i]->type != ipft)
 			continue;
 
-		*(unsigned *)b = ipfilters[i].compare;
-		Sys_Printf("%3i|%3i.%3i.%3i.%3i", i, b[0], b[1], b[2], b[3]);
-		switch((int)ipfilters[i].type)
+		Sys_Printf("%3i|%18.18s", i, FilterToString(list[i], buf, sizeof(buf)));
+		switch((int)list[i]->type)
 		{
 			case ipft_ban:  Sys_Printf("| ban"); break;
 			case ipft_safe: Sys_Printf("|safe"); break;
 			default: Sys_Printf("|unkn"); break;
 		}
 
-		if (ipfilters[i].time)
+		if (list[i]->time)
 		{
-			long df = ipfilters[i].time-long_time;
+			long df = list[i]->time-long_time;
 			long d, h, m, s;
 			d = df / (60*60*24);
 			df -= d * 60*60*24;
@@ -357,6 +557,8 @@ static void Do_BanList(ipfiltertype_t ipft)
 static void SV_BanList_f (void)
 {
 	unsigned char blist[64] = "Ban list:", id[64] = "id", ipmask[64] = "ip mask", type[64] = "type", expire[64] = "expire";
+	ipfilter_t **list;
+	int count;
 
 	if (numipfilters < 1)
 	{
@@ -366,43 +568,35 @@ static void SV_BanList_f (void)
 
 	Sys_Printf("%s\n"
 				"\235\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236"
-				"\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\237\n"
-				"%3.3s|%15.15s|%4.4s|%9.9s\n",
+				"\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\236\237\n"
+				"%3.3s|%18.18s|%4.4s|%9.9s\n",
 				blist, id, ipmask, type, expire);
 
-	Do_BanList(ipft_safe);
-	Do_BanList(ipft_ban);
+	list = SV_CollectFilters(&count);
+	Do_BanList(list, count, ipft_safe);
+	Do_BanList(list, count, ipft_ban);
+	Sys_free(list);
 }
 
 static qbool SV_CanAddBan (ipfilter_t *f)
 {
-	int i;
+	ipfilter_t *old;
 
 	if (f->compare == 0)
 		return false;
 
-	for (i=0 ; i<numipfilters ; i++)
-		if (ipfilters[i].mask == f->mask && ipfilters[i].compare == f->compare && ipfilters[i].type == ipft_safe)
-			return false; // can't add filter f because present "safe" filter
+	if ((old = SV_FindFilter(f)) && old->type == ipft_safe)
+		return false; // can't add filter f because present "safe" filter
 
 	return true;
 }
 
-static void SV_RemoveBansIPFilter (int i)
-{
-	for (; i + 1 < numipfilters; i++)
-		ipfilters[i] = ipfilters[i + 1];
-
-	numipfilters--;
-}
-
 static void SV_Cmd_Banip_f(void)
 {
-	unsigned char	b[4];
 	double		d;
 	int			c, t;
 	ipfilter_t  f;
-	char		arg2[32], arg2c[sizeof(arg2)], tmp_str[256];
+	char		arg2[32], arg2c[sizeof(arg2)], tmp_str[256], buf[32];
 
 	c = Cmd_Argc ();
 	if (c < 3)
@@ -444,18 +638,19 @@ static void SV_Cmd_Banip_f(void)
 		return;
 	}
 
-	*(unsigned *)b = f.compare;
-	Sys_Printf("%3i.%3i.%3i.%3i was banned for %d%s\n", b[0], b[1], b[2], b[3], t, arg2c);
+	FilterToString(&f, buf, sizeof(buf));
+	Sys_Printf("%s was banned for %d%s\n", buf, t, arg2c);
 
-	snprintf(tmp_str, sizeof(tmp_str), "addip %i.%i.%i.%i ban %s%.0lf\n", b[0], b[1], b[2], b[3], d ? "+" : "", d);
+	snprintf(tmp_str, sizeof(tmp_str), "addip %s ban %s%.0lf\n", buf, d ? "+" : "", d);
 	Cbuf_AddText(tmp_str);
 	Cbuf_AddText("writeip\n");
 }
 
 static void SV_Cmd_Banremove_f(void)
 {
-	unsigned char	b[4];
-	int		id;
+	ipfilter_t	**list;
+	char		buf[32];
+	int			id, count;
 
 	if (Cmd_Argc () < 2)
 	{
@@ -472,40 +667,109 @@ static void SV_Cmd_Banremove_f(void)
 		return;
 	}
 
-	if (ipfilters[id].type == ipft_safe)
+	// ids are positions in the list which banlist shows
+	list = SV_CollectFilters(&count);
+
+	if (list[id]->type == ipft_safe)
 	{
 		Sys_Printf("Can't remove such ban with id: %d\n", id);
+		Sys_free(list);
 		return;
 	}
 
-	*(unsigned *)b = ipfilters[id].compare;
-	Sys_Printf("%3i.%3i.%3i.%3i was unbanned\n", b[0], b[1], b[2], b[3]);
+	Sys_Printf("%s was unbanned\n", FilterToString(list[id], buf, sizeof(buf)));
 
-	SV_RemoveBansIPFilter (id);
+	SV_RemoveFilter (list[id]);
+	Sys_free(list);
 	Cbuf_AddText("writeip\n");
 }
 
 void SV_CleanBansIPList (void)
 {
-	time_t	long_time = time(NULL);
-	int     i;
+	time_t	long_time = Sys_Time();
+	int     i, count;
+	ipfilter_t **list;
 
-	for (i = 0; i < numipfilters;)
+	// called every second, so do not walk the whole list unless something really expired
+	if (!next_expire || next_expire > long_time)
+		return;
+
+	list = SV_CollectFilters(&count);
+	next_expire = 0;
+
+	for (i = 0; i < count; i++)
 	{
-		if (ipfilters[i].time && ipfilters[i].time <= long_time)
-		{
-			SV_RemoveBansIPFilter (i);
-		}
-		else
-		{
-			i++;
-		}
+		if (!list[i]->time)
+			continue;
+
+		if (list[i]->time <= long_time)
+			SV_RemoveFilter (list[i]);
+		else if (!next_expire || list[i]->time < next_expire)
+			next_expire = list[i]->time;
+	}
+
+	Sys_free(list);
+}
+
+// kernel checks rules in order, so sort them the way SV_IsBanned() picks filter: longest mask first, safe before ban of the same length
+static int SV_CompareRules (const void *a, const void *b)
+{
+	const net_ban_rule_t *ra = (const net_ban_rule_t *) a, *rb = (const net_ban_rule_t *) b;
+	int bits_a = SV_MaskBits(ra->mask), bits_b = SV_MaskBits(rb->mask);
+
+	if (bits_a != bits_b)
+		return bits_b - bits_a;
+	if (ra->ban != rb->ban)
+		return ra->ban ? 1 : -1;
+	if (ra->mask != rb->mask)
+		return ra->mask < rb->mask ? -1 : 1;
+	if (ra->compare != rb->compare)
+		return ra->compare < rb->compare ? -1 : 1;
+
+	return 0;
+}
+
+void SV_UpdateBanFilter (void)
+{
+	net_ban_rule_t	*rules;
+	ipfilter_t		**list;
+	int				i, count;
+
+	// bans are added in bunches, so we rebuild filter once for all of them
+	if (!filters_changed && !ban_filter->modified)
+		return;
+
+	filters_changed = ban_filter->modified = false;
+
+	if (!ban_filter->integer)
+	{
+		NET_SetBanFilter(NULL, 0);
+		return;
+	}
+
+	list = SV_CollectFilters(&count);
+	rules = Sys_malloc(max(count, 1) * sizeof(*rules));
+
+	for (i = 0; i < count; i++)
+	{
+		rules[i].mask = ntohl(list[i]->mask);
+		rules[i].compare = ntohl(list[i]->compare);
+		rules[i].ban = (list[i]->type == ipft_ban);
 	}
+
+	qsort(rules, count, sizeof(*rules), SV_CompareRules);
+	NET_SetBanFilter(rules, count);
+
+	Sys_free(rules);
+	Sys_free(list);
 }
 
 void Ban_Init(void)
 {
 //	Cvar_Register(&filterban);
+	ban_filter = Cvar_Get("ban_filter", "1", 0);
+
+	IPTrie_Init(&ipfilters);
 
 	Cmd_AddCommand ("addip", SV_AddIP_f);
 	Cmd_AddCommand ("removeip", SV_RemoveIP_f);
@@ -520,4 +784,3 @@ void Ban_Init(void)
 	Cbuf_InsertText ("exec " LISTIP_NAME "\n");
 	Cbuf_Execute();
 }
-
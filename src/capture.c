@@ -0,0 +1,327 @@
+/*
+	capture.c - recording of forwarded traffic.
+
+	"capture start <file> [userid ...]" records datagrams which came from clients and from servers,
+	of all peers or only of listed ones, "capture stop" closes the file. qwfwd-bench -R plays the file back.
+
+	Forwarding thread appends records to own block, so recording a packet is a memcpy without locks.
+	Block goes to the writer thread when it is full and at the end of each frame, writer thread does file I/O,
+	so slow disk does not stall forwarding. If the writer falls behind and all blocks are queued, records are dropped (and counted).
+	Capture is started and stopped with config locked, when forwarding threads are between frames and have no blocks,
+	so every block belongs to one file. When capture is off it costs one check of capture_active per packet.
+
+	File is capture_header_t, then records: capture_record_t followed by datagram itself.
+	Everything is in byte order of the host which wrote it, it is little endian on everything we build for.
+*/
+
+#include "qwfwd.h"
+
+#define CAPTURE_BLOCK_SIZE		(64 * 1024)
+#define CAPTURE_MAX_BLOCKS		256			// 16 MB queued at most
+#define CAPTURE_MAX_PEERS		32
+
+typedef struct capture_block_s
+{
+	struct capture_block_s	*next;
+	FILE					*fp;		// file of the capture block was taken for
+	qbool					close;		// writer closes the file after this block
+	int						records;
+	int						len;
+	byte					data[CAPTURE_BLOCK_SIZE];
+} capture_block_t;
+
+qbool							capture_active;
+
+static THREAD_LOCAL capture_block_t	*capture_block;	// block current thread fills
+
+// queue of the writer thread and free blocks, protected with capture_mutex
+static sys_mutex_t				capture_mutex;
+static sys_sem_t				capture_sem;		// posted for each queued block
+static sys_sem_t				capture_closed;		// writer posts it when file is closed
+static capture_block_t			*capture_head, *capture_tail;
+static capture_block_t			*capture_free;
+static int						capture_blocks;		// allocated so far
+static qbool					capture_thread;		// writer thread is running
+static int						capture_closing;	// stopped captures, writer may be still writing them
+
+// current capture, changed by main thread with config locked
+static FILE						*capture_fp;
+static char						capture_name[256];
+static double					capture_start;
+static int						capture_peers[CAPTURE_MAX_PEERS];
+static int						capture_peers_count;	// 0 means all peers
+
+// written by writer thread
+static unsigned long long		capture_records;
+static unsigned long long		capture_bytes;
+static qbool					capture_failed;		// write error
+static unsigned int				capture_dropped;	// records dropped by forwarding threads
+
+//======================================================
+// writer thread
+
+static void Capture_Thread(void *arg)
+{
+	capture_block_t *b;
+	qbool last;
+
+	for (;;)
+	{
+		Sys_SemWait(&capture_sem);
+
+		Sys_MutexLock(&capture_mutex);
+		if ((b = capture_head) && !(capture_head = b->next))
+			capture_tail = NULL;
+		last = !capture_head;
+		Sys_MutexUnlock(&capture_mutex);
+
+		if (!b)
+			continue;
+
+		if (b->len && !capture_failed)
+		{
+			// flush when we caught up, so killed proxy leaves most of the capture behind
+			if (fwrite(b->data, 1, b->len, b->fp) != (size_t)b->len || (last && fflush(b->fp)))
+				capture_failed = true;
+			Sys_AtomicAdd(&capture_records, b->records);
+			Sys_AtomicAdd(&capture_bytes, b->len);
+		}
+
+		if (b->close)
+		{
+			if (fclose(b->fp))
+				capture_failed = true;
+			Sys_SemPost(&capture_closed);
+		}
+
+		Sys_MutexLock(&capture_mutex);
+		b->next = capture_free;
+		capture_free = b;
+		Sys_MutexUnlock(&capture_mutex);
+	}
+}
+
+// take free block, returns NULL if all blocks are queued, unless force is set
+static capture_block_t *Capture_Alloc(qbool force)
+{
+	capture_block_t *b = NULL;
+
+	Sys_MutexLock(&capture_mutex);
+	if (capture_free)
+	{
+		b = capture_free;
+		capture_free = b->next;
+	}
+	else if (force || capture_blocks < CAPTURE_MAX_BLOCKS)
+	{
+		capture_blocks++;
+		b = Sys_malloc(sizeof(*b));
+	}
+	Sys_MutexUnlock(&capture_mutex);
+
+	if (b)
+	{
+		b->next = NULL;
+		b->fp = capture_fp;
+		b->close = false;
+		b->records = 0;
+		b->len = 0;
+	}
+
+	return b;
+}
+
+static void Capture_Submit(capture_block_t *b)
+{
+	Sys_MutexLock(&capture_mutex);
+	if (capture_tail)
+		capture_tail->next = b;
+	else
+		capture_head = b;
+	capture_tail = b;
+	Sys_MutexUnlock(&capture_mutex);
+
+	Sys_SemPost(&capture_sem);
+}
+
+//======================================================
+// forwarding threads
+
+void Capture_Packet(peer_t *p, capture_dir_t dir, const byte *data, int size)
+{
+	capture_record_t rec;
+	int i, need = (int)sizeof(rec) + size, userid = FWD_peer_info(p)->userid;
+
+	if (capture_peers_count)
+	{
+		for (i = 0; i < capture_peers_count && capture_peers[i] != userid; i++)
+			;
+		if (i == capture_peers_count)
+			return; // not the peer we record
+	}
+
+	if (size <= 0 || need > CAPTURE_BLOCK_SIZE)
+		return;
+
+	if (!capture_block || capture_block->len + need > CAPTURE_BLOCK_SIZE)
+	{
+		if (capture_block)
+			Capture_Submit(capture_block);
+
+		if (!(capture_block = Capture_Alloc(false)))
+		{
+			Sys_AtomicAdd(&capture_dropped, 1);
+			return;
+		}
+	}
+
+	rec.usec = (unsigned long long)((Sys_DoubleTime() - capture_start) * 1000000.0);
+	rec.userid = (unsigned int)userid;
+	rec.size = (unsigned short)size;
+	rec.dir = (byte)dir;
+	rec.proto = (byte)p->proto;
+
+	memcpy(capture_block->data + capture_block->len, &rec, sizeof(rec));
+	memcpy(capture_block->data + capture_block->len + sizeof(rec), data, size);
+	capture_block->len += need;
+	capture_block->records++;
+}
+
+void Capture_Frame(void)
+{
+	if (!capture_block)
+		return;
+
+	Capture_Submit(capture_block);
+	capture_block = NULL;
+}
+
+//======================================================
+// main thread
+
+static void Capture_Stop(void)
+{
+	capture_block_t *b;
+
+	capture_active = false;
+
+	// forwarding threads queued everything they had, so this is the last block of the file
+	b = Capture_Alloc(true);
+	b->close = true;
+	Capture_Submit(b);
+	capture_closing++;
+
+	capture_fp = NULL;
+}
+
+static void Capture_Start(const char *name)
+{
+	capture_header_t header;
+	FILE *fp;
+	int i;
+
+	if (!FS_SafePath(name) || !(fp = fopen(name, "wb")))
+	{
+		Sys_Printf("Couldn't open capture file %s\n", name);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = CAPTURE_VERSION;
+	header.time = (unsigned int)Sys_Time();
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+	{
+		Sys_Printf("Couldn't write capture file %s\n", name);
+		fclose(fp);
+		return;
+	}
+
+	if (!capture_thread && !(capture_thread = Sys_CreateThread(Capture_Thread, NULL)))
+	{
+		Sys_Printf("Capture_Start: failed to start writer thread\n");
+		fclose(fp);
+		return;
+	}
+
+	capture_peers_count = 0;
+	for (i = 3; i < Cmd_Argc() && capture_peers_count < CAPTURE_MAX_PEERS; i++)
+		capture_peers[capture_peers_count++] = atoi(Cmd_Argv(i));
+
+	strlcpy(capture_name, name, sizeof(capture_name));
+	capture_fp = fp;
+	capture_start = Sys_DoubleTime();
+	capture_records = capture_bytes = 0;
+	capture_failed = false;
+	Sys_AtomicExchange(&capture_dropped, 0);
+	capture_active = true;
+
+	if (capture_peers_count)
+		Sys_Printf("capturing %d peers to %s\n", capture_peers_count, capture_name);
+	else
+		Sys_Printf("capturing all peers to %s\n", capture_name);
+}
+
+static void Capture_Cmd_Capture_f(void)
+{
+	if (Cmd_Argc() >= 3 && !strcmp(Cmd_Argv(1), "start"))
+	{
+		if (capture_active)
+			Sys_Printf("already capturing to %s\n", capture_name);
+		else
+			Capture_Start(Cmd_Argv(2));
+		return;
+	}
+
+	if (Cmd_Argc() == 2 && !strcmp(Cmd_Argv(1), "stop"))
+	{
+		if (!capture_active)
+		{
+			Sys_Printf("not capturing\n");
+			return;
+		}
+
+		Capture_Stop();
+		Sys_Printf("capture %s stopped\n", capture_name);
+		return;
+	}
+
+	if (Cmd_Argc() != 1)
+	{
+		Sys_Printf("Usage: capture [start <file> [userid ...] | stop]\n");
+		return;
+	}
+
+	if (capture_active)
+		Sys_Printf("capturing %s to %s\n", capture_peers_count ? "some peers" : "all peers", capture_name);
+	else if (capture_name[0])
+		Sys_Printf("last capture was %s\n", capture_name);
+	else
+	{
+		Sys_Printf("not capturing\n");
+		return;
+	}
+
+	Sys_Printf("%llu records, %llu bytes written, %u dropped%s\n", Sys_AtomicLoad(&capture_records), Sys_AtomicLoad(&capture_bytes),
+		Sys_AtomicLoad(&capture_dropped), capture_failed ? ", write error" : "");
+}
+
+void Capture_Init(void)
+{
+	Sys_MutexInit(&capture_mutex);
+	Sys_SemInit(&capture_sem);
+	Sys_SemInit(&capture_closed);
+
+	Cmd_AddCommand("capture", Capture_Cmd_Capture_f);
+}
+
+void Capture_Shutdown(void)
+{
+	if (capture_active)
+		Capture_Stop();
+
+	// so the file is complete when we exit
+	for ( ; capture_closing > 0; capture_closing--)
+		Sys_SemWait(&capture_closed);
+}
@@ -13,10 +13,10 @@ static void CL_SendConnectPacket_QW(peer_t *p)
 		return;
 
 	// Let the server know what extensions we support.
-	strlcpy (biguserinfo, p->userinfo, sizeof (biguserinfo));
+	strlcpy (biguserinfo, FWD_peer_info(p)->userinfo, sizeof (biguserinfo));
 	snprintf(data, sizeof(data), "\xff\xff\xff\xff" "connect %i %i %i \"%s\"\n", QW_PROTOCOL_VERSION, p->qport, p->challenge, biguserinfo);
 
-	NET_SendPacket(net_from_socket, strlen(data), data, &net_from);
+	NET_SendPacket(p->s, strlen(data), data, FWD_peer_to(p));
 }
 
 // Responses to broadcasts, etc
@@ -111,7 +111,7 @@ static void CL_SendConnectPacket_Q3(peer_t *p)
 		return;
 
 	// add challenge to the temporary userinfo
-	strlcpy (biguserinfo, p->userinfo, sizeof (biguserinfo));
+	strlcpy (biguserinfo, FWD_peer_info(p)->userinfo, sizeof (biguserinfo));
 	snprintf(tmp, sizeof(tmp), "%d", p->challenge);
 	Info_SetValueForKey(biguserinfo, "challenge", tmp, sizeof(biguserinfo));
 	// make string
@@ -123,7 +123,7 @@ static void CL_SendConnectPacket_Q3(peer_t *p)
 	Huff_EncryptPacket(&msg, 12);
 
 	// ok, send it!
-	NET_SendPacket(net_from_socket, msg.cursize, msg.data, &net_from);
+	NET_SendPacket(p->s, msg.cursize, msg.data, FWD_peer_to(p));
 }
 
 static qbool CL_ConnectionlessPacket_Q3 (peer_t *p) 
@@ -199,7 +199,7 @@ static qbool CL_ConnectionlessPacket_Q3 (peer_t *p)
 	if ( !stricmp(c, "disconnect") )
 	{
 //		CL_DisconnectPacket( from );
-		p->ps = ps_drop; // drop this peer
+		FWD_peer_drop(p); // drop this peer
 		return need_forward = true; // so client have chance to see what server trying to say
 	}
 
@@ -54,6 +54,7 @@ void Cmd_Wait_f (void)
 void Cbuf_AddText (char *text) { Cbuf_AddTextEx (&cbuf_main, text); }
 void Cbuf_InsertText (char *text) { Cbuf_InsertTextEx (&cbuf_main, text); }
 void Cbuf_Execute () { Cbuf_ExecuteEx (&cbuf_main); }
+qbool Cbuf_HasText (void) { return cbuf_main.text_end > cbuf_main.text_start; }
 
 /*
 ============
@@ -557,10 +558,11 @@ void Cmd_UnAliasAll_f (void)
 =============================================================================
 */
 
-static	int			cmd_argc;
-static	char		*cmd_argv[MAX_ARGS];
+// tokenizer state is per thread, workers tokenize connectionless packets
+static	THREAD_LOCAL int	cmd_argc;
+static	THREAD_LOCAL char	*cmd_argv[MAX_ARGS];
 static	char		*cmd_null_string = "";
-static	char		*cmd_args = NULL;
+static	THREAD_LOCAL char	*cmd_args = NULL;
 
 static cmd_function_t	*cmd_hash_array[32];
 static cmd_function_t	*cmd_functions;		// possible commands to execute
@@ -637,7 +639,7 @@ Parses the given string into command line tokens.
 void Cmd_TokenizeString (char *text)
 {
 	size_t idx, token_len;
-	static char argv_buf[MAX_MSGLEN + MAX_ARGS];
+	static THREAD_LOCAL char argv_buf[MAX_MSGLEN + MAX_ARGS];
 
 	idx = 0;
 
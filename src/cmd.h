@@ -71,6 +71,9 @@ void Cbuf_Execute (void);
 // Normally called once per frame, but may be explicitly invoked.
 // Do not call inside a command function!
 
+qbool Cbuf_HasText (void);
+// true if there is something to execute in the command buffer.
+
 //===========================================================================
 
 /*
@@ -146,6 +146,7 @@ cvar_t *Cvar_Get(const char *var_name, const char *value, int flags)
 static void SV_SendServerInfoChange(char *key, char *value)
 {
 //	Sys_DPrintf("SV_SendServerInfoChange FIXME\n");
+	SV_StatusChanged();
 }
 
 /*
@@ -0,0 +1,382 @@
+/*
+	dns.c - asynchronous host name resolver with cache.
+
+	Host names are resolved by the pool of resolver threads, so slow DNS server
+	does not freeze the main loop. Results are cached, failures are cached as well (for shorter time).
+	Both cache and resolver queue are bounded, clients pick the names and could grow them without limit.
+	Dotted decimal addresses are parsed in place and never go to the resolver.
+*/
+
+#include "qwfwd.h"
+
+#define DNS_HASH_SIZE		256		// must be power of two
+#define DNS_MAX_HOST		256		// longest host name we accept
+#define DNS_MAX_ENTRIES		4096	// cache never grows over that, the oldest entry is thrown out to make room for new one
+#define DNS_MAX_PENDING		256		// lookups queued or in progress, clients choose host names, so they must not flood resolver
+#define DNS_MAX_THREADS		16
+#define DNS_SWEEP_TIME		60		// seconds, how frequently we check cache for expired entries
+
+static cvar_t *dns_threads;
+static cvar_t *dns_cache_ttl;
+static cvar_t *dns_negative_ttl;
+
+typedef struct dns_entry
+{
+	char				host[DNS_MAX_HOST];	// host name, lower case
+	dns_status_t		status;				// dns_pending until some resolver thread done with it
+	struct in_addr		addr;				// resolved address, if status is dns_ok
+	time_t				expires;			// when result expires, we do not use it after that
+
+	struct dns_entry	*hash_next;			// next entry in hash bucket
+	struct dns_entry	*job_next;			// next entry in resolver queue
+	struct dns_entry	*age_prev;			// all entries, in order they were (re)queued for resolving
+	struct dns_entry	*age_next;
+} dns_entry_t;
+
+static dns_entry_t		*dns_hash[DNS_HASH_SIZE];
+static dns_entry_t		*dns_oldest;		// head of the age list
+static dns_entry_t		*dns_newest;		// tail of the age list
+static int				dns_entries;
+static int				dns_pending_count;
+static time_t			dns_last_sweep;
+
+// everything above and the queue below is protected with this mutex, since resolver threads update entries
+static sys_mutex_t		dns_mutex;
+
+static dns_entry_t		*dns_queue_head;	// entries waiting for resolver thread
+static dns_entry_t		*dns_queue_tail;
+static sys_sem_t		dns_queue_sem;		// number of entries in the queue
+
+static qbool			dns_initialized;
+static int				dns_running_threads;
+
+static unsigned int DNS_Hash(const char *host)
+{
+	unsigned int h = 5381;
+
+	while (*host)
+		h = h * 33 + (unsigned char)*host++;
+
+	return h & (DNS_HASH_SIZE - 1);
+}
+
+static dns_entry_t *DNS_Find(const char *host)
+{
+	dns_entry_t *e;
+
+	for (e = dns_hash[DNS_Hash(host)]; e; e = e->hash_next)
+	{
+		if (!strcmp(e->host, host))
+			return e;
+	}
+
+	return NULL;
+}
+
+// functions below must be called with dns_mutex locked
+
+static void DNS_AgeUnlink(dns_entry_t *e)
+{
+	if (e->age_prev)
+		e->age_prev->age_next = e->age_next;
+	else
+		dns_oldest = e->age_next;
+
+	if (e->age_next)
+		e->age_next->age_prev = e->age_prev;
+	else
+		dns_newest = e->age_prev;
+}
+
+static void DNS_AgeLink(dns_entry_t *e)
+{
+	e->age_next = NULL;
+	e->age_prev = dns_newest;
+
+	if (dns_newest)
+		dns_newest->age_next = e;
+	else
+		dns_oldest = e;
+
+	dns_newest = e;
+}
+
+// entry must not be pending, resolver thread still refers to it then
+static void DNS_Remove(dns_entry_t *e)
+{
+	dns_entry_t **link;
+
+	for (link = &dns_hash[DNS_Hash(e->host)]; *link != e; link = &(*link)->hash_next)
+		;
+
+	*link = e->hash_next;
+	DNS_AgeUnlink(e);
+	Sys_free(e);
+	dns_entries--;
+}
+
+// remove expired entries, so cache does not keep what nobody asks for
+static void DNS_Sweep(time_t current)
+{
+	dns_entry_t *e, *next;
+
+	for (e = dns_oldest; e; e = next)
+	{
+		next = e->age_next;
+
+		if (e->status != dns_pending && e->expires <= current)
+			DNS_Remove(e);
+	}
+
+	dns_last_sweep = current;
+}
+
+// make room for new entry, at most DNS_MAX_PENDING entries are skipped
+static qbool DNS_Evict(void)
+{
+	dns_entry_t *e;
+
+	for (e = dns_oldest; e; e = e->age_next)
+	{
+		if (e->status != dns_pending)
+		{
+			DNS_Remove(e);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// blocking resolve, this is what resolver threads do
+static qbool DNS_Lookup(const char *host, struct in_addr *addr)
+{
+	struct addrinfo hints, *res = NULL;
+	qbool ok = false;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (!getaddrinfo(host, NULL, &hints, &res) && res)
+	{
+		*addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+		ok = true;
+	}
+
+	if (res)
+		freeaddrinfo(res);
+
+	return ok;
+}
+
+static void DNS_Thread(void *arg)
+{
+	char host[DNS_MAX_HOST];
+	struct in_addr addr;
+	dns_entry_t *e;
+	qbool ok;
+
+	for (;;)
+	{
+		Sys_SemWait(&dns_queue_sem);
+
+		Sys_MutexLock(&dns_mutex);
+		e = dns_queue_head;
+		if (e)
+		{
+			dns_queue_head = e->job_next;
+			if (!dns_queue_head)
+				dns_queue_tail = NULL;
+			strlcpy(host, e->host, sizeof(host));
+		}
+		Sys_MutexUnlock(&dns_mutex);
+
+		if (!e)
+			continue;
+
+		// NOTE: slow part, do it without lock. Entry can't be removed from cache while it pending.
+		memset(&addr, 0, sizeof(addr));
+		ok = DNS_Lookup(host, &addr);
+
+		Sys_MutexLock(&dns_mutex);
+		dns_pending_count--;
+		e->addr = addr;
+		e->status = ok ? dns_ok : dns_failed;
+		e->expires = Sys_Time() + (ok ? dns_cache_ttl->integer : dns_negative_ttl->integer);
+		Sys_MutexUnlock(&dns_mutex);
+	}
+}
+
+// parse dotted decimal address, we do not need resolver for that
+qbool DNS_ParseAddress(const char *host, struct in_addr *addr)
+{
+	unsigned int octet, ip = 0;
+	int i, digits;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (i && *host++ != '.')
+			return false;
+
+		for (octet = 0, digits = 0; *host >= '0' && *host <= '9'; host++, digits++)
+		{
+			octet = octet * 10 + (*host - '0');
+			if (octet > 255)
+				return false;
+		}
+
+		if (!digits)
+			return false;
+
+		ip = (ip << 8) | octet;
+	}
+
+	if (*host)
+		return false; // trailing garbage, this may be host name like 1.2.3.4.example.com
+
+	addr->s_addr = htonl(ip);
+	return true;
+}
+
+dns_status_t DNS_Resolve(const char *host, struct in_addr *addr)
+{
+	char name[DNS_MAX_HOST], *s;
+	dns_status_t status;
+	dns_entry_t *e;
+	time_t current;
+
+	if (DNS_ParseAddress(host, addr))
+		return dns_ok; // fast path
+
+	if (!host[0] || strlen(host) >= sizeof(name))
+		return dns_failed;
+
+	// DNS names are case insensitive
+	strlcpy(name, host, sizeof(name));
+	for (s = name; *s; s++)
+		*s = tolower(*(unsigned char *)s);
+
+	// no resolver threads, so do it right now
+	if (!dns_running_threads)
+		return DNS_Lookup(name, addr) ? dns_ok : dns_failed;
+
+	current = Sys_Time();
+
+	Sys_MutexLock(&dns_mutex);
+
+	// NOTE: sweep walks the whole cache, so do it rarely, even if cache is full
+	if (current - dns_last_sweep > DNS_SWEEP_TIME)
+		DNS_Sweep(current);
+
+	e = DNS_Find(name);
+
+	if (e && (e->status == dns_pending || e->expires > current))
+	{
+		// result from cache or lookup in progress
+		status = e->status;
+		*addr = e->addr;
+		Sys_MutexUnlock(&dns_mutex);
+		return status;
+	}
+
+	if (dns_pending_count >= DNS_MAX_PENDING || (!e && dns_entries >= DNS_MAX_ENTRIES && !DNS_Evict()))
+	{
+		Sys_MutexUnlock(&dns_mutex);
+		Sys_DPrintf("dns: too many lookups in progress, %s failed\n", name);
+		return dns_failed;
+	}
+
+	if (e)
+	{
+		// expired, resolve it again
+		DNS_AgeUnlink(e);
+	}
+	else
+	{
+		e = Sys_malloc(sizeof(*e));
+		strlcpy(e->host, name, sizeof(e->host));
+		e->hash_next = dns_hash[DNS_Hash(name)];
+		dns_hash[DNS_Hash(name)] = e;
+		dns_entries++;
+	}
+
+	e->status = dns_pending;
+	e->job_next = NULL;
+	DNS_AgeLink(e);
+	dns_pending_count++;
+
+	// put entry in resolver queue
+	if (dns_queue_tail)
+		dns_queue_tail->job_next = e;
+	else
+		dns_queue_head = e;
+	dns_queue_tail = e;
+
+	Sys_MutexUnlock(&dns_mutex);
+
+	Sys_SemPost(&dns_queue_sem);
+
+	Sys_DPrintf("dns: resolving %s\n", name);
+
+	return dns_pending;
+}
+
+static void DNS_Cmd_Cache_f(void)
+{
+	static const char *status_str[] = { "pending", "ok", "failed" };
+	time_t current = Sys_Time();
+	dns_entry_t *e;
+	int i, count = 0;
+
+	Sys_Printf("=== dns cache ===\n");
+
+	Sys_MutexLock(&dns_mutex);
+	for (i = 0; i < DNS_HASH_SIZE; i++)
+	{
+		for (e = dns_hash[i]; e; e = e->hash_next, count++)
+		{
+			Sys_Printf("%-32s %-7s %-15s %d\n", e->host, status_str[e->status],
+				e->status == dns_ok ? inet_ntoa(e->addr) : "-",
+				e->status == dns_pending ? 0 : (int)(e->expires - current));
+		}
+	}
+	Sys_MutexUnlock(&dns_mutex);
+
+	Sys_Printf("%d entries\n", count);
+}
+
+void DNS_Init(void)
+{
+	int i, threads;
+
+	if (dns_initialized)
+		return;
+
+	dns_threads			= Cvar_Get("dns_threads",		"2", CVAR_NOSET);
+	dns_cache_ttl		= Cvar_Get("dns_cache_ttl",		"300", 0);
+	dns_negative_ttl	= Cvar_Get("dns_negative_ttl",	"30", 0);
+
+	Sys_MutexInit(&dns_mutex);
+	Sys_SemInit(&dns_queue_sem);
+
+	dns_last_sweep = Sys_Time();
+
+	threads = (int)bound(0, dns_threads->integer, DNS_MAX_THREADS);
+	for (i = 0; i < threads; i++)
+	{
+		if (!Sys_CreateThread(DNS_Thread, NULL))
+		{
+			Sys_Printf("DNS_Init: failed to start resolver thread\n");
+			break;
+		}
+		dns_running_threads++;
+	}
+
+	if (!dns_running_threads)
+		Sys_Printf("DNS_Init: no resolver threads, host names will be resolved synchronously\n");
+
+	Cmd_AddCommand("dnscache", DNS_Cmd_Cache_f);
+
+	dns_initialized = true;
+}
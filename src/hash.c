@@ -0,0 +1,32 @@
+/*
+	hash.c - helpers for open addressing hash tables.
+
+	Tables of peers (peer.c), servers (query.c) and whitelisted hosts (whitelist.c) use linear probing
+	with power of two size and backward shift deletion, these are the parts they share.
+	Keys are not secret, so unkeyed murmur3 finalizer is enough, see siphash.c for the keyed hash.
+*/
+
+#include "qwfwd.h"
+
+unsigned int Hash_Int(unsigned int h)
+{
+	// murmur3 finalizer, spread bits over the whole word
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
+unsigned int Hash_Addr(const struct sockaddr_in *addr)
+{
+	return Hash_Int((unsigned int)addr->sin_addr.s_addr ^ ((unsigned int)addr->sin_port * 0x9E3779B1u));
+}
+
+qbool Hash_CanShift(unsigned int hole, unsigned int j, unsigned int k)
+{
+	// entry at j can move to the hole if the hole is cyclically between k and j
+	return (j > hole && (k <= hole || k > j)) || (j < hole && (k <= hole && k > j));
+}
@@ -26,19 +26,66 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define MAX_HUFF_BUF_SIZE ( MSG_BUF_SIZE + 64 ) // have no idea about which size it should be
 
-#define ID_INLINE
+//
+// tree is one struct (~37 KB instead of ~57 KB of the old void pointer table), so it can be put on the stack of any thread.
+// nodes are linked with pointers, not indexes: tree update and walk are chains of dependent loads
+// and index of the node would add address arithmetic to every step, which made decrypt slower than the old code.
+//
+#define HUFF_NYT			256		// "not yet transmitted", escape code for the byte which is not in the tree yet
+#define HUFF_INTERNAL		257		// symbol of the internal node
+#define HUFF_MAX_NODES		(2 * HUFF_NYT + 1)	// 257 leaves and 256 internal nodes
+#define HUFF_MAX_HEADS		768
 
-#define VALUE(a)			(*(intptr_t *)&(a))
-#define NODE(a)				((void*)(a))
+#define HUFF_LOOKUP_BITS	12
+#define HUFF_LOOKUP_SIZE	(1 << HUFF_LOOKUP_BITS)
+#define HUFF_LOOKUP_MASK	(HUFF_LOOKUP_SIZE - 1)
 
-#define NODE_START			NODE(  1)
-#define NODE_NONE			NODE(256)
-#define NODE_NEXT			NODE(257)
+typedef struct huff_node_s
+{
+	struct huff_node_s	*left, *right, *parent;	// tree
+	struct huff_node_s	*next, *prev;			// all nodes ordered by weight, lowest weight first
+	struct huff_node_s	**head;					// slot in heads[] with highest ranked node of the block of nodes with the same weight
+	int					symbol;					// byte, HUFF_NYT or HUFF_INTERNAL
+	int					weight;
+} huff_node_t;
+
+// adaptive Huffman tree (FGK), compatible with Q3 one, each user has own copy so it is reentrant.
+// it points into itself, so it can't be copied by value.
+typedef struct huff_s
+{
+	huff_node_t	nodes[HUFF_MAX_NODES];
+	huff_node_t	*heads[HUFF_MAX_HEADS];	// free slots are linked through the slot value
+	huff_node_t	*loc[HUFF_NYT + 1];		// leaf of each symbol
+	huff_node_t	*root;
+	huff_node_t	*lhead;					// lowest ranked node, which is always NYT
+	huff_node_t	**freeheads;			// NULL if there is no free slots
+	int			numnodes;
+	int			numheads;
+} huff_t;
+
+// bit stream, bits go from the lowest bit of each byte, reads past the size return zeroes, writes past the size are dropped
+typedef struct huff_bits_s
+{
+	byte		*data;
+	int			size;	// in bytes
+	int			pos;	// in bits
+} huff_bits_t;
 
-#define NOT_REFERENCED		256
+// code of each symbol of the static tree, first bit to send is the lowest one
+typedef struct huff_code_s
+{
+	unsigned int	bits;
+	int				len;
+} huff_code_t;
 
-#define HUFF_TREE_SIZE		7175
-typedef void				*tree_t[HUFF_TREE_SIZE];
+// result of walking static tree from the root with HUFF_LOOKUP_BITS bits,
+// symbol is HUFF_INTERNAL if code is longer than HUFF_LOOKUP_BITS, then we have to continue walking from the node
+typedef struct huff_lookup_s
+{
+	short		symbol;
+	short		node;
+	int			bits;
+} huff_lookup_t;
 
 //
 // pre-defined frequency counts for all bytes [0..255]
@@ -78,18 +125,12 @@ static int q3huffCounts[256] = {
 	0x003F5, 0x00325, 0x003F0, 0x0031C, 0x003E4, 0x00421, 0x02CC1, 0x034C0
 };
 
-static int countinghuffCounts[256];
-
-
 //
-// static Huffman tree
+// static Huffman tree, built once by Huff_Init() and read only after that
 //
-static tree_t	huffTree;
-
-//
-// received from MSG_* code
-//
-static int		huffBitPos;
+static huff_t			huffTree;
+static huff_code_t		huffCodes[HUFF_NYT + 1];
+static huff_lookup_t	huffLookup[HUFF_LOOKUP_SIZE];
 
 
 /*
@@ -102,216 +143,206 @@ static int		huffBitPos;
 
 /*
 ============
-Huff_PrepareTree
+Huff_InitTree
 ============
 */
-static ID_INLINE void Huff_PrepareTree(tree_t tree)
+static void Huff_InitTree(huff_t *huff)
 {
-	void **node;
-	
-	memset(tree, 0, sizeof(tree_t));
-	
-	// create first node
-	node = &tree[263];
-	tree[0] = (void*)(VALUE(tree[0])+1);
-
-	node[7] = NODE_NONE;
-	tree[2] = node;
-	tree[3] = node;
-	tree[4] = node;
-	tree[261] = node;
-}
+	huff_node_t *nyt = &huff->nodes[0];
 
+	memset(nyt, 0, sizeof(*nyt));
+	nyt->symbol = HUFF_NYT;
 
+	memset(huff->loc, 0, sizeof(huff->loc));
+	huff->root = huff->lhead = huff->loc[HUFF_NYT] = nyt;
+	huff->freeheads = NULL;
+	huff->numnodes = 1;
+	huff->numheads = 0;
+}
 
 /*
 ============
-Huff_GetNode
+Huff_AllocHead
 ============
 */
-static ID_INLINE void **Huff_GetNode(void **tree)
+static huff_node_t **Huff_AllocHead(huff_t *huff)
 {
-	void **node;
-	int	value;
+	huff_node_t **head = huff->freeheads;
 
-	node = (void**)tree[262];
-	if (!node)
+	if (!head)
 	{
-		value = VALUE(tree[1])++;
-		node = &tree[value + 6407];
-		return node;
+		if (huff->numheads >= HUFF_MAX_HEADS)
+			Sys_Error("Huff_AllocHead: out of heads\n"); // can't happen, there is at most one block per node
+
+		return &huff->heads[huff->numheads++];
 	}
 
-	tree[262] = node[0];
-	return node;
+	huff->freeheads = (huff_node_t **)*head;
+	return head;
+}
+
+/*
+============
+Huff_FreeHead
+============
+*/
+static void Huff_FreeHead(huff_t *huff, huff_node_t **head)
+{
+	*head = (huff_node_t *)huff->freeheads;
+	huff->freeheads = head;
 }
 
 /*
 ============
 Huff_Swap
+
+Swap location of two nodes in the tree
 ============
 */
-static ID_INLINE void Huff_Swap(void **tree1, void **tree2, void **tree3)
+static void Huff_Swap(huff_t *huff, huff_node_t *n1, huff_node_t *n2)
 {
-	void **a, **b;
+	huff_node_t *p1 = n1->parent, *p2 = n2->parent;
 
-	a = (void**)tree2[2];
-	if (a)
+	if (p1)
 	{
-		if (a[0] == tree2)
-			a[0] = tree3;
+		if (p1->left == n1)
+			p1->left = n2;
 		else
-			a[1] = tree3;
+			p1->right = n2;
 	}
 	else
-		tree1[2] = tree3;
+		huff->root = n2;
 
-	b = (void**)tree3[2];
-
-	if (b)
+	if (p2)
 	{
-		if (b[0] == tree3)
-		{
-			b[0] = tree2;
-			tree2[2] = b;
-			tree3[2] = a;
-			return;
-		}
-
-		b[1] = tree2;
-		tree2[2] = b;
-		tree3[2] = a;
-		return;
+		if (p2->left == n2)
+			p2->left = n1;
+		else
+			p2->right = n1;
 	}
+	else
+		huff->root = n1;
 
-	tree1[2] = tree2;
-	tree2[2] = NULL;
-	tree3[2] = a;
+	n1->parent = p2;
+	n2->parent = p1;
 }
 
 /*
 ============
-Huff_SwapTrees
+Huff_SwapList
+
+Swap two nodes in the list ordered by weight
 ============
 */
-static ID_INLINE void Huff_SwapTrees(void **tree1, void **tree2)
+static void Huff_SwapList(huff_node_t *a, huff_node_t *b)
 {
-	void **temp;
+	huff_node_t *tmp;
+
+	tmp = a->next; a->next = b->next; b->next = tmp;
+	tmp = a->prev; a->prev = b->prev; b->prev = tmp;
+
+	if (a->next == a)
+		a->next = b;
+	if (b->next == b)
+		b->next = a;
+
+	if (a->next)
+		a->next->prev = a;
+	if (b->next)
+		b->next->prev = b;
+	if (a->prev)
+		a->prev->next = a;
+	if (b->prev)
+		b->prev->next = b;
+}
 
-	temp = (void**)tree1[3];
-	tree1[3] = tree2[3];
-	tree2[3] = temp;
+/*
+============
+Huff_Increment
 
-	temp = (void**)tree1[4];
-	tree1[4] = tree2[4];
-	tree2[4] = temp;
+Increment weight of the node and its parents, keeping sibling property
+============
+*/
+static void Huff_Increment(huff_t *huff, huff_node_t *node)
+{
+	huff_node_t *path[HUFF_MAX_NODES], *lnode;
+	int depth = 0;
 
-	if (tree1[3] == tree1)
-		tree1[3] = tree2;
+	// going up, parent is taken after node is moved
+	for ( ; node; node = node->parent)
+	{
+		if (node->next && node->next->weight == node->weight)
+		{
+			lnode = *node->head;
+			if (lnode != node->parent)
+				Huff_Swap(huff, lnode, node);
+			Huff_SwapList(lnode, node);
+		}
 
-	if (tree2[3] == tree2)
-		tree2[3] = tree1;
+		if (node->prev && node->prev->weight == node->weight)
+			*node->head = node->prev;
+		else
+			Huff_FreeHead(huff, node->head);
 
-	temp = (void**)tree1[3];
-	if (temp)
-		temp[4] = tree1;
+		node->weight++;
 
-	temp = (void**)tree2[3];
-	if (temp)
-		temp[4] = tree2;
+		if (node->next && node->next->weight == node->weight)
+		{
+			node->head = node->next->head;
+		}
+		else
+		{
+			node->head = Huff_AllocHead(huff);
+			*node->head = node;
+		}
 
-	temp = (void**)tree1[4];
-	if (temp)
-		temp[3] = tree1;
+		if (node->parent)
+			path[depth++] = node;
+	}
 
-	temp = (void**)tree2[4];
-	if (temp)
-		temp[3] = tree2;
+	// going down, once parents are done
+	while (depth--)
+	{
+		node = path[depth];
 
+		if (node->prev == node->parent)
+		{
+			Huff_SwapList(node, node->parent);
+			if (*node->head == node)
+				*node->head = node->parent;
+		}
+	}
 }
 
 /*
 ============
-Huff_DeleteNode
-============
-*/
-static ID_INLINE void Huff_DeleteNode(void **tree1, void **tree2)
-{
-	tree2[0] = tree1[262];
-	tree1[262] = tree2;
-}
+Huff_LinkAfterHead
 
-/*
-============
-Huff_IncrementFreq_r
+Put new node of weight 1 right after the NYT node
 ============
 */
-static void Huff_IncrementFreq_r(void **tree1, void **tree2)
+static void Huff_LinkAfterHead(huff_t *huff, huff_node_t *node, huff_node_t *headnode)
 {
-	void **a, **b;
+	huff_node_t *lhead = huff->lhead;
 
-	if (!tree2)
-	{
-		return;
-	}
-
-	a = (void**)tree2[3];
-	if (a)
-	{
-		a = (void**)a[6];
-		if (a == tree2[6])
-		{
-			b = (void**)tree2[5];
-			if (b[0] != tree2[2])
-			{
-				Huff_Swap(tree1, (void**)b[0], tree2);
-			}
-			Huff_SwapTrees((void**)b[0], tree2);
-		}
-	}
+	node->weight = 1;
+	node->next = lhead->next;
 
-	a = (void**)tree2[4];
-	if (a && a[6] == tree2[6])
+	if (lhead->next && lhead->next->weight == 1)
 	{
-		b = (void**)tree2[5];
-		b[0] = a;
+		lhead->next->prev = node;
+		node->head = lhead->next->head;
 	}
 	else
 	{
-		a = (void**)tree2[5];
-		a[0] = 0;
-		Huff_DeleteNode(tree1, (void**)tree2[5]);
+		if (lhead->next)
+			lhead->next->prev = node;
+		node->head = Huff_AllocHead(huff);
+		*node->head = headnode;
 	}
 
-	
-	VALUE(tree2[6])++;
-	a = (void**)tree2[3];
-	if (a && a[6] == tree2[6])
-	{
-		tree2[5] = a[5];
-	}
-	else
-	{
-		a = Huff_GetNode(tree1);
-		tree2[5] = a;
-		a[0] = tree2;
-	}
-
-	if (tree2[2])
-	{
-		Huff_IncrementFreq_r(tree1, (void**)tree2[2]);
-	
-		if (tree2[4] == tree2[2])
-		{
-			Huff_SwapTrees(tree2, (void**)tree2[2]);
-			a = (void**)tree2[5];
-
-			if (a[0] == tree2)
-			{
-				a[0] = (void**)tree2[2];
-			}
-		}
-	}
+	lhead->next = node;
+	node->prev = lhead;
 }
 
 /*
@@ -321,114 +352,51 @@ Huff_AddReference
 Insert 'ch' into the tree or increment it's frequency
 ============
 */
-static void Huff_AddReference(void **tree, intptr_t ch)
+static void Huff_AddReference(huff_t *huff, int ch)
 {
-	void **a, **b, **c, **d;
-	int value;
+	huff_node_t *lhead, *leaf, *node, *parent;
 
 	ch &= 255;
-	if (tree[ch + 5])
+	if (huff->loc[ch])
 	{
-		Huff_IncrementFreq_r(tree, (void**)tree[ch + 5]);
+		Huff_Increment(huff, huff->loc[ch]);
 		return; // already added
 	}
 
-	value = VALUE(tree[0])++;
-	b = &tree[value * 8 + 263];
+	// NYT node becomes internal node with NYT and new leaf as children
+	lhead = huff->lhead;
+	leaf = &huff->nodes[huff->numnodes++];
+	node = &huff->nodes[huff->numnodes++];
 
-	value = VALUE(tree[0])++;
-	a = &tree[value * 8 + 263];
+	node->symbol = HUFF_INTERNAL;
+	Huff_LinkAfterHead(huff, node, node);
 
-	a[7] = NODE_NEXT;
-	a[6] = NODE_START;
-	d = (void**)tree[3];
-	a[3] = d[3];
-	if (a[3])
-	{
-		d = (void**)a[3];
-		d[4] = a;
-		d = (void**)a[3];
-		if (d[6] == NODE_START)
-		{
-			a[5] = d[5];
-		}
-		else
-		{
-			d = Huff_GetNode(tree);
-			a[5] = d;
-			d[0] = a;
-		}
-	}
-	else
-	{
-		d = Huff_GetNode(tree);
-		a[5] = d;
-		d[0] = a;
+	leaf->symbol = ch;
+	Huff_LinkAfterHead(huff, leaf, node); // NOTE: head points to internal node, like in original Q3 code, list is never empty here anyway
+	leaf->left = leaf->right = NULL;
 
-	}
-	
-	d = (void**)tree[3];
-	d[3] = a;
-	a[4] = (void**)tree[3];
-	b[7] = NODE(ch);
-	b[6] = NODE_START;
-	d = (void**)tree[3];
-	b[3] = d[3];
-	if (b[3])
+	parent = lhead->parent;
+	if (parent)
 	{
-		d = (void**)b[3];
-		d[4] = b;
-		if (d[6] == NODE_START)
-		{
-			b[5] = d[5];
-		}
+		if (parent->left == lhead)
+			parent->left = node;
 		else
-		{
-			d = Huff_GetNode(tree);
-			b[5] = d;
-			d[0] = a;
-		}
+			parent->right = node;
 	}
 	else
 	{
-		d = Huff_GetNode(tree);
-		b[5] = d;
-		d[0] = b;
+		huff->root = node;
 	}
 
-	d = (void**)tree[3];
-	d[3] = b;
-	b[4] = (void**)tree[3];
-	b[1] = NULL;
-	b[0] = NULL;
-	d = (void**)tree[3];
-	c = (void**)d[2];
-	if (c)
-	{
-		if (c[0] == tree[3])
-		{
-			c[0] = a;
-		}
-		else
-		{
-			c[1] = a;
-		}
-	}
-	else
-	{
-		tree[2] = a;
-	}
+	node->right = leaf;
+	node->left = lhead;
+	node->parent = parent;
+	leaf->parent = node;
+	lhead->parent = node;
 
-	a[1] = b;
-	d = (void**)tree[3];
-	a[0] = d;
-	a[2] = d[2];
-	b[2] = a;
-	d = (void**)tree[3];
-	d[2] = a;
-	tree[ch + 5] = b;
+	huff->loc[ch] = leaf;
 
-	Huff_IncrementFreq_r(tree, (void**)a[2]);
+	Huff_Increment(huff, parent);
 }
 
 /*
@@ -441,104 +409,102 @@ static void Huff_AddReference(void **tree, intptr_t ch)
 
 /*
 ============
-Huff_EmitBit
+Huff_PutBits
 
-Put one bit into buffer
+Put len bits of value into the stream, lowest bit first
 ============
 */
-static ID_INLINE void Huff_EmitBit(int bit, byte *buffer)
+static void Huff_PutBits(huff_bits_t *bits, unsigned int value, int len)
 {
-	if (!(huffBitPos & 7))
+	int i, shift, n;
+
+	while (len > 0)
 	{
-		buffer[huffBitPos >> 3] = 0;
-	}
+		i = bits->pos >> 3;
+		shift = bits->pos & 7;
+		n = 8 - shift;
+		if (n > len)
+			n = len;
+
+		if (i < bits->size)
+		{
+			if (!shift)
+				bits->data[i] = 0;
+			bits->data[i] |= (value & ((1u << n) - 1)) << shift;
+		}
 
-	buffer[huffBitPos >> 3] |= bit << (huffBitPos & 7);
-	huffBitPos++;
+		value >>= n;
+		len -= n;
+		bits->pos += n;
+	}
 }
 
 /*
 ============
 Huff_GetBit
 
-Read one bit from buffer
+Read one bit from the stream
 ============
 */
-static ID_INLINE int Huff_GetBit(byte *buffer)
+static int Huff_GetBit(huff_bits_t *bits)
 {
-	int bit;
+	int i = bits->pos >> 3, bit = 0;
 
-	bit = buffer[huffBitPos >> 3] >> (huffBitPos & 7);
-	huffBitPos++;
+	if (i < bits->size)
+		bit = (bits->data[i] >> (bits->pos & 7)) & 1;
+	bits->pos++;
 
-	return (bit & 1);
+	return bit;
 }
 
 /*
 ============
-Huff_EmitPathToByte
+Huff_PeekBits
+
+Get at least HUFF_LOOKUP_BITS next bits, without moving in the stream
 ============
 */
-static ID_INLINE void Huff_EmitPathToByte(void **tree, void **subtree, byte *buffer)
+static unsigned int Huff_PeekBits(const huff_bits_t *bits)
 {
-	if (tree[2])
-	{
-		Huff_EmitPathToByte((void**)tree[2], tree, buffer);
-	}
-
-	if (!subtree)
-	{
-		return;
-	}
+	const byte *p = bits->data + (bits->pos >> 3);
+	int left = bits->size - (bits->pos >> 3);
+	unsigned int value;
 
-	//
-	// emit tree walking control bits
-	//
-	if (tree[1] == subtree)
-	{
-		Huff_EmitBit(1, buffer);
-	}
+	if (left >= 3)
+		value = p[0] | (p[1] << 8) | (p[2] << 16);
 	else
-	{
-		Huff_EmitBit(0, buffer);
-	}
+		value = (left > 0 ? p[0] : 0) | (left > 1 ? p[1] << 8 : 0);
+
+	return value >> (bits->pos & 7);
 }
 
 /*
 ============
-Huff_GetByteFromTree
+Huff_EmitPath
 
-Get one byte using dynamic or static tree
+Emit path from the root to the node
 ============
 */
-static ID_INLINE int Huff_GetByteFromTree(void **tree, byte *buffer)
+static void Huff_EmitPath(huff_node_t *node, huff_bits_t *bits)
 {
-	if (!tree)
-	{
-		return 0;
-	}
+	huff_node_t *parent;
+	unsigned int value = 0;
+	int depth = 0;
 
-	//
-	// walk through the tree until we get a value
-	//
-	while (tree[7] == NODE_NEXT)
+	// path is collected from the leaf, so bit next to the root ends up as the lowest one
+	for ( ; (parent = node->parent); node = parent, depth++)
 	{
-		if (!Huff_GetBit(buffer))
-		{
-			tree = (void**)tree[0];
-		}
-		else
+		// very deep node, put upper part of the path first
+		if (depth == 32)
 		{
-			tree = (void**)tree[1];
+			Huff_EmitPath(node, bits);
+			break;
 		}
 
-		if (!tree)
-		{
-			return 0;
-		}
+		value = (value << 1) | (parent->right == node);
 	}
 
-	return VALUE(tree[7]);
+	Huff_PutBits(bits, value, depth);
 }
 
 /*
@@ -548,34 +514,89 @@ Huff_EmitByteDynamic
 Emit one byte using dynamic tree
 ============
 */
-static void Huff_EmitByteDynamic(void **tree, int value, byte *buffer)
+static void Huff_EmitByteDynamic(huff_t *huff, int ch, huff_bits_t *bits)
 {
-	void **subtree;
+	unsigned int value;
 	int i;
 
-	//
 	// if byte was already referenced, emit path to it
-	//
-	subtree = (void**)tree[value + 5];
-	if (subtree)
+	if (huff->loc[ch])
 	{
-		if (subtree[2])
-		{
-			Huff_EmitPathToByte((void**)subtree[2], subtree, buffer);
-		}		
+		Huff_EmitPath(huff->loc[ch], bits);
 		return;
 	}
 
-	//
-	// byte was not referenced, just emit 8 bits
-	//
-	Huff_EmitByteDynamic(tree, NOT_REFERENCED, buffer);
+	// byte was not referenced, emit escape and 8 bits, highest bit first
+	Huff_EmitPath(huff->loc[HUFF_NYT], bits);
+
+	for (i = 0, value = 0; i < 8; i++)
+		value |= ((ch >> (7 - i)) & 1) << i;
+
+	Huff_PutBits(bits, value, 8);
+}
+
+/*
+============
+Huff_GetByteDynamic
 
-	for (i = 7; i >= 0; i--)
+Get one byte using dynamic tree, returns HUFF_NYT if byte follows as 8 bits.
+Tree changes after every byte, so there is no lookup table for it, we walk it bit by bit, taking HUFF_LOOKUP_BITS bits from the stream at once
+============
+*/
+static int Huff_GetByteDynamic(huff_t *huff, huff_bits_t *bits)
+{
+	huff_node_t *node = huff->root;
+	unsigned int value;
+	int i;
+
+	// only leaves have no children, checking the child we load anyway is cheaper than checking the symbol
+	while (node->left)
 	{
-		Huff_EmitBit((value >> i) & 1, buffer);
+		value = Huff_PeekBits(bits);
+
+		for (i = 0; i < HUFF_LOOKUP_BITS && node->left; i++, value >>= 1)
+			node = (value & 1) ? node->right : node->left;
+
+		bits->pos += i;
 	}
 
+	return node->symbol;
+}
+
+/*
+============
+Huff_EmitByte
+
+Emit one byte using static tree
+============
+*/
+static void Huff_EmitByte(int ch, huff_bits_t *bits)
+{
+	Huff_PutBits(bits, huffCodes[ch].bits, huffCodes[ch].len);
+}
+
+/*
+============
+Huff_GetByte
+
+Get one byte using static tree, up to HUFF_LOOKUP_BITS bits are decoded by single table lookup
+============
+*/
+static int Huff_GetByte(huff_bits_t *bits)
+{
+	const huff_lookup_t *lookup = &huffLookup[Huff_PeekBits(bits) & HUFF_LOOKUP_MASK];
+	const huff_node_t *node;
+
+	bits->pos += lookup->bits;
+
+	if (lookup->symbol != HUFF_INTERNAL)
+		return lookup->symbol;
+
+	// code is longer than the table, which is rare, finish it bit by bit
+	for (node = &huffTree.nodes[lookup->node]; node->symbol == HUFF_INTERNAL; )
+		node = Huff_GetBit(bits) ? node->right : node->left;
+
+	return node->symbol;
 }
 
 /*
@@ -588,7 +609,7 @@ static void Huff_EmitByteDynamic(void **tree, int value, byte *buffer)
 
 /*
 ============
-Huff_CompressPacket
+Huff_EncryptPacket
 
 Compress message using dynamic Huffman tree,
 beginning from specified offset
@@ -596,12 +617,13 @@ beginning from specified offset
 */
 void Huff_EncryptPacket(sizebuf_t *msg, int offset)
 {
-	tree_t	tree;
-	byte	buffer[MAX_HUFF_BUF_SIZE];
-	byte	*data;
-	int		outLen;
-	int		inLen;
-	int		i;
+	huff_t		huff;
+	huff_bits_t	bits;
+	byte		buffer[MAX_HUFF_BUF_SIZE];
+	byte		*data;
+	int			outLen;
+	int			inLen;
+	int			i;
 
 	data = msg->data + offset;
 	inLen = msg->cursize - offset;
@@ -610,28 +632,37 @@ void Huff_EncryptPacket(sizebuf_t *msg, int offset)
 		return;
 	}
 
-	Huff_PrepareTree(tree);
+	Huff_InitTree(&huff);
 
 	buffer[0] = inLen >> 8;
 	buffer[1] = inLen & 0xFF;
-	huffBitPos = 16;
+	bits.data = buffer;
+	bits.size = sizeof(buffer);
+	bits.pos = 16;
 
 	for (i = 0; i < inLen; i++)
 	{
-		Huff_EmitByteDynamic(tree, data[i], buffer);
-		Huff_AddReference(tree, data[i]);
+		Huff_EmitByteDynamic(&huff, data[i], &bits);
+		Huff_AddReference(&huff, data[i]);
 	}
-	
-	outLen = (huffBitPos >> 3) + 1;
+
+	outLen = (bits.pos >> 3) + 1;
+	if (outLen > (int)sizeof(buffer) || outLen > msg->maxsize - offset)
+	{
+		return; // does not fit
+	}
+
+	// last byte was not touched if we stopped on byte boundary
+	if (!(bits.pos & 7))
+		buffer[outLen - 1] = 0;
 
 	msg->cursize = offset + outLen;
 	memcpy(data, buffer, outLen);
-
 }
 
 /*
 ============
-Huff_DecompressPacket
+Huff_DecryptPacket
 
 Decompress message using dynamic Huffman tree,
 beginning from specified offset
@@ -639,13 +670,14 @@ beginning from specified offset
 */
 void Huff_DecryptPacket(sizebuf_t *msg, int offset)
 {
-	tree_t	tree;
-	byte	buffer[MAX_HUFF_BUF_SIZE];
-	byte	*data;
-	int		outLen;
-	int		inLen;
-	int		i, j;
-	int		ch;
+	huff_t		huff;
+	huff_bits_t	bits;
+	byte		buffer[MAX_HUFF_BUF_SIZE];
+	byte		*data;
+	int			outLen;
+	int			inLen;
+	int			i, j;
+	int			ch;
 
 	data = msg->data + offset;
 	inLen = msg->cursize - offset;
@@ -654,11 +686,13 @@ void Huff_DecryptPacket(sizebuf_t *msg, int offset)
 		return;
 	}
 
-	Huff_PrepareTree(tree);
+	Huff_InitTree(&huff);
 
 	outLen = (data[0] << 8) + data[1];
-	huffBitPos = 16;
-	
+	bits.data = data;
+	bits.size = msg->maxsize - offset;
+	bits.pos = 16;
+
 	if (outLen > msg->maxsize - offset)
 	{
 		outLen = msg->maxsize - offset;
@@ -666,130 +700,120 @@ void Huff_DecryptPacket(sizebuf_t *msg, int offset)
 
 	for (i = 0; i < outLen; i++)
 	{
-		if ((huffBitPos >> 3) > inLen)
+		if ((bits.pos >> 3) > inLen)
 		{
-			buffer[i] = 0;
+			memset(buffer + i, 0, outLen - i);
 			break;
 		}
 
-		ch = Huff_GetByteFromTree((void**)tree[2], data);
+		ch = Huff_GetByteDynamic(&huff, &bits);
 
-		if (ch == NOT_REFERENCED)
+		if (ch == HUFF_NYT)
 		{
 			ch = 0; // just read 8 bits
-			for (j = 0 ; j < 8 ; j++)
+			for (j = 0; j < 8; j++)
 			{
 				ch <<= 1;
-				ch |= Huff_GetBit(data);
+				ch |= Huff_GetBit(&bits);
 			}
 		}
 
 		buffer[i] = ch;
-		Huff_AddReference(tree, ch);
+		Huff_AddReference(&huff, ch);
 	}
 
-
 	msg->cursize = offset + outLen;
 	memcpy(data, buffer, outLen);
 }
 
-/*
-============
-Huff_EmitByte
-============
-*/
-void Huff_EmitByte(int ch, byte *buffer, int *count)
-{
-	huffBitPos = *count;
-	Huff_EmitPathToByte((void**)huffTree[ch + 5], NULL, buffer);
-	*count = huffBitPos;
-}
-
-/*
-============
-Huff_GetByte
-============
-*/
-int Huff_GetByte(byte *buffer, int *count)
-{
-	int ch;
-
-	huffBitPos = *count;
-	ch = Huff_GetByteFromTree((void**)huffTree[2], buffer);
-	*count = huffBitPos;
-
-	return ch;
-}
-
-static qbool madetable;
 /*
 ============
 Huff_Init
+
+Build static tree and tables for it, must be called before any thread uses static tree
 ============
 */
-void Huff_Init(int *huffCounts)
+void Huff_Init(void)
 {
-	int	i, j;
-
-	if (!huffCounts)
-		huffCounts = q3huffCounts;
+	huff_node_t	*node, *parent;
+	int			i, j;
 
 	// build empty tree
-	Huff_PrepareTree(huffTree);
+	Huff_InitTree(&huffTree);
 
 	// add all pre-defined byte references
 	for (i = 0; i < 256; i++)
 	{
-		for (j = 0; j < huffCounts[i]; j++)
+		for (j = 0; j < q3huffCounts[i]; j++)
+		{
+			Huff_AddReference(&huffTree, i);
+		}
+	}
+
+	// codes for the encoder, NYT has code too, since it is in the tree
+	for (i = 0; i <= HUFF_NYT; i++)
+	{
+		huffCodes[i].bits = 0;
+		huffCodes[i].len = 0;
+
+		for (node = huffTree.loc[i]; node && (parent = node->parent); node = parent)
 		{
-			Huff_AddReference(huffTree, i);
+			if (huffCodes[i].len >= 32)
+				Sys_Error("Huff_Init: code is too long\n");
+
+			huffCodes[i].bits = (huffCodes[i].bits << 1) | (parent->right == node);
+			huffCodes[i].len++;
 		}
-		huffCounts[i] = LittleLong(huffCounts[i]);
 	}
 
-	for(i=0;i<256;i++)
-		huffCounts[i] = LittleLong(huffCounts[i]);
+	// lookup table for the decoder
+	for (i = 0; i < HUFF_LOOKUP_SIZE; i++)
+	{
+		node = huffTree.root;
+
+		for (j = 0; j < HUFF_LOOKUP_BITS && node->symbol == HUFF_INTERNAL; j++)
+			node = ((i >> j) & 1) ? node->right : node->left;
 
-	madetable = true;
+		huffLookup[i].symbol = node->symbol;
+		huffLookup[i].node = (short)(node - huffTree.nodes);
+		huffLookup[i].bits = j;
+	}
 }
 
 /*
 ============
 Huff_CompressPacket
 
-Compress message using loaded Huffman tree,
+Compress message using static Huffman tree,
 beginning from specified offset
 ============
 */
-void Huff_CompressPacket( sizebuf_t *msg, int offset )
+void Huff_CompressPacket(sizebuf_t *msg, int offset)
 {
-	byte	buffer[MAX_HUFF_BUF_SIZE];
-	byte	*data;
-	int		outLen;
-	int		inLen;
-	int		i;
-
-	if (!madetable)
-		Huff_Init(NULL);
+	huff_bits_t	bits;
+	byte		buffer[MAX_HUFF_BUF_SIZE];
+	byte		*data;
+	int			outLen;
+	int			inLen;
+	int			i;
 
 	data = msg->data + offset;
-	inLen = msg->cursize - offset;	
+	inLen = msg->cursize - offset;
 	if (inLen <= 0 || inLen >= MAX_HUFF_BUF_SIZE)
 	{
 		return;
 	}
 
-	outLen = 0;
-	for (i=0; i < inLen; i++)
-	{
-		if (i == MAX_HUFF_BUF_SIZE)
-			Sys_Error("Compression became too large\n");
-		Huff_EmitByte(data[i], buffer, &outLen);
+	bits.data = buffer;
+	bits.size = sizeof(buffer);
+	bits.pos = 0;
 
-		countinghuffCounts[data[i]]++;
+	for (i = 0; i < inLen; i++)
+	{
+		Huff_EmitByte(data[i], &bits);
 	}
 
-	outLen = (huffBitPos >> 3) + 1;
+	outLen = (bits.pos >> 3) + 1;
 
 	if (outLen > inLen)
 	{
@@ -799,9 +823,13 @@ void Huff_CompressPacket( sizebuf_t *msg, int offset )
 		return;	//cap it at only 1 byte growth.
 	}
 
+	// last byte was not touched if we stopped on byte boundary
+	if (!(bits.pos & 7))
+		buffer[outLen - 1] = 0;
+
 	msg->cursize = offset + outLen;
 	{	//add the bitcount
-		data[0] = (outLen<<3) - huffBitPos;
+		data[0] = (outLen<<3) - bits.pos;
 		data+=1;
 		msg->cursize+=1;
 	}
@@ -814,23 +842,20 @@ void Huff_CompressPacket( sizebuf_t *msg, int offset )
 ============
 Huff_DecompressPacket
 
-Decompress message using loaded Huffman tree,
+Decompress message using static Huffman tree,
 beginning from specified offset
 ============
 */
 void Huff_DecompressPacket(sizebuf_t *msg, int offset)
 {
-	byte	buffer[MAX_HUFF_BUF_SIZE];
-	byte	*data;
-	int		outLen;
-	int		inLen;
-	int		i;
-
-	if (!madetable)
-		Huff_Init(NULL);
+	huff_bits_t	bits;
+	byte		buffer[MAX_HUFF_BUF_SIZE];
+	byte		*data;
+	int			inLen;
+	int			i;
 
 	data = msg->data + offset;
-	inLen = msg->cursize - offset;	
+	inLen = msg->cursize - offset;
 	if (inLen <= 0 || inLen >= MAX_HUFF_BUF_SIZE)
 	{
 		return;
@@ -848,18 +873,19 @@ void Huff_DecompressPacket(sizebuf_t *msg, int offset)
 		data+=1;
 	}
 
-	outLen = 0;
-	for(i=0; outLen < inLen; i++)
+	bits.data = data;
+	bits.size = msg->maxsize - offset - 1;
+	bits.pos = 0;
+
+	for(i=0; bits.pos < inLen; i++)
 	{
 		if (i == MAX_HUFF_BUF_SIZE)
 			Sys_Error("Decompression became too large\n");
-		buffer[i] = Huff_GetByte(data, &outLen);
+		buffer[i] = Huff_GetByte(&bits);
 	}
-	
+
 	msg->cursize = offset + i;
 	if (msg->cursize > msg->maxsize)
 		Sys_Error("Decompression became too large\n");
 	memcpy(msg->data + offset, buffer, i);
 }
-
-
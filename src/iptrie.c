@@ -0,0 +1,269 @@
+/*
+	iptrie.c - longest prefix match over IPv4 prefixes.
+
+	Path compressed binary trie: node exists only where prefix has a value or where two branches split,
+	so memory is linear in number of prefixes and lookup visits at most 33 nodes, no matter how many prefixes we have.
+	Addresses and prefixes are in host byte order here, callers convert it.
+*/
+
+#include "qwfwd.h"
+
+#define IPTRIE_MASK(len)		((len) ? 0xFFFFFFFFu << (32 - (len)) : 0u)
+#define IPTRIE_BIT(addr, i)		(((addr) >> (31 - (i))) & 1)
+
+struct iptrie_node_s
+{
+	unsigned int			prefix;		// masked by len
+	int						len;		// 0..32
+	void					*value;		// NULL for pure branch node
+	struct iptrie_node_s	*child[2];
+};
+
+// how many leading bits a and b have in common
+static int IPTrie_CommonBits(unsigned int a, unsigned int b)
+{
+	unsigned int x = a ^ b;
+	int n = 0;
+
+	if (!x)
+		return 32;
+
+#ifdef __GNUC__
+	n = __builtin_clz(x);
+#else
+	while (!(x & 0x80000000u))
+	{
+		x <<= 1;
+		n++;
+	}
+#endif
+
+	return n;
+}
+
+static iptrie_node_t *IPTrie_NewNode(unsigned int prefix, int len, void *value)
+{
+	iptrie_node_t *n = Sys_malloc(sizeof(*n));
+
+	n->prefix = prefix & IPTRIE_MASK(len);
+	n->len = len;
+	n->value = value;
+
+	return n;
+}
+
+void IPTrie_Init(iptrie_t *trie)
+{
+	trie->root = NULL;
+	trie->count = 0;
+}
+
+static void IPTrie_FreeNode(iptrie_node_t *n)
+{
+	if (!n)
+		return;
+
+	IPTrie_FreeNode(n->child[0]);
+	IPTrie_FreeNode(n->child[1]);
+	Sys_free(n);
+}
+
+void IPTrie_Clear(iptrie_t *trie)
+{
+	IPTrie_FreeNode(trie->root);
+	IPTrie_Init(trie);
+}
+
+void *IPTrie_Insert(iptrie_t *trie, unsigned int prefix, int len, void *value)
+{
+	iptrie_node_t **link = &trie->root, *n, *split;
+	void *old;
+	int common;
+
+	prefix &= IPTRIE_MASK(len);
+
+	while ((n = *link))
+	{
+		common = IPTrie_CommonBits(n->prefix, prefix);
+		if (common > n->len)
+			common = n->len;
+		if (common > len)
+			common = len;
+
+		if (common < n->len)
+		{
+			// node is not a prefix of the new one, put branch node (or the new one) above it
+			split = IPTrie_NewNode(prefix, common, NULL);
+			split->child[IPTRIE_BIT(n->prefix, common)] = n;
+			*link = split;
+
+			if (common == len)
+				split->value = value;
+			else
+				split->child[IPTRIE_BIT(prefix, common)] = IPTrie_NewNode(prefix, len, value);
+
+			trie->count++;
+			return NULL;
+		}
+
+		if (n->len == len)
+		{
+			// exact prefix, replace value
+			old = n->value;
+			n->value = value;
+			if (!old)
+				trie->count++;
+			return old;
+		}
+
+		link = &n->child[IPTRIE_BIT(prefix, n->len)];
+	}
+
+	*link = IPTrie_NewNode(prefix, len, value);
+	trie->count++;
+
+	return NULL;
+}
+
+// drop node if it does not carry anything useful
+static void IPTrie_Compact(iptrie_node_t **link)
+{
+	iptrie_node_t *n = *link;
+
+	if (!n || n->value || (n->child[0] && n->child[1]))
+		return;
+
+	*link = n->child[0] ? n->child[0] : n->child[1];
+	Sys_free(n);
+}
+
+void *IPTrie_Remove(iptrie_t *trie, unsigned int prefix, int len)
+{
+	iptrie_node_t **link = &trie->root, **parent = NULL, *n;
+	void *value;
+
+	prefix &= IPTRIE_MASK(len);
+
+	while ((n = *link))
+	{
+		if (n->len > len || (prefix & IPTRIE_MASK(n->len)) != n->prefix)
+			return NULL;
+
+		if (n->len == len)
+			break;
+
+		parent = link;
+		link = &n->child[IPTRIE_BIT(prefix, n->len)];
+	}
+
+	if (!n || !n->value)
+		return NULL;
+
+	value = n->value;
+	n->value = NULL;
+	trie->count--;
+
+	// node may be not needed anymore, and then its parent may be just a branch with single child
+	IPTrie_Compact(link);
+	if (parent)
+		IPTrie_Compact(parent);
+
+	return value;
+}
+
+void *IPTrie_Find(iptrie_t *trie, unsigned int prefix, int len)
+{
+	iptrie_node_t *n = trie->root;
+
+	prefix &= IPTRIE_MASK(len);
+
+	while (n && n->len <= len && (prefix & IPTRIE_MASK(n->len)) == n->prefix)
+	{
+		if (n->len == len)
+			return n->value;
+
+		n = n->child[IPTRIE_BIT(prefix, n->len)];
+	}
+
+	return NULL;
+}
+
+void *IPTrie_Lookup(iptrie_t *trie, unsigned int addr, int *len)
+{
+	iptrie_node_t *n = trie->root;
+	void *best = NULL;
+
+	while (n && (addr & IPTRIE_MASK(n->len)) == n->prefix)
+	{
+		if (n->value)
+		{
+			best = n->value;
+			if (len)
+				*len = n->len;
+		}
+
+		if (n->len == 32)
+			break;
+
+		n = n->child[IPTRIE_BIT(addr, n->len)];
+	}
+
+	return best;
+}
+
+static void IPTrie_WalkNode(iptrie_node_t *n, iptrie_func_t func, void *arg)
+{
+	if (!n)
+		return;
+
+	if (n->value)
+		func(n->prefix, n->len, n->value, arg);
+
+	IPTrie_WalkNode(n->child[0], func, arg);
+	IPTrie_WalkNode(n->child[1], func, arg);
+}
+
+void IPTrie_Walk(iptrie_t *trie, iptrie_func_t func, void *arg)
+{
+	IPTrie_WalkNode(trie->root, func, arg);
+}
+
+// parse "a.b.c.d/len" or "a.b.c.d", returns prefix in host byte order
+qbool IPTrie_ParseCIDR(const char *s, unsigned int *prefix, int *len)
+{
+	char addr[32];
+	const char *slash = strchr(s, '/');
+	struct in_addr in;
+	int bits = 32;
+
+	if (slash)
+	{
+		const char *p = slash + 1;
+
+		if (!*p || (size_t)(slash - s) >= sizeof(addr))
+			return false;
+
+		for (bits = 0; *p; p++)
+		{
+			if (*p < '0' || *p > '9')
+				return false;
+			bits = bits * 10 + (*p - '0');
+			if (bits > 32)
+				return false;
+		}
+
+		strlcpy(addr, s, (size_t)(slash - s) + 1);
+	}
+	else
+	{
+		strlcpy(addr, s, sizeof(addr));
+	}
+
+	if (!DNS_ParseAddress(addr, &in))
+		return false;
+
+	*prefix = ntohl(in.s_addr) & IPTRIE_MASK(bits);
+	*len = bits;
+
+	return true;
+}
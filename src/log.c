@@ -0,0 +1,453 @@
+/*
+	log.c - asynchronous logger.
+
+	Sys_Printf() and friends only format the message and put it into the lock free ring,
+	the logger thread takes messages from the ring and writes them to the console,
+	and to the log file or syslog if asked. So slow terminal or pipe does not stall forwarding.
+	Before Log_Init() and if the logger thread can't be started messages are written right away.
+
+	Ring is bounded multi producer queue (Dmitry Vyukov's one), each slot has sequence number which tells
+	whether slot is free for producer or ready for consumer, so producers never lock anything.
+	Long message takes several slots in a row, so messages from different threads are never mixed.
+	If the ring is full, debug messages are dropped (and counted), other messages wait until it is drained.
+*/
+
+#include "qwfwd.h"
+
+#ifdef APP_DLL
+	#define QWFWD_PREFIX "QWFWD: "
+#else
+	#define QWFWD_PREFIX ""
+#endif
+
+#define LOG_RING_SIZE		2048	// must be power of two
+#define LOG_SLOT_TEXT		256		// text bytes in one slot
+#define LOG_MAX_TEXT		2048	// longest message, longer one is truncated
+#define LOG_WRITE_BUFFER	16384	// console output is collected and written with one call
+
+typedef enum
+{
+	lf_text,	// as it is printed to the console
+	lf_kv,		// time=... level=... msg="..."
+	lf_json		// {"time":"...","level":"...","msg":"..."}
+} log_format_t;
+
+typedef struct log_slot_s
+{
+	unsigned int		seq;		// == position when free for producer, == position + 1 when ready for consumer
+	unsigned char		level;
+	unsigned char		more;		// message continues in the next slot
+	unsigned short		len;
+	time_t				time;
+	char				text[LOG_SLOT_TEXT];
+} log_slot_t;
+
+static log_slot_t		log_ring[LOG_RING_SIZE];
+static unsigned int		log_head;		// next position for producer
+static unsigned int		log_tail;		// next position for consumer, used with log_mutex locked
+static unsigned int		log_dropped;	// debug messages dropped because ring was full
+static int				log_sleeping;	// logger thread waits on the semaphore, so it has to be woken up
+
+// consumer side: whoever drains the ring and everything below is protected with this mutex
+static sys_mutex_t		log_mutex;
+static sys_sem_t		log_sem;
+static qbool			log_async;		// logger thread is running
+static qbool			log_initialized;
+
+static FILE				*log_fp;
+static log_format_t		log_fmt;
+static qbool			log_use_syslog;
+
+static cvar_t			*log_file;
+static cvar_t			*log_format;
+static cvar_t			*log_syslog;
+
+static const char		*log_level_names[] = { "error", "info", "debug" };
+
+qbool Log_Enabled(log_level_t level)
+{
+	if (level == ll_debug)
+		return developer && developer->integer;
+
+	return true;
+}
+
+// quake charset to plain ascii
+static void Log_Translate(unsigned char *t, int len)
+{
+	for ( ; len > 0; len--, t++)
+	{
+		if (*t >= 146 && *t < 156)
+			*t = *t - 146 + '0';
+		if (*t == 143)
+			*t = '.';
+		if (*t == 157 || *t == 158 || *t == 159)
+			*t = '-';
+		if (*t >= 128)
+			*t -= 128;
+		if (*t == 16)
+			*t = '[';
+		if (*t == 17)
+			*t = ']';
+		if (*t == 29)
+			*t = '-';
+		if (*t == 30)
+			*t = '-';
+		if (*t == 31)
+			*t = '-';
+		if (*t == '\a')	//doh. :D
+			*t = ' ';
+	}
+}
+
+static void Log_Console(const char *text, int len)
+{
+	if (len > 0)
+		fwrite(text, 1, len, stdout);
+}
+
+// write one line of the message in structured format
+static void Log_Structured(FILE *f, time_t t, log_level_t level, const char *line, int len)
+{
+	struct tm	tm;
+	char		ts[32];
+	int			i;
+
+#ifdef _WIN32
+	tm = *gmtime(&t); // thread local in MS CRT
+#else
+	gmtime_r(&t, &tm);
+#endif
+	strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+	if (log_fmt == lf_json)
+		fprintf(f, "{\"time\":\"%s\",\"level\":\"%s\",\"msg\":\"", ts, log_level_names[level]);
+	else
+		fprintf(f, "time=%s level=%s msg=\"", ts, log_level_names[level]);
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = (unsigned char)line[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c == '\t')
+			fputs("\\t", f);
+		else if (c < 32)
+			fprintf(f, log_fmt == lf_json ? "\\u%04x" : "\\x%02x", c);
+		else
+			fputc(c, f);
+	}
+
+	fputs(log_fmt == lf_json ? "\"}\n" : "\"\n", f);
+}
+
+// write whole message to the log file and syslog
+static void Log_Output(time_t t, log_level_t level, char *text, int len)
+{
+	char *line, *end, *stop = text + len;
+
+	if (log_fp && log_fmt == lf_text)
+		fwrite(text, 1, len, log_fp);
+
+	if (!(log_fp && log_fmt != lf_text) && !log_use_syslog)
+		return;
+
+	// structured records are one per line, empty lines are not worth it
+	for (line = text; line < stop; line = end + 1)
+	{
+		for (end = line; end < stop && *end != '\n'; end++)
+			;
+
+		if (end == line)
+			continue;
+
+		if (log_fp && log_fmt != lf_text)
+			Log_Structured(log_fp, t, level, line, end - line);
+
+#ifndef _WIN32
+		if (log_use_syslog)
+			syslog(level == ll_error ? LOG_ERR : (level == ll_debug ? LOG_DEBUG : LOG_INFO), "%.*s", (int)(end - line), line);
+#endif
+	}
+}
+
+// write out everything in the ring, must be called with log_mutex locked
+static void Log_Drain(void)
+{
+	static char		out[LOG_WRITE_BUFFER];
+	static char		text[LOG_MAX_TEXT];
+	int				out_len = 0, len;
+	unsigned int	dropped;
+	log_slot_t		*slot;
+	log_level_t		level;
+	time_t			t;
+	qbool			more;
+
+	for (;;)
+	{
+		slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+		if ((int)(Sys_AtomicLoad(&slot->seq) - (log_tail + 1)) < 0)
+			break; // empty
+
+		// collect the message, producer publishes its first slot last, so the rest are ready as well
+		level = (log_level_t)slot->level;
+		t = slot->time;
+		len = 0;
+		do
+		{
+			slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+			memcpy(text + len, slot->text, slot->len);
+			len += slot->len;
+			more = slot->more;
+
+			Sys_AtomicStore(&slot->seq, log_tail + LOG_RING_SIZE); // free for the producer on the next lap
+			log_tail++;
+		} while (more);
+
+		Log_Translate((unsigned char *)text, len);
+
+		if (out_len + (int)sizeof(QWFWD_PREFIX) - 1 + len > LOG_WRITE_BUFFER)
+		{
+			Log_Console(out, out_len);
+			out_len = 0;
+		}
+
+		memcpy(out + out_len, QWFWD_PREFIX, sizeof(QWFWD_PREFIX) - 1);
+		out_len += sizeof(QWFWD_PREFIX) - 1;
+		memcpy(out + out_len, text, len);
+		out_len += len;
+
+		Log_Output(t, level, text, len);
+	}
+
+	if ((dropped = Sys_AtomicExchange(&log_dropped, 0)))
+	{
+		len = snprintf(text, sizeof(text), "log: %u debug messages dropped, output is too slow\n", dropped);
+		Log_Console(out, out_len);
+		out_len = 0;
+		Log_Console(text, len);
+		Log_Output(time(NULL), ll_info, text, len);
+	}
+
+	Log_Console(out, out_len);
+
+	if (log_fp)
+		fflush(log_fp);
+}
+
+// try to put message into the ring, false if there is no room
+static qbool Log_Push(log_level_t level, const char *text, int len)
+{
+	unsigned int	pos, i, count = len ? (len + LOG_SLOT_TEXT - 1) / LOG_SLOT_TEXT : 1;
+	time_t			t = time(NULL);
+	log_slot_t		*slot;
+
+	// claim count slots in a row at once
+	pos = Sys_AtomicLoad(&log_head);
+	for (;;)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (Sys_AtomicLoad(&log_ring[(pos + i) & (LOG_RING_SIZE - 1)].seq) != pos + i)
+				break;
+		}
+
+		if (i == count)
+		{
+			if (Sys_AtomicCAS(&log_head, &pos, pos + count))
+				break; // they are ours
+			continue; // someone was faster, pos is updated
+		}
+
+		if ((int)(Sys_AtomicLoad(&log_ring[(pos + i) & (LOG_RING_SIZE - 1)].seq) - (pos + i)) < 0)
+			return false; // consumer did not free it yet, so ring is full
+
+		pos = Sys_AtomicLoad(&log_head); // someone claimed it, try again
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		slot = &log_ring[(pos + i) & (LOG_RING_SIZE - 1)];
+		slot->level = (unsigned char)level;
+		slot->time = t;
+		slot->len = (unsigned short)(len < LOG_SLOT_TEXT ? len : LOG_SLOT_TEXT);
+		slot->more = (i + 1 < count);
+		memcpy(slot->text, text, slot->len);
+		text += slot->len;
+		len -= slot->len;
+	}
+
+	// publish, first slot goes last, so consumer never sees half of the message
+	for (i = count; i > 0; i--)
+		Sys_AtomicStore(&log_ring[(pos + i - 1) & (LOG_RING_SIZE - 1)].seq, pos + i);
+
+	// wake up logger thread if it sleeps
+	if (Sys_AtomicLoad(&log_sleeping) && Sys_AtomicExchange(&log_sleeping, 0))
+		Sys_SemPost(&log_sem);
+
+	return true;
+}
+
+void Log_Write(log_level_t level, const char *text)
+{
+	int len = strlen(text);
+
+	len = len < LOG_MAX_TEXT ? len : LOG_MAX_TEXT;
+
+	if (!log_async)
+	{
+		// there is no logger thread, write it out right here
+		char buf[LOG_MAX_TEXT];
+
+		memcpy(buf, text, len);
+		Log_Translate((unsigned char *)buf, len);
+
+		if (log_initialized)
+			Sys_MutexLock(&log_mutex);
+		Log_Console(QWFWD_PREFIX, sizeof(QWFWD_PREFIX) - 1);
+		Log_Console(buf, len);
+		Log_Output(time(NULL), level, buf, len);
+		if (log_initialized)
+			Sys_MutexUnlock(&log_mutex);
+		return;
+	}
+
+	while (!Log_Push(level, text, len))
+	{
+		if (level == ll_debug)
+		{
+			Sys_AtomicAdd(&log_dropped, 1);
+			return;
+		}
+
+		Log_Flush(); // we can't lose it, drain the ring ourself
+	}
+}
+
+void Log_Flush(void)
+{
+	if (!log_initialized)
+		return;
+
+	Sys_MutexLock(&log_mutex);
+	Log_Drain();
+	Sys_MutexUnlock(&log_mutex);
+}
+
+static void Log_Thread(void *arg)
+{
+	for (;;)
+	{
+		Log_Flush();
+
+		// go to sleep, but check the ring once more after we said so, producer may miss our flag otherwise
+		Sys_AtomicStore(&log_sleeping, 1);
+
+		if ((int)(Sys_AtomicLoad(&log_ring[Sys_AtomicLoad(&log_tail) & (LOG_RING_SIZE - 1)].seq) - (Sys_AtomicLoad(&log_tail) + 1)) >= 0)
+		{
+			if (Sys_AtomicExchange(&log_sleeping, 0))
+				continue; // nobody posted the semaphore, go on
+		}
+
+		Sys_SemWait(&log_sem);
+	}
+}
+
+// check if log cvars changed and reopen outputs, main thread only
+void Log_Frame(void)
+{
+	qbool failed = false;
+
+	if (!log_initialized)
+		return;
+
+	if (!log_file->modified && !log_format->modified && !log_syslog->modified)
+		return;
+
+	Sys_MutexLock(&log_mutex);
+
+	Log_Drain(); // what is in the ring goes to old outputs
+
+	if (log_fp)
+	{
+		fclose(log_fp);
+		log_fp = NULL;
+	}
+
+	if (log_file->string[0])
+	{
+		if (!FS_SafePath(log_file->string) || !(log_fp = fopen(log_file->string, "a")))
+			failed = true;
+	}
+
+	if (!strcmp(log_format->string, "json"))
+		log_fmt = lf_json;
+	else if (!strcmp(log_format->string, "kv"))
+		log_fmt = lf_kv;
+	else
+		log_fmt = lf_text;
+
+#ifndef _WIN32
+	if (log_syslog->integer && !log_use_syslog)
+		openlog("qwfwd", LOG_PID, LOG_DAEMON);
+	else if (!log_syslog->integer && log_use_syslog)
+		closelog();
+	log_use_syslog = !!log_syslog->integer;
+#endif
+
+	log_file->modified = log_format->modified = log_syslog->modified = false;
+
+	Sys_MutexUnlock(&log_mutex);
+
+	if (failed)
+		Sys_Printf("Couldn't open log file %s\n", log_file->string);
+}
+
+void Log_Init(void)
+{
+	unsigned int i;
+
+	if (log_initialized)
+		return;
+
+	log_file	= Cvar_Get("log_file",		"", 0); // empty means console only
+	log_format	= Cvar_Get("log_format",	"text", 0); // text, kv or json, for log file
+	log_syslog	= Cvar_Get("log_syslog",	"0", 0);
+
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		log_ring[i].seq = i;
+
+	Sys_MutexInit(&log_mutex);
+	Sys_SemInit(&log_sem);
+
+	log_initialized = true;
+
+#ifndef __GNUC__
+	return; // no real atomics, see Sys_AtomicCAS(), so messages are written synchronously
+#endif
+
+	if (!Sys_CreateThread(Log_Thread, NULL))
+	{
+		Sys_Printf("Log_Init: failed to start logger thread, messages will be written synchronously\n");
+		return;
+	}
+
+	log_async = true;
+}
+
+void Log_Shutdown(void)
+{
+	Log_Flush();
+
+	if (!log_initialized)
+		return;
+
+	Sys_MutexLock(&log_mutex);
+	if (log_fp)
+	{
+		fclose(log_fp);
+		log_fp = NULL;
+	}
+	Sys_MutexUnlock(&log_mutex);
+}
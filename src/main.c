@@ -86,6 +86,7 @@ static void SV_Serverinfo_f (void)
 	else
 	{
 		Info_SetValueForKey (ps.info, key, value, sizeof(ps.info));	
+		SV_StatusChanged();
 	}
 }
 
@@ -98,13 +99,10 @@ static void Cmd_Quit_f(void)
 		ps.wanttoexit = true; // delayed exit, clean
 }
 
-static void sighup_handler(int signal)
-{
-	reload = true;
-}
-
 DWORD WINAPI FWD_proc(void *lpParameter)
 {
+	time_t current, bans_checked = 0;
+
 	if (!lpParameter)
 		return 1;
 
@@ -132,9 +130,12 @@ DWORD WINAPI FWD_proc(void *lpParameter)
 	city			= Cvar_Get("city",		"", CVAR_SERVERINFO);
 	coords			= Cvar_Get("coords",		"", CVAR_SERVERINFO);
 
+	Log_Init();				// from now messages are written by logger thread
+
 	// register basic commands
 	Cmd_AddCommand("quit", Cmd_Quit_f);
 	Cmd_AddCommand("serverinfo", SV_Serverinfo_f);
+	Cmd_AddCommand("cachestats", SV_Cmd_CacheStats_f);
 
 	Whitelist_Init();
 
@@ -144,10 +145,15 @@ DWORD WINAPI FWD_proc(void *lpParameter)
 
 	// init rest systems
 	Sys_DoubleTime();		// init time
+	SV_InitChallenges();	// secret for challenges
+	Huff_Init();			// static Huffman tables, before any worker may use them
 	Ban_Init();				// init bans, this will exec "qwfwd_listip.cfg" as well, so you don't have to put it in qwfwd.cfg
+	DNS_Init();				// init resolver
 	NET_Init();				// init network
 	FWD_Init();				// init peers
 	QRY_Init();				// init query 
+	Stats_Init();			// init counters and metrics endpoint
+	Capture_Init();			// init traffic capture
 
 	ps.initialized = true;
 
@@ -155,30 +161,66 @@ DWORD WINAPI FWD_proc(void *lpParameter)
 	Cmd_StuffCmds(argc, argv);
 	Cbuf_Execute();
 
+	FWD_StartWorkers();		// start forwarding threads, if any
+
 	Sys_Printf("qwfwd: ready to rock at %s:%d\n", net_ip->string, net_port->integer);
 
 	while(!ps.wanttoexit)
 	{
-		if (reload)
+		current = Sys_Time();
+
+		// forwarding workers read bans, whitelist and cvars, so we change them only with config locked,
+		// and lock it only when there is something to change, so workers are not stalled every frame
+		if (reload || Cbuf_HasText() || current != bans_checked)
 		{
-			Cmd_WhitelistPurge_f();
-			Cbuf_InsertText("exec qwfwd.cfg\n");
-			Cbuf_Execute();
-			reload = false;
+			FWD_LockConfig();
+
+			if (reload)
+			{
+				Whitelist_BeginReload();	// config fills new whitelist, old one is still used until config is done
+				Cbuf_InsertText("exec qwfwd.cfg\n");
+				Cbuf_Execute();
+				Whitelist_EndReload();
+				reload = false;
+			}
+
+			Cbuf_Execute();			// Process console commands.
+
+			if (current != bans_checked)
+			{
+				SV_CleanBansIPList();	// Periodically check is it time to remove some bans.
+				bans_checked = current;
+			}
+
+			SV_UpdateBanFilter();	// Kernel drops banned datagrams, tell it what changed.
+
+			FWD_UnlockConfig();
 		}
 
-		Cbuf_Execute();			// Process console commands.
 		FWD_update_peers();		// Do basic proxy job.
 		QRY_Frame();			// Do query related job.
-		SV_CleanBansIPList();	// Periodically check is it time to remove some bans.
+		Log_Frame();			// Reopen log file if log cvars changed.
 	}
 
+	FWD_Shutdown();		// wait for forwarding workers
+	QRY_Shutdown();		// save server list
+	Capture_Shutdown();	// write out capture file, if any
+	NET_FlushPackets();	// send whatever left in the queue
+
 	Cmd_DeInit();		// this is optional, but helps me check memory leaks
+	Log_Shutdown();		// write out what is left in the log queue
 	Cvar_DeInit();		// this is optional, but helps me check memory leaks
 
 	return 0;
 }
 
+#ifndef QWFWD_NO_MAIN // tools link everything above and have own main()
+
+static void sighup_handler(int signal)
+{
+	reload = true;
+}
+
 int main(int _argc, char *_argv[])
 {
 	fwd_params_t params;
@@ -231,3 +273,5 @@ int main(int _argc, char *_argv[])
 	FWD_proc(&params);
 	return 0;
 }
+
+#endif // QWFWD_NO_MAIN
@@ -71,8 +71,8 @@ void SZ_Print (sizebuf_t *buf, const char *data)
 
 // reading
 
-static int msg_readcount;
-static qbool msg_badread;
+static THREAD_LOCAL int msg_readcount;
+static THREAD_LOCAL qbool msg_badread;
 
 void MSG_BeginReading (void)
 {
@@ -183,7 +183,7 @@ float MSG_ReadFloat (void)
 
 char *MSG_ReadString (void)
 {
-	static char string[2048];
+	static THREAD_LOCAL char string[2048];
 	int c;
 	size_t l = 0;
 
@@ -208,7 +208,7 @@ char *MSG_ReadString (void)
 
 char *MSG_ReadStringLine (void)
 {
-	static char string[2048];
+	static THREAD_LOCAL char string[2048];
 	int c;
 	size_t l = 0;
 
@@ -1,23 +1,315 @@
 // net.c
 
+#if defined(__linux__) && !defined(NET_NO_MMSG)
+	#define NET_MMSG // batch datagrams with recvmmsg()/sendmmsg(), so we do less syscalls
+	#ifndef _GNU_SOURCE
+		#define _GNU_SOURCE // recvmmsg()/sendmmsg()
+	#endif
+#endif
+
 #include "qwfwd.h"
 
+#ifdef __linux__
+	#define NET_REUSEPORT_CBPF // steer clients to the forwarding workers with classic BPF program
+	#define NET_BAN_CBPF // kernel drops datagrams of banned addresses, see NET_SetBanFilter()
+	#include <linux/filter.h>
+	#ifndef SO_ATTACH_REUSEPORT_CBPF
+		#define SO_ATTACH_REUSEPORT_CBPF 51
+	#endif
+#endif
+
 cvar_t				*net_ip;
 cvar_t				*net_port;
 
-int					net_socket;
-struct sockaddr_in	net_from;
-int					net_from_socket;
-sizebuf_t			net_message;
-static byte			net_message_buffer[MSG_BUF_SIZE];
+// NOTE: all of these are per thread, each forwarding worker has own proxy socket
+THREAD_LOCAL int				net_socket;
+THREAD_LOCAL struct sockaddr_in	net_from;
+THREAD_LOCAL int				net_from_socket;
+THREAD_LOCAL sizebuf_t			net_message;
+THREAD_LOCAL qbool				net_refused;
+static THREAD_LOCAL byte		net_message_buffer[MSG_BUF_SIZE];
+
+//=============================================================================
+
+// in-memory network of the simulation, NULL means we use kernel sockets
+net_backend_t				*net_backend;
+
+// proxy sockets of all workers, set by NET_OpenWorkerSockets()
+static int					*net_proxy_sockets;
+static int					net_proxy_sockets_count;
+
+// ban filter, see NET_SetBanFilter()
+static int					net_ban_filter_rules = -1;	// rules in the kernel filter, -1 if there is no filter
+static int					net_ban_filter_total;		// rules we were asked for
+static int					net_ban_filter_insns;
+
+static int NET_BackendGetPacket(int s, sizebuf_t *msg)
+{
+	int ret;
+
+	SZ_Clear(msg);
+
+	net_from_socket = s;
+
+	if ((ret = net_backend->recv(s, msg->data, msg->maxsize - 1, &net_from)) <= 0)
+	{
+		net_refused = (ret < 0);
+		return false;
+	}
+
+	Stats_Inc(st_net_recv_calls);
+	Stats_Inc(st_net_recv_packets);
+
+	msg->cursize = ret;
+	msg->data[ret] = 0;
+
+	return ret;
+}
+
+static void NET_BackendSendPacket(int s, int length, const void *data, struct sockaddr_in *to)
+{
+	net_backend->send(s, length, data, to);
+
+	Stats_Inc(st_net_send_calls);
+	Stats_Inc(st_net_send_packets);
+}
+
+#ifdef NET_MMSG
+
+#define NET_RECV_BATCH		32			// datagrams we read with single recvmmsg()
+#define NET_SEND_BATCH		64			// datagrams we queue before sendmmsg()
+#define NET_SEND_POOL		(64 * 1024)	// bytes we can queue before sendmmsg()
+
+// datagrams which we got with the last recvmmsg() but not yet returned by NET_GetPacket()
+// NOTE: batches are per thread as well
+static THREAD_LOCAL int					recv_socket = INVALID_SOCKET;	// socket which batch belongs to
+static THREAD_LOCAL int					recv_count;						// how much datagrams in the batch
+static THREAD_LOCAL int					recv_next;						// next datagram to return
+static THREAD_LOCAL qbool				recv_drained;					// socket had less data than batch size
+static THREAD_LOCAL struct mmsghdr		recv_msgs[NET_RECV_BATCH];
+static THREAD_LOCAL struct iovec		recv_iov[NET_RECV_BATCH];
+static THREAD_LOCAL struct sockaddr_in	recv_from[NET_RECV_BATCH];
+static THREAD_LOCAL byte				recv_buf[NET_RECV_BATCH][MSG_BUF_SIZE];
+
+// datagrams queued by NET_SendPacket() and sent by NET_FlushPackets()
+static THREAD_LOCAL int					send_count;
+static THREAD_LOCAL int					send_pool_used;
+static THREAD_LOCAL int					send_socket[NET_SEND_BATCH];
+static THREAD_LOCAL struct mmsghdr		send_msgs[NET_SEND_BATCH];
+static THREAD_LOCAL struct iovec		send_iov[NET_SEND_BATCH];
+static THREAD_LOCAL struct sockaddr_in	send_to[NET_SEND_BATCH];
+static THREAD_LOCAL byte				send_pool[NET_SEND_POOL];
+
+// read batch of datagrams from socket, return false if there nothing to read
+static qbool NET_RecvBatch(int s)
+{
+	int i, ret;
+
+	recv_socket = s;
+	recv_count = recv_next = 0;
+	recv_drained = false;
+
+	for (i = 0; i < NET_RECV_BATCH; i++)
+	{
+		recv_iov[i].iov_base = recv_buf[i];
+		recv_iov[i].iov_len = sizeof(recv_buf[i]);
+		memset(&recv_msgs[i].msg_hdr, 0, sizeof(recv_msgs[i].msg_hdr));
+		recv_msgs[i].msg_hdr.msg_name = &recv_from[i];
+		recv_msgs[i].msg_hdr.msg_namelen = sizeof(recv_from[i]);
+		recv_msgs[i].msg_hdr.msg_iov = &recv_iov[i];
+		recv_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg(s, recv_msgs, NET_RECV_BATCH, 0, NULL);
+
+	if (ret == SOCKET_ERROR)
+	{
+		recv_socket = INVALID_SOCKET;
+
+		if (qerrno == EWOULDBLOCK || qerrno == EINTR)
+			return false;
+
+		if (qerrno == ECONNRESET || qerrno == ECONNREFUSED)
+		{
+			Sys_DPrintf ("NET_GetPacket: Connection was forcibly closed\n");
+			net_refused = true;
+			return false;
+		}
+
+		Sys_Error ("NET_GetPacket: recvmmsg: (%i): %s", qerrno, strerror (qerrno));
+	}
+
+	Stats_Inc(st_net_recv_calls);
+	Stats_Add(st_net_recv_packets, ret);
+
+	recv_count = ret;
+	// socket had less datagrams than we asked, so it is empty now and there no point to ask it again,
+	// if something arrive after that, select()/epoll will tell us about it
+	recv_drained = (ret < NET_RECV_BATCH);
+
+	return (ret > 0);
+}
+
+int NET_GetPacket(int s, sizebuf_t *msg)
+{
+	int ret;
+
+	net_refused = false;
+
+	if (net_backend)
+		return NET_BackendGetPacket(s, msg);
+
+	SZ_Clear(msg);
+
+	net_from_socket = s;
+
+	for (;;)
+	{
+		if (s != recv_socket || recv_next >= recv_count)
+		{
+			if (s == recv_socket && recv_drained)
+			{
+				recv_socket = INVALID_SOCKET; // so next call does syscall for real
+				return false;
+			}
+
+			if (!NET_RecvBatch(s))
+				return false;
+		}
+
+		ret = recv_msgs[recv_next].msg_len;
+		net_from = recv_from[recv_next];
+
+		if ((recv_msgs[recv_next].msg_hdr.msg_flags & MSG_TRUNC) || ret >= msg->maxsize)
+		{
+			recv_next++;
+			Sys_Printf ("NET_GetPacket: Oversize packet from %s\n", inet_ntoa(net_from.sin_addr));
+			continue;
+		}
+
+		memcpy(msg->data, recv_buf[recv_next], ret);
+		recv_next++;
+
+		msg->cursize = ret;
+		msg->data[ret] = 0;
+
+		return ret;
+	}
+}
 
 //=============================================================================
 
+static void NET_SendError(void)
+{
+	if (qerrno == EWOULDBLOCK)
+		return;
+
+	if (qerrno == ECONNREFUSED)
+		return;
+
+	Sys_Printf ("NET_SendPacket: sendmmsg: (%i): %s\n", qerrno, strerror (qerrno));
+}
+
+// send all datagrams queued by NET_SendPacket()
+void NET_FlushPackets(void)
+{
+	int i, j, ret;
+
+#ifdef NET_URING
+	if (uring_active)
+	{
+		URING_Submit();
+		return;
+	}
+#endif
+
+	// sendmmsg() works with single socket, so send each run of datagrams for the same socket with one syscall
+	for (i = 0; i < send_count; )
+	{
+		for (j = i + 1; j < send_count && send_socket[j] == send_socket[i]; j++)
+			;
+
+		while (i < j)
+		{
+			ret = sendmmsg(send_socket[i], &send_msgs[i], j - i, 0);
+
+			if (ret == SOCKET_ERROR)
+			{
+				if (qerrno == EINTR)
+					continue;
+
+				NET_SendError();
+				i++; // skip datagram which fail, try the rest
+				continue;
+			}
+
+			Stats_Inc(st_net_send_calls);
+			Stats_Add(st_net_send_packets, ret);
+
+			i += (ret > 0 ? ret : 1);
+		}
+	}
+
+	send_count = send_pool_used = 0;
+}
+
+void NET_SendPacket(int s, int length, const void *data, struct sockaddr_in *to)
+{
+	struct mmsghdr *m;
+
+	if (net_backend)
+	{
+		NET_BackendSendPacket(s, length, data, to);
+		return;
+	}
+
+#ifdef NET_URING
+	if (uring_active)
+	{
+		URING_SendPacket(s, length, data, to);
+		return;
+	}
+#endif
+
+	if (length < 0 || length > NET_SEND_POOL)
+		return;
+
+	if (send_count >= NET_SEND_BATCH || send_pool_used + length > NET_SEND_POOL)
+		NET_FlushPackets();
+
+	memcpy(send_pool + send_pool_used, data, length);
+
+	send_socket[send_count] = s;
+	send_iov[send_count].iov_base = send_pool + send_pool_used;
+	send_iov[send_count].iov_len = length;
+
+	m = &send_msgs[send_count];
+	memset(&m->msg_hdr, 0, sizeof(m->msg_hdr));
+	if (to) // connected socket gets no address
+	{
+		send_to[send_count] = *to;
+		m->msg_hdr.msg_name = &send_to[send_count];
+		m->msg_hdr.msg_namelen = sizeof(send_to[send_count]);
+	}
+	m->msg_hdr.msg_iov = &send_iov[send_count];
+	m->msg_hdr.msg_iovlen = 1;
+
+	send_pool_used += length;
+	send_count++;
+}
+
+#else // NET_MMSG
+
 int NET_GetPacket(int s, sizebuf_t *msg)
 {
 	int ret;
 	socklen_t fromlen = sizeof (net_from);
 
+	net_refused = false;
+
+	if (net_backend)
+		return NET_BackendGetPacket(s, msg);
+
 	SZ_Clear(msg);
 
 	net_from_socket = s;
@@ -35,15 +327,20 @@ int NET_GetPacket(int s, sizebuf_t *msg)
 			return false;
 		}
 
-		if (qerrno == ECONNRESET)
+		// windows says ECONNRESET on ICMP port unreachable
+		if (qerrno == ECONNRESET || qerrno == ECONNREFUSED)
 		{
 			Sys_DPrintf ("NET_GetPacket: Connection was forcibly closed by %s\n", inet_ntoa(net_from.sin_addr));
+			net_refused = true;
 			return false;
 		}
 
 		Sys_Error ("NET_GetPacket: recvfrom: (%i): %s", qerrno, strerror (qerrno));
 	}
 
+	Stats_Inc(st_net_recv_calls);
+	Stats_Inc(st_net_recv_packets);
+
 	if (ret >= msg->maxsize)
 	{
 		Sys_Printf ("NET_GetPacket: Oversize packet from %s\n", inet_ntoa(net_from.sin_addr));
@@ -60,9 +357,20 @@ int NET_GetPacket(int s, sizebuf_t *msg)
 
 void NET_SendPacket(int s, int length, const void *data, struct sockaddr_in *to)
 {
-	socklen_t addrlen = sizeof(*to);
+	int ret;
 
-	if (sendto(s, (const char *) data, length, 0, (struct sockaddr *)to, addrlen) == SOCKET_ERROR)
+	if (net_backend)
+	{
+		NET_BackendSendPacket(s, length, data, to);
+		return;
+	}
+
+	if (to)
+		ret = sendto(s, (const char *) data, length, 0, (struct sockaddr *)to, sizeof(*to));
+	else
+		ret = send(s, (const char *) data, length, 0);
+
+	if (ret == SOCKET_ERROR)
 	{
 		if (qerrno == EWOULDBLOCK)
 			return;
@@ -70,13 +378,43 @@ void NET_SendPacket(int s, int length, const void *data, struct sockaddr_in *to)
 		if (qerrno == ECONNREFUSED)
 			return;
 
-		Sys_Printf ("NET_SendPacket: sendto: (%i): %s\n", qerrno, strerror (qerrno));
+		Sys_Printf ("NET_SendPacket: send: (%i): %s\n", qerrno, strerror (qerrno));
+		return;
 	}
+
+	Stats_Inc(st_net_send_calls);
+	Stats_Inc(st_net_send_packets);
+}
+
+// there nothing to flush, we send datagrams immediately
+void NET_FlushPackets(void)
+{
+}
+
+#endif // NET_MMSG
+
+static void NET_Cmd_NetStats_f(void)
+{
+	unsigned long long recv_calls = Stats_Value(st_net_recv_calls), recv_packets = Stats_Value(st_net_recv_packets);
+	unsigned long long send_calls = Stats_Value(st_net_send_calls), send_packets = Stats_Value(st_net_send_packets);
+
+	Sys_Printf("=== network batching ===\n");
+	Sys_Printf("recv: %llu syscalls, %llu packets, %.2f packets per syscall\n",
+		recv_calls, recv_packets, recv_calls ? (double)recv_packets / recv_calls : 0.0);
+	Sys_Printf("send: %llu syscalls, %llu packets, %.2f packets per syscall\n",
+		send_calls, send_packets, send_calls ? (double)send_packets / send_calls : 0.0);
+#ifdef NET_URING
+	URING_PrintStats();
+#endif
+	if (net_ban_filter_rules >= 0)
+		Sys_Printf("ban filter: %d of %d filters in kernel, %d instructions\n", net_ban_filter_rules, net_ban_filter_total, net_ban_filter_insns);
+	else
+		Sys_Printf("ban filter: off\n");
 }
 
 //=============================================================================
 
-int NET_UDP_OpenSocket(const char *ip, int port, qbool do_bind)
+static int NET_UDP_OpenSocketEx(const char *ip, int port, qbool do_bind, qbool reuseport)
 {
 	int s;
 	unsigned long _true = 1;
@@ -87,6 +425,16 @@ int NET_UDP_OpenSocket(const char *ip, int port, qbool do_bind)
 		return INVALID_SOCKET;
 	}
 
+#ifdef SO_REUSEPORT
+	// forwarding workers bind own socket to the same port
+	if (reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (void *)&_true, sizeof(_true)))
+	{
+		Sys_Printf("NET_UDP_OpenSocket: setsockopt SO_REUSEPORT: (%i): %s\n", qerrno, strerror (qerrno));
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+#endif
+
 #ifndef _WIN32
 	if (do_bind)
 	{
@@ -128,6 +476,315 @@ int NET_UDP_OpenSocket(const char *ip, int port, qbool do_bind)
 	return s;
 }
 
+int NET_UDP_OpenSocket(const char *ip, int port, qbool do_bind)
+{
+	if (net_backend)
+		return net_backend->open(ip, port, do_bind);
+
+	return NET_UDP_OpenSocketEx(ip, port, do_bind, false);
+}
+
+void NET_CloseSocket(int s)
+{
+	if (net_backend)
+		net_backend->close(s);
+	else
+		closesocket(s);
+}
+
+qbool NET_ConnectSocket(int s, struct sockaddr_in *to)
+{
+	if (net_backend)
+		return net_backend->connect ? net_backend->connect(s, to) : false;
+
+	// UDP connect() sends nothing, kernel just remembers the address and the route
+	if (connect(s, (struct sockaddr *)to, sizeof(*to)) == SOCKET_ERROR)
+	{
+		Sys_DPrintf("NET_ConnectSocket: connect: (%i): %s\n", qerrno, strerror (qerrno));
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef NET_REUSEPORT_CBPF
+
+// kernel picks socket of SO_REUSEPORT group with this program, so datagrams from the same client address (ip and port)
+// always come to the same socket, and so to the worker which owns this client
+static qbool NET_AttachReusePortFilter(int s, int count)
+{
+	struct sock_filter code[] =
+	{
+		// X = length of IP header
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+		// A = source port
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		// A = source ip ^ source port
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		// mix bits, so neighbour addresses do not go to the same socket, and pick socket
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int)count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+
+	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)))
+	{
+		Sys_Printf("NET_AttachReusePortFilter: setsockopt: (%i): %s\n", qerrno, strerror (qerrno));
+		return false;
+	}
+
+	return true;
+}
+
+#endif // NET_REUSEPORT_CBPF
+
+//=============================================================================
+// ban filter
+
+#ifdef NET_BAN_CBPF
+
+#define NET_BAN_LEAF		8	// that much compares we check one by one, bigger sets are split with binary search
+#define NET_BAN_PROLOGUE	6	// instructions which drop runts
+#define NET_UDP_HEADER		8	// filter of UDP socket sees datagram starting with UDP header
+
+static int NET_BanTreeSize(int count)
+{
+	if (count <= NET_BAN_LEAF)
+		return count + 2;
+
+	return 2 + NET_BanTreeSize(count / 2) + NET_BanTreeSize(count - count / 2);
+}
+
+// rules with the same mask and action go to one group, address is loaded and masked once for them
+static int NET_BanGroupEnd(const net_ban_rule_t *rules, int i, int count)
+{
+	int j;
+
+	for (j = i + 1; j < count && rules[j].mask == rules[i].mask && rules[j].ban == rules[i].ban; j++)
+		;
+
+	return j;
+}
+
+static int NET_BanGroupSize(const net_ban_rule_t *rules, int count)
+{
+	return 1 + (rules[0].mask != 0xFFFFFFFF) + NET_BanTreeSize(count);
+}
+
+// instructions we need for the first count rules
+static int NET_BanFilterSize(const net_ban_rule_t *rules, int count)
+{
+	int i, j, size = NET_BAN_PROLOGUE + 1;
+
+	for (i = 0; i < count; i = j)
+	{
+		j = NET_BanGroupEnd(rules, i, count);
+		size += NET_BanGroupSize(rules + i, j - i);
+	}
+
+	return size;
+}
+
+// binary search of masked address among sorted compares, leaf returns ret on match and jumps to miss otherwise.
+// conditional jumps are 8 bit, so far ones are done with BPF_JA
+static int NET_EmitBanTree(struct sock_filter *code, int pc, const net_ban_rule_t *rules, int count, int miss, unsigned int ret)
+{
+	int i, half = count / 2;
+
+	if (count <= NET_BAN_LEAF)
+	{
+		for (i = 0; i < count; i++, pc++)
+			code[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, rules[i].compare, count - i, 0);
+		code[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, miss - (pc + 1), 0, 0);
+		code[pc + 1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ret);
+		return pc + 2;
+	}
+
+	// upper half follows the lower one
+	code[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, rules[half].compare, 0, 1);
+	code[pc + 1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, NET_BanTreeSize(half), 0, 0);
+	pc = NET_EmitBanTree(code, pc + 2, rules, half, miss, ret);
+
+	return NET_EmitBanTree(code, pc, rules + half, count - half, miss, ret);
+}
+
+static void NET_EmitBanFilter(struct sock_filter *code, const net_ban_rule_t *rules, int count)
+{
+	static const struct sock_filter prologue[NET_BAN_PROLOGUE] =
+	{
+		// drop datagrams shorter than 4 bytes, but single A2A_ACK, servers answer our pings with it
+		BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+		BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, NET_UDP_HEADER + 4, 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, NET_UDP_HEADER + 1, 0, 2),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, NET_UDP_HEADER),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, A2A_ACK, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	int i, j, pc = NET_BAN_PROLOGUE, end;
+
+	memcpy(code, prologue, sizeof(prologue));
+
+	for (i = 0; i < count; i = j)
+	{
+		j = NET_BanGroupEnd(rules, i, count);
+		end = pc + NET_BanGroupSize(rules + i, j - i);
+
+		// A = source address
+		code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+		if (rules[i].mask != 0xFFFFFFFF)
+			code[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, rules[i].mask);
+
+		pc = NET_EmitBanTree(code, pc, rules + i, j - i, end, rules[i].ban ? 0 : 0xFFFFFFFF);
+	}
+
+	// nothing matched, let it in
+	code[pc] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+}
+
+qbool NET_SetBanFilter(const net_ban_rule_t *rules, int count)
+{
+	int *sockets = net_proxy_sockets_count ? net_proxy_sockets : &net_socket;
+	int sockets_count = net_proxy_sockets_count ? net_proxy_sockets_count : 1;
+	struct sock_filter *code;
+	struct sock_fprog prog;
+	int i, lo, hi, mid, fit;
+
+	if (net_backend)
+		return false;
+
+	if (rules)
+	{
+		// first rules win anyway, so take as much of them as program can hold
+		for (lo = 0, hi = count; lo < hi; )
+		{
+			mid = (lo + hi + 1) / 2;
+			if (NET_BanFilterSize(rules, mid) <= BPF_MAXINSNS)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		// kernel may not like big program even if it fits, socket option memory is limited with optmem_max
+		for (fit = lo; ; fit /= 2)
+		{
+			prog.len = NET_BanFilterSize(rules, fit);
+			prog.filter = code = Sys_malloc(prog.len * sizeof(*code));
+			NET_EmitBanFilter(code, rules, fit);
+
+			for (i = 0; i < sockets_count && !setsockopt(sockets[i], SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)); i++)
+				;
+
+			Sys_free(code);
+
+			if (i == sockets_count)
+			{
+				if (fit < count)
+					Sys_DPrintf("NET_SetBanFilter: kernel checks %d of %d ban filters\n", fit, count);
+
+				net_ban_filter_rules = fit;
+				net_ban_filter_total = count;
+				net_ban_filter_insns = prog.len;
+				return true;
+			}
+
+			if (!fit)
+				break;
+		}
+
+		Sys_Printf("NET_SetBanFilter: setsockopt: (%i): %s\n", qerrno, strerror (qerrno));
+	}
+
+	// do not leave old filter on sockets, it may ban what is not banned anymore, kernel wants int sized option even if it ignores it
+	for (i = 0, lo = 0; i < sockets_count; i++)
+		setsockopt(sockets[i], SOL_SOCKET, SO_DETACH_FILTER, (void *)&lo, sizeof(lo));
+
+	net_ban_filter_rules = -1;
+
+	return false;
+}
+
+#else // NET_BAN_CBPF
+
+qbool NET_SetBanFilter(const net_ban_rule_t *rules, int count)
+{
+	return false;
+}
+
+#endif // NET_BAN_CBPF
+
+// remember proxy sockets, so ban filter goes to each of them
+static int NET_KeepProxySockets(int *sockets, int count)
+{
+	Sys_free(net_proxy_sockets);
+	net_proxy_sockets = Sys_malloc(count * sizeof(*net_proxy_sockets));
+	memcpy(net_proxy_sockets, sockets, count * sizeof(*net_proxy_sockets));
+	net_proxy_sockets_count = count;
+
+	return count;
+}
+
+int NET_OpenWorkerSockets(int *sockets, int count)
+{
+	int i = 0;
+
+	sockets[0] = net_socket;
+
+	if (net_backend)
+		return 1; // simulation runs everything in the main thread
+
+#ifdef SO_REUSEPORT
+	if (count < 2)
+		return NET_KeepProxySockets(sockets, 1);
+
+	// proxy socket was bound without SO_REUSEPORT, so reopen it
+	closesocket(net_socket);
+
+	for (i = 0; i < count; i++)
+	{
+		if ((sockets[i] = NET_UDP_OpenSocketEx(net_ip->string, net_port->integer, true, true)) == INVALID_SOCKET)
+			break;
+	}
+
+	if (i < count)
+	{
+		Sys_Printf("NET_OpenWorkerSockets: failed to open socket for each worker, using single one\n");
+		while (i-- > 0)
+			closesocket(sockets[i]);
+
+		if ((net_socket = NET_UDP_OpenSocket(net_ip->string, net_port->integer, true)) == INVALID_SOCKET)
+			Sys_Error("NET_OpenWorkerSockets: failed to initialize socket");
+
+		sockets[0] = net_socket;
+		return NET_KeepProxySockets(sockets, 1);
+	}
+
+#ifdef NET_REUSEPORT_CBPF
+	// without filter kernel uses hash of the addresses, which is consistent as well, as long as group does not change
+	NET_AttachReusePortFilter(sockets[0], count);
+#endif
+
+	net_socket = sockets[0];
+#else
+	Sys_Printf("NET_OpenWorkerSockets: SO_REUSEPORT is not supported, using single worker\n");
+	i = 1;
+#endif
+
+	return NET_KeepProxySockets(sockets, i);
+}
+
+void NET_InitThread(int s)
+{
+	net_socket = s;
+	SZ_InitEx(&net_message, net_message_buffer, sizeof(net_message_buffer), false);
+}
+
 //=============================================================================
 
 qbool NET_GetSockAddrIn_ByHostAndPort(struct sockaddr_in *address, const char *host, int port)
@@ -148,7 +805,11 @@ qbool NET_GetSockAddrIn_ByHostAndPort(struct sockaddr_in *address, const char *h
 	sin.sin_port = htons((u_short)port);
 
 	/* Map host name to IP address, allowing for dotted decimal */
-	if((phe = gethostbyname(host)))
+	if (DNS_ParseAddress(host, &sin.sin_addr))
+	{
+		// dotted decimal, no need to bother resolver
+	}
+	else if((phe = gethostbyname(host)))
 	{
 		memcpy((char *)&sin.sin_addr, phe->h_addr, phe->h_length);
 	}
@@ -298,6 +959,8 @@ void NET_Init (void)
 	// init the message buffer
 	SZ_InitEx(&net_message, net_message_buffer, sizeof(net_message_buffer), false);
 
+	Cmd_AddCommand("netstats", NET_Cmd_NetStats_f);
+
 	Sys_DPrintf("UDP Initialized\n");
 }
 
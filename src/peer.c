@@ -4,15 +4,401 @@
 
 #include "qwfwd.h"
 
-peer_t *peers = NULL;
-static int userid = 0;
+#if defined(__linux__) && !defined(FWD_NO_EPOLL)
+	#define FWD_EPOLL // use epoll instead of select, so we do not scan every peer on each wake up
+	#include <sys/epoll.h>
+#endif
+
+//======================================================
+// forwarding workers.
+// each worker runs in own thread with own proxy socket, all sockets are bound to net_port with SO_REUSEPORT,
+// kernel sends datagrams from the same client to the same socket, so worker owns its peers and nobody else touch them.
+// main thread is worker 0, it does console, query and config job as well.
+
+#define FWD_MAX_WORKERS 64
+
+//======================================================
+// peers pool.
+// peers are not allocated one by one, worker keeps them in chunks of FWD_POOL_CHUNK slots and reuses free slots,
+// so connect/disconnect does not hit malloc. chunks are never freed, so peer pointer is valid while peer lives.
+// hot part of the peer (peer_t) is small and cache line aligned, cold part (peer_info_t) lives in own chunks with the same slot,
+// so walking peers does not drag userinfo through the cache.
+// outside of the pool (hash table, epoll/io_uring) peer is referred by handle: slot plus generation of the slot.
+// generation is bumped when slot is freed, so stale handle does not turn into some other peer.
+
+#define FWD_POOL_CHUNK_SHIFT	6
+#define FWD_POOL_CHUNK			(1 << FWD_POOL_CHUNK_SHIFT) // slots per chunk
+#define FWD_HANDLE_SLOT_BITS	20
+#define FWD_HANDLE_SLOT_MASK	((1u << FWD_HANDLE_SLOT_BITS) - 1)
+#define FWD_HANDLE_GEN_STEP		(1u << FWD_HANDLE_SLOT_BITS)
+#define FWD_POOL_MAX_SLOTS		(1 << FWD_HANDLE_SLOT_BITS)
+
+// handles of sockets which are not peers, peer handle always has non zero generation so it never clash with these
+#define FWD_HANDLE_NET			0	// main proxy socket
+#define FWD_HANDLE_STDIN		1	// console
+
+typedef struct fwd_pool_s
+{
+	peer_t			**hot;			// chunks of hot data, cache line aligned
+	void			**hot_mem;		// the same chunks as we got them from malloc
+	peer_info_t		**cold;			// chunks of cold data
+	int				chunks;			// allocated chunks
+	int				max_chunks;		// size of the arrays above
+	int				slots;			// slots which ever was used, we walk peers up to here
+	int				free;			// first slot in the free list, -1 if list is empty
+} fwd_pool_t;
+
+#define FWD_pool_peer(pool, slot)	(&(pool)->hot[(slot) >> FWD_POOL_CHUNK_SHIFT][(slot) & (FWD_POOL_CHUNK - 1)])
+#define FWD_pool_info(pool, slot)	(&(pool)->cold[(slot) >> FWD_POOL_CHUNK_SHIFT][(slot) & (FWD_POOL_CHUNK - 1)])
+
+// fails to compile if peer_t grows over two cache lines, put new fields to peer_info_t unless they are needed for every packet
+typedef char fwd_peer_size_check[sizeof(peer_t) <= 2 * CACHE_LINE_SIZE ? 1 : -1];
+
+//======================================================
+// worker state, see "forwarding workers" above
+
+typedef struct fwd_worker_s
+{
+	int				id;
+	int				socket;		// proxy socket of this worker
+	fwd_pool_t		pool;		// peers of this worker
+	sys_mutex_t		lock;		// protects pool and peer fields other threads read (status, cllist)
+	timer_wheel_t	timers;		// peer timers, only owner thread use it
+	unsigned int	time;		// Sys_Milliseconds() when worker woke up last time
+	unsigned int	wake_usec;	// Sys_Microseconds() of the same moment, for latency stats
+	unsigned long long	wake_packets;	// datagrams read by this thread before it woke up
+} fwd_worker_t;
+
+static cvar_t					*fwd_workers;
+
+static fwd_worker_t				workers[FWD_MAX_WORKERS];
+static int						workers_count;
+static THREAD_LOCAL fwd_worker_t	*worker;		// worker of current thread
+
+static sys_rwlock_t				config_lock;	// workers read bans, whitelist and cvars, main thread changes them
+static sys_sem_t				workers_done;	// worker posts it when it quits
+static volatile qbool			workers_exit;
+
+static volatile int				peers_total;	// peers of all workers
+static volatile int				userid;
+
+// add one more chunk to the pool, worker lock must be held since other threads may walk the pool
+static qbool FWD_pool_grow(fwd_pool_t *pool)
+{
+	int i, slot;
+
+	if ((pool->chunks + 1) * FWD_POOL_CHUNK > FWD_POOL_MAX_SLOTS)
+		return false; // handle can't address more slots
+
+	if (pool->chunks == pool->max_chunks)
+	{
+		int max_chunks = pool->max_chunks ? pool->max_chunks * 2 : 16;
+		peer_t **hot = Sys_malloc(max_chunks * sizeof(*hot));
+		void **hot_mem = Sys_malloc(max_chunks * sizeof(*hot_mem));
+		peer_info_t **cold = Sys_malloc(max_chunks * sizeof(*cold));
+
+		if (pool->chunks)
+		{
+			memcpy(hot, pool->hot, pool->chunks * sizeof(*hot));
+			memcpy(hot_mem, pool->hot_mem, pool->chunks * sizeof(*hot_mem));
+			memcpy(cold, pool->cold, pool->chunks * sizeof(*cold));
+		}
+
+		Sys_free(pool->hot);
+		Sys_free(pool->hot_mem);
+		Sys_free(pool->cold);
+
+		pool->hot = hot;
+		pool->hot_mem = hot_mem;
+		pool->cold = cold;
+		pool->max_chunks = max_chunks;
+	}
+
+	// malloc does not promise cache line alignment, so align it ourself
+	pool->hot_mem[pool->chunks] = Sys_malloc(FWD_POOL_CHUNK * sizeof(peer_t) + CACHE_LINE_SIZE);
+	pool->hot[pool->chunks] = (peer_t *)(((size_t)pool->hot_mem[pool->chunks] + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+	pool->cold[pool->chunks] = Sys_malloc(FWD_POOL_CHUNK * sizeof(peer_info_t));
+	pool->chunks++;
+
+	// Sys_malloc() zeroes memory, so new slots are ps_free already, but they need generation
+	for (i = 0; i < FWD_POOL_CHUNK; i++)
+	{
+		slot = (pool->chunks - 1) * FWD_POOL_CHUNK + i;
+		FWD_pool_peer(pool, slot)->handle = FWD_HANDLE_GEN_STEP | (unsigned int)slot;
+	}
+
+	return true;
+}
+
+// take free slot from the pool, worker lock must be held
+static peer_t *FWD_pool_alloc(fwd_pool_t *pool)
+{
+	unsigned int handle;
+	peer_t *p;
+	int slot;
+
+	if (pool->free >= 0)
+	{
+		slot = pool->free;
+		pool->free = FWD_pool_peer(pool, slot)->next;
+	}
+	else
+	{
+		if (pool->slots == pool->chunks * FWD_POOL_CHUNK && !FWD_pool_grow(pool))
+			return NULL;
+		slot = pool->slots++;
+	}
+
+	// clear slot, but keep generation
+	p = FWD_pool_peer(pool, slot);
+	handle = p->handle;
+	memset(p, 0, sizeof(*p));
+	p->handle = handle;
+	p->s = INVALID_SOCKET;
+	p->ps = ps_drop; // caller sets real state
+
+	return p;
+}
+
+// put slot back to the pool, worker lock must be held
+static void FWD_pool_release(fwd_pool_t *pool, peer_t *p)
+{
+	int slot = (int)(p->handle & FWD_HANDLE_SLOT_MASK);
+
+	p->ps = ps_free;
+
+	// new generation, zero generation is reserved for FWD_HANDLE_NET/FWD_HANDLE_STDIN
+	p->handle += FWD_HANDLE_GEN_STEP;
+	if (!(p->handle & ~FWD_HANDLE_SLOT_MASK))
+		p->handle += FWD_HANDLE_GEN_STEP;
+
+	p->next = pool->free;
+	pool->free = slot;
+}
+
+// resolve handle of the current worker peer, returns NULL if peer is gone
+static peer_t *FWD_peer_by_handle(unsigned int handle)
+{
+	fwd_pool_t *pool = &worker->pool;
+	int slot = (int)(handle & FWD_HANDLE_SLOT_MASK);
+	peer_t *p;
+
+	if (slot >= pool->slots)
+		return NULL;
+
+	p = FWD_pool_peer(pool, slot);
+
+	return (p->handle == handle && p->ps != ps_free) ? p : NULL;
+}
+
+peer_info_t *FWD_peer_info(const peer_t *p)
+{
+	return FWD_pool_info(&worker->pool, (int)(p->handle & FWD_HANDLE_SLOT_MASK));
+}
+
+//======================================================
+// peers hash table.
+// open addressing with linear probing, keyed by client address (ip and port),
+// so we do not walk all peers for every packet which come to the main socket.
+// table keeps peer handles, zero is empty entry since peer handle is never zero.
+// table is per worker, only owner thread use it.
+
+#define FWD_HASH_MIN_SIZE 256 // must be power of two
+
+static THREAD_LOCAL unsigned int	*peers_hash;
+static THREAD_LOCAL unsigned int	peers_hash_size; // always power of two
+static THREAD_LOCAL int				peers_count; // number of peers in the table
+
+static void FWD_hash_insert(peer_t *p); // forward reference
+
+static void FWD_hash_resize(unsigned int size)
+{
+	unsigned int	*old = peers_hash;
+	unsigned int	old_size = peers_hash_size, i;
+
+	peers_hash = Sys_malloc(size * sizeof(*peers_hash));
+	peers_hash_size = size;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old[i])
+			FWD_hash_insert(FWD_peer_by_handle(old[i]));
+	}
+
+	Sys_free(old);
+}
+
+static void FWD_hash_insert(peer_t *p)
+{
+	unsigned int i, mask;
+
+	// keep load factor below 1/2, so probe sequences stay short
+	if (!peers_hash || (unsigned int)(peers_count + 1) * 2 > peers_hash_size)
+		FWD_hash_resize(peers_hash ? peers_hash_size * 2 : FWD_HASH_MIN_SIZE);
+
+	mask = peers_hash_size - 1;
+
+	for (i = Hash_Addr(&p->from) & mask; peers_hash[i]; i = (i + 1) & mask)
+		;
+
+	peers_hash[i] = p->handle;
+}
+
+static void FWD_hash_remove(peer_t *p)
+{
+	unsigned int i, j, k, mask;
+
+	if (!peers_hash)
+		return;
+
+	mask = peers_hash_size - 1;
+
+	for (i = Hash_Addr(&p->from) & mask; peers_hash[i] != p->handle; i = (i + 1) & mask)
+	{
+		if (!peers_hash[i])
+			return; // not in the table
+	}
+
+	// backward shift deletion, so we do not need tombstones
+	for (j = (i + 1) & mask; peers_hash[j]; j = (j + 1) & mask)
+	{
+		k = Hash_Addr(&FWD_peer_by_handle(peers_hash[j])->from) & mask; // ideal slot for entry at j
+
+		if (Hash_CanShift(i, j, k))
+		{
+			peers_hash[i] = peers_hash[j];
+			i = j;
+		}
+	}
+
+	peers_hash[i] = 0;
+}
+
+#ifdef FWD_EPOLL
+#define FWD_MAX_EVENTS 256
+
+static THREAD_LOCAL int epoll_fd = INVALID_SOCKET;
+#endif
+
+// register socket in epoll/io_uring, handle will be returned back to us with the event
+static qbool FWD_poll_add(int s, unsigned int handle)
+{
+	if (net_backend)
+		return net_backend->watch(s, handle);
+
+#ifdef NET_URING
+	if (uring_active)
+	{
+		void *data = (void *)(size_t)handle;
+
+		return (handle == FWD_HANDLE_STDIN) ? URING_WatchPoll(s, data) : URING_Watch(s, data);
+	}
+#endif
+
+#ifdef FWD_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = handle;
+
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &ev) < 0)
+		{
+			Sys_Printf("FWD_poll_add: epoll_ctl: (%i): %s\n", qerrno, strerror(qerrno));
+			return false;
+		}
+	}
+#endif
+
+	return true;
+}
+
+static void FWD_poll_remove(int s)
+{
+	if (net_backend)
+	{
+		net_backend->unwatch(s);
+		return;
+	}
+
+#ifdef NET_URING
+	if (uring_active)
+	{
+		URING_Unwatch(s);
+		return;
+	}
+#endif
+
+#ifdef FWD_EPOLL
+	{
+		struct epoll_event ev; // kernels before 2.6.9 require non NULL event even for EPOLL_CTL_DEL
+
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, &ev) < 0)
+			Sys_DPrintf("FWD_poll_remove: epoll_ctl: (%i): %s\n", qerrno, strerror(qerrno));
+	}
+#endif
+}
+
+static void FWD_poll_init(void)
+{
+#if defined(NET_URING) || defined(FWD_EPOLL)
+	qbool ok = false;
+#endif
+
+	// simulated network, there is no console either
+	if (net_backend)
+	{
+		if (!FWD_poll_add(net_socket, FWD_HANDLE_NET))
+			Sys_Error("FWD_poll_init: failed to watch main socket");
+		return;
+	}
+
+#if defined(NET_URING) || defined(FWD_EPOLL)
+
+#ifdef NET_URING
+	// io_uring if kernel supports it, epoll otherwise
+	if (URING_Init())
+	{
+		URING_Watch(net_socket, (void *)(size_t)FWD_HANDLE_NET);
+		ok = URING_CheckWatch(net_socket);
+	}
+#endif
+
+#ifdef FWD_EPOLL
+	if (!ok)
+	{
+		if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			Sys_Error("FWD_poll_init: epoll_create1: (%i): %s", qerrno, strerror(qerrno));
+
+		if (!FWD_poll_add(net_socket, FWD_HANDLE_NET))
+			Sys_Error("FWD_poll_init: failed to watch main socket");
+		ok = true;
+	}
+#endif
+
+// if not DLL - read stdin
+#ifndef APP_DLL
+	// try read stdin only if connected to a terminal, console is job of the main thread
+	if (ok && !worker->id && isatty(STDIN) && isatty(STDOUT))
+		FWD_poll_add(STDIN, FWD_HANDLE_STDIN);
+#endif
+#endif
+}
 
 peer_t	*FWD_peer_by_addr(struct sockaddr_in *from)
 {
 	peer_t *p;
+	unsigned int i, mask;
+
+	if (!peers_hash)
+		return NULL;
 
-	for (p = peers; p; p = p->next)
+	mask = peers_hash_size - 1;
+
+	for (i = Hash_Addr(from) & mask; peers_hash[i]; i = (i + 1) & mask)
 	{
+		p = FWD_peer_by_handle(peers_hash[i]);
 		if (NET_CompareAddress(&p->from, from))
 			return p;
 	}
@@ -31,21 +417,143 @@ static int parse_color(const char *userinfo, const char *key)
 	return (color < 0) ? 0 : ((color > 16) ? 16 : color);
 }
 
+// check if we allowed to connect to remote host
+static qbool FWD_remote_allowed(struct sockaddr_in *to)
+{
+	if (!SV_IsWhitelisted(to))
+		return false;
+
+	// check for bans.
+	if (SV_IsBanned(to))
+		return false;
+
+	return true;
+}
+
+//======================================================
+// peer timers.
+// each peer has one timer in the wheel of the worker, it fires when something may be due for the peer:
+// timeout, challenge resend or q3 disconnect probe. timer is not moved when packet comes,
+// FWD_peer_timer() just checks what is really due and schedules it again, so packet path only updates "last".
+
+#define FWD_PEER_TIMEOUT		15000	// drop peer if client silent that long
+#define FWD_CHALLENGE_RESEND	3000	// ask remote server for a challenge again
+#define FWD_RESOLVE_CHECK		100		// check resolver for peer in ps_resolving state
+#define FWD_Q3_PROBE_IDLE		1000	// q3 client silent that long, probably it is gone, probe remote server
+#define FWD_Q3_PROBE_INTERVAL	50
+
+// main thread has console and queries to serve, workers only have to notice workers_exit
+#define FWD_MAIN_MAX_WAIT		100
+#define FWD_WORKER_MAX_WAIT		500
+
+// times wrap around, so compare them by difference
+static unsigned int FWD_time_min(unsigned int a, unsigned int b)
+{
+	return ((int)(a - b) < 0) ? a : b;
+}
+
+// find out when we should look at the peer next time
+static void FWD_peer_schedule(peer_t *p)
+{
+	unsigned int now = worker->time;
+	unsigned int next = p->last + FWD_PEER_TIMEOUT;
+
+	switch (p->ps)
+	{
+		case ps_drop:
+			next = now;
+			break;
+		case ps_resolving:
+			next = now + FWD_RESOLVE_CHECK;
+			break;
+		case ps_challenge:
+			next = FWD_time_min(next, p->connect + FWD_CHALLENGE_RESEND);
+			break;
+		case ps_connected:
+			if (p->proto == pr_q3)
+			{
+				if (now - p->last > FWD_Q3_PROBE_IDLE)
+					next = FWD_time_min(next, p->q3_disconnect_check + FWD_Q3_PROBE_INTERVAL);
+				else
+					next = FWD_time_min(next, p->last + FWD_Q3_PROBE_IDLE + 1);
+			}
+			break;
+		default:
+			break;
+	}
+
+	if ((int)(next - now) <= 0)
+		next = now + 1; // next tick
+
+	Timer_Add(&worker->timers, &p->timer, next);
+}
+
+void FWD_peer_drop(peer_t *p)
+{
+	p->ps = ps_drop;
+	FWD_peer_schedule(p); // so it freed on the next tick
+}
+
+struct sockaddr_in *FWD_peer_to(peer_t *p)
+{
+	return p->connected ? NULL : &p->to;
+}
+
+// we know where peer goes, connect socket there, so kernel looks up route once and drops datagrams from anyone else.
+// if it fails we still work, just with sendto() and our own check of the sender
+static void FWD_peer_connect(peer_t *p)
+{
+	p->connected = NET_ConnectSocket(p->s, &p->to);
+}
+
+static void FWD_peer_cant_connect(peer_t *p)
+{
+	const char *host = FWD_peer_info(p)->host;
+
+	Sys_DPrintf("peer %s:%d can't connect to %s\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port), host);
+
+	if (p->proto == pr_qw)
+		Netchan_OutOfBandPrint(net_socket, &p->from, "%c\n" "proxy can't connect to %s\n", A2C_PRINT, host);
+	else
+		Netchan_OutOfBandPrint(net_socket, &p->from, "print\n" "proxy can't connect to %s\n", host);
+}
+
+// nobody listens on the server port, do not wait for timeout
+static void FWD_peer_refused(peer_t *p)
+{
+	if (p->ps == ps_drop)
+		return;
+
+	Sys_DPrintf("peer %s:%d refused by server\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port));
+	Stats_Inc(st_peer_refused);
+
+	if (p->ps < ps_connected)
+		FWD_peer_cant_connect(p); // client waits for connect reply, tell it why there is none
+
+	FWD_peer_drop(p);
+}
+
 peer_t	*FWD_peer_new(const char *remote_host, int remote_port, struct sockaddr_in *from, const char *userinfo, int qport, protocol_t proto, qbool link)
 {
 	peer_t *p;
+	peer_info_t *info;
 	struct sockaddr_in to;
 	int s = INVALID_SOCKET;
 	qbool new_peer = false;
+	dns_status_t dns;
 
-	if (!NET_GetSockAddrIn_ByHostAndPort(&to, remote_host, remote_port))
-		return NULL; // failed to resolve host name?
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons((u_short)remote_port);
 
-	if (!SV_IsWhitelisted(&to))
+	// NOTE: resolver does not block, if host name is not resolved yet then peer waits in ps_resolving state
+	if ((dns = DNS_Resolve(remote_host, &to.sin_addr)) == dns_failed)
+	{
+		Sys_DPrintf("failed to resolve %s\n", remote_host);
 		return NULL;
+	}
 
-	// check for bans.
-	if (SV_IsBanned(&to))
+	if (dns == dns_ok && !FWD_remote_allowed(&to))
 		return NULL;
 
 	// we probably already have such peer, reuse it then
@@ -62,131 +570,488 @@ peer_t	*FWD_peer_new(const char *remote_host, int remote_port, struct sockaddr_i
 		// NOTE: socket allocated here! Do not forget free it!!!
 		if ((s = NET_UDP_OpenSocket(NULL, 0, false)) == INVALID_SOCKET)
 			return NULL; // out of sockets?
+	}
 
-		p = Sys_malloc(sizeof(*p)); // alloc peer if needed
+	// other threads may walk the pool and read reused peer right now
+	Sys_MutexLock(&worker->lock);
+
+	if (new_peer)
+	{
+		// take peer from the pool and watch socket once, so main loop does not need to check every peer
+		if (!(p = FWD_pool_alloc(&worker->pool)) || !FWD_poll_add(s, p->handle))
+		{
+			if (p)
+				FWD_pool_release(&worker->pool, p);
+			Sys_MutexUnlock(&worker->lock);
+			NET_CloseSocket(s);
+			return NULL;
+		}
 	}
 
+	info = FWD_peer_info(p);
+
 	p->s		= ( new_peer ) ? s : p->s; // reuse socket in case of reusing
 	p->from		= *from;
 	p->to		= to;
-	p->ps		= ( !new_peer && proto == pr_q3 ) ? p->ps : ps_challenge; // do not reset state for q3 in case of peer reusing
+	if (dns == dns_pending)
+		p->ps	= ps_resolving;
+	else
+		p->ps	= ( !new_peer && proto == pr_q3 ) ? p->ps : ps_challenge; // do not reset state for q3 in case of peer reusing
 	p->qport	= qport;
 	p->proto	= proto;
-	strlcpy(p->userinfo, userinfo, sizeof(p->userinfo));
-	Info_ValueForKey(userinfo, "name", p->name, sizeof(p->name));
-	p->top          = parse_color(userinfo, "topcolor");
-	p->bottom       = parse_color(userinfo, "bottomcolor");
-	p->userid	= ( new_peer ) ? ++userid : p->userid; // do not bump userid in case of peer reusing
-
-	time(&p->last);
-
-	// link only new peer, in case of reusing it already done...
-	if (new_peer && link)
+	strlcpy(info->host, remote_host, sizeof(info->host));
+	strlcpy(info->userinfo, userinfo, sizeof(info->userinfo));
+	Info_ValueForKey(userinfo, "name", info->name, sizeof(info->name));
+	info->top		= parse_color(userinfo, "topcolor");
+	info->bottom	= parse_color(userinfo, "bottomcolor");
+	info->userid	= ( new_peer ) ? Sys_AtomicAdd(&userid, 1) : info->userid; // do not bump userid in case of peer reusing
+	if (new_peer)
+		info->packets_in = info->bytes_in = info->packets_out = info->bytes_out = 0; // pool does not clear cold part
+
+	p->last		= worker->time;
+	if (new_peer)
+		p->connect	= worker->time - FWD_CHALLENGE_RESEND; // so challenge sent ASAP
+
+	if (new_peer)
 	{
-		p->next = peers;
-		peers = p;
+		// peer is in the pool, so it counted and checked for timeout anyway, but we can't find it by address unless it linked
+		if (link)
+		{
+			FWD_hash_insert(p);
+			peers_count++;
+		}
+		Sys_AtomicAdd(&peers_total, 1);
 	}
 
+	Sys_MutexUnlock(&worker->lock);
+
+	// reused peer may go to another server, socket is connected again then
+	if (dns == dns_ok)
+		FWD_peer_connect(p);
+	else
+		p->connected = false; // so we check sender until we know where peer goes
+
+	SV_StatusChanged(); // new peer, or name of reused one may differ
+	FWD_peer_schedule(p);
+
 	return p;
 }
 
-// free peer data, perform unlink if requested
-static void FWD_peer_free(peer_t *peer, qbool unlink)
+// free peer data and put it back to the pool
+static void FWD_peer_free(peer_t *peer)
 {
 	if (!peer)
 		return;
 
-	if (unlink)
+	if (FWD_peer_by_addr(&peer->from) == peer)
 	{
-		peer_t *next, *prev, *current;
+		FWD_hash_remove(peer);
+		peers_count--;
+	}
+	Sys_AtomicAdd(&peers_total, -1);
 
-		prev = NULL;
-		current = peers;
+	Timer_Remove(&worker->timers, &peer->timer);
 
-		for ( ; current; )
-		{
-			next = current->next;
+	// free all data related to peer
+	if (peer->s) // there should be no zero socket, it's stdin
+	{
+		NET_FlushPackets(); // we may have queued datagrams for this socket
+		FWD_poll_remove(peer->s);
+		NET_CloseSocket(peer->s);
+	}
 
-			if (peer == current)
-			{
-				if (prev)
-					prev->next = next;
-				else
-					peers = next;
+	Sys_MutexLock(&worker->lock);
+	FWD_pool_release(&worker->pool, peer);
+	Sys_MutexUnlock(&worker->lock);
 
-				break;
-			}
+	SV_StatusChanged();
+}
 
-			prev = current;
-			current = next;
-		}
+// peer in ps_resolving state, check if resolver done with remote host
+static void FWD_peer_resolve(peer_t *p)
+{
+	const char *host = FWD_peer_info(p)->host;
+	struct in_addr addr;
+
+	switch (DNS_Resolve(host, &addr))
+	{
+		case dns_pending:
+			return; // not yet
+		case dns_ok:
+			// status and metrics read the address with worker lock held
+			Sys_MutexLock(&worker->lock);
+			p->to.sin_addr = addr;
+			Sys_MutexUnlock(&worker->lock);
+
+			if (FWD_remote_allowed(&p->to))
+			{
+				FWD_peer_connect(p);
+				p->ps = ps_challenge;
+				p->connect = worker->time - FWD_CHALLENGE_RESEND; // so challenge sent ASAP
+				return;
+			}
+			break;
+		default:
+			break;
 	}
 
-	// free all data related to peer
-	if (peer->s) // there should be no zero socket, it's stdin
-		closesocket(peer->s);
-	Sys_free(peer);
+	FWD_peer_cant_connect(p);
+
+	p->ps = ps_drop;
 }
 
-static void FWD_check_timeout(void)
+// peer timer fired, do whatever is due for the peer and schedule it again
+static void FWD_peer_timer(wheel_timer_t *t)
 {
+	peer_t *p = (peer_t *)((byte *)t - offsetof(peer_t, timer));
+	unsigned int now = worker->time;
 	byte msg_data[6];
 	sizebuf_t msg;
-	time_t cur_time;
-	double d_cur_time;
+
+	if (p->ps == ps_drop)
+	{
+		Sys_DPrintf("peer %s:%d dropped\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port));
+		FWD_peer_free(p);
+		return;
+	}
+
+	// this is helper for q3 to guess disconnect asap
+	if (p->proto == pr_q3 && p->ps == ps_connected)
+	{
+		if (now - p->last > FWD_Q3_PROBE_IDLE && now - p->q3_disconnect_check >= FWD_Q3_PROBE_INTERVAL)
+		{
+			p->q3_disconnect_check = now;
+			SZ_InitEx(&msg, msg_data, sizeof(msg_data), true);
+			MSG_WriteLong(&msg, 0);
+			MSG_WriteShort(&msg, p->qport);
+			NET_SendPacket(p->s, msg.cursize, msg.data, FWD_peer_to(p));
+		}
+	}
+
+	if (p->ps == ps_resolving)
+		FWD_peer_resolve(p);
+
+	if (p->ps == ps_challenge)
+	{
+		// send challenge time to time
+		if (now - p->connect >= FWD_CHALLENGE_RESEND)
+		{
+			p->connect = now;
+			Netchan_OutOfBandPrint(p->s, FWD_peer_to(p), "getchallenge%s", p->proto == pr_qw ? "\n" : "");
+		}
+	}
+
+	if (p->ps != ps_drop && now - p->last >= FWD_PEER_TIMEOUT)
+	{
+		Sys_DPrintf("peer %s:%d timed out\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port));
+		Stats_Inc(st_peer_timeouts);
+		p->ps = ps_drop;
+	}
+
+	FWD_peer_schedule(p);
+}
+
+// process packet which came to the main proxy socket from the client, packet is in net_message
+static void FWD_net_socket_packet(void)
+{
+	qbool connectionless;
+	int cnt;
 	peer_t *p;
+	peer_info_t *info;
 
-	SZ_InitEx(&msg, msg_data, sizeof(msg_data), true);
+	Stats_Inc(st_client_packets_in);
+	Stats_Add(st_client_bytes_in, net_message.cursize);
 
-	cur_time = time(NULL);
-	d_cur_time = Sys_DoubleTime();
+	// check for bans.
+	if (SV_IsBanned(&net_from))
+	{
+		Stats_Inc(st_drop_banned);
+		return;
+	}
 
-	for (p = peers; p; p = p->next)
+	if (net_message.cursize == 1 && net_message.data[0] == A2A_ACK)
 	{
-		// this is helper for q3 to guess disconnect asap
-		if (p->proto == pr_q3)
+		QRY_SV_PingReply();
+
+		return;
+	}
+
+	MSG_BeginReading();
+	connectionless = (MSG_ReadLong() == -1);
+
+	if (connectionless)
+	{
+		if (MSG_BadRead())
+			return;
+
+		if (!SV_ConnectionlessPacket())
+			return; // seems we do not need forward it
+	}
+
+	// search in peers, if we have this peer already, then forward/send packet to remote server
+	if (!(p = FWD_peer_by_addr(&net_from)))
+	{
+		Stats_Inc(st_drop_unknown);
+		return; // peer was not found
+	}
+
+	info = FWD_peer_info(p);
+	info->packets_in++;
+	info->bytes_in += net_message.cursize;
+
+	if (capture_active)
+		Capture_Packet(p, cd_client, net_message.data, net_message.cursize);
+
+	// forward data to the server/proxy
+	if (p->ps >= ps_connected)
+	{
+		cnt = 1; // one packet by default
+
+		// check for "drop" aka client disconnect,
+		// first 10 bytes for NON connectionless packet is netchan related shit in QW
+		if (p->proto == pr_qw && !connectionless && net_message.cursize > 10 && net_message.data[10] == clc_stringcmd)
 		{
-			if (cur_time - p->last > 1 && d_cur_time - p->q3_disconnect_check > 0.05 && p->ps == ps_connected)
+			if (!strcmp((char*)net_message.data + 10 + 1, "drop"))
 			{
-				p->q3_disconnect_check = d_cur_time;
-				SZ_Clear(&msg);
-				MSG_WriteLong(&msg, 0);
-				MSG_WriteShort(&msg, p->qport);
-				NET_SendPacket(p->s, msg.cursize, msg.data, &p->to);
+//				Sys_Printf("peer drop detected\n");
+				FWD_peer_drop(p); // drop peer ASAP
+				Stats_Inc(st_peer_drops);
+				cnt = 3; // send few packets due to possibile packet lost
 			}
 		}
 
-		if (cur_time - p->last < 15) // few seconds timeout
-			continue;
+		Stats_Add(st_server_packets_out, cnt);
+		Stats_Add(st_server_bytes_out, cnt * net_message.cursize);
 
-		Sys_DPrintf("peer %s:%d timed out\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port));
+		for ( ; cnt > 0; cnt--)
+			NET_SendPacket(p->s, net_message.cursize, net_message.data, FWD_peer_to(p));
+	}
 
-		p->ps = ps_drop;
+	p->last = worker->time;
+}
+
+// process packet which came to the peer socket from the remote server, packet is in net_message
+static void FWD_peer_socket_packet(peer_t *p)
+{
+	peer_info_t *info;
+
+	Stats_Inc(st_server_packets_in);
+	Stats_Add(st_server_bytes_in, net_message.cursize);
+
+	// check for bans.
+	if (SV_IsBanned(&net_from))
+	{
+		Stats_Inc(st_drop_banned);
+		return;
 	}
+
+	// we should check is this packet from remote server, this may be some evil packet from haxors...
+	// kernel did it already for connected socket
+	if (!p->connected && !NET_CompareAddress(&p->to, &net_from))
+	{
+		Stats_Inc(st_drop_spoofed);
+		return;
+	}
+
+	if (capture_active)
+		Capture_Packet(p, cd_server, net_message.data, net_message.cursize);
+
+	MSG_BeginReading();
+	if (MSG_ReadLong() == -1)
+	{
+		if (MSG_BadRead())
+			return;
+
+		if (!CL_ConnectionlessPacket(p))
+			return; // seems we do not need forward it
+	}
+	else if (p->ps < ps_connected)
+	{
+		return;
+	}
+
+	Stats_Inc(st_client_packets_out);
+	Stats_Add(st_client_bytes_out, net_message.cursize);
+	info = FWD_peer_info(p);
+	info->packets_out++;
+	info->bytes_out += net_message.cursize;
+
+	NET_SendPacket(net_socket, net_message.cursize, net_message.data, &p->from);
+
+// qqshka: commented out
+//	p->last = worker->time;
+}
+
+// read everything which came to the main proxy socket
+static void FWD_net_socket_read(void)
+{
+	while (NET_GetPacket(net_socket, &net_message))
+		FWD_net_socket_packet();
+}
+
+// read everything which came to the peer socket
+static void FWD_peer_socket_read(peer_t *p)
+{
+	while (NET_GetPacket(p->s, &net_message))
+		FWD_peer_socket_packet(p);
+
+	if (net_refused)
+		FWD_peer_refused(p);
+}
+
+// worker threads hold config lock for reading while they process packets,
+// main thread is the only one who changes config, so it does not need it.
+// it called right after we woke up, so it updates worker time as well
+static void FWD_worker_lock(void)
+{
+	if (worker->id)
+		Sys_RWLockRead(&config_lock);
+
+	worker->time = Sys_Milliseconds();
+	worker->wake_usec = Sys_Microseconds();
+	worker->wake_packets = stats_thread->counter[st_client_packets_in] + stats_thread->counter[st_server_packets_in];
+}
+
+// how long we may sleep waiting for packets, nearest peer timer wake us up
+static int FWD_wait_timeout(void)
+{
+	if (worker->id)
+		return Timer_NextTimeout(&worker->timers, Sys_Milliseconds(), FWD_WORKER_MAX_WAIT);
+
+	// main thread sends server pings too
+	return QRY_NextTimeout(Timer_NextTimeout(&worker->timers, Sys_Milliseconds(), FWD_MAIN_MAX_WAIT));
 }
 
-static void FWD_check_drop(void)
+static void FWD_worker_unlock(void)
 {
-	peer_t *p, *next;
+	if (worker->id)
+		Sys_RWUnlockRead(&config_lock);
+}
+
+#define FWD_BACKEND_EVENTS 256
+
+// simulated network, backend advances virtual time while we wait
+static void FWD_backend_network_update(void)
+{
+	unsigned int handles[FWD_BACKEND_EVENTS];
+	int count, i;
+	peer_t *p;
+
+	count = net_backend->wait(handles, FWD_BACKEND_EVENTS, FWD_wait_timeout());
 
-	for (p = peers; p; p = next)
+	FWD_worker_lock(); // FWD_update_peers() unlocks it
+
+	for (i = 0; i < count; i++)
 	{
-		next = p->next;
+		if (handles[i] == FWD_HANDLE_NET)
+			FWD_net_socket_read();
+		else if ((p = FWD_peer_by_handle(handles[i])))
+			FWD_peer_socket_read(p);
+	}
+}
 
-		if (p->ps != ps_drop)
-			continue;
+#ifdef NET_URING
 
-		Sys_DPrintf("peer %s:%d dropped\n", inet_ntoa(p->from.sin_addr), (int)ntohs(p->from.sin_port));
-		FWD_peer_free(p, true); // NOTE: 'p' is not valid after this function, so we remember 'next' before this function
+static THREAD_LOCAL qbool uring_stdin_ready;
+
+// io_uring got something for us
+static void FWD_uring_event(void *data)
+{
+	unsigned int handle = (unsigned int)(size_t)data;
+	peer_t *p;
+
+	if (handle == FWD_HANDLE_NET)
+		FWD_net_socket_packet();
+	else if (handle == FWD_HANDLE_STDIN)
+		uring_stdin_ready = true;
+	else if ((p = FWD_peer_by_handle(handle)))
+	{
+		if (net_refused)
+			FWD_peer_refused(p);
+		else
+			FWD_peer_socket_packet(p);
+	}
+}
+
+static void FWD_uring_network_update(void)
+{
+	fd_set stdinfds;
+
+	FD_ZERO(&stdinfds);
+	uring_stdin_ready = false;
+
+	// queued datagrams are submitted with the same syscall which waits for events
+	URING_Wait(FWD_wait_timeout());
+
+	FWD_worker_lock(); // FWD_update_peers() unlocks it
+	URING_Dispatch(FWD_uring_event);
+
+	if (uring_stdin_ready)
+		FD_SET(STDIN, &stdinfds);
+
+	// read console input.
+	// NOTE: we do not do that if we are in DLL mode...
+	Sys_ReadSTDIN(&ps, stdinfds);
+}
+
+#endif // NET_URING
+
+#ifdef FWD_EPOLL
+
+static void FWD_network_update(void)
+{
+	struct epoll_event events[FWD_MAX_EVENTS];
+	fd_set stdinfds;
+	int retval, i;
+
+	FD_ZERO(&stdinfds);
+
+	// send everything we queued since last time, before going to sleep
+	NET_FlushPackets();
+
+	/* Sleep for some time, wake up immidiately if there input packet. */
+retry:
+	retval = epoll_wait(epoll_fd, events, FWD_MAX_EVENTS, FWD_wait_timeout());
+	if (retval < 0)
+	{
+		if (errno == EINTR)
+		{
+			goto retry;
+		}
+		perror("epoll_wait");
+		retval = 0;
 	}
+
+	FWD_worker_lock(); // FWD_update_peers() unlocks it
+
+	// we got events only for the sockets with pending data, so there is no need to check every peer
+	for (i = 0; i < retval; i++)
+	{
+		unsigned int handle = events[i].data.u32;
+		peer_t *p;
+
+		if (handle == FWD_HANDLE_NET)
+			FWD_net_socket_read();
+		else if (handle == FWD_HANDLE_STDIN)
+			FD_SET(STDIN, &stdinfds);
+		else if ((p = FWD_peer_by_handle(handle)))
+			FWD_peer_socket_read(p);
+	}
+
+	// read console input.
+	// NOTE: we do not do that if we are in DLL mode...
+	Sys_ReadSTDIN(&ps, stdinfds);
 }
 
+#else // FWD_EPOLL
+
 static void FWD_network_update(void)
 {
 	fd_set rfds;
 	struct timeval tv;
 	int retval;
-	int i1;
+	int i, i1, timeout;
+	fwd_pool_t *pool = &worker->pool;
 	peer_t *p;
 
 	FD_ZERO(&rfds);
@@ -195,8 +1060,12 @@ static void FWD_network_update(void)
 	FD_SET(net_socket, &rfds);
 	i1 = net_socket + 1;
 
-	for (p = peers; p; p = p->next)
+	for (i = 0; i < pool->slots; i++)
 	{
+		p = FWD_pool_peer(pool, i);
+		if (p->ps == ps_free)
+			continue;
+
 		// select on peers sockets
 		FD_SET(p->s, &rfds);
 		if (p->s >= i1)
@@ -206,8 +1075,8 @@ static void FWD_network_update(void)
 // if not DLL - read stdin
 #ifndef APP_DLL
 	#ifndef _WIN32
-	// try read stdin only if connected to a terminal.
-	if (isatty(STDIN) && isatty(STDOUT))
+	// try read stdin only if connected to a terminal, console is job of the main thread
+	if (!worker->id && isatty(STDIN) && isatty(STDOUT))
 	{
 		FD_SET(STDIN, &rfds);
 		if (STDIN >= i1)
@@ -216,9 +1085,13 @@ static void FWD_network_update(void)
 	#endif // _WIN32
 #endif
 
+	// send everything we queued since last time, before going to sleep
+	NET_FlushPackets();
+
 	/* Sleep for some time, wake up immidiately if there input packet. */
-	tv.tv_sec = 0;
-	tv.tv_usec = 100000; // 100 ms
+	timeout = FWD_wait_timeout();
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
 
 retry:
 	retval = select(i1, &rfds, (fd_set *)0, (fd_set *)0, &tv);
@@ -229,9 +1102,12 @@ retry:
 			goto retry;
 		}
 		perror("select");
-		return;
+		FD_ZERO(&rfds);
+		retval = 0;
 	}
 
+	FWD_worker_lock(); // FWD_update_peers() unlocks it
+
 	// read console input.
 	// NOTE: we do not do that if we are in DLL mode...
 	Sys_ReadSTDIN(&ps, rfds);
@@ -241,185 +1117,198 @@ retry:
 
 	// if we have input packet on main server/proxy socket, then read it
 	if(FD_ISSET(net_socket, &rfds))
+		FWD_net_socket_read();
+
+	// now lets check peers sockets, perhaps we have input packets too
+	for (i = 0; i < pool->slots; i++)
 	{
-		qbool connectionless;
-		int cnt;
+		p = FWD_pool_peer(pool, i);
+		if (p->ps != ps_free && FD_ISSET(p->s, &rfds))
+			FWD_peer_socket_read(p);
+	}
+}
 
-		// read it
-		for(;;)
-		{
-			if (!NET_GetPacket(net_socket, &net_message))
-				break;
+#endif // FWD_EPOLL
 
-			// check for bans.
-			if (SV_IsBanned(&net_from))
-				continue;
+int FWD_peers_count(void)
+{
+	return peers_total;
+}
 
-			if (net_message.cursize == 1 && net_message.data[0] == A2A_ACK)
-			{
-				QRY_SV_PingReply();
+void FWD_ForEachPeer(fwd_peer_func_t func, void *arg)
+{
+	fwd_pool_t *pool;
+	peer_t *p;
+	int i, j;
 
-				continue;
-			}
+	for (i = 0; i < workers_count; i++)
+	{
+		pool = &workers[i].pool;
 
-			MSG_BeginReading();
-			connectionless = (MSG_ReadLong() == -1);
+		Sys_MutexLock(&workers[i].lock);
+		for (j = 0; j < pool->slots; j++)
+		{
+			p = FWD_pool_peer(pool, j);
+			if (p->ps != ps_free)
+				func(p, FWD_pool_info(pool, j), arg);
+		}
+		Sys_MutexUnlock(&workers[i].lock);
+	}
+}
 
-			if (connectionless)
-			{
-				if (MSG_BadRead())
-					continue;
+void FWD_LockConfig(void)
+{
+	Sys_RWLockWrite(&config_lock);
+}
 
-				if (!SV_ConnectionlessPacket())
-					continue; // seems we do not need forward it
-			}
+void FWD_UnlockConfig(void)
+{
+	Sys_RWUnlockWrite(&config_lock);
+}
 
-			// search in peers
-			for (p = peers; p; p = p->next)
-			{
-				// we have this peer already, so forward/send packet to remote server
-				if (NET_CompareAddress(&p->from, &net_from))
-					break;
-			}
+//======================================================
 
-			// peer was not found
-			if (!p)
-				continue;
+typedef struct fwd_cllist_s
+{
+	int				count;
+	unsigned int	current;
+} fwd_cllist_t;
 
-			// forward data to the server/proxy
-			if (p->ps >= ps_connected)
-			{
-				cnt = 1; // one packet by default
-
-				// check for "drop" aka client disconnect,
-				// first 10 bytes for NON connectionless packet is netchan related shit in QW
-				if (p->proto == pr_qw && !connectionless && net_message.cursize > 10 && net_message.data[10] == clc_stringcmd)
-				{
-					if (!strcmp((char*)net_message.data + 10 + 1, "drop"))
-					{
-//						Sys_Printf("peer drop detected\n");
-						p->ps = ps_drop; // drop peer ASAP
-						cnt = 3; // send few packets due to possibile packet lost
-					}
-				}
-
-				for ( ; cnt > 0; cnt--)
-					NET_SendPacket(p->s, net_message.cursize, net_message.data, &p->to);
-			}
+static void FWD_Cmd_ClList_Peer(peer_t *p, peer_info_t *info, void *arg)
+{
+	fwd_cllist_t *list = (fwd_cllist_t *) arg;
+	char ipport1[] = "xxx.xxx.xxx.xxx:xxxxx";
+	char ipport2[] = "xxx.xxx.xxx.xxx:xxxxx";
 
-			time(&p->last);
-		}
-	}
+	Sys_Printf("%6d %-*s %-*s %4d %7llu %7llu %s\n",
+		info->userid,
+		sizeof(ipport1)-1, NET_AdrToString(&p->from, ipport1, sizeof(ipport1)),
+		sizeof(ipport2)-1, NET_AdrToString(&p->to,   ipport2, sizeof(ipport2)),
+		(int)((list->current - p->connect) / 60000), info->bytes_in / 1024, info->bytes_out / 1024, info->name);
 
-	// now lets check peers sockets, perhaps we have input packets too
-	for (p = peers; p; p = p->next)
-	{
-		if(FD_ISSET(p->s, &rfds))
-		{
-			// yeah, we have packet, read it then
-			for (;;)
-			{
-				if (!NET_GetPacket(p->s, &net_message))
-					break;
+	list->count++;
+}
 
-				// check for bans.
-				if (SV_IsBanned(&net_from))
-					continue;
+static void FWD_Cmd_ClList_f(void)
+{
+	char ipport1[] = "xxx.xxx.xxx.xxx:xxxxx";
+	char ipport2[] = "xxx.xxx.xxx.xxx:xxxxx";
+	fwd_cllist_t list;
 
-				// we should check is this packet from remote server, this may be some evil packet from haxors...
-				if (!NET_CompareAddress(&p->to, &net_from))
-					continue;
+	list.count = 0;
+	list.current = Sys_Milliseconds();
 
-				MSG_BeginReading();
-				if (MSG_ReadLong() == -1)
-				{
-					if (MSG_BadRead())
-						continue;
+	Sys_Printf("=== client list ===\n");
+	Sys_Printf("##id## %-*s %-*s time   in kb  out kb name\n", sizeof(ipport1)-1, "address from", sizeof(ipport2)-1, "address to");
+	Sys_Printf("---------------------------------------------------------------------------------------\n");
 
-					if (!CL_ConnectionlessPacket(p))
-						continue; // seems we do not need forward it
+	FWD_ForEachPeer(FWD_Cmd_ClList_Peer, &list);
 
-					NET_SendPacket(net_socket, net_message.cursize, net_message.data, &p->from);
-					continue;
-				}
+	Sys_Printf("---------------------------------------------------------------------------------------\n");
+	if (workers_count > 1)
+		Sys_Printf("%d clients, %d workers\n", list.count, workers_count);
+	else
+		Sys_Printf("%d clients\n", list.count);
+}
 
-				if (p->ps >= ps_connected)
-					NET_SendPacket(net_socket, net_message.cursize, net_message.data, &p->from);
+//======================================================
 
-// qqshka: commented out
-//				time(&p->last);
+void FWD_update_peers(void)
+{
+	if (net_backend)
+		FWD_backend_network_update();
+#ifdef NET_URING
+	else if (uring_active)
+		FWD_uring_network_update();
+#endif
+	else
+		FWD_network_update();
+	Timer_Run(&worker->timers, worker->time, FWD_peer_timer);
 
-			} // for (;;)
-		} // if(FD_ISSET(p->s, &rfds))
+	// what we read since wake up is queued for sending by now
+	Stats_Latency(Sys_Microseconds() - worker->wake_usec,
+		(int)(stats_thread->counter[st_client_packets_in] + stats_thread->counter[st_server_packets_in] - worker->wake_packets));
 
-		if (p->ps == ps_challenge)
-		{
-			// send challenge time to time
-			if (time(NULL) - p->connect > 2)
-			{
-				p->connect = time(NULL);
-				Netchan_OutOfBandPrint(p->s, &p->to, "getchallenge%s", p->proto == pr_qw ? "\n" : "");
-			}
-		}
-	} // for (p = peers; p; p = p->next)
+	// recorded datagrams go to the writer while we still hold config lock, see capture.c
+	Capture_Frame();
+
+	FWD_worker_unlock();
 }
 
-int FWD_peers_count(void)
+//======================================================
+
+static void FWD_worker_thread(void *arg)
 {
-	int cnt;
-	peer_t *p;
+	worker = (fwd_worker_t *) arg;
 
-	for (cnt = 0, p = peers; p; p = p->next)
-	{
-		cnt++;
-	}
+	Stats_InitThread();
+	NET_InitThread(worker->socket);
+	FWD_poll_init();
 
-	return cnt;
-}
+	while (!workers_exit)
+		FWD_update_peers();
 
-//======================================================
+	NET_FlushPackets(); // send whatever left in the queue
 
-static void FWD_Cmd_ClList_f(void)
-{
-	peer_t *p;
-	char ipport1[] = "xxx.xxx.xxx.xxx:xxxxx";
-	char ipport2[] = "xxx.xxx.xxx.xxx:xxxxx";
-	int idx;
-	time_t current = time(NULL);
+	Sys_SemPost(&workers_done);
+}
 
-	Sys_Printf("=== client list ===\n");
-	Sys_Printf("##id## %-*s %-*s time name\n", sizeof(ipport1)-1, "address from", sizeof(ipport2)-1, "address to");
-	Sys_Printf("-----------------------------------------------------------------------\n");
+void FWD_StartWorkers(void)
+{
+	int i;
 
-	for (idx = 1, p = peers; p; p = p->next, idx++)
+	for (i = 1; i < workers_count; i++)
 	{
-		Sys_Printf("%6d %-*s %-*s %4d %s\n",
-			p->userid,
-			sizeof(ipport1)-1, NET_AdrToString(&p->from, ipport1, sizeof(ipport1)),
-			sizeof(ipport2)-1, NET_AdrToString(&p->to,   ipport2, sizeof(ipport2)),
-			(int)(current - p->connect)/60, p->name);
+		// nobody would read this worker socket, so we can't continue without it
+		if (!Sys_CreateThread(FWD_worker_thread, &workers[i]))
+			Sys_Error("FWD_StartWorkers: failed to start worker thread");
 	}
 
-	Sys_Printf("-----------------------------------------------------------------------\n");
-	Sys_Printf("%d clients\n", idx-1);
+	if (workers_count > 1)
+		Sys_Printf("%d forwarding workers started\n", workers_count);
 }
 
-//======================================================
-
-void FWD_update_peers(void)
+void FWD_Shutdown(void)
 {
-	FWD_network_update();
-	FWD_check_timeout();
-	FWD_check_drop();
-}
+	int i;
 
-//======================================================
+	// workers notice it within FWD_WORKER_MAX_WAIT ms, when their wait times out
+	workers_exit = true;
+
+	for (i = 1; i < workers_count; i++)
+		Sys_SemWait(&workers_done);
+}
 
 void FWD_Init(void)
 {
-	peers = NULL;
+	int sockets[FWD_MAX_WORKERS];
+	int i;
+
+	fwd_workers = Cvar_Get("fwd_workers", "1", CVAR_NOSET);
+
+	peers_total = 0;
 	userid = 0;
 
+	Sys_RWLockInit(&config_lock);
+	Sys_SemInit(&workers_done);
+
+	workers_count = NET_OpenWorkerSockets(sockets, (int)bound(1, fwd_workers->integer, FWD_MAX_WORKERS));
+
+	for (i = 0; i < workers_count; i++)
+	{
+		workers[i].id = i;
+		workers[i].socket = sockets[i];
+		memset(&workers[i].pool, 0, sizeof(workers[i].pool));
+		workers[i].pool.free = -1;
+		workers[i].time = Sys_Milliseconds();
+		Timer_Init(&workers[i].timers, workers[i].time);
+		Sys_MutexInit(&workers[i].lock);
+	}
+
+	// main thread is worker 0
+	worker = &workers[0];
+
+	FWD_poll_init();
+
 	Cmd_AddCommand("cllist", FWD_Cmd_ClList_f);
 }
-
@@ -4,10 +4,12 @@
 
 #include "qwfwd.h"
 
-#define QW_SERVER_RATE (0.1) // seconds, accept fraction, how frequently sent ONE packet to some server, so 0.1 means one packet per 1/10 of second
 #define QW_SERVER_PING_QUERY "\xff\xff\xff\xffk\n"
-#define QW_SERVER_MIN_PING_REQUEST_TIME 60 // seconds, minimal time interval allowed to sent ping, so we do not spam server too fast
-#define QW_SERVER_DEAD_TIME (60 * 60) // seconds, if we do not get reply from server in this time, guess server is DEAD
+#define QW_SERVER_PING_TIMEOUT 1000 // milliseconds, no reply in this time and ping is lost
+#define QW_SERVER_PING_RETRIES 2 // how many times we resend lost ping before we call probe failed
+#define QW_SERVER_MAX_BACKOFF (60 * 30) // seconds, max interval between probes of unresponsive server
+#define QW_SERVER_DEAD_FAILS 5 // failed probes in a row and we guess server is DEAD
+#define QW_SERVER_PING_BURST 0.01 // seconds, how much of ping rate may be sent at once
 
 
 #define QW_MASTER_QUERY "c\n"
@@ -21,20 +23,35 @@
 
 #define MAX_MASTERS 8 // size for masters fixed size array, I am lazy
 
-#define MAX_SERVERS 512 // we will not add more than that servers to our list, just for some sanity
+#define QW_SNAPSHOT_DEFAULT_NAME "qwfwd_servers.dat"
+#define QW_SNAPSHOT_MAGIC "QWSV"
+#define QW_SNAPSHOT_VERSION 1
+#define QW_SNAPSHOT_TIME (60 * 5) // seconds, how frequently we save server list
+#define QW_SNAPSHOT_MAX_AGE (60 * 60 * 24) // seconds, older snapshot is ignored, pings in it are not worth anything
+#define QW_SNAPSHOT_HEADER 16 // magic, version, time, servers count
+#define QW_SNAPSHOT_RECORD 24 // ip, port, ping, rtt min, avg and jitter, seconds since last reply
+
+#define QW_SERVERS_HASH_MIN_SIZE 256 // must be power of two
 
 #define MAX_SV_FILTERS 16 // how much servers we can filter with masters_filter_servers, can be increased widely.
+#define QW_SV_FILTER_HASH_SIZE (MAX_SV_FILTERS * 4) // must be power of two
 #define QW_DEFAULT_SV_FILTER "127.0.0.1" // some masters provide unusable servers, filter them.
 
 static cvar_t *masters_query;
 static cvar_t *masters_heartbeat;
 static cvar_t *masters_list;
 static cvar_t *masters_filter_servers;
+static cvar_t *masters_max_servers;
+static cvar_t *masters_ping_rate;
+static cvar_t *masters_ping_inflight;
+static cvar_t *masters_ping_interval;
+static cvar_t *masters_snapshot;
 
 // master state enum
 typedef enum
 {
 	ms_unknown,		// unknown state
+	ms_resolving,	// this slot waits for resolver
 	ms_used			// this slot used in masters_t struct
 } master_state_t;
 
@@ -43,7 +60,10 @@ typedef struct master
 {
 	master_state_t			state;		// master state
 	time_t					next_query;	// next time when query master server
+	int						seq;		// bumped with each query, servers listed in reply are stamped with it
+	qbool					replied;	// we got reply to the query number seq
 	struct sockaddr_in		addr;		// master addr
+	char					host[256];	// master host name, we need it while master in ms_resolving state
 } master_t;
 
 // all masters in one struct
@@ -62,29 +82,79 @@ typedef struct server
 {
 	struct sockaddr_in		addr;			// addr
 
-	qbool					reply;			// true if we get reply after ping packet was sent,
-											// reset to false each time we sent packet
-	double					ping_sent_at;	// last time when we send ping request, so we can calculate ping time
-	double					ping_reply_at;	// last time when we receive ping reply from server,
-											// so we can guess is server dead etc
-	int						ping;			// ping to that server in milliseconds
-
-	struct server			*next;			// next server in linked list
+	double					ping_sent_at;	// when we sent last ping packet, so we can calculate ping time,
+											// zero if we do not wait for reply
+	double					ping_reply_at;	// last time when we receive ping reply from server
+	int						retries;		// ping packets resent in the current probe
+	int						fails;			// probes without reply in a row, server is probed less often with each fail
+
+	// round trip times, in milliseconds
+	double					rtt_min;
+	double					rtt_avg;		// smoothed, this is what we report as ping
+	double					rtt_jitter;		// smoothed deviation from rtt_avg
+	int						ping;			// rtt_avg rounded, 0xFFFF if server never replied
+
+	unsigned int			masters;		// bit for each masters.master[] slot which listed server in its last reply
+	int						master_seq[MAX_MASTERS]; // master seq when master listed server last time
+
+	int						index;			// position in servers.list
+	wheel_timer_t			timer;			// when we should probe server or when probe times out
+	struct server			*ready_next;	// in the queue of servers waiting for ping slot
+	struct server			*ready_prev;
+	qbool					ready;
 } server_t;
 
 // single server_filter struct.
 // used by masters_filter_servers.
+// filters match ip only, so it is a hash set of ips.
 typedef struct server_filter
 {
-	struct sockaddr_in		addr[MAX_SV_FILTERS];			// addr[]
+	unsigned int			ip[QW_SV_FILTER_HASH_SIZE];	// open addressing hash set in network byte order, 0 marks empty slot
+	qbool					zero;						// 0.0.0.0 is filtered, it can't be in the set
 	int						count;
 } server_filter_t;
 
-static int sv_count;
-static server_t *servers;
+// all servers.
+// dense array is what we iterate, order does not matter, pings are driven by the per server timers below.
+// hash is open addressing with linear probing, keyed by server address (ip and port), keeps pointers to servers.
+typedef struct servers
+{
+	server_t				**list;
+	int						count;
+	int						size;			// allocated size of the list
+
+	server_t				**hash;
+	unsigned int			hash_size;		// always power of two
+
+	// ping scheduler.
+	// each server has a timer for the next probe, when it fires server goes to the ready queue,
+	// pings are sent from the queue as long as rate budget and limit of pings in flight allow it.
+	timer_wheel_t			timers;
+	server_t				*ready_head;
+	server_t				*ready_tail;
+	int						inflight;		// servers waiting for ping reply
+	double					tokens;			// rate budget, in packets
+	double					tokens_at;		// when budget was updated
+} servers_t;
+
+static servers_t servers;
+
+// pingstatus reply is kept ready to send, server at servers.list[i] is patched in place at slot i,
+// servers which do not fit in one packet are not reported
+#define QW_PINGSTATUS_HEADER	5 // -1 and A2C_PRINT
+#define QW_PINGSTATUS_SLOT		8 // ip, port and ping
+#define QW_PINGSTATUS_MAX		((MSG_BUF_SIZE - QW_PINGSTATUS_HEADER) / QW_PINGSTATUS_SLOT)
+
+static byte pingstatus[MSG_BUF_SIZE];
+static unsigned int pingstatus_sent, pingstatus_patches;
 static server_filter_t server_filter;
 static masters_t masters;
 
+// master replies and server pings come to any forwarding worker, so everything above is protected with this mutex
+static sys_mutex_t qry_mutex;
+
+static time_t snapshot_next; // when we save server list next time, main thread only
+
 static master_t	*QRY_Master_ByAddr(struct sockaddr_in *addr)
 {
 	int						i;
@@ -108,6 +178,7 @@ static qbool QRY_AddMaster(const char *master)
 	master_t				*m;
 	struct sockaddr_in		addr;
 	char					host[1024], *column;
+	dns_status_t			dns;
 
 	// decide host:port, port is optional and DEFAULT_MASTER_SERVER_PORT is used if ommited
 	port = 0;
@@ -125,13 +196,18 @@ static qbool QRY_AddMaster(const char *master)
 		return false; // empty host name, not funny
 	}
 
-	if (!NET_GetSockAddrIn_ByHostAndPort(&addr, host, port))
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u_short)port);
+
+	// NOTE: resolver does not block, if host name is not resolved yet then master waits in ms_resolving state
+	if ((dns = DNS_Resolve(host, &addr.sin_addr)) == dns_failed)
 	{
 		Sys_Printf("failed to add master server: %s\n", master);
 		return false;
 	}
 
-	if (QRY_Master_ByAddr(&addr))
+	if (dns == dns_ok && QRY_Master_ByAddr(&addr))
 	{
 		Sys_Printf("failed to add master server: %s - already added!\n", master);
 		return false;
@@ -139,15 +215,17 @@ static qbool QRY_AddMaster(const char *master)
 
 	for (i = 0, m = masters.master; i < MAX_MASTERS; i++, m++)
 	{
-		if (m->state == ms_used)
+		if (m->state != ms_unknown)
 			continue; // master slot used
 
 		memset(m, 0, sizeof(*m)); // reset data in slot
 
-		m->state = ms_used;
+		m->state = (dns == dns_ok) ? ms_used : ms_resolving;
 		m->addr = addr;
+		strlcpy(m->host, host, sizeof(m->host));
 
-		Sys_Printf("master server added: %s\n", master);
+		if (m->state == ms_used)
+			Sys_Printf("master server added: %s\n", master);
 		return true;
 	}
 
@@ -155,18 +233,69 @@ static qbool QRY_AddMaster(const char *master)
 	return false;
 }
 
+// check masters which wait for resolver
+static void QRY_ResolveMasters(void)
+{
+	int						i;
+	master_t				*m;
+	struct sockaddr_in		addr;
+	char					buf[] = "xxx.xxx.xxx.xxx:xxxxx";
+
+	for (i = 0, m = masters.master; i < MAX_MASTERS; i++, m++)
+	{
+		if (m->state != ms_resolving)
+			continue;
+
+		addr = m->addr;
+
+		switch (DNS_Resolve(m->host, &addr.sin_addr))
+		{
+			case dns_pending:
+				continue; // not yet
+
+			case dns_ok:
+				if (QRY_Master_ByAddr(&addr))
+				{
+					Sys_Printf("failed to add master server: %s - already added!\n", m->host);
+					break;
+				}
+
+				m->addr = addr;
+				m->state = ms_used;
+				Sys_Printf("master server added: %s (%s)\n", m->host, NET_AdrToString(&m->addr, buf, sizeof(buf)));
+				continue;
+
+			default:
+				Sys_Printf("failed to add master server: %s\n", m->host);
+				break;
+		}
+
+		memset(m, 0, sizeof(*m)); // free slot
+	}
+}
+
+static void QRY_TriggerHeartbeat(void)
+{
+	masters.last_heartbeat = Sys_Time() - QW_MASTER_HEARTBEAT_SECONDS - 1; // trigger heartbeat ASAP
+}
+
 static void QRY_Cmd_Heartbeat_f(void)
 {
-	masters.last_heartbeat = time(NULL) - QW_MASTER_HEARTBEAT_SECONDS - 1; // trigger heartbeat ASAP
+	Sys_MutexLock(&qry_mutex);
+	QRY_TriggerHeartbeat();
+	Sys_MutexUnlock(&qry_mutex);
 }
 
+static void QRY_SV_ForgetMasters(void); // forward reference
+
 // clear masters
 static void QRY_MastersInit(void)
 {
 	memset(&masters, 0, sizeof(masters));
-	masters.init_time = time(NULL);
+	QRY_SV_ForgetMasters(); // master slots will be reused for other masters
+	masters.init_time = Sys_Time();
 
-	QRY_Cmd_Heartbeat_f();  // trigger heartbeat ASAP
+	QRY_TriggerHeartbeat();  // trigger heartbeat ASAP
 }
 
 // check if "masters" or "masters_query" cvar changed and do appropriate action
@@ -175,7 +304,7 @@ static void QRY_CheckMastersModified(void)
 	char *mlist;
 
 	// for fix issues with DNS and such force masters re-init time to time
-	if (time(NULL) - masters.init_time > QW_MASTERS_FORCE_RE_INIT)
+	if (Sys_Time() - masters.init_time > QW_MASTERS_FORCE_RE_INIT)
 	{
 		Sys_DPrintf("forcing masters re-init\n");
 		masters_list->modified = true;
@@ -197,12 +326,14 @@ static void QRY_CheckMastersModified(void)
 	masters_list->modified = masters_query->modified = false;
 }
 
+static void QRY_SV_AgeOut(int master); // forward reference
+
 // query master servers
 static void QRY_QueryMasters(void)
 {
 	int			i;
 	master_t	*m;
-	time_t		current_time = time(NULL);
+	time_t		current_time = Sys_Time();
 	char		buf[] = "xxx.xxx.xxx.xxx:xxxxx";
 
 	// do we need query masters?
@@ -218,7 +349,13 @@ static void QRY_QueryMasters(void)
 			continue; // not yet
 
 		Sys_DPrintf("query master: %s\n", NET_AdrToString(&m->addr, buf, sizeof(buf)));
-		
+
+		// master answered previous query, forget servers it did not list in that reply
+		if (m->replied)
+			QRY_SV_AgeOut(i);
+		m->seq++;
+		m->replied = false;
+
 		NET_SendPacket(net_socket, sizeof(QW_MASTER_QUERY), QW_MASTER_QUERY, &m->addr);
 		m->next_query = current_time + QW_MASTER_QUERY_TIME_SHORT; // delay next query for some time
 	}
@@ -231,7 +368,7 @@ static void QRY_HeartbeatMasters(void)
 	char		string[128];
 	int			i, len;
 	master_t	*m;
-	time_t		current_time = time(NULL);
+	time_t		current_time = Sys_Time();
 	char		buf[] = "xxx.xxx.xxx.xxx:xxxxx";
 
 	// do we need heartbeat masters?
@@ -267,14 +404,19 @@ qbool QRY_IsMasterReply(void)
 	return true;
 }
 
-static server_t	*QRY_SV_new(const char *remote_host, int remote_port, qbool link); // forward reference
+static server_t	*QRY_SV_ByAddr(struct sockaddr_in *addr); // forward reference
+static server_t	*QRY_SV_new(struct sockaddr_in *addr); // forward reference
+static void QRY_SV_Reserve(int count); // forward reference
 
-void SVC_QRY_ParseMasterReply(void)
+static void QRY_ParseMasterReply(void)
 {
-    int				i, c;
-	master_t		*m;
-	int				ret = net_message.cursize;
-	unsigned char	*answer = net_message.data; // not the smartest way, but why copy from one place to another...
+	int					i, c, added;
+	master_t			*m;
+	server_t			*sv;
+	struct sockaddr_in	addr;
+	int					ret = net_message.cursize;
+	unsigned char		*answer = net_message.data; // not the smartest way, but why copy from one place to another...
+	char				buf[] = "xxx.xxx.xxx.xxx:xxxxx";
 
 	// no point to parse it, we do not query masters
 	if (!masters_query->integer)
@@ -286,207 +428,477 @@ void SVC_QRY_ParseMasterReply(void)
 	Sys_DPrintf ("master server reply from %s:%d\n", inet_ntoa(net_from.sin_addr), (int)ntohs(net_from.sin_port));
 
 	// is it reply from registered master server or someone trying to do some evil things?
-	for (i = 0, m = masters.master; i < MAX_MASTERS; i++, m++)
-	{
-		if (m->state != ms_used)
-			continue; // master slot not used
-
-		if (NET_CompareAddress(&net_from, &m->addr))
-		{
-			// OK - it is reply from registered master server
-			m->next_query = time(NULL) + QW_MASTER_QUERY_TIME; // delay next query for some time
-			break;
-		}
-	}
-
-	if (i >= MAX_MASTERS)
+	if (!(m = QRY_Master_ByAddr(&net_from)))
 	{
 		Sys_Printf("Reply from not registered master server\n");
 		return;
 	}
 
+	// OK - it is reply from registered master server
+	m->next_query = Sys_Time() + QW_MASTER_QUERY_TIME; // delay next query for some time
+	m->replied = true; // reply may come in several packets, so we can't age out servers until the next query
+
 	Sys_DPrintf("master server returned %d bytes\n", ret);
 
-	for (c = 0, i = 6; i + 5 < ret; i += 6, c++)
-	{
-		char ip[64];
-		int port = 256 * (int)answer[i+4] + (int)answer[i+5];
+	// entries are 4 bytes of ip and 2 bytes of port, both in network byte order, which is how sockaddr_in keeps them
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	QRY_SV_Reserve((ret - 6) / 6); // grow list and hash once for the whole reply
 
-		snprintf(ip, sizeof(ip), "%u.%u.%u.%u",
-			(int)answer[i+0], (int)answer[i+1],
-			(int)answer[i+2], (int)answer[i+3]);
+	for (added = c = 0, i = 6; i + 5 < ret; i += 6, c++)
+	{
+		memcpy(&addr.sin_addr, answer + i, 4);
+		memcpy(&addr.sin_port, answer + i + 4, 2);
 
 		if (developer->integer > 1)
-			Sys_DPrintf("SERVER: %4d %s:%d\n", c, ip, port);
+			Sys_DPrintf("SERVER: %4d %s\n", c, NET_AdrToString(&addr, buf, sizeof(buf)));
+
+		if (!addr.sin_port)
+			continue; // garbage
+
+		if (!(sv = QRY_SV_ByAddr(&addr)))
+		{
+			if (!(sv = QRY_SV_new(&addr)))
+				continue; // filtered or we have too much servers
+			added++;
+		}
 
-		QRY_SV_new(ip, port, true);
+		sv->masters |= 1u << (m - masters.master);
+		sv->master_seq[m - masters.master] = m->seq;
 	}
+
+	Sys_DPrintf("master server listed %d servers, %d new\n", c, added);
+}
+
+void SVC_QRY_ParseMasterReply(void)
+{
+	Sys_MutexLock(&qry_mutex);
+	QRY_ParseMasterReply();
+	Sys_MutexUnlock(&qry_mutex);
 }
 
 //========================================
 
-static struct sockaddr_in *QRY_FL_Filtered(struct sockaddr_in *addr); // forward reference
+static qbool QRY_FL_Filtered(struct sockaddr_in *addr); // forward reference
 
 static int QRY_SV_Count(void)
 {
-	return sv_count;
+	return servers.count;
 }
 
-// return server by pseudo index
-static server_t	*QRY_SV_ByIndex(int idx)
+static void QRY_SV_HashInsert(server_t *sv); // forward reference
+
+static void QRY_SV_HashResize(unsigned int size)
 {
-	server_t	*sv;
+	server_t		**old = servers.hash;
+	unsigned int	old_size = servers.hash_size, i;
+
+	servers.hash = Sys_malloc(size * sizeof(*servers.hash));
+	servers.hash_size = size;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old[i])
+			QRY_SV_HashInsert(old[i]);
+	}
+
+	Sys_free(old);
+}
+
+// NOTE: servers.count does not include this server yet
+static void QRY_SV_HashInsert(server_t *sv)
+{
+	unsigned int i, mask;
+
+	// keep load factor below 1/2, so probe sequences stay short
+	if (!servers.hash || (unsigned int)(servers.count + 1) * 2 > servers.hash_size)
+		QRY_SV_HashResize(servers.hash ? servers.hash_size * 2 : QW_SERVERS_HASH_MIN_SIZE);
+
+	mask = servers.hash_size - 1;
+
+	for (i = Hash_Addr(&sv->addr) & mask; servers.hash[i]; i = (i + 1) & mask)
+		;
+
+	servers.hash[i] = sv;
+}
+
+static void QRY_SV_HashRemove(server_t *sv)
+{
+	unsigned int i, j, k, mask;
+
+	if (!servers.hash)
+		return;
+
+	mask = servers.hash_size - 1;
+
+	for (i = Hash_Addr(&sv->addr) & mask; servers.hash[i] != sv; i = (i + 1) & mask)
+	{
+		if (!servers.hash[i])
+			return; // not in the table
+	}
 
-	if (idx < 0)
+	// backward shift deletion, so we do not need tombstones
+	for (j = (i + 1) & mask; servers.hash[j]; j = (j + 1) & mask)
+	{
+		k = Hash_Addr(&servers.hash[j]->addr) & mask; // ideal slot for entry at j
+
+		if (Hash_CanShift(i, j, k))
+		{
+			servers.hash[i] = servers.hash[j];
+			i = j;
+		}
+	}
+
+	servers.hash[i] = NULL;
+}
+
+static server_t	*QRY_SV_ByAddr(struct sockaddr_in *addr)
+{
+	unsigned int i, mask;
+
+	if (!servers.count)
 		return NULL;
 
-	for (sv = servers; sv; sv = sv->next, idx--)
-		if (!idx)
-			return sv;
+	mask = servers.hash_size - 1;
+
+	for (i = Hash_Addr(addr) & mask; servers.hash[i]; i = (i + 1) & mask)
+	{
+		if (NET_CompareAddress(addr, &servers.hash[i]->addr))
+			return servers.hash[i];
+	}
 
 	return NULL;
 }
 
-static server_t	*QRY_SV_ByAddrEx(struct sockaddr_in *addr, qbool base)
+// write server to its slot of the pingstatus reply
+static void QRY_PS_Write(server_t *sv)
 {
-	// use different compare function.
-	typedef		qbool (*net_cmp_func)(struct sockaddr_in *a, struct sockaddr_in *b);
-	net_cmp_func cmp_func = base ? NET_CompareBaseAddress : NET_CompareAddress;
+	sizebuf_t buf;
 
-	server_t	*sv;
+	if (sv->index >= QW_PINGSTATUS_MAX)
+		return; // not reported
 
-	for (sv = servers; sv; sv = sv->next)
-		if ((*cmp_func)(addr, &sv->addr))
-			return sv;
+	SZ_InitEx(&buf, pingstatus + QW_PINGSTATUS_HEADER + sv->index * QW_PINGSTATUS_SLOT, QW_PINGSTATUS_SLOT, false);
+	MSG_WriteLong(&buf, *(int *)&sv->addr.sin_addr);
+	MSG_WriteShort(&buf, (short)ntohs(sv->addr.sin_port));
+	MSG_WriteShort(&buf, (short)sv->ping);
 
-	return NULL;
+	pingstatus_patches++;
 }
 
-static server_t	*QRY_SV_ByAddr(struct sockaddr_in *addr)
+static void QRY_PS_Init(void)
+{
+	sizebuf_t buf;
+
+	SZ_InitEx(&buf, pingstatus, QW_PINGSTATUS_HEADER, false);
+	MSG_WriteLong(&buf, -1);	// -1 sequence means out of band
+	MSG_WriteChar(&buf, A2C_PRINT);
+}
+
+// put server at the end of the ready queue
+static void QRY_SV_Ready(server_t *sv)
 {
-	return QRY_SV_ByAddrEx(addr, false);
+	if (sv->ready)
+		return;
+
+	sv->ready = true;
+	sv->ready_next = NULL;
+	sv->ready_prev = servers.ready_tail;
+
+	if (servers.ready_tail)
+		servers.ready_tail->ready_next = sv;
+	else
+		servers.ready_head = sv;
+
+	servers.ready_tail = sv;
 }
 
-static server_t	*QRY_SV_new(const char *remote_host, int remote_port, qbool link)
+static void QRY_SV_Unready(server_t *sv)
 {
-	server_t			*sv;
-	struct sockaddr_in	addr;
+	if (!sv->ready)
+		return;
 
-	if (QRY_SV_Count() >= MAX_SERVERS)
-		return NULL;
+	if (sv->ready_prev)
+		sv->ready_prev->ready_next = sv->ready_next;
+	else
+		servers.ready_head = sv->ready_next;
+
+	if (sv->ready_next)
+		sv->ready_next->ready_prev = sv->ready_prev;
+	else
+		servers.ready_tail = sv->ready_prev;
 
-	if (!NET_GetSockAddrIn_ByHostAndPort(&addr, remote_host, remote_port))
-		return NULL; // failed to resolve host name?
+	sv->ready = false;
+	sv->ready_next = sv->ready_prev = NULL;
+}
 
-	if ((sv = QRY_SV_ByAddr(&addr)))
-		return NULL; // we already have such server on list
+// forget everything scheduler knows about server
+static void QRY_SV_Unschedule(server_t *sv)
+{
+	Timer_Remove(&servers.timers, &sv->timer);
+	QRY_SV_Unready(sv);
 
-	if (QRY_FL_Filtered(&addr))
+	if (sv->ping_sent_at)
+	{
+		sv->ping_sent_at = 0;
+		servers.inflight--;
+	}
+}
+
+// probe server again after interval, which grows twice with each failed probe
+static void QRY_SV_ScheduleProbe(server_t *sv)
+{
+	double delay = (masters_ping_interval->value > 0 ? masters_ping_interval->value : 1) * (1 << (sv->fails < 16 ? sv->fails : 16));
+
+	if (sv->fails && delay > QW_SERVER_MAX_BACKOFF)
+		delay = QW_SERVER_MAX_BACKOFF;
+
+	Timer_Add(&servers.timers, &sv->timer, Sys_Milliseconds() + (unsigned int)(1000 * delay));
+}
+
+// make sure list and hash have room for count more servers
+static void QRY_SV_Reserve(int count)
+{
+	int				need = servers.count + count;
+	unsigned int	hash_size;
+
+	if (masters_max_servers->integer > 0 && need > masters_max_servers->integer)
+		need = masters_max_servers->integer;
+
+	if (need > servers.size)
+	{
+		server_t **old = servers.list;
+
+		servers.size = servers.size ? servers.size : QW_SERVERS_HASH_MIN_SIZE;
+		while (servers.size < need)
+			servers.size *= 2;
+		servers.list = Sys_malloc(servers.size * sizeof(*servers.list));
+		if (old)
+			memcpy(servers.list, old, servers.count * sizeof(*servers.list));
+		Sys_free(old);
+	}
+
+	// same load factor as QRY_SV_HashInsert() keeps
+	hash_size = servers.hash ? servers.hash_size : QW_SERVERS_HASH_MIN_SIZE;
+	while ((unsigned int)need * 2 > hash_size)
+		hash_size *= 2;
+	if (hash_size != servers.hash_size)
+		QRY_SV_HashResize(hash_size);
+}
+
+// NOTE: caller checks server is not on the list already
+static server_t	*QRY_SV_new(struct sockaddr_in *addr)
+{
+	server_t			*sv;
+
+	if (masters_max_servers->integer > 0 && QRY_SV_Count() >= masters_max_servers->integer)
+		return NULL;
+
+	if (QRY_FL_Filtered(addr))
 	{
 		char buf[] = "xxx.xxx.xxx.xxx:xxxxx";
-		Sys_DPrintf("filtered: %s\n", NET_AdrToString(&addr, buf, sizeof(buf)));
+		Sys_DPrintf("filtered: %s\n", NET_AdrToString(addr, buf, sizeof(buf)));
 		return NULL; // filtered
 	}
 
-	sv_count++;
-
 	sv = Sys_malloc(sizeof(*sv));
-	sv->addr = addr;
+	sv->addr = *addr;
 	sv->ping = 0xFFFF; // mark as unreachable
 
-	if (link)
-	{
-		sv->next = servers;
-		servers = sv;
-	}
+	QRY_SV_Reserve(1);
+	QRY_SV_HashInsert(sv);
+	sv->index = servers.count++;
+	servers.list[sv->index] = sv;
+	QRY_PS_Write(sv);
+
+	QRY_SV_Ready(sv); // probe it asap
 
 	return sv;
 }
 
-// free server data, perform unlink if requested
-static void QRY_SV_free(server_t *sv, qbool unlink)
+// move server to the given position in the list
+static void QRY_SV_Move(server_t *sv, int index)
+{
+	servers.list[index] = sv;
+	sv->index = index;
+	QRY_PS_Write(sv);
+}
+
+// unlink and free server data
+static void QRY_SV_free(server_t *sv)
 {
+	int last;
+
 	if (!sv)
 		return;
 
-	if (unlink)
+	QRY_SV_HashRemove(sv);
+	QRY_SV_Unschedule(sv);
+
+	// fill the hole with the last server
+	last = --servers.count;
+
+	if (sv->index != last)
+		QRY_SV_Move(servers.list[last], sv->index);
+
+	servers.list[last] = NULL;
+
+	// free all data related to server
+	Sys_free(sv);
+}
+
+// master did not list servers in reply to its last query, forget them, unless other masters still list them
+static void QRY_SV_AgeOut(int master)
+{
+	int			i;
+	server_t	*sv;
+	char		buf[] = "xxx.xxx.xxx.xxx:xxxxx";
+
+	for (i = servers.count - 1; i >= 0; i--)
 	{
-		server_t *next, *prev, *current;
+		sv = servers.list[i];
 
-		prev = NULL;
-		current = servers;
+		if ((sv->masters & (1u << master)) && sv->master_seq[master] != masters.master[master].seq)
+			sv->masters &= ~(1u << master);
 
-		for ( ; current; )
-		{
-			next = current->next;
+		if (sv->masters)
+			continue;
 
-			if (sv == current)
-			{
-				if (prev)
-					prev->next = next;
-				else
-					servers = next;
+		Sys_DPrintf("not listed -> %s\n", NET_AdrToString(&sv->addr, buf, sizeof(buf)));
+		QRY_SV_free(sv);
+	}
+}
 
-				break;
-			}
+// masters were re-initialized, servers are kept but they are not listed by anyone until masters reply again
+static void QRY_SV_ForgetMasters(void)
+{
+	int i;
 
-			prev = current;
-			current = next;
-		}
+	for (i = 0; i < servers.count; i++)
+		servers.list[i]->masters = 0;
+}
+
+// server timer fired, it is either time to probe it or probe timed out
+static void QRY_SV_Timer(wheel_timer_t *t)
+{
+	server_t *sv = (server_t *)((byte *)t - offsetof(server_t, timer));
+	char buf[] = "xxx.xxx.xxx.xxx:xxxxx";
+
+	if (!sv->ping_sent_at)
+	{
+		QRY_SV_Ready(sv);
+		return;
 	}
 
-	// free all data related to server
-	Sys_free(sv);
+	// ping lost
+	sv->ping_sent_at = 0;
+	servers.inflight--;
+
+	if (sv->retries < QW_SERVER_PING_RETRIES)
+	{
+		sv->retries++;
+		QRY_SV_Ready(sv);
+		return;
+	}
 
-	sv_count--;
+	sv->retries = 0;
+	sv->fails++;
+
+	if (sv->fails >= QW_SERVER_DEAD_FAILS)
+	{
+		Sys_DPrintf("dead -> %s\n", NET_AdrToString(&sv->addr, buf, sizeof(buf)));
+		QRY_SV_free(sv); // remove damn server, however master server may add it back...
+		return;
+	}
+
+	QRY_SV_ScheduleProbe(sv);
 }
 
-static void QRY_SV_PingServers(void)
+static double QRY_SV_PingRate(void)
 {
-	static int		idx;
-	static double	last;
+	return masters_ping_rate->value > 0 ? masters_ping_rate->value : 1;
+}
 
+static void QRY_SV_PingServers(void)
+{
 	double			current = Sys_DoubleTime(); // we need double time for ping measurement
+	double			rate = QRY_SV_PingRate(), burst;
 	server_t		*sv;
 
 	// do not ping servers since we do not query masters
 	if (!masters_query->integer)
 		return;
 
-	if (!servers)
-		return; // nothing to do
+	Timer_Run(&servers.timers, Sys_Milliseconds(), QRY_SV_Timer);
 
-	if (current - last < QW_SERVER_RATE)
-		return; // do not ping servers too fast
+	// refill rate budget, allow small bursts only, so pings are spread evenly
+	burst = rate * QW_SERVER_PING_BURST;
+	burst = burst > 1 ? burst : 1;
+	servers.tokens += (current - servers.tokens_at) * rate;
+	servers.tokens = servers.tokens < burst ? servers.tokens : burst;
+	servers.tokens_at = current;
 
-	last = current;
+	while ((sv = servers.ready_head) && servers.tokens >= 1 && servers.inflight < masters_ping_inflight->integer)
+	{
+		QRY_SV_Unready(sv);
 
-	idx = (int)max(0, idx);
-	sv = QRY_SV_ByIndex(idx++);
-	if (!sv)
-		sv = QRY_SV_ByIndex(idx = 0); // can't find server by index, try with index 0
+		servers.tokens -= 1;
+		servers.inflight++;
+		sv->ping_sent_at = current; // remember when we sent ping
+		Timer_Add(&servers.timers, &sv->timer, Sys_Milliseconds() + QW_SERVER_PING_TIMEOUT);
 
-	if (!sv)
-		return; // hm, should not be the case...
+		NET_SendPacket(net_socket, sizeof(QW_SERVER_PING_QUERY)-1, QW_SERVER_PING_QUERY, &sv->addr);
+//		Sys_Printf("ping(%3d) -> %s:%d\n", sv->index, inet_ntoa(sv->addr.sin_addr), (int)ntohs(sv->addr.sin_port));
+	}
+}
 
-	// check for dead server
-	if (!sv->reply && sv->ping_sent_at - sv->ping_reply_at > QW_SERVER_DEAD_TIME)
-	{
-		Sys_DPrintf("dead -> %s:%d\n", inet_ntoa(sv->addr.sin_addr), (int)ntohs(sv->addr.sin_port));
+int QRY_NextTimeout(int max)
+{
+	int timeout, wait;
 
-		QRY_SV_free(sv, true); // remove damn server, however master server may add it back...
-		idx--; // step back index
-		return;
+	if (!masters_query->integer)
+		return max;
+
+	Sys_MutexLock(&qry_mutex);
+
+	timeout = Timer_NextTimeout(&servers.timers, Sys_Milliseconds(), max);
+
+	// wake up when next ping may be sent
+	if (servers.ready_head && servers.inflight < masters_ping_inflight->integer)
+	{
+		wait = (int)(1000 * (1 - servers.tokens) / QRY_SV_PingRate());
+		wait = wait > 0 ? wait : 0;
+		timeout = wait < timeout ? wait : timeout;
 	}
 
-	if (sv->ping_sent_at && current - sv->ping_sent_at < QW_SERVER_MIN_PING_REQUEST_TIME)
-		return; // do not spam server
+	Sys_MutexUnlock(&qry_mutex);
 
-	sv->ping_sent_at = current; // remember when we sent ping
-	sv->reply = false; // reset reply flag
+	return timeout;
+}
+
+static void QRY_SV_UpdateRTT(server_t *sv, double rtt)
+{
+	int ping = sv->ping;
+
+	// same smoothing as TCP does (RFC 6298)
+	if (sv->ping == 0xFFFF)
+	{
+		sv->rtt_min = sv->rtt_avg = rtt;
+		sv->rtt_jitter = rtt / 2;
+	}
+	else
+	{
+		sv->rtt_min = rtt < sv->rtt_min ? rtt : sv->rtt_min;
+		sv->rtt_jitter += ((rtt > sv->rtt_avg ? rtt - sv->rtt_avg : sv->rtt_avg - rtt) - sv->rtt_jitter) / 4;
+		sv->rtt_avg += (rtt - sv->rtt_avg) / 8;
+	}
+
+	sv->ping = (int)(sv->rtt_avg + 0.5);
+	sv->ping = sv->ping < 0xFFFF ? sv->ping : 0xFFFE;
 
-	NET_SendPacket(net_socket, sizeof(QW_SERVER_PING_QUERY)-1, QW_SERVER_PING_QUERY, &sv->addr);
-//	Sys_Printf("ping(%3d) -> %s:%d\n", idx, inet_ntoa(sv->addr.sin_addr), (int)ntohs(sv->addr.sin_port));
+	if (sv->ping != ping)
+		QRY_PS_Write(sv);
 }
 
 void QRY_SV_PingReply(void)
@@ -500,16 +912,27 @@ void QRY_SV_PingReply(void)
 		return;
 	}
 
+	Sys_MutexLock(&qry_mutex);
+
 	sv = QRY_SV_ByAddr(&net_from);
 
 	if (sv)
 	{
 		double current = Sys_DoubleTime();
-		double ping = current - sv->ping_sent_at;
 
-		sv->ping = (int)max(0, 1000.0 * ping);
 		sv->ping_reply_at = current;
-		sv->reply = true;
+		sv->fails = 0;
+
+		// late reply to lost ping still tells us server is alive, but we can't measure anything with it
+		if (sv->ping_sent_at)
+		{
+			QRY_SV_UpdateRTT(sv, 1000.0 * (current - sv->ping_sent_at));
+
+			sv->ping_sent_at = 0;
+			sv->retries = 0;
+			servers.inflight--;
+			QRY_SV_ScheduleProbe(sv);
+		}
 
 //		Sys_Printf("ping <- %s:%d, %d\n", inet_ntoa(net_from.sin_addr), (int)ntohs(net_from.sin_port), sv->ping);
 	}
@@ -517,39 +940,31 @@ void QRY_SV_PingReply(void)
 	{
 //		Sys_Printf("ping <- %s:%d, not registered server\n", inet_ntoa(net_from.sin_addr), (int)ntohs(net_from.sin_port));
 	}
+
+	Sys_MutexUnlock(&qry_mutex);
 }
 
 void SVC_QRY_PingStatus(void)
 {
-	static sizebuf_t buf; // static  - so it not allocated each time
-	static byte		buf_data[MSG_BUF_SIZE]; // static  - so it not allocated each time
-
-	server_t		*sv;
+	int size = QW_PINGSTATUS_HEADER;
 
-	SZ_InitEx(&buf, buf_data, sizeof(buf_data), true);
-
-	MSG_WriteLong(&buf, -1);	// -1 sequence means out of band
-	MSG_WriteChar(&buf, A2C_PRINT);
+	Sys_MutexLock(&qry_mutex);
 
 	// if we does not query masters then we can't proved reliable info, so do not send servers list
 	if (masters_query->integer)
-	{
-		for (sv = servers; sv; sv = sv->next)
-		{
-			MSG_WriteLong(&buf, *(int *)&sv->addr.sin_addr);
-			MSG_WriteShort(&buf, (short)ntohs(sv->addr.sin_port));
-			MSG_WriteShort(&buf, (short)sv->ping);
-		}
-	}
+		size += (servers.count < QW_PINGSTATUS_MAX ? servers.count : QW_PINGSTATUS_MAX) * QW_PINGSTATUS_SLOT;
 
-	if (buf.overflowed)
-	{
-		Sys_Printf("SVC_QRY_PingStatus: overflow\n");
-		return; // overflowed
-	}
+	NET_SendPacket(net_from_socket, size, pingstatus, &net_from); // send the datagram
+	pingstatus_sent++;
 
-	// send the datagram
-	NET_SendPacket(net_from_socket, buf.cursize, buf.data, &net_from);
+	Sys_MutexUnlock(&qry_mutex);
+}
+
+void QRY_PrintCacheStats(void)
+{
+	Sys_MutexLock(&qry_mutex);
+	Sys_Printf("pingstatus: %u sent, %u patches\n", pingstatus_sent, pingstatus_patches);
+	Sys_MutexUnlock(&qry_mutex);
 }
 
 //==============================================
@@ -561,23 +976,27 @@ static void QRY_FL_Init(void)
 	memset(&server_filter, 0, sizeof(server_filter));
 }
 
-static struct sockaddr_in *QRY_FL_Filtered(struct sockaddr_in *addr)
+static qbool QRY_FL_Filtered(struct sockaddr_in *addr)
 {
-	int						i;
+	unsigned int i, ip = addr->sin_addr.s_addr;
+
+	if (!ip)
+		return server_filter.zero;
 
-	for (i = 0; i < server_filter.count; i++)
+	for (i = Hash_Int(ip) & (QW_SV_FILTER_HASH_SIZE - 1); server_filter.ip[i]; i = (i + 1) & (QW_SV_FILTER_HASH_SIZE - 1))
 	{
-		if (NET_CompareBaseAddress(addr, &server_filter.addr[i]))
-			return &server_filter.addr[i];
+		if (server_filter.ip[i] == ip)
+			return true;
 	}
 
-	return NULL;
+	return false;
 }
 
 static qbool QRY_FL_AddFilter(const char *filter)
 {
 	struct sockaddr_in		addr;
 	char					host[1024], *column;
+	unsigned int			i;
 
 	if (server_filter.count >= MAX_SV_FILTERS)
 	{
@@ -610,7 +1029,17 @@ static qbool QRY_FL_AddFilter(const char *filter)
 		return false;
 	}
 
-	server_filter.addr[server_filter.count] = addr;
+	if (!addr.sin_addr.s_addr)
+	{
+		server_filter.zero = true;
+	}
+	else
+	{
+		// set is 4 times bigger than max filters count, so there is always free slot
+		for (i = Hash_Int(addr.sin_addr.s_addr) & (QW_SV_FILTER_HASH_SIZE - 1); server_filter.ip[i]; i = (i + 1) & (QW_SV_FILTER_HASH_SIZE - 1))
+			;
+		server_filter.ip[i] = addr.sin_addr.s_addr;
+	}
 	server_filter.count++;
 
 	Sys_Printf("server filter added: %s\n", filter);
@@ -622,13 +1051,16 @@ static void QRY_FL_RemoveFilteredServers(void)
 	int			i;
 	server_t	*sv;
 
-	for (i = 0; i < server_filter.count; i++)
+	// filters match ip only, so several servers may match the same filter, check them all
+	for (i = servers.count - 1; i >= 0; i--)
 	{
-		if ((sv = QRY_SV_ByAddrEx(&server_filter.addr[i], true)))
+		sv = servers.list[i];
+
+		if (QRY_FL_Filtered(&sv->addr))
 		{
 			char buf[] = "xxx.xxx.xxx.xxx:xxxxx";
 			Sys_DPrintf("filtered: %s\n", NET_AdrToString(&sv->addr, buf, sizeof(buf)));
-			QRY_SV_free(sv, true);
+			QRY_SV_free(sv);
 		}
 	}
 }
@@ -657,6 +1089,180 @@ static void QRY_FL_CheckVarsModified(void)
 	masters_filter_servers->modified = false;
 }
 
+//==============================================
+// server list snapshot, so pingstatus is useful right after restart.
+// _SN_ stands for snapshot.
+// file is written aside and renamed over the old one, so it is either old or new, never half written.
+// numbers are little endian, ip and port are in network byte order as they are in sockaddr_in.
+
+static int QRY_SN_ReadLong(const byte *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+static float QRY_SN_ReadFloat(const byte *p)
+{
+	union { float f; int l; } dat;
+
+	dat.l = QRY_SN_ReadLong(p);
+	return dat.f;
+}
+
+static void QRY_SN_Load(void)
+{
+	byte				*data, *p;
+	int					size, count, i, age;
+	time_t				saved;
+	double				current = Sys_DoubleTime();
+	server_t			*sv;
+	struct sockaddr_in	addr;
+
+	if (!masters_snapshot->string[0] || !masters_query->integer)
+		return;
+
+	if (!(data = (byte *)FS_ReadFile(NULL, masters_snapshot->string, NULL, &size)))
+		return; // no snapshot yet
+
+	if (size < QW_SNAPSHOT_HEADER || memcmp(data, QW_SNAPSHOT_MAGIC, 4) || QRY_SN_ReadLong(data + 4) != QW_SNAPSHOT_VERSION)
+	{
+		Sys_Printf("server list snapshot %s: wrong format, ignored\n", masters_snapshot->string);
+		Sys_free(data);
+		return;
+	}
+
+	saved = (time_t)(unsigned int)QRY_SN_ReadLong(data + 8);
+	count = QRY_SN_ReadLong(data + 12);
+
+	// divide, count comes from the file and multiplication may overflow
+	if (count < 0 || count > (size - QW_SNAPSHOT_HEADER) / QW_SNAPSHOT_RECORD)
+	{
+		Sys_Printf("server list snapshot %s: truncated, ignored\n", masters_snapshot->string);
+		Sys_free(data);
+		return;
+	}
+
+	if (Sys_Time() - saved > QW_SNAPSHOT_MAX_AGE)
+	{
+		Sys_Printf("server list snapshot %s: too old, ignored\n", masters_snapshot->string);
+		Sys_free(data);
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	// QRY_SV_new() would refuse the rest anyway, do not reserve room for them
+	if (masters_max_servers->integer > 0 && count > masters_max_servers->integer)
+		count = masters_max_servers->integer;
+
+	QRY_SV_Reserve(count);
+
+	for (i = 0, p = data + QW_SNAPSHOT_HEADER; i < count; i++, p += QW_SNAPSHOT_RECORD)
+	{
+		memcpy(&addr.sin_addr, p, 4);
+		memcpy(&addr.sin_port, p + 4, 2);
+
+		if (!addr.sin_port || QRY_SV_ByAddr(&addr) || !(sv = QRY_SV_new(&addr)))
+			continue;
+
+		// servers are probed again asap, until then we report what we measured before restart
+		sv->ping = (p[6] | (p[7] << 8));
+		sv->rtt_min = QRY_SN_ReadFloat(p + 8);
+		sv->rtt_avg = QRY_SN_ReadFloat(p + 12);
+		sv->rtt_jitter = QRY_SN_ReadFloat(p + 16);
+		if ((age = QRY_SN_ReadLong(p + 20)) >= 0)
+			sv->ping_reply_at = current - age - (Sys_Time() - saved);
+		QRY_PS_Write(sv);
+	}
+
+	Sys_Printf("server list snapshot %s: %d servers loaded\n", masters_snapshot->string, servers.count);
+	Sys_free(data);
+}
+
+static void QRY_SN_Save(void)
+{
+	sizebuf_t	buf;
+	byte		*data;
+	int			i, size;
+	double		current = Sys_DoubleTime();
+	server_t	*sv;
+	FILE		*f;
+	char		name[1024];
+
+	// build it with lock held, but write file without it, so workers are not blocked by disk
+	Sys_MutexLock(&qry_mutex);
+
+	size = QW_SNAPSHOT_HEADER + servers.count * QW_SNAPSHOT_RECORD;
+	data = Sys_malloc(size);
+	SZ_InitEx(&buf, data, size, false);
+
+	SZ_Write(&buf, QW_SNAPSHOT_MAGIC, 4);
+	MSG_WriteLong(&buf, QW_SNAPSHOT_VERSION);
+	MSG_WriteLong(&buf, (int)Sys_Time());
+	MSG_WriteLong(&buf, servers.count);
+
+	for (i = 0; i < servers.count; i++)
+	{
+		sv = servers.list[i];
+
+		SZ_Write(&buf, &sv->addr.sin_addr, 4);
+		SZ_Write(&buf, &sv->addr.sin_port, 2);
+		MSG_WriteShort(&buf, sv->ping);
+		MSG_WriteFloat(&buf, (float)sv->rtt_min);
+		MSG_WriteFloat(&buf, (float)sv->rtt_avg);
+		MSG_WriteFloat(&buf, (float)sv->rtt_jitter);
+		MSG_WriteLong(&buf, sv->ping_reply_at ? (int)(current - sv->ping_reply_at) : -1);
+	}
+
+	Sys_MutexUnlock(&qry_mutex);
+
+	snprintf(name, sizeof(name), "%s.tmp", masters_snapshot->string);
+
+	if (!FS_SafePath(name) || !(f = fopen(name, "wb")))
+	{
+		Sys_Printf("Couldn't open %s\n", name);
+		Sys_free(data);
+		return;
+	}
+
+	if (fwrite(data, buf.cursize, 1, f) != 1 || fflush(f))
+	{
+		Sys_Printf("Couldn't write %s\n", name);
+		fclose(f);
+		remove(name);
+		Sys_free(data);
+		return;
+	}
+
+	fclose(f);
+	Sys_free(data);
+
+#ifdef _WIN32
+	if (!MoveFileEx(name, masters_snapshot->string, MOVEFILE_REPLACE_EXISTING))
+#else
+	if (rename(name, masters_snapshot->string))
+#endif
+	{
+		Sys_Printf("Couldn't rename %s to %s\n", name, masters_snapshot->string);
+		remove(name);
+	}
+}
+
+// save server list time to time, main thread only
+static void QRY_SN_Frame(void)
+{
+	time_t current = Sys_Time();
+
+	if (!masters_snapshot->string[0] || !masters_query->integer)
+		return;
+
+	if (current < snapshot_next)
+		return; // not yet
+
+	snapshot_next = current + QW_SNAPSHOT_TIME;
+	QRY_SN_Save();
+}
+
 //==============================================
 
 static void QRY_Cmd_SvList_f(void)
@@ -665,29 +1271,42 @@ static void QRY_Cmd_SvList_f(void)
 	int idx;
 	char ipport[] = "xxx.xxx.xxx.xxx:xxxxx";
 
+	Sys_MutexLock(&qry_mutex);
+
 	Sys_Printf("=== server list ===\n");
-	Sys_Printf("### %-*s ping\n", sizeof(ipport)-1, "address");
-	Sys_Printf("--------------------------------------\n");
+	Sys_Printf("### %-*s ping  min jitter masters\n", sizeof(ipport)-1, "address");
+	Sys_Printf("--------------------------------------------------\n");
 
-	for (idx = 1, sv = servers; sv; sv = sv->next, idx++)
+	for (idx = 1; idx <= servers.count; idx++)
 	{
-		Sys_Printf("%3d %-*s %d\n",
-			idx, sizeof(ipport)-1, NET_AdrToString(&sv->addr, ipport, sizeof(ipport)), (int)sv->ping);
+		sv = servers.list[idx - 1];
+		Sys_Printf("%3d %-*s %4d %4d %6d %7x\n",
+			idx, sizeof(ipport)-1, NET_AdrToString(&sv->addr, ipport, sizeof(ipport)), (int)sv->ping,
+			(int)(sv->rtt_min + 0.5), (int)(sv->rtt_jitter + 0.5), sv->masters);
 	}
 
-	Sys_Printf("--------------------------------------\n");
+	Sys_Printf("--------------------------------------------------\n");
 	Sys_Printf("%d servers\n", idx-1);
+
+	Sys_MutexUnlock(&qry_mutex);
 }
 
 //==============================================
 
 void QRY_Frame(void)
 {
+	Sys_MutexLock(&qry_mutex);
+
 	QRY_FL_CheckVarsModified();		// check if "masters_filter_servers" variable changed
 	QRY_CheckMastersModified();		// check is "masters" variable changed
+	QRY_ResolveMasters();			// check masters which wait for resolver
 	QRY_QueryMasters();				// request time to time server list from masters
 	QRY_HeartbeatMasters();			// send heartbeat to masters time to time
 	QRY_SV_PingServers();			// ping time to time normal qw servers
+
+	Sys_MutexUnlock(&qry_mutex);
+
+	QRY_SN_Frame();					// save server list time to time
 }
 
 //==============================================
@@ -698,12 +1317,34 @@ void QRY_Init(void)
 	masters_heartbeat	= Cvar_Get("masters_heartbeat",	"1", 0);
 	masters_list		= Cvar_Get("masters",			QW_DEFAULT_MASTER_SERVERS, 0);
 	masters_filter_servers = Cvar_Get("masters_filter_servers",	QW_DEFAULT_SV_FILTER, 0);
+	masters_max_servers	= Cvar_Get("masters_max_servers",	"0", 0); // 0 means no limit
+	masters_ping_rate	= Cvar_Get("masters_ping_rate",		"50", 0); // ping packets per second
+	masters_ping_inflight = Cvar_Get("masters_ping_inflight",	"32", 0); // pings waiting for reply at once
+	masters_ping_interval = Cvar_Get("masters_ping_interval",	"60", 0); // seconds between pings of the same server
+	masters_snapshot	= Cvar_Get("masters_snapshot",	QW_SNAPSHOT_DEFAULT_NAME, 0); // empty means do not save server list
+
+	Sys_MutexInit(&qry_mutex);
 
 	Cmd_AddCommand("svlist", QRY_Cmd_SvList_f);
 	Cmd_AddCommand("heartbeat", QRY_Cmd_Heartbeat_f);
 
+	Timer_Init(&servers.timers, Sys_Milliseconds());
+	QRY_PS_Init();
+	servers.tokens_at = Sys_DoubleTime();
+
 	// clear filters
 	QRY_FL_Init();
 	// clear masters
 	QRY_MastersInit();
+
+	// load server list we had before restart
+	QRY_SN_Load();
+	snapshot_next = Sys_Time() + QW_SNAPSHOT_TIME;
+}
+
+void QRY_Shutdown(void)
+{
+	// save server list, so it is here after restart
+	if (masters_snapshot->string[0] && masters_query->integer)
+		QRY_SN_Save();
 }
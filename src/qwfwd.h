@@ -14,6 +14,8 @@
 #include <time.h>
 #include <memory.h>
 #include <string.h>
+#include <stddef.h>
+#include <ctype.h>
 
 #ifdef __GNUC__
 #define LittleLong(x) ({ typeof(x) _x = (x); _x = (((unsigned char *)&_x)[0]|(((unsigned char *)&_x)[1]<<8)|(((unsigned char *)&_x)[2]<<16)|(((unsigned char *)&_x)[3]<<24)); _x; })
@@ -26,6 +28,7 @@
 #ifdef _WIN32
 
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <conio.h>
 
 	#if defined(_DEBUG) && defined(_MSC_VER)
@@ -107,6 +110,37 @@ typedef unsigned char byte;
 	#define STDOUT 1
 #endif
 
+// per thread variable, forwarding workers keep their own copy of packet related globals
+#ifdef _MSC_VER
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+// NOTE: there is no SO_REUSEPORT on windows, so there are no forwarding workers and simple add is enough there
+#ifdef __GNUC__
+	#define Sys_AtomicAdd(ptr, value) __atomic_add_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+	#define Sys_AtomicLoad(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+	#define Sys_AtomicStore(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+	#define Sys_AtomicExchange(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_SEQ_CST)
+	// if *ptr equals *expected set it to value and return true, otherwise copy *ptr to *expected and return false
+	#define Sys_AtomicCAS(ptr, expected, value) __atomic_compare_exchange_n((ptr), (expected), (value), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#else
+	#define Sys_AtomicAdd(ptr, value) (*(ptr) += (value))
+	#define Sys_AtomicLoad(ptr) (*(ptr))
+	#define Sys_AtomicStore(ptr, value) (*(ptr) = (value))
+	#define Sys_AtomicExchange(ptr, value) InterlockedExchange((volatile LONG *)(ptr), (value))
+	#define Sys_AtomicCAS(ptr, expected, value) (*(ptr) == *(expected) ? (*(ptr) = (value), true) : (*(expected) = *(ptr), false))
+#endif
+
+#define CACHE_LINE_SIZE 64
+
+#ifdef _MSC_VER
+	#define CACHE_ALIGNED __declspec(align(CACHE_LINE_SIZE))
+#else
+	#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
 #ifndef __cplusplus
 typedef enum {false, true} qbool;
 #else
@@ -135,32 +169,57 @@ typedef enum
 
 typedef enum
 {
+	ps_free,		// slot in the peers pool is not used
 	ps_drop,		// we should drop this peer soon
+	ps_resolving,	// waiting while resolver done with remote host name
 	ps_challenge,	// peer getting a challenge
 	ps_connected	// peer fully connected
 } peer_state_t;
 
-
-typedef struct peer
+// timer of the timer wheel, see timer.c
+typedef struct wheel_timer_s
+{
+	struct wheel_timer_s	*next;		// NULL if timer is not pending
+	struct wheel_timer_s	*prev;
+	unsigned int			expires;	// Sys_Milliseconds() when timer fires
+} wheel_timer_t;
+
+// hot part of the peer, this is what we touch for every packet and while checking timeouts.
+// peers live in the per worker pool, see peer.c, so do not put big things here.
+typedef struct CACHE_ALIGNED peer
 {
-	time_t last;					// socket timeout helper
-	double q3_disconnect_check;		// helper for q3 to guess disconnect
-	time_t connect;					// connect helper
-	int challenge;					// challenge num
-	char userinfo[MAX_INFO_STRING]; // userinfo
-	char name[MAX_INFO_KEY];		// name, extracted from userinfo
-	int top;
-	int bottom;
-	int userid;						// unique per proxy userid
-	int qport;						// qport
 	struct sockaddr_in from;		// client addr
 	struct sockaddr_in to;			// remote addr
 	int s;							// socket, used for connection to remote host
+	qbool connected;				// socket is connected to "to", kernel drops datagrams from anyone else
 	peer_state_t ps;				// peer state
 	protocol_t	proto;				// which protocol we use
-	struct peer *next;				// next peer in linked list
+	int qport;						// qport
+	int challenge;					// challenge num
+	unsigned int handle;			// slot in the pool and generation of the slot
+	int next;						// next free slot, while slot is in the free list
+	unsigned int last;				// socket timeout helper, Sys_Milliseconds()
+	unsigned int connect;			// connect helper, Sys_Milliseconds()
+	unsigned int q3_disconnect_check;	// helper for q3 to guess disconnect, Sys_Milliseconds()
+	wheel_timer_t timer;			// when we should look at this peer next time, see FWD_peer_timer()
 } peer_t;
 
+// cold part of the peer, stored separately by the same slot, use FWD_peer_info() to get it
+typedef struct peer_info
+{
+	char userinfo[MAX_INFO_STRING]; // userinfo
+	char name[MAX_INFO_KEY];		// name, extracted from userinfo
+	char host[MAX_INFO_KEY * 4];	// remote host name, we need it while peer in ps_resolving state
+	int top;
+	int bottom;
+	int userid;						// unique per proxy userid
+	// traffic of this peer, only owner worker changes them
+	unsigned long long packets_in;	// from client
+	unsigned long long bytes_in;
+	unsigned long long packets_out;	// to client
+	unsigned long long bytes_out;
+} peer_info_t;
+
 // used for passing params for thread
 typedef struct fwd_params
 {
@@ -231,7 +290,7 @@ extern cvar_t *hostport, *countrycode, *city, *coords;
 //
 
 #define MAX_COM_TOKEN	1024
-extern char		com_token[MAX_COM_TOKEN];
+extern THREAD_LOCAL char	com_token[MAX_COM_TOKEN];
 
 char			*COM_Parse (char *data);							// Parse a token out of a string
 char			*COM_ParseToken (char *data, char *out, int outsize, const char *punctuation); // FTE token function
@@ -260,15 +319,170 @@ qbool			FS_SafePath(const char *in);
 // peer.c
 //
 
-extern	peer_t		*peers;
+typedef void	(*fwd_peer_func_t)(peer_t *p, peer_info_t *info, void *arg);
 
+// NOTE: peers are per worker, lookup and creation work with peers of the current thread
 peer_t		*FWD_peer_by_addr(struct sockaddr_in *from);
+peer_info_t	*FWD_peer_info(const peer_t *p);
+// address for NET_SendPacket() to the remote server, NULL if peer socket is connected to it
+struct sockaddr_in	*FWD_peer_to(peer_t *p);
+// peer is freed a bit later, so caller may still use it
+void		FWD_peer_drop(peer_t *p);
 peer_t		*FWD_peer_new(const char *remote_host, int remote_port, struct sockaddr_in *from, const char *userinfo, int qport, protocol_t proto, qbool link);
 void		FWD_update_peers(void);
+// walk peers of all workers, peer list of the worker is locked while we walk it
+void		FWD_ForEachPeer(fwd_peer_func_t func, void *arg);
 
+// peers of all workers
 int			FWD_peers_count(void);
 
+// workers read bans, whitelist and cvars, main thread must lock it before changing anything
+void		FWD_LockConfig(void);
+void		FWD_UnlockConfig(void);
+
 void		FWD_Init(void);
+// start worker threads, rest of the systems must be initialized by now
+void		FWD_StartWorkers(void);
+void		FWD_Shutdown(void);
+
+//
+// dns.c
+//
+
+typedef enum
+{
+	dns_pending,	// lookup in progress, ask again later
+	dns_ok,			// address resolved
+	dns_failed		// host name can't be resolved
+} dns_status_t;
+
+void			DNS_Init(void);
+// does not block, returns dns_pending while lookup in progress, so caller should ask again later
+dns_status_t	DNS_Resolve(const char *host, struct in_addr *addr);
+// parse dotted decimal address, return false if it is not an address
+qbool			DNS_ParseAddress(const char *host, struct in_addr *addr);
+
+//
+// log.c
+//
+
+typedef enum
+{
+	ll_error,
+	ll_info,
+	ll_debug		// printed only with "developer" set
+} log_level_t;
+
+void			Log_Init(void);
+void			Log_Shutdown(void);
+// apply changes of log cvars, main thread only
+void			Log_Frame(void);
+// check it before formatting the message, so nothing is formatted for nothing
+qbool			Log_Enabled(log_level_t level);
+// queue message, logger thread writes it out
+void			Log_Write(log_level_t level, const char *text);
+// write out everything queued so far
+void			Log_Flush(void);
+
+//
+// stats.c
+//
+
+typedef enum
+{
+	st_client_packets_in,	// datagrams from clients to the proxy socket
+	st_client_bytes_in,
+	st_client_packets_out,	// datagrams from the proxy socket to clients
+	st_client_bytes_out,
+	st_server_packets_in,	// datagrams from servers to peer sockets
+	st_server_bytes_in,
+	st_server_packets_out,	// datagrams from peer sockets to servers
+	st_server_bytes_out,
+	st_drop_banned,			// datagrams from banned addresses
+	st_drop_unknown,		// datagrams from clients we have no peer for
+	st_drop_spoofed,		// datagrams to peer socket not from its server
+	st_challenges,
+	st_challenge_failures,
+	st_connects,
+	st_connects_rejected,
+	st_peer_timeouts,
+	st_peer_drops,
+	st_peer_refused,
+	st_net_recv_calls,		// syscalls of the socket layer, so we can see how good batching works
+	st_net_send_calls,
+	st_net_recv_packets,	// datagrams passed with these syscalls
+	st_net_send_packets,
+	st_uring_enters,		// io_uring_enter() calls
+	st_uring_recv,			// datagrams received through io_uring
+	st_uring_sent,			// datagrams sent through io_uring
+	st_uring_fallback,		// datagrams sent with sendto() since there was no free io_uring send slot
+	st_max
+} stat_t;
+
+#define STATS_LATENCY_BUCKETS	12
+
+// counters of one thread, see stats.c
+typedef struct CACHE_ALIGNED stats_thread_s
+{
+	unsigned long long	counter[st_max];
+	unsigned long long	latency[STATS_LATENCY_BUCKETS];	// datagrams by time spent inside the proxy
+	unsigned long long	latency_sum;					// microseconds
+} stats_thread_t;
+
+extern THREAD_LOCAL stats_thread_t	*stats_thread;
+
+// only owner thread changes its counters, so no atomics
+#define Stats_Add(stat, value)	(stats_thread->counter[(stat)] += (value))
+#define Stats_Inc(stat)			Stats_Add((stat), 1)
+
+void			Stats_Init(void);
+// give calling thread own counters, forwarding workers call it when they start
+void			Stats_InitThread(void);
+// datagrams were handled in usec microseconds since we woke up
+void			Stats_Latency(unsigned int usec, int packets);
+// counter summed over all threads
+unsigned long long	Stats_Value(stat_t stat);
+
+//
+// capture.c
+//
+
+#define CAPTURE_MAGIC		"QWFWDCAP"
+#define CAPTURE_VERSION		1
+
+typedef enum
+{
+	cd_client,		// datagram came from client to the proxy socket
+	cd_server		// datagram came from server to the peer socket
+} capture_dir_t;
+
+typedef struct capture_header_s
+{
+	char			magic[8];		// CAPTURE_MAGIC, not zero terminated
+	unsigned int	version;
+	unsigned int	time;			// Sys_Time() when capture started
+} capture_header_t;
+
+// record header, datagram follows it
+typedef struct capture_record_s
+{
+	unsigned long long	usec;		// since capture started
+	unsigned int	userid;			// peer, as in cllist
+	unsigned short	size;			// of the datagram
+	byte			dir;			// capture_dir_t
+	byte			proto;			// protocol_t of the peer
+} capture_record_t;
+
+// set while capture is on, so forwarding threads check it before calling anything
+extern qbool		capture_active;
+
+void			Capture_Init(void);
+// close capture file, if any, and wait until it is written out
+void			Capture_Shutdown(void);
+// record datagram of the peer, if we capture this peer
+void			Capture_Packet(peer_t *p, capture_dir_t dir, const byte *data, int size);
+// hand recorded datagrams to the writer, forwarding threads call it at the end of each frame
+void			Capture_Frame(void);
 
 //
 // msg.c
@@ -373,6 +587,55 @@ double			bound( double a, double b, double c );
 void			Sys_ReadSTDIN(proxy_static_t *cluster, fd_set socketset);
 
 double			Sys_DoubleTime (void);
+// monotonic milliseconds, wraps around every 49 days, so compare it only by difference
+unsigned int	Sys_Milliseconds (void);
+// monotonic microseconds, wraps around every 71 minutes, so compare it only by difference
+unsigned int	Sys_Microseconds (void);
+// use it instead of time(NULL), so simulation may drive it as well
+time_t			Sys_Time (void);
+// time functions above return virtual time from now on, it does not move unless it is set again
+void			Sys_SetVirtualClock (unsigned long long usec);
+// fill buffer with random bytes, from OS if possible
+void			Sys_RandomBytes (void *buf, int size);
+
+// threads, used by subsystems which must not block the main loop
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION	sys_mutex_t;
+typedef HANDLE				sys_sem_t;
+#else
+typedef pthread_mutex_t		sys_mutex_t;
+typedef struct sys_sem_s
+{
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	int						count;
+} sys_sem_t;
+#endif
+
+#ifdef _WIN32
+typedef SRWLOCK				sys_rwlock_t;
+#else
+typedef pthread_rwlock_t	sys_rwlock_t;
+#endif
+
+typedef void	(*sys_thread_func_t)(void *arg);
+
+// start detached thread, return false on failure
+qbool			Sys_CreateThread(sys_thread_func_t func, void *arg);
+void			Sys_MutexInit(sys_mutex_t *mutex);
+void			Sys_MutexLock(sys_mutex_t *mutex);
+void			Sys_MutexUnlock(sys_mutex_t *mutex);
+// counting semaphore
+void			Sys_SemInit(sys_sem_t *sem);
+void			Sys_SemPost(sys_sem_t *sem);
+void			Sys_SemWait(sys_sem_t *sem);
+// readers/writer lock, writers have priority
+void			Sys_RWLockInit(sys_rwlock_t *lock);
+void			Sys_RWLockRead(sys_rwlock_t *lock);
+void			Sys_RWUnlockRead(sys_rwlock_t *lock);
+void			Sys_RWLockWrite(sys_rwlock_t *lock);
+void			Sys_RWUnlockWrite(sys_rwlock_t *lock);
 
 //
 // net.c
@@ -380,14 +643,62 @@ double			Sys_DoubleTime (void);
 
 extern	cvar_t			*net_ip, *net_port;
 
-extern	int			net_socket;
-extern	struct sockaddr_in	net_from;
-extern	int			net_from_socket;
-extern	sizebuf_t		net_message;
+// NOTE: each forwarding worker has own proxy socket and reads own packets
+extern	THREAD_LOCAL int		net_socket;
+extern	THREAD_LOCAL struct sockaddr_in	net_from;
+extern	THREAD_LOCAL int		net_from_socket;
+extern	THREAD_LOCAL sizebuf_t	net_message;
+// last NET_GetPacket() failed since remote side refused what we sent to it (ICMP port unreachable),
+// only connected sockets get it, on windows unconnected ones do as well
+extern	THREAD_LOCAL qbool		net_refused;
+
+// replacement of kernel sockets, so simulation may run proxy over in-memory network.
+// sockets are small positive numbers of the backend, watched socket are reported by wait() with the handle it was watched with
+typedef struct net_backend_s
+{
+	int		(*open)(const char *ip, int port, qbool do_bind);
+	void	(*close)(int s);
+	// returns datagram size, 0 if there nothing to read, -1 if remote side refused what we sent
+	int		(*recv)(int s, byte *data, int size, struct sockaddr_in *from);
+	// to is NULL for connected socket
+	void	(*send)(int s, int length, const void *data, struct sockaddr_in *to);
+	qbool	(*connect)(int s, struct sockaddr_in *to);
+	qbool	(*watch)(int s, unsigned int handle);
+	void	(*unwatch)(int s);
+	// wait up to msec for readable sockets, returns how much handles it put in the array
+	int		(*wait)(unsigned int *handles, int max, int msec);
+} net_backend_t;
+
+// set it before FWD_proc(), NULL means kernel sockets
+extern	net_backend_t			*net_backend;
 
 int				NET_GetPacket(int s, sizebuf_t *msg);
+// NOTE: datagram may be queued, it will be sent for real with NET_FlushPackets(), to is NULL for connected socket
 void				NET_SendPacket(int s, int length, const void *data, struct sockaddr_in *to);
+// send all queued datagrams, main loop calls it before going to sleep
+void				NET_FlushPackets(void);
 int				NET_UDP_OpenSocket(const char *ip, int port, qbool do_bind);
+void				NET_CloseSocket(int s);
+// datagrams of the socket go only to the address and come only from it, returns false if it stays unconnected
+qbool				NET_ConnectSocket(int s, struct sockaddr_in *to);
+// reopen proxy socket as count sockets bound to the same port, returns how much we got, net_socket is sockets[0]
+int				NET_OpenWorkerSockets(int *sockets, int count);
+
+// rule of the ban filter, rules are checked in order and the first matching one decides.
+// rules with the same mask and action must be next to each other, sorted by compare
+typedef struct net_ban_rule_s
+{
+	unsigned int	mask;		// host byte order
+	unsigned int	compare;	// host byte order
+	qbool			ban;		// drop datagram if rule matches, pass it to us otherwise
+} net_ban_rule_t;
+
+// kernel drops runts and datagrams of banned addresses on proxy sockets before we read them, linux only.
+// if there too much rules, kernel checks as much first ones as it can and the rest is up to SV_IsBanned().
+// NULL rules removes the filter, returns false if there is no filter
+qbool				NET_SetBanFilter(const net_ban_rule_t *rules, int count);
+// set up network globals of the worker thread
+void				NET_InitThread(int s);
 qbool				NET_GetSockAddrIn_ByHostAndPort(struct sockaddr_in *address, const char *host, int port);
 
 char				*NET_BaseAdrToString (struct sockaddr_in *a, char *buf, size_t bufsize);
@@ -403,11 +714,88 @@ void				Netchan_OutOfBandPrint(int s, struct sockaddr_in *adr, const char *forma
 
 void				NET_Init(void);
 
+//
+// uring.c
+//
+
+#if defined(__linux__) && defined(USE_IO_URING)
+
+#define NET_URING // io_uring network backend compiled in
+
+// called for each datagram (net_message, net_from and net_from_socket are set) or readiness of polled descriptor
+typedef void	(*uring_func_t)(void *data);
+
+extern	THREAD_LOCAL qbool	uring_active;
+
+qbool				URING_Init(void);
+qbool				URING_CheckWatch(int s);
+qbool				URING_Watch(int s, void *data);
+qbool				URING_WatchPoll(int s, void *data);
+void				URING_Unwatch(int s);
+void				URING_SendPacket(int s, int length, const void *data, struct sockaddr_in *to);
+void				URING_Submit(void);
+void				URING_Wait(int msec);
+void				URING_Dispatch(uring_func_t func);
+void				URING_PrintStats(void);
+
+#endif
+
+//
+// timer.c
+//
+
+#define TIMER_ROOT_BITS		8	// root wheel, 256 lists of 1 ms
+#define TIMER_LEVEL_BITS	6	// each next level has 64 lists, 64 times coarser than previous
+#define TIMER_LEVELS		3
+
+typedef struct timer_wheel_s
+{
+	unsigned int	now;		// next tick we have to process
+	int				count;		// pending timers
+	wheel_timer_t	root[1 << TIMER_ROOT_BITS];
+	wheel_timer_t	levels[TIMER_LEVELS][1 << TIMER_LEVEL_BITS];
+} timer_wheel_t;
+
+// timer is not pending any more when it called, so it may add the same timer again
+typedef void		(*timer_func_t)(wheel_timer_t *t);
+
+#define				Timer_Pending(t) ((t)->next != NULL)
+
+void				Timer_Init(timer_wheel_t *wheel, unsigned int now);
+void				Timer_Add(timer_wheel_t *wheel, wheel_timer_t *t, unsigned int expires);
+void				Timer_Remove(timer_wheel_t *wheel, wheel_timer_t *t);
+// fire everything what expired by "now"
+void				Timer_Run(timer_wheel_t *wheel, unsigned int now, timer_func_t func);
+// how long we can sleep, in milliseconds, but no longer than "max"
+int					Timer_NextTimeout(timer_wheel_t *wheel, unsigned int now, int max);
+
+//
+// hash.c
+//
+
+// murmur3 finalizer
+unsigned int		Hash_Int(unsigned int h);
+unsigned int		Hash_Addr(const struct sockaddr_in *addr);
+// backward shift deletion: can entry at slot j, which ideal slot is k, move to the hole
+qbool				Hash_CanShift(unsigned int hole, unsigned int j, unsigned int k);
+
+//
+// siphash.c
+//
+
+#define SIPHASH_KEY_SIZE	16
+
+unsigned long long	SipHash(const byte key[SIPHASH_KEY_SIZE], const void *data, size_t len);
+
 //
 // svc.c
 //
 
+void				SV_InitChallenges (void);
 qbool				SV_ConnectionlessPacket (void);
+// something what goes into status reply changed: peers or serverinfo
+void				SV_StatusChanged (void);
+void				SV_Cmd_CacheStats_f (void);
 
 //
 // clc.c
@@ -436,22 +824,55 @@ void				Info_SetValueForKeyEx (char *s, const char *key, const char *value, unsi
 //
 
 void				QRY_Init(void);
+void				QRY_Shutdown(void);
 void				QRY_Frame(void);
 void				QRY_SV_PingReply();
+// how long main thread may sleep before query needs it, but no longer than "max"
+int					QRY_NextTimeout(int max);
 qbool				QRY_IsMasterReply(void);
 void				SVC_QRY_ParseMasterReply(void);
 void				SVC_QRY_PingStatus(void);
+void				QRY_PrintCacheStats(void);
 
 //
 // huff.c
 //
 
+void				Huff_Init(void);
 void				Huff_EncryptPacket(sizebuf_t *msg, int offset);
 void				Huff_DecryptPacket(sizebuf_t *msg, int offset);
 void				Huff_CompressPacket(sizebuf_t *msg, int offset);
 void				Huff_DecompressPacket(sizebuf_t *msg, int offset);
-int					Huff_GetByte(byte *buffer, int *count);
-void				Huff_EmitByte(int ch, byte *buffer, int *count);
+
+//
+// iptrie.c
+//
+
+// longest prefix match trie, prefixes and addresses are in host byte order
+typedef struct iptrie_node_s iptrie_node_t;
+
+typedef struct iptrie_s
+{
+	iptrie_node_t	*root;
+	int				count;		// prefixes with value
+} iptrie_t;
+
+typedef void		(*iptrie_func_t)(unsigned int prefix, int len, void *value, void *arg);
+
+void				IPTrie_Init(iptrie_t *trie);
+void				IPTrie_Clear(iptrie_t *trie);
+// returns previous value of the prefix, if any
+void				*IPTrie_Insert(iptrie_t *trie, unsigned int prefix, int len, void *value);
+// returns removed value, NULL if there was no such prefix
+void				*IPTrie_Remove(iptrie_t *trie, unsigned int prefix, int len);
+// exact prefix
+void				*IPTrie_Find(iptrie_t *trie, unsigned int prefix, int len);
+// value of the longest prefix which matches address, len of that prefix returned in "len" if it not NULL
+void				*IPTrie_Lookup(iptrie_t *trie, unsigned int addr, int *len);
+// walk prefixes in address order
+void				IPTrie_Walk(iptrie_t *trie, iptrie_func_t func, void *arg);
+// parse "a.b.c.d/len" or just "a.b.c.d" which is /32
+qbool				IPTrie_ParseCIDR(const char *s, unsigned int *prefix, int *len);
 
 //
 // ban.c
@@ -461,11 +882,15 @@ void				Huff_EmitByte(int ch, byte *buffer, int *count);
 void				Ban_Init(void);
 // Periodically check is it time to remove some bans.
 void				SV_CleanBansIPList(void);
+// Rebuild kernel filter if ban list was changed.
+void				SV_UpdateBanFilter(void);
 // Return true if add is banned.
 qbool				SV_IsBanned (struct sockaddr_in *addr);
 
 // Whitelist system.
 void Whitelist_Init(void);
+void Whitelist_BeginReload(void);
+void Whitelist_EndReload(void);
 void Cmd_WhitelistPurge_f (void);
 qbool SV_IsWhitelisted(struct sockaddr_in *addr);
 
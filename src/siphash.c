@@ -0,0 +1,76 @@
+/*
+	siphash.c - SipHash-2-4 keyed hash.
+
+	Reference: Jean-Philippe Aumasson, Daniel J. Bernstein, "SipHash: a fast short-input PRF".
+	We use it where attacker controls the input and should not be able to guess the output, that is challenges (svc.c).
+	Hash tables of peers, servers and whitelist use unkeyed murmur3 finalizer (hash.c), it is faster and they only need spread.
+*/
+
+#include "qwfwd.h"
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND				\
+	do {						\
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);	\
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;						\
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;						\
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);	\
+	} while (0)
+
+// read little endian word, so result does not depend on the host byte order
+static unsigned long long SipHash_Read64(const byte *p)
+{
+	return (unsigned long long)p[0]			| ((unsigned long long)p[1] << 8)
+		| ((unsigned long long)p[2] << 16)	| ((unsigned long long)p[3] << 24)
+		| ((unsigned long long)p[4] << 32)	| ((unsigned long long)p[5] << 40)
+		| ((unsigned long long)p[6] << 48)	| ((unsigned long long)p[7] << 56);
+}
+
+unsigned long long SipHash(const byte key[SIPHASH_KEY_SIZE], const void *data, size_t len)
+{
+	const byte *in = (const byte *) data;
+	const byte *end = in + len - (len % 8);
+	unsigned long long k0 = SipHash_Read64(key);
+	unsigned long long k1 = SipHash_Read64(key + 8);
+	unsigned long long v0 = 0x736f6d6570736575ULL ^ k0;
+	unsigned long long v1 = 0x646f72616e646f6dULL ^ k1;
+	unsigned long long v2 = 0x6c7967656e657261ULL ^ k0;
+	unsigned long long v3 = 0x7465646279746573ULL ^ k1;
+	unsigned long long m, b = ((unsigned long long)len) << 56;
+
+	for ( ; in != end; in += 8)
+	{
+		m = SipHash_Read64(in);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	// last 0..7 bytes, falls through intentionally
+	switch (len % 8)
+	{
+		case 7: b |= ((unsigned long long)in[6]) << 48;
+		case 6: b |= ((unsigned long long)in[5]) << 40;
+		case 5: b |= ((unsigned long long)in[4]) << 32;
+		case 4: b |= ((unsigned long long)in[3]) << 24;
+		case 3: b |= ((unsigned long long)in[2]) << 16;
+		case 2: b |= ((unsigned long long)in[1]) << 8;
+		case 1: b |= ((unsigned long long)in[0]);
+		default: break;
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,400 @@
+/*
+	stats.c - traffic counters and metrics export.
+
+	Every thread which forwards packets has own block of counters, only that thread changes it,
+	so counting is plain increment without atomics or locks. Blocks are cache line aligned,
+	so threads do not share cache lines. Readers (console command, metrics endpoint) sum all blocks,
+	they may see a counter a bit behind, which is fine for statistics.
+
+	Metrics are served in Prometheus text format over HTTP by own thread, so scrape does not touch the main loop.
+*/
+
+#include "qwfwd.h"
+
+#define STATS_MAX_THREADS	64	// the same as max forwarding workers
+
+// upper bounds of latency buckets in microseconds, last bucket is +Inf
+static const unsigned int stats_latency_bounds[STATS_LATENCY_BUCKETS - 1] =
+	{ 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000 };
+
+static stats_thread_t			stats_threads[STATS_MAX_THREADS];
+static int						stats_threads_count = 1;	// block 0 is main thread one
+
+THREAD_LOCAL stats_thread_t		*stats_thread = &stats_threads[0];
+
+static cvar_t					*metrics_ip;
+static cvar_t					*metrics_port;
+
+typedef struct stats_info_s
+{
+	const char	*name;		// metric name, without qwfwd_ prefix
+	const char	*labels;	// labels, if counter is one of the series of the same metric
+	const char	*help;
+} stats_info_t;
+
+// NOTE: order must match stat_t, series of the same metric must be next to each other
+static const stats_info_t stats_info[st_max] =
+{
+	{ "packets_total",		"side=\"client\",direction=\"in\"",		"Datagrams handled by the proxy." },
+	{ "bytes_total",		"side=\"client\",direction=\"in\"",		"Bytes of datagrams handled by the proxy." },
+	{ "packets_total",		"side=\"client\",direction=\"out\"",	NULL },
+	{ "bytes_total",		"side=\"client\",direction=\"out\"",	NULL },
+	{ "packets_total",		"side=\"server\",direction=\"in\"",		NULL },
+	{ "bytes_total",		"side=\"server\",direction=\"in\"",		NULL },
+	{ "packets_total",		"side=\"server\",direction=\"out\"",	NULL },
+	{ "bytes_total",		"side=\"server\",direction=\"out\"",	NULL },
+	{ "dropped_total",		"reason=\"banned\"",					"Datagrams dropped." },
+	{ "dropped_total",		"reason=\"unknown_peer\"",				NULL },
+	{ "dropped_total",		"reason=\"spoofed\"",					NULL },
+	{ "challenges_total",			NULL,	"Challenges sent to clients." },
+	{ "challenge_failures_total",	NULL,	"Connects with bad challenge." },
+	{ "connects_total",				NULL,	"Peers added." },
+	{ "connects_rejected_total",	NULL,	"Connects refused: proxy full, remote host not allowed or can't be resolved." },
+	{ "peer_timeouts_total",		NULL,	"Peers dropped because client was silent." },
+	{ "peer_drops_total",			NULL,	"Peers dropped because client disconnected." },
+	{ "peer_refused_total",			NULL,	"Peers dropped because server port is unreachable." },
+	{ "net_calls_total",			"op=\"recv\"",	"Receive and send syscalls of the socket layer." },
+	{ "net_calls_total",			"op=\"send\"",	NULL },
+	{ "net_call_packets_total",		"op=\"recv\"",	"Datagrams passed with these syscalls." },
+	{ "net_call_packets_total",		"op=\"send\"",	NULL },
+	{ "uring_enters_total",			NULL,	"io_uring_enter() calls." },
+	{ "uring_packets_total",		"direction=\"in\"",	"Datagrams received and sent through io_uring." },
+	{ "uring_packets_total",		"direction=\"out\"",	NULL },
+	{ "uring_fallback_total",		NULL,	"Datagrams sent without io_uring since there was no free send slot." },
+};
+
+//======================================================
+
+void Stats_InitThread(void)
+{
+	int i = Sys_AtomicAdd(&stats_threads_count, 1) - 1;
+
+	if (i >= STATS_MAX_THREADS)
+	{
+		Sys_Printf("Stats_InitThread: too many threads, counters of this one are not exact\n");
+		return; // keep sharing main thread block, better than nothing
+	}
+
+	stats_thread = &stats_threads[i];
+}
+
+void Stats_Latency(unsigned int usec, int packets)
+{
+	int i;
+
+	if (packets <= 0)
+		return;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS - 1 && usec > stats_latency_bounds[i]; i++)
+		;
+
+	stats_thread->latency[i] += packets;
+	stats_thread->latency_sum += (unsigned long long)usec * packets;
+}
+
+// sum counters of all threads
+static void Stats_Sum(stats_thread_t *total)
+{
+	int i, j, count = Sys_AtomicLoad(&stats_threads_count);
+
+	memset(total, 0, sizeof(*total));
+
+	for (i = 0; i < count && i < STATS_MAX_THREADS; i++)
+	{
+		for (j = 0; j < st_max; j++)
+			total->counter[j] += stats_threads[i].counter[j];
+		for (j = 0; j < STATS_LATENCY_BUCKETS; j++)
+			total->latency[j] += stats_threads[i].latency[j];
+		total->latency_sum += stats_threads[i].latency_sum;
+	}
+}
+
+unsigned long long Stats_Value(stat_t stat)
+{
+	unsigned long long value = 0;
+	int i, count = Sys_AtomicLoad(&stats_threads_count);
+
+	for (i = 0; i < count && i < STATS_MAX_THREADS; i++)
+		value += stats_threads[i].counter[stat];
+
+	return value;
+}
+
+//======================================================
+// text buffer which grows as we print into it
+
+typedef struct stats_buf_s
+{
+	char	*data;
+	int		size;
+	int		len;
+} stats_buf_t;
+
+static void Stats_Printf(stats_buf_t *buf, const char *fmt, ...)
+{
+	va_list	argptr;
+	int		len;
+	char	*old;
+
+	for (;;)
+	{
+		if (buf->size - buf->len > 1)
+		{
+			va_start(argptr, fmt);
+			len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, argptr);
+			va_end(argptr);
+
+			if (len >= 0 && len < buf->size - buf->len)
+			{
+				buf->len += len;
+				return;
+			}
+		}
+
+		old = buf->data;
+		buf->size = buf->size ? buf->size * 2 : 16384;
+		buf->data = Sys_malloc(buf->size);
+		if (old)
+			memcpy(buf->data, old, buf->len);
+		Sys_free(old);
+	}
+}
+
+typedef struct stats_peers_s
+{
+	stats_buf_t		*buf;
+	const char		*metric;
+	qbool			bytes;
+} stats_peers_t;
+
+static void Stats_PrintPeer(peer_t *p, peer_info_t *info, void *arg)
+{
+	stats_peers_t *peers = (stats_peers_t *) arg;
+	char ipport[] = "xxx.xxx.xxx.xxx:xxxxx";
+
+	NET_AdrToString(&p->from, ipport, sizeof(ipport));
+
+	Stats_Printf(peers->buf, "qwfwd_%s{userid=\"%d\",client=\"%s\",direction=\"in\"} %llu\n",
+		peers->metric, info->userid, ipport, peers->bytes ? info->bytes_in : info->packets_in);
+	Stats_Printf(peers->buf, "qwfwd_%s{userid=\"%d\",client=\"%s\",direction=\"out\"} %llu\n",
+		peers->metric, info->userid, ipport, peers->bytes ? info->bytes_out : info->packets_out);
+}
+
+// everything in Prometheus text exposition format
+static void Stats_PrintMetrics(stats_buf_t *buf)
+{
+	stats_thread_t	total;
+	stats_peers_t	peers;
+	unsigned long long count;
+	int				i;
+
+	Stats_Sum(&total);
+
+	for (i = 0; i < st_max; i++)
+	{
+		if (stats_info[i].help)
+		{
+			Stats_Printf(buf, "# HELP qwfwd_%s %s\n", stats_info[i].name, stats_info[i].help);
+			Stats_Printf(buf, "# TYPE qwfwd_%s counter\n", stats_info[i].name);
+		}
+
+		if (stats_info[i].labels)
+			Stats_Printf(buf, "qwfwd_%s{%s} %llu\n", stats_info[i].name, stats_info[i].labels, total.counter[i]);
+		else
+			Stats_Printf(buf, "qwfwd_%s %llu\n", stats_info[i].name, total.counter[i]);
+	}
+
+	Stats_Printf(buf, "# HELP qwfwd_latency_seconds Time datagrams spent inside the proxy, from the wake up they were read in until they were queued for sending.\n");
+	Stats_Printf(buf, "# TYPE qwfwd_latency_seconds histogram\n");
+	for (count = 0, i = 0; i < STATS_LATENCY_BUCKETS; i++)
+	{
+		count += total.latency[i];
+		if (i < STATS_LATENCY_BUCKETS - 1)
+			Stats_Printf(buf, "qwfwd_latency_seconds_bucket{le=\"%g\"} %llu\n", stats_latency_bounds[i] / 1000000.0, count);
+		else
+			Stats_Printf(buf, "qwfwd_latency_seconds_bucket{le=\"+Inf\"} %llu\n", count);
+	}
+	Stats_Printf(buf, "qwfwd_latency_seconds_sum %g\n", total.latency_sum / 1000000.0);
+	Stats_Printf(buf, "qwfwd_latency_seconds_count %llu\n", count);
+
+	Stats_Printf(buf, "# HELP qwfwd_peers Connected peers.\n");
+	Stats_Printf(buf, "# TYPE qwfwd_peers gauge\n");
+	Stats_Printf(buf, "qwfwd_peers %d\n", FWD_peers_count());
+
+	peers.buf = buf;
+
+	Stats_Printf(buf, "# HELP qwfwd_peer_packets_total Datagrams of the peer, in is from client, out is to client.\n");
+	Stats_Printf(buf, "# TYPE qwfwd_peer_packets_total counter\n");
+	peers.metric = "peer_packets_total";
+	peers.bytes = false;
+	FWD_ForEachPeer(Stats_PrintPeer, &peers);
+
+	Stats_Printf(buf, "# HELP qwfwd_peer_bytes_total Bytes of datagrams of the peer, in is from client, out is to client.\n");
+	Stats_Printf(buf, "# TYPE qwfwd_peer_bytes_total counter\n");
+	peers.metric = "peer_bytes_total";
+	peers.bytes = true;
+	FWD_ForEachPeer(Stats_PrintPeer, &peers);
+}
+
+//======================================================
+// metrics endpoint, one request per connection, one connection at a time, this is for scraper, not for browsers.
+
+static void Stats_HTTP_Serve(int c)
+{
+	static const char	not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+	char				req[1024], header[256];
+	int					len = 0, ret;
+	stats_buf_t			body;
+
+	// read request headers, we only care about the first line
+	while (len < (int)sizeof(req) - 1)
+	{
+		if ((ret = recv(c, req + len, sizeof(req) - 1 - len, 0)) <= 0)
+			return; // timeout or client gone
+
+		len += ret;
+		req[len] = 0;
+
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+
+	if (strncmp(req, "GET /metrics ", sizeof("GET /metrics ") - 1) && strncmp(req, "GET / ", sizeof("GET / ") - 1))
+	{
+		send(c, not_found, sizeof(not_found) - 1, 0);
+		return;
+	}
+
+	memset(&body, 0, sizeof(body));
+	Stats_PrintMetrics(&body);
+
+	len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", body.len);
+
+	if (send(c, header, len, 0) == len)
+	{
+		for (len = 0; len < body.len; len += ret)
+		{
+			if ((ret = send(c, body.data + len, body.len - len, 0)) <= 0)
+				break;
+		}
+	}
+
+	Sys_free(body.data);
+}
+
+static void Stats_HTTP_Thread(void *arg)
+{
+	int		s = (int)(size_t)arg, c;
+#ifdef _WIN32
+	DWORD	timeout = 2000;
+#else
+	struct timeval timeout = { 2, 0 };
+#endif
+
+	for (;;)
+	{
+		if ((c = accept(s, NULL, NULL)) == INVALID_SOCKET)
+			continue;
+
+		// scraper which does not send request does not hold us forever
+		setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+		setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+
+		Stats_HTTP_Serve(c);
+		closesocket(c);
+	}
+}
+
+static void Stats_HTTP_Init(void)
+{
+	struct sockaddr_in	addr;
+	int					s, i = 1;
+
+	if (metrics_port->integer <= 0)
+		return; // disabled
+
+	if (!NET_GetSockAddrIn_ByHostAndPort(&addr, metrics_ip->string, metrics_port->integer))
+	{
+		Sys_Printf("Stats_HTTP_Init: wrong metrics_ip %s\n", metrics_ip->string);
+		return;
+	}
+
+	if ((s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+	{
+		Sys_Printf("Stats_HTTP_Init: socket: (%i): %s\n", qerrno, strerror (qerrno));
+		return;
+	}
+
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&i, sizeof(i));
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) || listen(s, 8))
+	{
+		Sys_Printf("Stats_HTTP_Init: bind/listen %s:%d: (%i): %s\n", metrics_ip->string, metrics_port->integer, qerrno, strerror (qerrno));
+		closesocket(s);
+		return;
+	}
+
+	if (!Sys_CreateThread(Stats_HTTP_Thread, (void *)(size_t)s))
+	{
+		Sys_Printf("Stats_HTTP_Init: failed to start metrics thread\n");
+		closesocket(s);
+		return;
+	}
+
+	Sys_Printf("metrics available at http://%s:%d/metrics\n", metrics_ip->string, metrics_port->integer);
+}
+
+//======================================================
+
+static void Stats_Cmd_Stats_f(void)
+{
+	stats_thread_t		total;
+	unsigned long long	count, seen;
+	int					i, q;
+	static const int	quantiles[] = { 50, 90, 99 };
+
+	Stats_Sum(&total);
+
+	Sys_Printf("=== stats ===\n");
+	for (i = 0; i < st_max; i++)
+	{
+		if (stats_info[i].labels)
+			Sys_Printf("%-26s %-36s %llu\n", stats_info[i].name, stats_info[i].labels, total.counter[i]);
+		else
+			Sys_Printf("%-26s %-36s %llu\n", stats_info[i].name, "", total.counter[i]);
+	}
+
+	for (count = 0, i = 0; i < STATS_LATENCY_BUCKETS; i++)
+		count += total.latency[i];
+
+	Sys_Printf("latency: %llu packets, avg %.0f us", count, count ? (double)total.latency_sum / count : 0.0);
+
+	// quantile is reported as upper bound of the bucket it falls into
+	for (q = 0; q < (int)(sizeof(quantiles) / sizeof(quantiles[0])) && count; q++)
+	{
+		for (seen = 0, i = 0; i < STATS_LATENCY_BUCKETS - 1; i++)
+		{
+			seen += total.latency[i];
+			if (seen * 100 >= count * quantiles[q])
+				break;
+		}
+
+		if (i < STATS_LATENCY_BUCKETS - 1)
+			Sys_Printf(", p%d <= %u us", quantiles[q], stats_latency_bounds[i]);
+		else
+			Sys_Printf(", p%d > %u us", quantiles[q], stats_latency_bounds[STATS_LATENCY_BUCKETS - 2]);
+	}
+	Sys_Printf("\n");
+
+	Sys_Printf("%d peers\n", FWD_peers_count());
+}
+
+void Stats_Init(void)
+{
+	metrics_ip		= Cvar_Get("metrics_ip",	"127.0.0.1", CVAR_NOSET);
+	metrics_port	= Cvar_Get("metrics_port",	"0", CVAR_NOSET); // 0 means no metrics endpoint
+
+	Cmd_AddCommand("stats", Stats_Cmd_Stats_f);
+
+	Stats_HTTP_Init();
+}
@@ -16,112 +16,96 @@ challenge, they must give a valid IP address.
 =================
 */
 
-// MAX_CHALLENGES is made large to prevent a denial
-// of service attack that could cycle all of them
-// out before legitimate users connected
-#define	MAX_CHALLENGES	1024
+// challenges are not stored anywhere, challenge is keyed hash of client address, protocol and time bucket,
+// so on connect we just hash the same things again. this way getchallenge flood can't cycle out challenges
+// of legitimate clients and we do not need memory for them.
+// challenge is valid for the current and the previous bucket, so client has 30 to 60 seconds to connect.
+#define CHALLENGE_BUCKET		30000	// ms
+#define CHALLENGE_KEY_BUCKETS	120		// key used for hashing changes that often (once per hour)
 
-typedef struct
-{
-	struct sockaddr_in		adr;
-	int						challenge;
-	time_t					time;
-	protocol_t				proto;
-} challenge_t;
-
-static challenge_t		challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
+static byte challenge_secret[SIPHASH_KEY_SIZE];	// random, set on startup, key of the bucket derived from it
 
-// find challenge for address if any
-static unsigned int FindChallengeForAddr(struct sockaddr_in *addr)
+void SV_InitChallenges (void)
 {
-	unsigned int i;
+	Sys_RandomBytes(challenge_secret, sizeof(challenge_secret));
+}
 
-	for (i = 0; i < MAX_CHALLENGES; i++)
-	{
-		if (NET_CompareAddress(addr, &challenges[i].adr))
-		{
-			break; // found
-		}
-	}
+static int SV_ChallengeForBucket(struct sockaddr_in *addr, protocol_t proto, unsigned int bucket)
+{
+	byte key[SIPHASH_KEY_SIZE], data[11];
+	unsigned int epoch[2];
+	unsigned long long h;
+
+	// rotating secret, derive key of the epoch from our startup secret
+	epoch[0] = bucket / CHALLENGE_KEY_BUCKETS;
+	epoch[1] = 0;
+	h = SipHash(challenge_secret, epoch, sizeof(epoch));
+	memcpy(key, &h, 8);
+	epoch[1] = 1;
+	h = SipHash(challenge_secret, epoch, sizeof(epoch));
+	memcpy(key + 8, &h, 8);
+
+	memcpy(data, &addr->sin_addr.s_addr, 4);
+	memcpy(data + 4, &addr->sin_port, 2);
+	data[6] = (byte) proto;
+	memcpy(data + 7, &bucket, 4);
+
+	return (int)(SipHash(key, data, sizeof(data)) & 0x7fffffff);
+}
 
-	return i;
+static unsigned int SV_ChallengeBucket(void)
+{
+	return Sys_Milliseconds() / CHALLENGE_BUCKET;
 }
 
 // see if the challenge is valid
-static qbool CheckChallenge( int challenge )
+static qbool CheckChallenge( int challenge, protocol_t proto )
 {
-	unsigned int i = FindChallengeForAddr(&net_from);
+	unsigned int bucket = SV_ChallengeBucket();
+	peer_t *p;
 
-	if (i >= MAX_CHALLENGES)
-	{
-		Netchan_OutOfBandPrint(net_from_socket, &net_from, "%c\nNo challenge for address.\n", A2C_PRINT);
-		return false;
-	}
+	if (challenge == SV_ChallengeForBucket(&net_from, proto, bucket) || challenge == SV_ChallengeForBucket(&net_from, proto, bucket - 1))
+		return true; // good!
 
-	if (challenge != challenges[i].challenge)
-	{
-		Netchan_OutOfBandPrint(net_from_socket, &net_from, "%c\nBad challenge.\n", A2C_PRINT);
-		return false;
-	}
+	// q3 overwrite trick, see SVC_GetChallenge()
+	if (proto == pr_q3 && (p = FWD_peer_by_addr(&net_from)) && p->ps == ps_connected && p->challenge == challenge)
+		return true;
 
-	return true; // good!
+	Stats_Inc(st_challenge_failures);
+	Netchan_OutOfBandPrint(net_from_socket, &net_from, "%c\nBad challenge.\n", A2C_PRINT);
+	return false;
 }
 
 static void SVC_GetChallenge ( protocol_t proto )
 {
-	time_t	oldestTime;
-	int		i, oldest;
 	char	buf[256];
+	int		challenge;
 
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-
-	// see if we already have a challenge for this ip
-	for (i = 0 ; i < MAX_CHALLENGES; i++)
-	{
-		if (NET_CompareAddress(&net_from, &challenges[i].adr))
-			break;
-
-		if (challenges[i].time < oldestTime)
-		{
-			oldestTime = challenges[i].time;
-			oldest = i;
-		}
-	}
-
-	if (i == MAX_CHALLENGES)
-	{
-		// overwrite the oldest
-		i = oldest;
-		challenges[i].challenge = (rand() << 16) ^ rand();
-		challenges[i].adr		= net_from;
-		challenges[i].time		= time(NULL);
-	}
-
-	// overwrite proto in any case!
-	challenges[i].proto	= proto;
+	challenge = SV_ChallengeForBucket(&net_from, proto, SV_ChallengeBucket());
 
-	if ( challenges[i].proto == pr_q3 )
+	if ( proto == pr_q3 )
 	{
 		peer_t *p = FWD_peer_by_addr( &net_from );
 		if ( p && p->ps == ps_connected )
 		{
 			Sys_DPrintf("challenge q3 overwrite trick!\n");
-			challenges[i].challenge = p->challenge; // use challenge from q3 server since q3 packets encrypted with it...
+			challenge = p->challenge; // use challenge from q3 server since q3 packets encrypted with it...
 		}
 	}
 
 	if ( developer->integer )
 	{
-		Sys_DPrintf("challenge %s: %s %d\n", challenges[i].proto == pr_qw ? "qw" : "q3", NET_AdrToString(&net_from, buf, sizeof(buf)), challenges[i].challenge);
+		Sys_DPrintf("challenge %s: %s %d\n", proto == pr_qw ? "qw" : "q3", NET_AdrToString(&net_from, buf, sizeof(buf)), challenge);
 	}
 
+	Stats_Inc(st_challenges);
+
 	// send it back
-	if ( challenges[i].proto == pr_qw )
+	if ( proto == pr_qw )
 	{
 		char *over;
 
-		snprintf(buf, sizeof(buf), "%c%i", S2C_CHALLENGE, challenges[i].challenge);
+		snprintf(buf, sizeof(buf), "%c%i", S2C_CHALLENGE, challenge);
 
 		over = buf + strlen(buf) + 1;
 
@@ -129,7 +113,7 @@ static void SVC_GetChallenge ( protocol_t proto )
 	}
 	else
 	{
-		Netchan_OutOfBandPrint(net_from_socket, &net_from, "challengeResponse %i", challenges[i].challenge);	
+		Netchan_OutOfBandPrint(net_from_socket, &net_from, "challengeResponse %i", challenge);	
 	}
 }
 
@@ -181,24 +165,11 @@ static qbool CheckUserinfo( char *userinfobuf, unsigned int bufsize, char *useri
 	return true;
 }
 
-static void SVC_DirectConnect (void)
+static void SVC_DirectConnect ( protocol_t proto )
 {
-	unsigned int i = FindChallengeForAddr(&net_from);
-
 	char userinfo[MAX_INFO_STRING], prx[MAX_INFO_KEY * 4 /* we allow huge size for prx */], *at;
 	peer_t *p = NULL;
 	int qport, port, challenge;
-	protocol_t proto;
-
-	if ( i >= MAX_CHALLENGES )
-	{
-		// here protocol is unknown
-		Netchan_OutOfBandPrint(net_from_socket, &net_from, "%c\nNo challenge for address.\n", A2C_PRINT);
-		return;
-	}
-
-	proto = challenges[i].proto;
-	challenge = challenges[i].challenge;
 
 	// different for qw and q3
 	if ( proto == pr_qw )
@@ -211,7 +182,8 @@ static void SVC_DirectConnect (void)
 		qport = atoi( Cmd_Argv( 2 ) );
 
 		// see if the challenge is valid
-		if ( !CheckChallenge( atoi( Cmd_Argv( 3 ) ) ) )
+		challenge = atoi( Cmd_Argv( 3 ) );
+		if ( !CheckChallenge( challenge, proto ) )
 			return; // wrong challenge
 
 		// and now validate userinfo
@@ -232,13 +204,15 @@ static void SVC_DirectConnect (void)
 		qport = atoi( Info_ValueForKey(userinfo, "qport", prx, sizeof(prx)) );
 
 		// see if the challenge is valid
-		if ( !CheckChallenge( atoi( Info_ValueForKey(userinfo, "challenge", prx, sizeof(prx)) ) ) )
+		challenge = atoi( Info_ValueForKey(userinfo, "challenge", prx, sizeof(prx)) );
+		if ( !CheckChallenge( challenge, proto ) )
 			return; // wrong challenge
 	}
 
 	// check proxy is full
 	if (FWD_peers_count() >= maxclients->integer)
 	{
+		Stats_Inc(st_connects_rejected);
 		Netchan_OutOfBandPrint (net_from_socket, &net_from, "%c\n" "proxy@%s is full\n\n", A2C_PRINT, hostname->string);
 		return; // no more free slots
 	}
@@ -295,10 +269,12 @@ static void SVC_DirectConnect (void)
 	if ((p = FWD_peer_new(prx, port, &net_from, userinfo, qport, proto, true)))
 	{
 		Sys_DPrintf("peer %s:%d added or reused\n", inet_ntoa(net_from.sin_addr), (int)ntohs(net_from.sin_port));
+		Stats_Inc(st_connects);
 	}
 	else
 	{
 		Sys_DPrintf("peer %s:%d was not added\n", inet_ntoa(net_from.sin_addr), (int)ntohs(net_from.sin_port));
+		Stats_Inc(st_connects_rejected);
 		return;
 	}
 
@@ -339,53 +315,122 @@ This message can be up to around 5k with worst case string lengths.
 //#define STATUS_SPECTATORS_AS_PLAYERS	8 //for ASE - change only frags: show as "S"
 //#define STATUS_SHOWTEAMS				16
 
-static void SVC_Status (void)
+// add one player line to the status reply
+static void SVC_StatusPeer (peer_t *p, peer_info_t *cl, void *arg)
 {
-	sizebuf_t buf;
+	sizebuf_t *buf = (sizebuf_t *) arg;
+	int top, bottom, ping, connect_t;
+	char *name, *frags, *skin;
+	char tmp[1024];
 
-	static byte buf_data[MSG_BUF_SIZE]; // static  - so it not allocated each time
-	static char tmp[1024]; // static too
+	top    = cl->top;
+	bottom = cl->bottom;
+	ping   = 666; //SV_CalcPing (cl);
+	name   = cl->name;
+	skin   = "";
+	frags  = "0";
+	connect_t = (int)((Sys_Milliseconds() - p->connect) / 60000); // not like it proper...
 
-	int top, bottom, ping, opt, connect_t;
-	char *name, *frags, *skin;
-	peer_t *cl;
+	snprintf(tmp, sizeof(tmp), "%i %s %i %i \"%s\" \"%s\" %i %i\n", cl->userid, frags, connect_t, ping, name, skin, top, bottom);
 
-	SZ_InitEx(&buf, buf_data, sizeof(buf_data), true);
+	SZ_Print(buf, tmp);
+}
+
+// status replies are cached per thread, one reply per combination of serverinfo/players options.
+// cache is rebuilt when something what goes into reply changed (see SV_StatusChanged()),
+// or when it is older than STATUS_CACHE_MAX_AGE, since connect time of the peers is in the reply too.
+#define STATUS_CACHE_MAX_AGE	1000 // milliseconds
+#define STATUS_CACHE_INFO		1
+#define STATUS_CACHE_PLAYERS	2
+#define STATUS_CACHE_VARIANTS	4
+
+typedef struct status_cache_s
+{
+	byte				data[MSG_BUF_SIZE];
+	int					size;			// -1 if reply overflowed
+	qbool				valid;
+	unsigned int		generation;		// status_generation this reply was built for
+	unsigned int		built;			// Sys_Milliseconds() when it was built
+} status_cache_t;
+
+static THREAD_LOCAL status_cache_t *status_cache; // allocated on first status query in the thread
+static unsigned int status_generation;
+static unsigned int status_hits, status_misses;
+
+void SV_StatusChanged(void)
+{
+	Sys_AtomicAdd(&status_generation, 1);
+}
+
+static void SVC_StatusBuild (status_cache_t *cache, int what)
+{
+	sizebuf_t buf;
+	char tmp[1024];
+
+	SZ_InitEx(&buf, cache->data, sizeof(cache->data), true);
 
 	MSG_WriteLong(&buf, -1);	// -1 sequence means out of band
 	MSG_WriteChar(&buf, A2C_PRINT);
 
-	opt = (Cmd_Argc() > 1) ? atoi(Cmd_Argv(1)) : 0;
-
-	if (opt == STATUS_OLDSTYLE || (opt & STATUS_SERVERINFO))
+	if (what & STATUS_CACHE_INFO)
 	{
 		snprintf(tmp, sizeof(tmp), "%s\n", ps.info);
 		SZ_Print(&buf, tmp);
 	}
 
-	if (opt == STATUS_OLDSTYLE || (opt & (STATUS_PLAYERS | STATUS_SPECTATORS)))
+	if (what & STATUS_CACHE_PLAYERS)
 	{
-		for (cl = peers; cl; cl = cl->next)
-		{
-			top    = cl->top;
-			bottom = cl->bottom;
-			ping   = 666; //SV_CalcPing (cl);
-			name   = cl->name;
-			skin   = "";
-			frags  = "0";
-			connect_t = (int)(time(NULL) - cl->connect)/60; // not like it proper...
+		// peers of all workers
+		FWD_ForEachPeer(SVC_StatusPeer, &buf);
+	}
 
-			snprintf(tmp, sizeof(tmp), "%i %s %i %i \"%s\" \"%s\" %i %i\n", cl->userid, frags, connect_t, ping, name, skin, top, bottom);
+	cache->size = buf.overflowed ? -1 : buf.cursize;
+}
 
-			SZ_Print(&buf, tmp);
-		}
+static void SVC_Status (void)
+{
+	status_cache_t *cache;
+	unsigned int generation = status_generation, now = Sys_Milliseconds();
+	int opt, what = 0;
+
+	opt = (Cmd_Argc() > 1) ? atoi(Cmd_Argv(1)) : 0;
+
+	if (opt == STATUS_OLDSTYLE || (opt & STATUS_SERVERINFO))
+		what |= STATUS_CACHE_INFO;
+
+	if (opt == STATUS_OLDSTYLE || (opt & (STATUS_PLAYERS | STATUS_SPECTATORS)))
+		what |= STATUS_CACHE_PLAYERS;
+
+	if (!status_cache)
+		status_cache = Sys_malloc(STATUS_CACHE_VARIANTS * sizeof(*status_cache));
+
+	cache = &status_cache[what];
+
+	if (cache->valid && cache->generation == generation && now - cache->built < STATUS_CACHE_MAX_AGE)
+	{
+		Sys_AtomicAdd(&status_hits, 1);
+	}
+	else
+	{
+		Sys_AtomicAdd(&status_misses, 1);
+
+		SVC_StatusBuild(cache, what);
+		cache->valid = true;
+		cache->generation = generation;
+		cache->built = now;
 	}
 
-	if (buf.overflowed)
+	if (cache->size < 0)
 		return; // overflowed
 
 	// send the datagram
-	NET_SendPacket(net_from_socket, buf.cursize, buf.data, &net_from);
+	NET_SendPacket(net_from_socket, cache->size, cache->data, &net_from);
+}
+
+void SV_Cmd_CacheStats_f (void)
+{
+	Sys_Printf("status:     %u hits, %u rebuilds\n", status_hits, status_misses);
+	QRY_PrintCacheStats();
 }
 
 /*
@@ -416,6 +461,7 @@ connectionless packets.
 qbool SV_ConnectionlessPacket(void)
 {
 	qbool need_forward = false;
+	protocol_t proto = pr_qw;
 	char	*s;
 	char	*c;
 
@@ -432,12 +478,13 @@ qbool SV_ConnectionlessPacket(void)
 		s = MSG_ReadString ();//MSG_ReadStringLine ();
 
 		// check for possibile huffmen compression for q3, zzz...
+		// compressed data starts with length of uncompressed data, which is small, so first byte is below ' ',
+		// qw has protocol version there
 		if ( s[0] == 'c' && !strncmp(s, "connect ", sizeof("connect ")-1) )
 		{
-			unsigned int i = FindChallengeForAddr(&net_from);
-
-			if ( i < MAX_CHALLENGES && challenges[i].proto == pr_q3 )
+			if ( net_message.cursize > 12 && net_message.data[12] < ' ' )
 			{
+				proto = pr_q3;
 				Huff_DecryptPacket(&net_message, 12);
 				MSG_BeginReading();
 				MSG_ReadLong();
@@ -456,7 +503,7 @@ qbool SV_ConnectionlessPacket(void)
 		else if (!strcmp(c, "pingstatus"))
 			SVC_QRY_PingStatus();
 		else if (!strcmp(c,"connect"))
-			SVC_DirectConnect();
+			SVC_DirectConnect( proto );
 		else if (!strcmp(c,"getchallenge"))
 			SVC_GetChallenge( !strcmp(s,"getchallenge\n") ? pr_qw : pr_q3 );
 		else if (!strcmp(c,"status"))
@@ -2,15 +2,13 @@
 System dependant stuff, live hard.
 Also contain some "misc" functions, have no idea where to put it, u r welcome to sort out it.
 */
- 
-#include "qwfwd.h"
 
-#ifdef APP_DLL
-	#define QWFWD_PREFIX "QWFWD: "
-#else
-	#define QWFWD_PREFIX ""
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE // pthread_rwlockattr_setkind_np()
 #endif
 
+#include "qwfwd.h"
+
 
 #ifdef _WIN32
 
@@ -109,58 +107,34 @@ size_t strlcat(char *dst, const char *src, size_t siz)
 
 #endif // defined(__linux__) || defined(_WIN32) || defined(__CYGWIN__)
 
+// NOTE: message is only queued here, charset translation and actual output is done by logger thread, see log.c
 void Sys_Printf(char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[2048];
-	unsigned char *t;
 	
 	va_start (argptr, fmt);
 	vsnprintf (string, sizeof(string), fmt, argptr);
 	va_end (argptr);
 
-	for (t = (unsigned char*)string; *t; t++)
-	{
-		if (*t >= 146 && *t < 156)
-			*t = *t - 146 + '0';
-		if (*t == 143)
-			*t = '.';
-		if (*t == 157 || *t == 158 || *t == 159)
-			*t = '-';
-		if (*t >= 128)
-			*t -= 128;
-		if (*t == 16)
-			*t = '[';
-		if (*t == 17)
-			*t = ']';
-		if (*t == 29)
-			*t = '-';
-		if (*t == 30)
-			*t = '-';
-		if (*t == 31)
-			*t = '-';
-		if (*t == '\a')	//doh. :D
-			*t = ' ';
-	}
-
-	printf(QWFWD_PREFIX "%s", string);
+	Log_Write(ll_info, string);
 }
 
 // print debug
-// this is just wrapper for Sys_Printf(), but print nothing if developer 0
+// same as Sys_Printf(), but print nothing if developer 0
 void Sys_DPrintf(char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[2048];
 	
-	if (!developer || !developer->integer)
+	if (!Log_Enabled(ll_debug))
 		return;
 	
 	va_start (argptr, fmt);
 	vsnprintf (string, sizeof(string), fmt, argptr);
 	va_end (argptr);
 
-	Sys_Printf("%s", string);
+	Log_Write(ll_debug, string);
 }
 
 void Sys_Exit(int code)
@@ -186,7 +160,8 @@ void Sys_Error (char *error, ...)
 	va_end (argptr);
 
 	strlcat(text, "\n", sizeof(text));
-	Sys_Printf("%s", text);
+	Log_Write(ll_error, text);
+	Log_Flush(); // we are about to exit, logger thread will not have a chance
 
 	Sys_Exit (1);
 }
@@ -365,7 +340,7 @@ static void Sys_InitDoubleTime (void)
 	}
 }
 
-double Sys_DoubleTime (void)
+static double Sys_RealDoubleTime (void)
 {
 
 	__int64 pcount;
@@ -378,9 +353,25 @@ double Sys_DoubleTime (void)
 	return (pcount - startcount) / pfreq;
 }
 
+static unsigned int Sys_RealMilliseconds (void)
+{
+	return GetTickCount();
+}
+
+static unsigned int Sys_RealMicroseconds (void)
+{
+	__int64 pcount;
+
+	if (!pfreq)
+		Sys_InitDoubleTime();
+
+	QueryPerformanceCounter ((LARGE_INTEGER *)&pcount);
+	return (unsigned int)(unsigned __int64)((pcount - startcount) / pfreq * 1000000.0);
+}
+
 #else
 
-double Sys_DoubleTime (void)
+static double Sys_RealDoubleTime (void)
 {
 	struct timeval tp;
 	struct timezone tzp;
@@ -397,5 +388,312 @@ double Sys_DoubleTime (void)
 	return (tp.tv_sec - secbase) + tp.tv_usec/1000000.0;
 }
 
+static unsigned int Sys_RealMilliseconds (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned int)ts.tv_sec * 1000u + (unsigned int)(ts.tv_nsec / 1000000);
+}
+
+static unsigned int Sys_RealMicroseconds (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned int)ts.tv_sec * 1000000u + (unsigned int)(ts.tv_nsec / 1000);
+}
+
 #endif
 
+// simulation drives time itself, so timeouts and schedules may be tested without waiting for them.
+// NOTE: only single threaded simulation sets it, so there no locking
+static qbool				sys_virtual_clock;
+static unsigned long long	sys_virtual_usec;
+
+#define SYS_VIRTUAL_EPOCH	1700000000 // what Sys_Time() returns at zero of virtual clock
+
+void Sys_SetVirtualClock (unsigned long long usec)
+{
+	sys_virtual_usec = usec;
+	sys_virtual_clock = true;
+}
+
+double Sys_DoubleTime (void)
+{
+	if (sys_virtual_clock)
+		return sys_virtual_usec / 1000000.0;
+
+	return Sys_RealDoubleTime();
+}
+
+unsigned int Sys_Milliseconds (void)
+{
+	if (sys_virtual_clock)
+		return (unsigned int)(sys_virtual_usec / 1000);
+
+	return Sys_RealMilliseconds();
+}
+
+unsigned int Sys_Microseconds (void)
+{
+	if (sys_virtual_clock)
+		return (unsigned int)sys_virtual_usec;
+
+	return Sys_RealMicroseconds();
+}
+
+time_t Sys_Time (void)
+{
+	if (sys_virtual_clock)
+		return (time_t)(SYS_VIRTUAL_EPOCH + sys_virtual_usec / 1000000);
+
+	return time(NULL);
+}
+
+// NOTE: it is not cryptographically strong, it is used only if we can't get random bytes from OS
+static void Sys_WeakRandomBytes (void *buf, int size)
+{
+	static unsigned long long counter;
+	unsigned long long x;
+	byte *out = (byte *) buf;
+	int i;
+
+	x = (unsigned long long)time(NULL) ^ ((unsigned long long)(Sys_RealDoubleTime() * 1000000.0) << 20)
+		^ (unsigned long long)(size_t)buf ^ (unsigned long long)(size_t)&counter ^ (++counter << 40);
+
+	// splitmix64
+	for (i = 0; i < size; i++)
+	{
+		unsigned long long z;
+
+		x += 0x9E3779B97F4A7C15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		out[i] ^= (byte) z;
+	}
+}
+
+void Sys_RandomBytes (void *buf, int size)
+{
+#ifndef _WIN32
+	FILE *f = fopen("/dev/urandom", "rb");
+
+	if (f)
+	{
+		qbool ok = (fread(buf, 1, size, f) == (size_t)size);
+
+		fclose(f);
+		if (ok)
+			return;
+	}
+#endif
+
+	memset(buf, 0, size);
+	Sys_WeakRandomBytes(buf, size);
+}
+
+
+//=============================================================================
+// threads
+
+typedef struct sys_thread_start_s
+{
+	sys_thread_func_t	func;
+	void				*arg;
+} sys_thread_start_t;
+
+#ifdef _WIN32
+
+static DWORD WINAPI Sys_ThreadStart(LPVOID param)
+{
+	sys_thread_start_t start = *(sys_thread_start_t *)param;
+
+	Sys_free(param);
+	start.func(start.arg);
+
+	return 0;
+}
+
+qbool Sys_CreateThread(sys_thread_func_t func, void *arg)
+{
+	sys_thread_start_t *start = Sys_malloc(sizeof(*start));
+	HANDLE thread;
+
+	start->func = func;
+	start->arg = arg;
+
+	if (!(thread = CreateThread(NULL, 0, Sys_ThreadStart, start, 0, NULL)))
+	{
+		Sys_free(start);
+		return false;
+	}
+
+	CloseHandle(thread); // detach
+	return true;
+}
+
+void Sys_MutexInit(sys_mutex_t *mutex)
+{
+	InitializeCriticalSection(mutex);
+}
+
+void Sys_MutexLock(sys_mutex_t *mutex)
+{
+	EnterCriticalSection(mutex);
+}
+
+void Sys_MutexUnlock(sys_mutex_t *mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+void Sys_SemInit(sys_sem_t *sem)
+{
+	if (!(*sem = CreateSemaphore(NULL, 0, 0x7fffffff, NULL)))
+		Sys_Error("Sys_SemInit: CreateSemaphore failed");
+}
+
+void Sys_SemPost(sys_sem_t *sem)
+{
+	ReleaseSemaphore(*sem, 1, NULL);
+}
+
+void Sys_SemWait(sys_sem_t *sem)
+{
+	WaitForSingleObject(*sem, INFINITE);
+}
+
+// SRW locks do not starve writers
+void Sys_RWLockInit(sys_rwlock_t *lock)
+{
+	InitializeSRWLock(lock);
+}
+
+void Sys_RWLockRead(sys_rwlock_t *lock)
+{
+	AcquireSRWLockShared(lock);
+}
+
+void Sys_RWUnlockRead(sys_rwlock_t *lock)
+{
+	ReleaseSRWLockShared(lock);
+}
+
+void Sys_RWLockWrite(sys_rwlock_t *lock)
+{
+	AcquireSRWLockExclusive(lock);
+}
+
+void Sys_RWUnlockWrite(sys_rwlock_t *lock)
+{
+	ReleaseSRWLockExclusive(lock);
+}
+
+#else // _WIN32
+
+static void *Sys_ThreadStart(void *param)
+{
+	sys_thread_start_t start = *(sys_thread_start_t *)param;
+
+	Sys_free(param);
+	start.func(start.arg);
+
+	return NULL;
+}
+
+qbool Sys_CreateThread(sys_thread_func_t func, void *arg)
+{
+	sys_thread_start_t *start = Sys_malloc(sizeof(*start));
+	pthread_t thread;
+
+	start->func = func;
+	start->arg = arg;
+
+	if (pthread_create(&thread, NULL, Sys_ThreadStart, start))
+	{
+		Sys_free(start);
+		return false;
+	}
+
+	pthread_detach(thread);
+	return true;
+}
+
+void Sys_MutexInit(sys_mutex_t *mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+void Sys_MutexLock(sys_mutex_t *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+void Sys_MutexUnlock(sys_mutex_t *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+void Sys_SemInit(sys_sem_t *sem)
+{
+	pthread_mutex_init(&sem->mutex, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->count = 0;
+}
+
+void Sys_SemPost(sys_sem_t *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+void Sys_SemWait(sys_sem_t *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	while (sem->count <= 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+void Sys_RWLockInit(sys_rwlock_t *lock)
+{
+	pthread_rwlockattr_t attr;
+
+	pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+	// glibc prefers readers by default, so busy readers may block writer forever
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+
+void Sys_RWLockRead(sys_rwlock_t *lock)
+{
+	pthread_rwlock_rdlock(lock);
+}
+
+void Sys_RWUnlockRead(sys_rwlock_t *lock)
+{
+	pthread_rwlock_unlock(lock);
+}
+
+void Sys_RWLockWrite(sys_rwlock_t *lock)
+{
+	pthread_rwlock_wrlock(lock);
+}
+
+void Sys_RWUnlockWrite(sys_rwlock_t *lock)
+{
+	pthread_rwlock_unlock(lock);
+}
+
+#endif // _WIN32
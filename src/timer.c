@@ -0,0 +1,184 @@
+/*
+	timer.c - hierarchical timer wheel.
+
+	Timers expiring within next 256 ms are kept in per millisecond lists, timers further in time
+	are kept in coarser levels, each level is 64 times coarser than previous one.
+	When root wheel wraps around, next list of the first level is redistributed (cascaded) to finer lists, and so on.
+	So add/remove is O(1) and running the wheel touches only timers which are expired or being cascaded.
+
+	Wheel is not thread safe, each thread should have own wheel.
+*/
+
+#include "qwfwd.h"
+
+#define TIMER_ROOT_SIZE		(1 << TIMER_ROOT_BITS)
+#define TIMER_ROOT_MASK		(TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+#define TIMER_SHIFT(level)	(TIMER_ROOT_BITS + (level) * TIMER_LEVEL_BITS)
+#define TIMER_MAX_DELAY		((1u << TIMER_SHIFT(TIMER_LEVELS)) - 1) // ~18 hours, longer timers are clamped
+
+static void Timer_ListInit(wheel_timer_t *head)
+{
+	head->next = head->prev = head;
+}
+
+static void Timer_ListAppend(wheel_timer_t *head, wheel_timer_t *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void Timer_ListUnlink(wheel_timer_t *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+void Timer_Init(timer_wheel_t *wheel, unsigned int now)
+{
+	int i, j;
+
+	for (i = 0; i < TIMER_ROOT_SIZE; i++)
+		Timer_ListInit(&wheel->root[i]);
+
+	for (i = 0; i < TIMER_LEVELS; i++)
+		for (j = 0; j < TIMER_LEVEL_SIZE; j++)
+			Timer_ListInit(&wheel->levels[i][j]);
+
+	wheel->now = now;
+	wheel->count = 0;
+}
+
+// put timer in the list where it belongs, depending how far it is from wheel time
+static void Timer_Insert(timer_wheel_t *wheel, wheel_timer_t *t)
+{
+	unsigned int delay = t->expires - wheel->now;
+	int level;
+
+	if ((int)delay < 0)
+	{
+		// already expired, fire it on the next tick
+		Timer_ListAppend(&wheel->root[wheel->now & TIMER_ROOT_MASK], t);
+		return;
+	}
+
+	if (delay < TIMER_ROOT_SIZE)
+	{
+		Timer_ListAppend(&wheel->root[t->expires & TIMER_ROOT_MASK], t);
+		return;
+	}
+
+	if (delay > TIMER_MAX_DELAY)
+		t->expires = wheel->now + TIMER_MAX_DELAY;
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+	{
+		if (delay < (1u << TIMER_SHIFT(level + 1)))
+			break;
+	}
+
+	Timer_ListAppend(&wheel->levels[level][(t->expires >> TIMER_SHIFT(level)) & TIMER_LEVEL_MASK], t);
+}
+
+void Timer_Add(timer_wheel_t *wheel, wheel_timer_t *t, unsigned int expires)
+{
+	if (Timer_Pending(t))
+		Timer_Remove(wheel, t);
+
+	t->expires = expires;
+	Timer_Insert(wheel, t);
+	wheel->count++;
+}
+
+void Timer_Remove(timer_wheel_t *wheel, wheel_timer_t *t)
+{
+	if (!Timer_Pending(t))
+		return;
+
+	Timer_ListUnlink(t);
+	wheel->count--;
+}
+
+// move timers from the list of the level to finer lists, returns index of the list, so caller knows if level wrapped too
+static int Timer_Cascade(timer_wheel_t *wheel, int level)
+{
+	int index = (wheel->now >> TIMER_SHIFT(level)) & TIMER_LEVEL_MASK;
+	wheel_timer_t *head = &wheel->levels[level][index], *t;
+
+	while ((t = head->next) != head)
+	{
+		Timer_ListUnlink(t);
+		Timer_Insert(wheel, t);
+	}
+
+	return index;
+}
+
+void Timer_Run(timer_wheel_t *wheel, unsigned int now, timer_func_t func)
+{
+	wheel_timer_t *head, *t;
+	int level;
+
+	while ((int)(now - wheel->now) >= 0)
+	{
+		// nothing to do, just catch up
+		if (!wheel->count)
+		{
+			wheel->now = now + 1;
+			break;
+		}
+
+		// root wheel wrapped around, bring timers from the coarser levels
+		if (!(wheel->now & TIMER_ROOT_MASK))
+		{
+			for (level = 0; level < TIMER_LEVELS; level++)
+			{
+				if (Timer_Cascade(wheel, level))
+					break;
+			}
+		}
+
+		head = &wheel->root[wheel->now & TIMER_ROOT_MASK];
+		wheel->now++;
+
+		// NOTE: callback may add timers, even to the same list, but they have later time so they are not fired now
+		while ((t = head->next) != head && (int)(t->expires - now) <= 0)
+		{
+			Timer_ListUnlink(t);
+			wheel->count--;
+			func(t);
+		}
+	}
+}
+
+int Timer_NextTimeout(timer_wheel_t *wheel, unsigned int now, int max)
+{
+	unsigned int tick = wheel->now;
+	int i, timeout;
+
+	if (!wheel->count)
+		return max;
+
+	if ((int)(now - tick) >= 0)
+		return 0; // wheel is behind, run it first
+
+	for (i = 0; i < TIMER_ROOT_SIZE; i++, tick++)
+	{
+		timeout = (int)(tick - now);
+		if (timeout >= max)
+			return max;
+
+		// coarser levels may have something for the next round of the root wheel, we have to wake up and cascade it
+		if (!(tick & TIMER_ROOT_MASK))
+			return timeout;
+
+		if (wheel->root[tick & TIMER_ROOT_MASK].next != &wheel->root[tick & TIMER_ROOT_MASK])
+			return timeout;
+	}
+
+	return max;
+}
@@ -4,7 +4,7 @@ Some token parse functions, too expansive for stand alone file?
 
 #include "qwfwd.h"
 
-char com_token[MAX_COM_TOKEN];
+THREAD_LOCAL char com_token[MAX_COM_TOKEN];
 
 /*
 ==============
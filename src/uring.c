@@ -0,0 +1,646 @@
+/*
+	uring.c - io_uring network backend.
+
+	Every watched socket has one multishot recvmsg request armed, kernel picks buffer for each datagram
+	from the provided buffer ring, so we do not copy packets and do not do syscall per socket or per packet.
+	Datagrams queued with NET_SendPacket() become sendmsg requests, they are submitted together with the wait,
+	so in the best case whole main loop iteration costs us single io_uring_enter().
+
+	Needs kernel 6.0 or newer (multishot recvmsg), on older kernels URING_Init() fails and we use epoll.
+*/
+
+#include "qwfwd.h"
+
+#ifdef NET_URING
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+	#define __NR_io_uring_setup		425
+	#define __NR_io_uring_enter		426
+	#define __NR_io_uring_register	427
+#endif
+
+#define URING_SQ_ENTRIES	256
+#define URING_CQ_ENTRIES	4096
+#define URING_RECV_BUFFERS	256					// must be power of two
+#define URING_SEND_SLOTS	256
+#define URING_BGID			0					// id of our provided buffer group
+
+// layout of provided buffer: io_uring_recvmsg_out, sender address, payload
+#define URING_RECV_HEADER	(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+#define URING_RECV_SIZE		(URING_RECV_HEADER + MSG_BUF_SIZE)
+
+// user_data of request: type in top byte, generation in next three bytes, socket or send slot in low 32 bits
+#define URING_UD_RECV		1ULL
+#define URING_UD_POLL		2ULL
+#define URING_UD_SEND		3ULL
+#define URING_UD_CANCEL		4ULL
+
+#define URING_UD(type, gen, idx)	(((type) << 56) | (((unsigned long long)(gen) & 0xFFFFFF) << 32) | (unsigned int)(idx))
+#define URING_UD_TYPE(ud)			((ud) >> 56)
+#define URING_UD_GEN(ud)			((unsigned int)((ud) >> 32) & 0xFFFFFF)
+#define URING_UD_IDX(ud)			((unsigned int)(ud))
+
+static cvar_t *net_io_uring;
+
+// NOTE: each forwarding worker has own ring, so everything below is per thread
+THREAD_LOCAL qbool uring_active;
+
+// socket we watch, indexed by socket, since sockets are small numbers
+typedef struct uring_watch_s
+{
+	void			*data;		// passed back to the callback
+	unsigned int	gen;		// bumped on each watch/unwatch, so we can ignore completions of stale requests
+	qbool			active;		// we want events for this socket
+	qbool			armed;		// kernel has request for this socket
+	qbool			poll;		// readiness only (stdin), not datagrams
+} uring_watch_t;
+
+typedef struct uring_send_s
+{
+	struct msghdr		msg;
+	struct iovec		iov;
+	struct sockaddr_in	to;
+	byte				buf[MSG_BUF_SIZE];
+} uring_send_t;
+
+static THREAD_LOCAL int							ring_fd = -1;
+static THREAD_LOCAL byte						*ring;			// SQ and CQ rings are one mapping
+static THREAD_LOCAL size_t						ring_size, sqes_size;
+
+// submission queue
+static THREAD_LOCAL unsigned int				*sq_khead, *sq_ktail, *sq_array;
+static THREAD_LOCAL unsigned int				sq_mask, sq_entries, sq_tail;
+static THREAD_LOCAL struct io_uring_sqe			*sqes;
+
+// completion queue
+static THREAD_LOCAL unsigned int				*cq_khead, *cq_ktail;
+static THREAD_LOCAL unsigned int				cq_mask;
+static THREAD_LOCAL struct io_uring_cqe			*cqes;
+
+// provided buffers for receive
+static THREAD_LOCAL struct io_uring_buf_ring	*buf_ring;
+static THREAD_LOCAL unsigned short				buf_tail;
+static THREAD_LOCAL byte						*recv_buffers;
+static THREAD_LOCAL struct msghdr				recv_msg; // template for multishot recvmsg, only name and control lengths matter
+
+static THREAD_LOCAL uring_watch_t				*watches;
+static THREAD_LOCAL int							watches_size;
+
+static THREAD_LOCAL uring_send_t				*send_slots;
+static THREAD_LOCAL int							send_free[URING_SEND_SLOTS]; // stack of free slots
+static THREAD_LOCAL int							send_free_count;
+
+static int URING_Enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+	Stats_Inc(st_uring_enters);
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+// requests we put in SQ but kernel did not see yet
+static unsigned int URING_Pending(void)
+{
+	return sq_tail - __atomic_load_n(sq_khead, __ATOMIC_ACQUIRE);
+}
+
+// submit everything we have without waiting for completions
+void URING_Submit(void)
+{
+	unsigned int pending;
+
+	if (!uring_active)
+		return;
+
+	__atomic_store_n(sq_ktail, sq_tail, __ATOMIC_RELEASE);
+
+	if (!(pending = URING_Pending()))
+		return;
+
+	while (URING_Enter(pending, 0, 0, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+static struct io_uring_sqe *URING_GetSQE(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (sq_tail - __atomic_load_n(sq_khead, __ATOMIC_ACQUIRE) >= sq_entries)
+	{
+		URING_Submit(); // SQ is full, give it to kernel
+		if (sq_tail - __atomic_load_n(sq_khead, __ATOMIC_ACQUIRE) >= sq_entries)
+			return NULL;
+	}
+
+	idx = sq_tail & sq_mask;
+	sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[idx] = idx;
+	sq_tail++;
+
+	return sqe;
+}
+
+// give buffer back to kernel
+static void URING_RecycleBuffer(unsigned int bid)
+{
+	struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (URING_RECV_BUFFERS - 1)];
+
+	buf->addr = (unsigned long long)(uintptr_t)(recv_buffers + bid * URING_RECV_SIZE);
+	buf->len = URING_RECV_SIZE;
+	buf->bid = (unsigned short)bid;
+	buf_tail++;
+
+	__atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+static qbool URING_Arm(int s)
+{
+	uring_watch_t *w = &watches[s];
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = URING_GetSQE()))
+		return false;
+
+	sqe->fd = s;
+
+	if (w->poll)
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = URING_UD(URING_UD_POLL, w->gen, s);
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->addr = (unsigned long long)(uintptr_t)&recv_msg;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BGID;
+		sqe->user_data = URING_UD(URING_UD_RECV, w->gen, s);
+	}
+
+	w->armed = true;
+
+	return true;
+}
+
+static qbool URING_AddWatch(int s, void *data, qbool poll)
+{
+	uring_watch_t *w;
+
+	if (s < 0)
+		return false;
+
+	if (s >= watches_size)
+	{
+		int size = (watches_size * 2 > s + 1) ? watches_size * 2 : s + 1;
+		uring_watch_t *tmp = Sys_malloc(size * sizeof(*tmp));
+
+		if (watches)
+			memcpy(tmp, watches, watches_size * sizeof(*tmp));
+		Sys_free(watches);
+		watches = tmp;
+		watches_size = size;
+	}
+
+	w = &watches[s];
+	w->gen++;
+	w->data = data;
+	w->active = true;
+	w->poll = poll;
+
+	return URING_Arm(s);
+}
+
+// watch socket for datagrams, data will be passed to callback of URING_Wait()
+qbool URING_Watch(int s, void *data)
+{
+	return URING_AddWatch(s, data, false);
+}
+
+// watch descriptor for readiness, callback of URING_Wait() will be called without datagram
+qbool URING_WatchPoll(int s, void *data)
+{
+	return URING_AddWatch(s, data, true);
+}
+
+// stop watching socket, kernel request is cancelled right away, so socket can be closed after that
+void URING_Unwatch(int s)
+{
+	uring_watch_t *w;
+	struct io_uring_sqe *sqe;
+
+	if (s < 0 || s >= watches_size || !watches[s].active)
+		return;
+
+	w = &watches[s];
+	w->active = false;
+
+	if (w->armed && (sqe = URING_GetSQE()))
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = URING_UD(w->poll ? URING_UD_POLL : URING_UD_RECV, w->gen, s);
+		sqe->user_data = URING_UD(URING_UD_CANCEL, 0, s);
+	}
+
+	w->armed = false;
+	w->gen++; // anything still in CQ for this socket is stale now
+
+	URING_Submit();
+}
+
+//=============================================================================
+
+static void URING_SendError(int err)
+{
+	if (err == EWOULDBLOCK || err == ECONNREFUSED)
+		return;
+
+	Sys_Printf ("NET_SendPacket: io_uring sendmsg: (%i): %s\n", err, strerror (err));
+}
+
+void URING_SendPacket(int s, int length, const void *data, struct sockaddr_in *to)
+{
+	struct io_uring_sqe *sqe;
+	uring_send_t *slot;
+	int idx;
+
+	if (length < 0)
+		return;
+
+	if (!send_free_count || length > (int)sizeof(slot->buf) || !(sqe = URING_GetSQE()))
+	{
+		// we are out of send slots, rather unusual, so send it old way.
+		// submit what we have first, so datagrams are not reordered
+		URING_Submit();
+		Stats_Inc(st_uring_fallback);
+
+		if ((to ? sendto(s, (const char *) data, length, 0, (struct sockaddr *)to, sizeof(*to)) : send(s, (const char *) data, length, 0)) == SOCKET_ERROR)
+			URING_SendError(qerrno);
+		return;
+	}
+
+	idx = send_free[--send_free_count];
+	slot = &send_slots[idx];
+
+	memcpy(slot->buf, data, length);
+	slot->iov.iov_base = slot->buf;
+	slot->iov.iov_len = length;
+	memset(&slot->msg, 0, sizeof(slot->msg));
+	if (to) // connected socket gets no address
+	{
+		slot->to = *to;
+		slot->msg.msg_name = &slot->to;
+		slot->msg.msg_namelen = sizeof(slot->to);
+	}
+	slot->msg.msg_iov = &slot->iov;
+	slot->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = s;
+	sqe->addr = (unsigned long long)(uintptr_t)&slot->msg;
+	sqe->user_data = URING_UD(URING_UD_SEND, 0, idx);
+}
+
+//=============================================================================
+
+// datagram arrived, point net_message to it and let callback handle it
+static void URING_Packet(int s, uring_watch_t *w, unsigned int bid, int len, uring_func_t func)
+{
+	byte *buf = recv_buffers + bid * URING_RECV_SIZE;
+	struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+	byte *saved_data = net_message.data;
+	int saved_maxsize = net_message.maxsize;
+	int size;
+
+	if (len < (int)URING_RECV_HEADER)
+		return;
+
+	Stats_Inc(st_uring_recv);
+
+	memset(&net_from, 0, sizeof(net_from));
+	memcpy(&net_from, buf + sizeof(*out), out->namelen < sizeof(net_from) ? out->namelen : sizeof(net_from));
+	net_from_socket = s;
+
+	size = (int)out->payloadlen;
+
+	if ((out->flags & MSG_TRUNC) || size >= MSG_BUF_SIZE)
+	{
+		Sys_Printf ("NET_GetPacket: Oversize packet from %s\n", inet_ntoa(net_from.sin_addr));
+		return;
+	}
+
+	// no copy, net_message uses provided buffer while callback runs
+	net_message.data = buf + URING_RECV_HEADER;
+	net_message.maxsize = MSG_BUF_SIZE;
+	net_message.cursize = size;
+	net_message.overflowed = false;
+	net_message.data[size] = 0;
+
+	func(w->data);
+
+	net_message.data = saved_data;
+	net_message.maxsize = saved_maxsize;
+	SZ_Clear(&net_message);
+}
+
+static void URING_Completion(struct io_uring_cqe *cqe, uring_func_t func)
+{
+	unsigned long long ud = cqe->user_data;
+	int s = (int)URING_UD_IDX(ud);
+	qbool more = (cqe->flags & IORING_CQE_F_MORE);
+	qbool stale;
+	uring_watch_t *w;
+
+	switch (URING_UD_TYPE(ud))
+	{
+	case URING_UD_SEND:
+		if (cqe->res < 0)
+			URING_SendError(-cqe->res);
+		else
+			Stats_Inc(st_uring_sent);
+		send_free[send_free_count++] = (int)URING_UD_IDX(ud);
+		return;
+
+	case URING_UD_RECV:
+	case URING_UD_POLL:
+		w = &watches[s];
+		stale = (!w->active || w->gen != URING_UD_GEN(ud));
+
+		if (cqe->flags & IORING_CQE_F_BUFFER)
+		{
+			unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if (!stale && cqe->res >= 0)
+				URING_Packet(s, w, bid, cqe->res, func);
+			URING_RecycleBuffer(bid);
+		}
+		else if (!stale && URING_UD_TYPE(ud) == URING_UD_POLL && cqe->res >= 0)
+		{
+			func(w->data);
+		}
+
+		if (stale || more)
+			return;
+
+		// multishot request terminated, arm it again, unless kernel does not like it at all
+		w->armed = false;
+
+		// connected socket got ICMP port unreachable, callback sees it as net_refused with no datagram
+		if (cqe->res == -ECONNREFUSED)
+		{
+			net_refused = true;
+			func(w->data);
+			net_refused = false;
+			if (w->active)
+				URING_Arm(s);
+			return;
+		}
+
+		if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR && cqe->res != -EAGAIN)
+		{
+			Sys_Printf("URING: request for socket %d failed: (%i): %s\n", s, -cqe->res, strerror(-cqe->res));
+			if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP || cqe->res == -EBADF)
+				return;
+		}
+
+		URING_Arm(s);
+		return;
+
+	default:
+		return; // cancel or something we do not care about
+	}
+}
+
+// submit queued requests and wait up to msec for completions
+void URING_Wait(int msec)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int wait;
+	int ret;
+
+	__atomic_store_n(sq_ktail, sq_tail, __ATOMIC_RELEASE);
+
+	// there no point to sleep if we already have completions
+	wait = (*cq_khead == __atomic_load_n(cq_ktail, __ATOMIC_ACQUIRE)) ? 1 : 0;
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = msec / 1000;
+	ts.tv_nsec = (msec % 1000) * 1000000LL;
+	arg.ts = (unsigned long long)(uintptr_t)&ts;
+
+	ret = URING_Enter(URING_Pending(), wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY)
+		perror("io_uring_enter");
+}
+
+// process completions, func is called for each datagram and readiness event
+void URING_Dispatch(uring_func_t func)
+{
+	unsigned int head = *cq_khead, tail;
+
+	// process completions, callback may queue new requests, that fine, they will be submitted next time
+	for (;;)
+	{
+		tail = __atomic_load_n(cq_ktail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			break;
+
+		for ( ; head != tail; head++)
+		{
+			struct io_uring_cqe cqe = cqes[head & cq_mask];
+
+			// release entry before callback, so CQ does not overflow while we busy
+			__atomic_store_n(cq_khead, head + 1, __ATOMIC_RELEASE);
+
+			URING_Completion(&cqe, func);
+		}
+	}
+}
+
+//=============================================================================
+
+void URING_PrintStats(void)
+{
+	unsigned long long enters = Stats_Value(st_uring_enters), recv = Stats_Value(st_uring_recv), sent = Stats_Value(st_uring_sent);
+
+	if (!uring_active)
+		return;
+
+	Sys_Printf("io_uring: %llu enters, %llu packets received, %llu sent, %llu sent without io_uring, %.2f packets per enter\n",
+		enters, recv, sent, Stats_Value(st_uring_fallback), enters ? (double)(recv + sent) / enters : 0.0);
+}
+
+// also cleans up after URING_Init() which failed half way
+static void URING_Shutdown(void)
+{
+	if (ring)
+		munmap(ring, ring_size);
+	if (sqes)
+		munmap(sqes, sqes_size);
+	if (buf_ring)
+		munmap(buf_ring, URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+	ring = NULL;
+	sqes = NULL;
+	buf_ring = NULL;
+
+	if (ring_fd >= 0)
+		close(ring_fd); // kernel frees rings and cancels requests
+	ring_fd = -1;
+
+	Sys_free(recv_buffers);
+	Sys_free(send_slots);
+	Sys_free(watches);
+	watches_size = 0;
+	send_free_count = 0;
+
+	uring_active = false;
+}
+
+// try to set up io_uring, return false if kernel can't do what we need
+qbool URING_Init(void)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	size_t sq_size, cq_size;
+	int i;
+
+	// NOTE: main thread gets here first, so worker threads do not touch cvars
+	if (!net_io_uring)
+		net_io_uring = Cvar_Get("net_io_uring", "1", CVAR_NOSET);
+
+	if (!net_io_uring->integer)
+		return false;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = URING_CQ_ENTRIES;
+
+	if ((ring_fd = (int)syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p)) < 0)
+	{
+		// COOP_TASKRUN is 5.19+, ask without it
+		p.flags &= ~IORING_SETUP_COOP_TASKRUN;
+		if ((ring_fd = (int)syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p)) < 0)
+		{
+			Sys_Printf("URING_Init: io_uring_setup: (%i): %s\n", errno, strerror(errno));
+			return false;
+		}
+	}
+
+	if ((p.features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP))
+		!= (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP))
+	{
+		Sys_Printf("URING_Init: kernel is too old\n");
+		URING_Shutdown();
+		return false;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+	sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	// one of them may succeed, so URING_Shutdown() gets NULL for the failed one
+	if ((ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING)) == MAP_FAILED)
+		ring = NULL;
+	if ((sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES)) == MAP_FAILED)
+		sqes = NULL;
+	if (!ring || !sqes)
+	{
+		Sys_Printf("URING_Init: mmap: (%i): %s\n", errno, strerror(errno));
+		URING_Shutdown();
+		return false;
+	}
+
+	sq_khead	= (unsigned int *)(ring + p.sq_off.head);
+	sq_ktail	= (unsigned int *)(ring + p.sq_off.tail);
+	sq_array	= (unsigned int *)(ring + p.sq_off.array);
+	sq_mask		= *(unsigned int *)(ring + p.sq_off.ring_mask);
+	sq_entries	= p.sq_entries;
+	sq_tail		= *sq_ktail;
+
+	cq_khead	= (unsigned int *)(ring + p.cq_off.head);
+	cq_ktail	= (unsigned int *)(ring + p.cq_off.tail);
+	cq_mask		= *(unsigned int *)(ring + p.cq_off.ring_mask);
+	cqes		= (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	// provided buffer ring, must be page aligned
+	buf_ring = mmap(NULL, URING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf_ring == MAP_FAILED)
+	{
+		buf_ring = NULL;
+		Sys_Printf("URING_Init: mmap: (%i): %s\n", errno, strerror(errno));
+		URING_Shutdown();
+		return false;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)(uintptr_t)buf_ring;
+	reg.ring_entries = URING_RECV_BUFFERS;
+	reg.bgid = URING_BGID;
+
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		Sys_Printf("URING_Init: can't register buffer ring: (%i): %s\n", errno, strerror(errno));
+		URING_Shutdown();
+		return false;
+	}
+
+	recv_buffers = Sys_malloc(URING_RECV_BUFFERS * URING_RECV_SIZE);
+	for (i = 0; i < URING_RECV_BUFFERS; i++)
+		URING_RecycleBuffer(i);
+
+	recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+	send_slots = Sys_malloc(URING_SEND_SLOTS * sizeof(*send_slots));
+	for (i = URING_SEND_SLOTS - 1; i >= 0; i--)
+		send_free[send_free_count++] = i;
+
+	uring_active = true;
+
+	Sys_Printf("io_uring network backend initialized\n");
+
+	return true;
+}
+
+// check that kernel accepted multishot recvmsg for the socket, if it did not then we have to use something else.
+// NOTE: call it right after first URING_Watch()
+qbool URING_CheckWatch(int s)
+{
+	unsigned int head, tail;
+	qbool ok = true;
+
+	URING_Submit();
+
+	// unsupported request fails right during submit, so its completion is already here
+	head = *cq_khead;
+	tail = __atomic_load_n(cq_ktail, __ATOMIC_ACQUIRE);
+	for ( ; head != tail; head++)
+	{
+		struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+
+		if (URING_UD_TYPE(cqe->user_data) == URING_UD_RECV && (int)URING_UD_IDX(cqe->user_data) == s
+			&& cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE))
+			ok = false;
+	}
+
+	if (!ok)
+	{
+		Sys_Printf("URING_Init: kernel does not support multishot recvmsg\n");
+		URING_Shutdown();
+	}
+
+	return ok;
+}
+
+#endif // NET_URING
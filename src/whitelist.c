@@ -1,17 +1,136 @@
 #include "qwfwd.h"
 
-#define WHITELIST_MAX_ADDRS 4096
+// whitelist of remote hosts peers allowed to connect to, empty whitelist allows everything.
+// exact hosts are in the hash set, CIDR ranges are in the prefix trie, there is no limit on the size.
+// on config reload new whitelist is built aside, so workers see either old or new list, never half built one.
 
-static int whitelist_count;
-static unsigned int whitelist[WHITELIST_MAX_ADDRS];
+#define WHITELIST_HASH_MIN_SIZE 64 // must be power of two
+
+typedef struct whitelist_s
+{
+	unsigned int	*hosts;			// open addressing hash set of addresses in network byte order, 0 marks empty slot
+	unsigned int	hosts_size;		// always power of two
+	int				hosts_count;
+	iptrie_t		ranges;			// CIDR ranges, and 0.0.0.0 if someone adds it, since it can't be in the hash set
+} whitelist_t;
+
+static whitelist_t	whitelists[2];
+static whitelist_t	*whitelist;			// what we check addresses against
+static whitelist_t	*whitelist_edit;	// what commands change, differs from "whitelist" only while we reload config
 
 static void Cmd_Whitelist_f (void);
 static void Cmd_WhitelistAdd_f (void);
 static void Cmd_WhitelistRemove_f (void);
 
+static char whitelist_range_tag; // value for the ranges in the trie, we only need to know prefix is there
+
+static int Whitelist_Count(whitelist_t *list)
+{
+	return list->hosts_count + list->ranges.count;
+}
+
+static qbool Whitelist_HasHost(whitelist_t *list, unsigned int ip)
+{
+	unsigned int i, mask;
+
+	if (!list->hosts_count)
+		return false;
+
+	mask = list->hosts_size - 1;
+
+	for (i = Hash_Int(ip) & mask; list->hosts[i]; i = (i + 1) & mask)
+	{
+		if (list->hosts[i] == ip)
+			return true;
+	}
+
+	return false;
+}
+
+static void Whitelist_InsertHost(whitelist_t *list, unsigned int ip); // forward reference
+
+static void Whitelist_Resize(whitelist_t *list, unsigned int size)
+{
+	unsigned int	*old = list->hosts;
+	unsigned int	old_size = list->hosts_size, i;
+
+	list->hosts = Sys_malloc(size * sizeof(*list->hosts));
+	list->hosts_size = size;
+	list->hosts_count = 0;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old[i])
+			Whitelist_InsertHost(list, old[i]);
+	}
+
+	Sys_free(old);
+}
+
+// NOTE: caller checks ip is not in the set already
+static void Whitelist_InsertHost(whitelist_t *list, unsigned int ip)
+{
+	unsigned int i, mask;
+
+	// keep load factor below 1/2
+	if (!list->hosts || (unsigned int)(list->hosts_count + 1) * 2 > list->hosts_size)
+		Whitelist_Resize(list, list->hosts ? list->hosts_size * 2 : WHITELIST_HASH_MIN_SIZE);
+
+	mask = list->hosts_size - 1;
+
+	for (i = Hash_Int(ip) & mask; list->hosts[i]; i = (i + 1) & mask)
+		;
+
+	list->hosts[i] = ip;
+	list->hosts_count++;
+}
+
+static qbool Whitelist_RemoveHost(whitelist_t *list, unsigned int ip)
+{
+	unsigned int i, j, k, mask;
+
+	if (!list->hosts_count)
+		return false;
+
+	mask = list->hosts_size - 1;
+
+	for (i = Hash_Int(ip) & mask; list->hosts[i] != ip; i = (i + 1) & mask)
+	{
+		if (!list->hosts[i])
+			return false;
+	}
+
+	// backward shift deletion, so we do not need tombstones
+	for (j = (i + 1) & mask; list->hosts[j]; j = (j + 1) & mask)
+	{
+		k = Hash_Int(list->hosts[j]) & mask;
+
+		if (Hash_CanShift(i, j, k))
+		{
+			list->hosts[i] = list->hosts[j];
+			i = j;
+		}
+	}
+
+	list->hosts[i] = 0;
+	list->hosts_count--;
+
+	return true;
+}
+
+static void Whitelist_Clear(whitelist_t *list)
+{
+	Sys_free(list->hosts);
+	list->hosts_size = 0;
+	list->hosts_count = 0;
+	IPTrie_Clear(&list->ranges);
+}
+
 void Whitelist_Init(void)
 {
-	whitelist_count = 0;
+	IPTrie_Init(&whitelists[0].ranges);
+	IPTrie_Init(&whitelists[1].ranges);
+	whitelist = whitelist_edit = &whitelists[0];
 
 	Cmd_AddCommand("whitelist", Cmd_Whitelist_f);
 	Cmd_AddCommand("whitelistadd", Cmd_WhitelistAdd_f);
@@ -19,23 +138,36 @@ void Whitelist_Init(void)
 	Cmd_AddCommand("whitelistpurge", Cmd_WhitelistPurge_f);
 }
 
-qbool SV_IsWhitelisted(struct sockaddr_in *addr)
+void Whitelist_BeginReload(void)
+{
+	// commands fill the spare list from now, addresses still checked against the current one
+	whitelist_edit = (whitelist == &whitelists[0]) ? &whitelists[1] : &whitelists[0];
+	Whitelist_Clear(whitelist_edit);
+}
+
+void Whitelist_EndReload(void)
 {
-	int i;
+	whitelist_t *old = whitelist;
+
+	if (whitelist_edit == whitelist)
+		return; // Whitelist_BeginReload() was not called
+
+	whitelist = whitelist_edit;
+	Whitelist_Clear(old);
+}
 
-	if (!whitelist_count)
+qbool SV_IsWhitelisted(struct sockaddr_in *addr)
+{
+	if (!Whitelist_Count(whitelist))
 	{
 		return true;
 	}
 
-	for (i = 0; i < whitelist_count; i++)
+	if (Whitelist_HasHost(whitelist, addr->sin_addr.s_addr) || IPTrie_Lookup(&whitelist->ranges, ntohl(addr->sin_addr.s_addr), NULL))
 	{
-		if (addr->sin_addr.s_addr == whitelist[i])
-		{
-			Sys_DPrintf("connection from %s allowed: address found in whitelist\n",
-				inet_ntoa(addr->sin_addr));
-			return true;
-		}
+		Sys_DPrintf("connection from %s allowed: address found in whitelist\n",
+			inet_ntoa(addr->sin_addr));
+		return true;
 	}
 
 	Sys_DPrintf("connection from %s dropped: address NOT in whitelist\n",
@@ -43,102 +175,119 @@ qbool SV_IsWhitelisted(struct sockaddr_in *addr)
 	return false;
 }
 
+static void Whitelist_PrintRange(unsigned int prefix, int len, void *value, void *arg)
+{
+	struct in_addr addr;
+
+	addr.s_addr = htonl(prefix);
+	Sys_Printf("%s/%d\n", inet_ntoa(addr), len);
+}
+
 static void Cmd_Whitelist_f(void)
 {
 	struct in_addr addr;
-	int i;
+	unsigned int i;
 
-	Sys_Printf("whitelist: %d addresses\n", whitelist_count);
+	Sys_Printf("whitelist: %d addresses\n", Whitelist_Count(whitelist_edit));
 
-	for (i = 0; i < whitelist_count; i++)
+	for (i = 0; i < whitelist_edit->hosts_size; i++)
 	{
-		addr.s_addr = whitelist[i];
+		if (!whitelist_edit->hosts[i])
+			continue;
+
+		addr.s_addr = whitelist_edit->hosts[i];
 		Sys_Printf("%s\n", inet_ntoa(addr));
 	}
+
+	IPTrie_Walk(&whitelist_edit->ranges, Whitelist_PrintRange, NULL);
+}
+
+// parse "a.b.c.d" or "a.b.c.d/len", single host returned as /32
+static qbool Whitelist_ParseAddress(const char *s, unsigned int *ip, int *len)
+{
+	unsigned int prefix;
+
+	if (!IPTrie_ParseCIDR(s, &prefix, len))
+		return false;
+
+	*ip = htonl(prefix);
+
+	return true;
 }
 
 static void Cmd_WhitelistAdd_f(void)
 {
 	char *ip_str;
-	int ip;
-	int i;
+	unsigned int ip;
+	int len;
 
 	if (Cmd_Argc() != 2)
 	{
-		Sys_Printf("usage: whitelistadd <ip>\n");
-		return;
-	}
-
-	if (whitelist_count >= WHITELIST_MAX_ADDRS)
-	{
-		Sys_Printf("error: whitelist is full\n");
+		Sys_Printf("usage: whitelistadd <ip[/bits]>\n");
 		return;
 	}
 
 	ip_str = Cmd_Argv(1);
 
-	ip = inet_addr(ip_str);
-	if (ip == INADDR_NONE)
+	if (!Whitelist_ParseAddress(ip_str, &ip, &len))
 	{
 		Sys_Printf("error: invalid IP address %s\n", ip_str);
 		return;
 	}
 
-	for (i = 0; i < whitelist_count; i++)
+	if (len == 32 && ip)
 	{
-		if (ip == whitelist[i])
+		if (Whitelist_HasHost(whitelist_edit, ip))
 		{
 			Sys_Printf("error: %s has already been added to the whitelist\n", ip_str);
 			return;
 		}
+
+		Whitelist_InsertHost(whitelist_edit, ip);
+		return;
 	}
 
-	whitelist[whitelist_count++] = ip;
+	if (IPTrie_Insert(&whitelist_edit->ranges, ntohl(ip), len, &whitelist_range_tag))
+	{
+		Sys_Printf("error: %s has already been added to the whitelist\n", ip_str);
+		return;
+	}
 }
 
 
 static void Cmd_WhitelistRemove_f(void)
 {
 	char *ip_str;
-	int ip;
-	int i;
-	int j;
+	unsigned int ip;
+	int len;
+	qbool removed;
 
 	if (Cmd_Argc() != 2)
 	{
-		Sys_Printf("usage: whitelistremove <ip>\n");
+		Sys_Printf("usage: whitelistremove <ip[/bits]>\n");
 		return;
 	}
 
 	ip_str = Cmd_Argv(1);
 
-	ip = inet_addr(ip_str);
-	if (ip == INADDR_NONE)
+	if (!Whitelist_ParseAddress(ip_str, &ip, &len))
 	{
 		Sys_Printf("error: invalid IP address %s\n", ip_str);
 		return;
 	}
 
-	for (i = 0; i < whitelist_count; i++)
-	{
-		if (whitelist[i] == ip)
-		{
-			for (j = i; j < whitelist_count - 1; j++)
-			{
-				whitelist[j] = whitelist[j + 1];
-			}
-
-			whitelist_count--;
-			Sys_Printf("%s removed from whitelist\n", ip_str);
-			return;
-		}
-	}
+	if (len == 32 && ip)
+		removed = Whitelist_RemoveHost(whitelist_edit, ip);
+	else
+		removed = (IPTrie_Remove(&whitelist_edit->ranges, ntohl(ip), len) != NULL);
 
-	Sys_Printf("error: %s not found in whitelist\n", ip_str);
+	if (removed)
+		Sys_Printf("%s removed from whitelist\n", ip_str);
+	else
+		Sys_Printf("error: %s not found in whitelist\n", ip_str);
 }
 
 void Cmd_WhitelistPurge_f(void)
 {
-	whitelist_count = 0;
-	memset(whitelist, 0, WHITELIST_MAX_ADDRS * sizeof(unsigned int));
+	Whitelist_Clear(whitelist_edit);
 }
@@ -0,0 +1,1114 @@
+/*
+	bench.c - load generator for qwfwd.
+
+	Starts qwfwd (or uses one which is already running), a stub game server and a bunch of QW and Q3 clients,
+	everything over loopback. Clients go through the same getchallenge -> connect (with prx key) -> netchan
+	sequence as real ones, stub server answers challenges and connects the way CL_ConnectionlessPacket_QW()
+	and CL_ConnectionlessPacket_Q3() of the proxy expect, and echoes netchan packets back.
+
+	Every netchan packet carries the time it was sent, clients and stub server live in one process,
+	so each packet which made it through the proxy gives one way forwarding latency.
+
+	With -R it replays traffic recorded with "capture start" instead of synthetic one: one client per recorded peer,
+	datagrams of clients are sent by clients, datagrams of servers are sent by stub server, with recorded timing
+	(sped up with -x, or as fast as possible). Recorded datagrams which are big enough carry the time stamp as well,
+	it overwrites part of the payload, but the proxy does not look there.
+*/
+
+#include "qwfwd.h"
+#include <poll.h>
+
+#define BENCH_STAMP_OFS			12		// netchan header, qport and some spare, then our stamp
+#define BENCH_PACKET_MIN		(BENCH_STAMP_OFS + (int)sizeof(bench_stamp_t))
+#define BENCH_RESEND			200		// ms, resend challenge/connect if no reply
+#define BENCH_CONNECT_TIMEOUT	10000	// ms, give up waiting for clients to connect
+#define BENCH_DRAIN				300		// ms, wait for packets in flight after traffic stopped
+#define BENCH_FLOOD_RESEND		100		// ms, in flood mode send again if nothing came back
+#define BENCH_CHALLENGE			31337	// what stub server uses as challenge
+#define BENCH_STAMP_MAGIC		0x51574642	// tells packet with our stamp from recorded one without it
+#define BENCH_REPLAY_POLL		64		// max speed replay reads what came back after that much datagrams
+
+#define BENCH_HIST_SUB			32		// sub buckets per power of two, ~3% precision
+#define BENCH_HIST_SIZE			(2 * BENCH_HIST_SUB + 40 * BENCH_HIST_SUB)
+
+typedef struct bench_stamp_s
+{
+	unsigned int		magic;		// BENCH_STAMP_MAGIC
+	unsigned int		seq;
+	unsigned long long	sent;		// Bench_Time() when packet was sent
+} bench_stamp_t;
+
+// log linear histogram of nanoseconds
+typedef struct bench_hist_s
+{
+	unsigned long long	count[BENCH_HIST_SIZE];
+	unsigned long long	total;
+} bench_hist_t;
+
+typedef enum
+{
+	bc_challenge,	// waiting for challenge from proxy
+	bc_connect,		// waiting for connect reply from proxy
+	bc_upstream,	// proxy said ok, waiting for stub server to see the connect
+	bc_ready,		// sending traffic
+} bench_state_t;
+
+typedef struct bench_client_s
+{
+	int					s;
+	protocol_t			proto;
+	bench_state_t		state;
+	int					qport;
+	int					challenge;
+	unsigned long long	sent;			// Bench_Time() of last challenge/connect packet
+	unsigned long long	ready_time;		// Bench_Time() when client got connected
+	unsigned long long	next_send;		// Bench_Time() of next netchan packet
+	unsigned int		seq;
+	volatile int		upstream;		// stub server saw the connect, set by server thread
+	struct sockaddr_in	upstream_addr;	// peer socket of the proxy, as stub server sees it
+	int					userid;			// recorded peer we replay
+} bench_client_t;
+
+// datagram of the capture we replay
+typedef struct bench_record_s
+{
+	unsigned long long	usec;		// since capture started
+	int					client;		// index in bench_clients
+	capture_dir_t		dir;
+	int					size;
+	byte				*data;
+} bench_record_t;
+
+static bench_client_t	*bench_clients;
+static int				bench_clients_count;
+static struct pollfd	*bench_pollfds;
+
+static int				bench_server_socket = -1;
+static int				bench_server_port;
+static volatile int		bench_stop;
+static qbool			bench_sending;			// traffic phase, clients send netchan packets
+static sys_sem_t		bench_server_done;
+
+static struct sockaddr_in bench_proxy;
+static pid_t			bench_proxy_pid;		// 0 if proxy was not started by us
+static char				bench_dir[64];			// working directory of the proxy we started
+
+// options
+static int				opt_qw = 32;
+static int				opt_q3 = 8;
+static int				opt_rate = 77;			// packets per second per client, 0 means as fast as possible
+static int				opt_window = 4;			// packets in flight per client when rate is 0
+static int				opt_seconds = 10;
+static int				opt_client_size = 48;
+static int				opt_server_size = 160;
+static int				opt_workers;
+static const char		*opt_binary = QWFWD_BENCH_BINARY;
+static int				opt_port;				// use already running proxy on that port
+static int				opt_pid;				// and read cpu usage of that process
+static char				opt_extra[1024];		// extra lines for qwfwd.cfg
+static const char		*opt_replay;			// capture file to replay
+static double			opt_speed = 1;			// replay speed, 0 means as fast as possible
+
+static bench_record_t	*bench_records;
+static int				bench_records_count;
+static unsigned long long bench_unstamped;		// replayed datagrams too small for the stamp
+
+// results, server ones are written by server thread only
+static bench_hist_t		hist_up;				// client -> server
+static bench_hist_t		hist_down;				// server -> client
+static unsigned long long server_received, server_sent;
+static unsigned long long client_received, client_sent;
+
+static unsigned long long Bench_Time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void Bench_Error(const char *fmt, ...)
+{
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	fprintf(stderr, "error: ");
+	vfprintf(stderr, fmt, argptr);
+	fprintf(stderr, "\n");
+	va_end(argptr);
+
+	if (bench_proxy_pid)
+	{
+		kill(bench_proxy_pid, SIGTERM);
+		waitpid(bench_proxy_pid, NULL, 0);
+		fprintf(stderr, "proxy output is in %s/qwfwd.log\n", bench_dir);
+	}
+
+	exit(1);
+}
+
+//=============================================================================
+// histogram
+
+static int Bench_HistIndex(unsigned long long v)
+{
+	int shift = 0;
+
+	if (v < 2 * BENCH_HIST_SUB)
+		return (int)v;
+
+	while ((v >> shift) >= 2 * BENCH_HIST_SUB)
+		shift++;
+
+	return (shift + 1) * BENCH_HIST_SUB + (int)(v >> shift) - BENCH_HIST_SUB;
+}
+
+static unsigned long long Bench_HistValue(int index)
+{
+	int shift;
+
+	if (index < 2 * BENCH_HIST_SUB)
+		return index;
+
+	shift = index / BENCH_HIST_SUB - 1;
+
+	// middle of the bucket
+	return ((unsigned long long)(index % BENCH_HIST_SUB + BENCH_HIST_SUB) << shift) + (1ull << shift) / 2;
+}
+
+static void Bench_HistAdd(bench_hist_t *h, unsigned long long v)
+{
+	int i = Bench_HistIndex(v);
+
+	h->count[i < BENCH_HIST_SIZE ? i : BENCH_HIST_SIZE - 1]++;
+	h->total++;
+}
+
+static void Bench_HistMerge(bench_hist_t *to, const bench_hist_t *from)
+{
+	int i;
+
+	for (i = 0; i < BENCH_HIST_SIZE; i++)
+		to->count[i] += from->count[i];
+
+	to->total += from->total;
+}
+
+static unsigned long long Bench_HistPercentile(const bench_hist_t *h, double q)
+{
+	unsigned long long want, seen = 0;
+	int i;
+
+	if (!h->total)
+		return 0;
+
+	want = (unsigned long long)(h->total * q);
+	want = want < h->total ? want : h->total - 1;
+
+	for (i = 0; i < BENCH_HIST_SIZE; i++)
+	{
+		seen += h->count[i];
+		if (seen > want)
+			return Bench_HistValue(i);
+	}
+
+	return Bench_HistValue(BENCH_HIST_SIZE - 1);
+}
+
+//=============================================================================
+// sockets
+
+static int Bench_Socket(int port)
+{
+	struct sockaddr_in addr;
+	int s, size = 4 * 1024 * 1024;
+
+	if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+		Bench_Error("socket: %s", strerror(errno));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((unsigned short)port);
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		Bench_Error("bind: %s", strerror(errno));
+
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));
+	setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *)&size, sizeof(size));
+
+	return s;
+}
+
+static int Bench_SocketPort(int s)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	getsockname(s, (struct sockaddr *)&addr, &len);
+
+	return ntohs(addr.sin_port);
+}
+
+static void Bench_OutOfBand(int s, struct sockaddr_in *to, const char *fmt, ...)
+{
+	va_list argptr;
+	char buf[MAX_MSGLEN];
+	int len;
+
+	memcpy(buf, "\xff\xff\xff\xff", 4);
+	va_start(argptr, fmt);
+	len = vsnprintf(buf + 4, sizeof(buf) - 4, fmt, argptr);
+	va_end(argptr);
+
+	sendto(s, buf, 4 + len, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+//=============================================================================
+// stub server
+
+static bench_client_t *Bench_ClientFromUserinfo(const char *s)
+{
+	const char *name = strstr(s, "\\name\\bench");
+	unsigned int i;
+
+	if (!name)
+		return NULL;
+
+	i = (unsigned int)atoi(name + sizeof("\\name\\bench") - 1);
+
+	return i < (unsigned int)bench_clients_count ? &bench_clients[i] : NULL;
+}
+
+static void Bench_ServerConnectionless(byte *data, int size, struct sockaddr_in *from)
+{
+	bench_client_t *c;
+	sizebuf_t msg;
+	byte buf[MAX_MSGLEN * 2];
+	char *s;
+
+	if (!strncmp((char *)data + 4, "getchallenge\n", sizeof("getchallenge\n") - 1))
+	{
+		Bench_OutOfBand(bench_server_socket, from, "%c%d", S2C_CHALLENGE, BENCH_CHALLENGE);
+		return;
+	}
+
+	if (!strncmp((char *)data + 4, "getchallenge", sizeof("getchallenge") - 1))
+	{
+		Bench_OutOfBand(bench_server_socket, from, "challengeResponse %d", BENCH_CHALLENGE);
+		return;
+	}
+
+	if (strncmp((char *)data + 4, "connect ", sizeof("connect ") - 1))
+		return;
+
+	// q3 connect is compressed, see SV_ConnectionlessPacket() of the proxy
+	SZ_InitEx(&msg, buf, sizeof(buf) - 1, true);
+	SZ_Write(&msg, data, size);
+	if (msg.cursize > 12 && msg.data[12] < ' ')
+		Huff_DecryptPacket(&msg, 12);
+	msg.data[msg.cursize] = 0;
+	s = (char *)msg.data + 4;
+
+	if (!(c = Bench_ClientFromUserinfo(s)))
+		return;
+
+	if (c->proto == pr_qw)
+		Bench_OutOfBand(bench_server_socket, from, "%c", S2C_CONNECTION);
+	else
+		Bench_OutOfBand(bench_server_socket, from, "connectResponse");
+
+	c->upstream_addr = *from;
+	Sys_AtomicStore(&c->upstream, 1);
+}
+
+static void Bench_ServerThread(void *arg)
+{
+	struct pollfd pfd;
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	bench_stamp_t stamp;
+	byte data[MAX_MSGLEN + 1], reply[MAX_MSGLEN];
+	unsigned int seq = 0;
+	int size;
+
+	memset(reply, 0, sizeof(reply));
+	pfd.fd = bench_server_socket;
+	pfd.events = POLLIN;
+
+	while (!Sys_AtomicLoad(&bench_stop))
+	{
+		if (poll(&pfd, 1, 50) <= 0)
+			continue;
+
+		for (;;)
+		{
+			fromlen = sizeof(from);
+			if ((size = recvfrom(bench_server_socket, (char *)data, sizeof(data) - 1, 0, (struct sockaddr *)&from, &fromlen)) < 0)
+				break;
+
+			if (size >= 4 && *(int *)data == -1)
+			{
+				data[size] = 0;
+				Bench_ServerConnectionless(data, size, &from);
+				continue;
+			}
+
+			if (size < BENCH_PACKET_MIN)
+				continue; // q3 disconnect probe of the proxy or something like that
+
+			memcpy(&stamp, data + BENCH_STAMP_OFS, sizeof(stamp));
+			if (stamp.magic != BENCH_STAMP_MAGIC)
+				continue; // replayed datagram without stamp
+
+			Bench_HistAdd(&hist_up, Bench_Time() - stamp.sent);
+			server_received++;
+
+			if (opt_replay)
+				continue; // recorded server traffic is sent by main thread
+
+			// echo it back, with our own stamp
+			seq++;
+			memcpy(reply, &seq, 4);
+			memcpy(reply + 4, &stamp.seq, 4);
+			stamp.sent = Bench_Time();
+			memcpy(reply + BENCH_STAMP_OFS, &stamp, sizeof(stamp));
+			sendto(bench_server_socket, (char *)reply, opt_server_size, 0, (struct sockaddr *)&from, fromlen);
+			server_sent++;
+		}
+	}
+
+	Sys_SemPost(&bench_server_done);
+}
+
+//=============================================================================
+// clients
+
+static void Bench_SendChallenge(bench_client_t *c)
+{
+	Bench_OutOfBand(c->s, &bench_proxy, "getchallenge%s", c->proto == pr_qw ? "\n" : "");
+	c->state = bc_challenge;
+	c->sent = Bench_Time();
+}
+
+static void Bench_SendConnect(bench_client_t *c)
+{
+	char data[MAX_MSGLEN];
+	byte msg_data[MAX_MSGLEN];
+	sizebuf_t msg;
+	int i = c - bench_clients;
+
+	c->state = bc_connect;
+	c->sent = Bench_Time();
+
+	if (c->proto == pr_qw)
+	{
+		Bench_OutOfBand(c->s, &bench_proxy, "connect %d %d %d \"\\name\\bench%d\\" QWFWD_PRX_KEY "\\127.0.0.1:%d\"\n",
+			QW_PROTOCOL_VERSION, c->qport, c->challenge, i, bench_server_port);
+		return;
+	}
+
+	// the same way CL_SendConnectPacket_Q3() does it
+	snprintf(data, sizeof(data), "\xff\xff\xff\xff" "connect \"\\challenge\\%d\\qport\\%d\\protocol\\68\\name\\bench%d\\" QWFWD_PRX_KEY "\\127.0.0.1:%d\"",
+		c->challenge, c->qport, i, bench_server_port);
+	SZ_InitEx(&msg, msg_data, sizeof(msg_data), true);
+	SZ_Print(&msg, data);
+	Huff_EncryptPacket(&msg, 12);
+
+	sendto(c->s, (char *)msg.data, msg.cursize, 0, (struct sockaddr *)&bench_proxy, sizeof(bench_proxy));
+}
+
+static void Bench_SendNetchan(bench_client_t *c)
+{
+	byte data[MAX_MSGLEN];
+	bench_stamp_t stamp;
+
+	memset(data, 0, opt_client_size);
+	c->seq++;
+	memcpy(data, &c->seq, 4);
+	if (c->proto == pr_qw)
+	{
+		data[8] = c->qport & 0xff;
+		data[9] = c->qport >> 8;
+	}
+	else
+	{
+		data[4] = c->qport & 0xff;
+		data[5] = c->qport >> 8;
+	}
+
+	stamp.magic = BENCH_STAMP_MAGIC;
+	stamp.seq = c->seq;
+	stamp.sent = Bench_Time();
+	memcpy(data + BENCH_STAMP_OFS, &stamp, sizeof(stamp));
+
+	sendto(c->s, (char *)data, opt_client_size, 0, (struct sockaddr *)&bench_proxy, sizeof(bench_proxy));
+	client_sent++;
+}
+
+static void Bench_SendDrop(bench_client_t *c)
+{
+	byte data[64];
+	int i;
+
+	if (c->proto != pr_qw)
+		return; // q3 clients are detected as gone by the proxy itself
+
+	memset(data, 0, sizeof(data));
+	data[8] = c->qport & 0xff;
+	data[9] = c->qport >> 8;
+	data[10] = clc_stringcmd;
+	strlcpy((char *)data + 11, "drop", sizeof(data) - 11);
+
+	for (i = 0; i < 3; i++)
+		sendto(c->s, (char *)data, 11 + sizeof("drop"), 0, (struct sockaddr *)&bench_proxy, sizeof(bench_proxy));
+}
+
+// connectionless reply from the proxy
+static void Bench_ClientConnectionless(bench_client_t *c, char *s)
+{
+	if (c->proto == pr_qw)
+	{
+		if (s[0] == S2C_CHALLENGE && c->state == bc_challenge)
+		{
+			c->challenge = atoi(s + 1);
+			Bench_SendConnect(c);
+		}
+		else if (s[0] == S2C_CONNECTION && c->state == bc_connect)
+		{
+			c->state = bc_upstream;
+		}
+		else if (s[0] == A2C_PRINT)
+		{
+			Bench_Error("proxy refused client %d: %s", (int)(c - bench_clients), s + 1);
+		}
+		return;
+	}
+
+	if (!strncmp(s, "challengeResponse ", sizeof("challengeResponse ") - 1) && c->state == bc_challenge)
+	{
+		c->challenge = atoi(s + sizeof("challengeResponse ") - 1);
+		Bench_SendConnect(c);
+	}
+	else if (!strcmp(s, "connectResponse") && c->state == bc_connect)
+	{
+		c->state = bc_upstream;
+	}
+	else if (!strncmp(s, "print\n", sizeof("print\n") - 1) && !strstr(s, "/reconnect"))
+	{
+		Bench_Error("proxy refused client %d: %s", (int)(c - bench_clients), s + sizeof("print\n") - 1);
+	}
+}
+
+static void Bench_ClientRead(bench_client_t *c)
+{
+	byte data[MAX_MSGLEN + 1];
+	bench_stamp_t stamp;
+	int size;
+
+	while ((size = recv(c->s, (char *)data, sizeof(data) - 1, 0)) >= 0)
+	{
+		if (size >= 4 && *(int *)data == -1)
+		{
+			data[size] = 0;
+			Bench_ClientConnectionless(c, (char *)data + 4);
+			continue;
+		}
+
+		if (size < BENCH_PACKET_MIN || c->state != bc_ready)
+			continue;
+
+		memcpy(&stamp, data + BENCH_STAMP_OFS, sizeof(stamp));
+		if (stamp.magic != BENCH_STAMP_MAGIC)
+			continue; // replayed datagram without stamp
+
+		Bench_HistAdd(&hist_down, Bench_Time() - stamp.sent);
+		client_received++;
+
+		if (!opt_rate && bench_sending && !opt_replay)
+		{
+			Bench_SendNetchan(c);
+			c->next_send = Bench_Time() + BENCH_FLOOD_RESEND * 1000000ull;
+		}
+	}
+}
+
+static void Bench_Poll(unsigned long long wait)
+{
+	int i, ms = (int)((wait + 999999) / 1000000);
+
+	if (poll(bench_pollfds, bench_clients_count, ms) <= 0)
+		return;
+
+	for (i = 0; i < bench_clients_count; i++)
+	{
+		if (bench_pollfds[i].revents)
+			Bench_ClientRead(&bench_clients[i]);
+	}
+}
+
+// returns time when the last client got connected
+static unsigned long long Bench_Connect(unsigned long long start)
+{
+	unsigned long long now, last = start;
+	int i, ready = 0;
+
+	for (i = 0; i < bench_clients_count; i++)
+		Bench_SendChallenge(&bench_clients[i]);
+
+	while (ready < bench_clients_count)
+	{
+		Bench_Poll(10 * 1000000ull);
+
+		now = Bench_Time();
+		if (now - start > BENCH_CONNECT_TIMEOUT * 1000000ull)
+			Bench_Error("only %d of %d clients connected in %d ms", ready, bench_clients_count, BENCH_CONNECT_TIMEOUT);
+
+		for (i = 0; i < bench_clients_count; i++)
+		{
+			bench_client_t *c = &bench_clients[i];
+
+			if (c->state == bc_ready)
+				continue;
+
+			// q3 proxy replies with connectResponse only when it is connected to the server itself,
+			// till then client asks for challenge again, this is what real q3 client does too
+			if (c->proto == pr_q3 && c->state == bc_connect && Sys_AtomicLoad(&c->upstream) && now - c->sent > 10 * 1000000ull)
+				Bench_SendChallenge(c);
+			else if (c->state == bc_challenge && now - c->sent > BENCH_RESEND * 1000000ull)
+				Bench_SendChallenge(c);
+			else if (c->state == bc_connect && now - c->sent > BENCH_RESEND * 1000000ull)
+				Bench_SendChallenge(c);
+
+			if (c->state == bc_upstream && Sys_AtomicLoad(&c->upstream))
+			{
+				c->state = bc_ready;
+				c->ready_time = now;
+				last = now;
+				ready++;
+			}
+		}
+	}
+
+	return last;
+}
+
+static void Bench_Traffic(unsigned long long start, unsigned long long end)
+{
+	unsigned long long now, next, interval = opt_rate ? 1000000000ull / opt_rate : 0;
+	int i, j;
+
+	for (i = 0; i < bench_clients_count; i++)
+	{
+		if (opt_rate)
+		{
+			// spread clients over the interval, so they do not send in bursts
+			bench_clients[i].next_send = start + interval * i / bench_clients_count;
+		}
+		else
+		{
+			for (j = 0; j < opt_window; j++)
+				Bench_SendNetchan(&bench_clients[i]);
+			bench_clients[i].next_send = start + BENCH_FLOOD_RESEND * 1000000ull;
+		}
+	}
+
+	while ((now = Bench_Time()) < end)
+	{
+		next = end;
+
+		for (i = 0; i < bench_clients_count; i++)
+		{
+			bench_client_t *c = &bench_clients[i];
+
+			if (c->next_send <= now)
+			{
+				Bench_SendNetchan(c);
+
+				if (!opt_rate)
+					c->next_send = now + BENCH_FLOOD_RESEND * 1000000ull; // something got lost, kick it
+				else if ((c->next_send += interval) < now)
+					c->next_send = now; // we are late, do not try to catch up with burst
+			}
+
+			next = c->next_send < next ? c->next_send : next;
+		}
+
+		Bench_Poll(next > now ? next - now : 0);
+	}
+}
+
+//=============================================================================
+// replay of captured traffic
+
+static int Bench_RecordCompare(const void *a, const void *b)
+{
+	const bench_record_t *ra = (const bench_record_t *)a, *rb = (const bench_record_t *)b;
+
+	// forwarding threads write blocks of own records, so file is ordered only within each thread,
+	// records of the same time keep file order, data pointers grow with it
+	if (ra->usec != rb->usec)
+		return ra->usec < rb->usec ? -1 : 1;
+
+	return ra->data < rb->data ? -1 : (ra->data > rb->data);
+}
+
+// read capture file, one client per recorded peer, returns number of clients
+static int Bench_LoadCapture(void)
+{
+	capture_header_t header;
+	capture_record_t rec;
+	byte *data;
+	long size, pos;
+	int count = 0, max_userid = 0, *clients;
+	FILE *f;
+
+	if (!(f = fopen(opt_replay, "rb")))
+		Bench_Error("can't open %s", opt_replay);
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	data = Sys_malloc(size + 1);
+	if (size < (long)sizeof(header) || fread(data, 1, size, f) != (size_t)size)
+		Bench_Error("can't read %s", opt_replay);
+	fclose(f);
+
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) || header.version != CAPTURE_VERSION)
+		Bench_Error("%s is not qwfwd capture of version %d", opt_replay, CAPTURE_VERSION);
+
+	// count records, so we allocate them once
+	for (pos = sizeof(header); pos + (long)sizeof(rec) <= size; pos += sizeof(rec) + rec.size)
+	{
+		memcpy(&rec, data + pos, sizeof(rec));
+		count++;
+		max_userid = max(max_userid, (int)rec.userid);
+	}
+
+	bench_records = Sys_malloc(max(count, 1) * sizeof(*bench_records));
+	clients = Sys_malloc((max_userid + 1) * sizeof(*clients));
+	bench_clients = Sys_malloc(max(count, 1) * sizeof(*bench_clients));
+
+	for (pos = sizeof(header); pos + (long)sizeof(rec) <= size; pos += sizeof(rec) + rec.size)
+	{
+		bench_record_t *r = &bench_records[bench_records_count];
+
+		memcpy(&rec, data + pos, sizeof(rec));
+		if (pos + (long)sizeof(rec) + rec.size > size)
+			break; // capture was cut
+
+		// handshake is ours, so connectionless datagrams are not replayed
+		if (rec.size >= 4 && !memcmp(data + pos + sizeof(rec), "\xff\xff\xff\xff", 4))
+			continue;
+
+		// clients[] keeps index plus one, so zero is peer we did not see yet
+		if (!clients[rec.userid])
+		{
+			bench_clients[bench_clients_count].userid = rec.userid;
+			bench_clients[bench_clients_count].proto = rec.proto == pr_q3 ? pr_q3 : pr_qw;
+			clients[rec.userid] = ++bench_clients_count;
+		}
+
+		r->usec = rec.usec;
+		r->client = clients[rec.userid] - 1;
+		r->dir = rec.dir == cd_server ? cd_server : cd_client;
+		r->size = min(rec.size, MAX_MSGLEN);
+		r->data = data + pos + sizeof(rec);
+		bench_records_count++;
+	}
+
+	Sys_free(clients);
+
+	if (!bench_records_count)
+		Bench_Error("%s has no datagrams to replay", opt_replay);
+
+	qsort(bench_records, bench_records_count, sizeof(*bench_records), Bench_RecordCompare);
+
+	return bench_clients_count;
+}
+
+static void Bench_ReplayRecord(bench_record_t *r)
+{
+	bench_client_t *c = &bench_clients[r->client];
+	byte data[MAX_MSGLEN];
+	bench_stamp_t stamp;
+
+	memcpy(data, r->data, r->size);
+
+	// stamp datagram if there is room, but keep "drop" of qw client intact, the proxy looks for it
+	if (r->size >= BENCH_PACKET_MIN && !(r->dir == cd_client && c->proto == pr_qw && data[10] == clc_stringcmd))
+	{
+		stamp.magic = BENCH_STAMP_MAGIC;
+		stamp.seq = ++c->seq;
+		stamp.sent = Bench_Time();
+		memcpy(data + BENCH_STAMP_OFS, &stamp, sizeof(stamp));
+
+		if (r->dir == cd_client)
+			client_sent++;
+		else
+			server_sent++;
+	}
+	else
+	{
+		bench_unstamped++;
+	}
+
+	if (r->dir == cd_client)
+		sendto(c->s, (char *)data, r->size, 0, (struct sockaddr *)&bench_proxy, sizeof(bench_proxy));
+	else
+		sendto(bench_server_socket, (char *)data, r->size, 0, (struct sockaddr *)&c->upstream_addr, sizeof(c->upstream_addr));
+}
+
+static void Bench_Replay(unsigned long long start)
+{
+	unsigned long long now, due, first = bench_records[0].usec;
+	int i;
+
+	for (i = 0; i < bench_records_count; i++)
+	{
+		if (opt_speed > 0)
+		{
+			due = start + (unsigned long long)((bench_records[i].usec - first) * 1000.0 / opt_speed);
+			while ((now = Bench_Time()) < due)
+				Bench_Poll(due - now);
+		}
+		else if (!(i % BENCH_REPLAY_POLL))
+		{
+			Bench_Poll(0);
+		}
+
+		Bench_ReplayRecord(&bench_records[i]);
+	}
+}
+
+//=============================================================================
+// proxy process
+
+// cpu seconds used by process so far, negative if we can't tell
+static double Bench_ProcessCPU(int pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE *f;
+	int len;
+
+	if (!pid)
+		return -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if (!(f = fopen(path, "r")))
+		return -1;
+
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len > 0 ? len : 0] = 0;
+
+	// process name may have spaces and brackets, so skip to the last bracket
+	if (!(p = strrchr(buf, ')')) || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return -1;
+
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static qbool Bench_ProxyAlive(void)
+{
+	struct pollfd pfd;
+	byte data[MAX_MSGLEN];
+	int s = Bench_Socket(0), i;
+	qbool alive = false;
+
+	pfd.fd = s;
+	pfd.events = POLLIN;
+
+	for (i = 0; i < 50 && !alive; i++)
+	{
+		if (bench_proxy_pid && waitpid(bench_proxy_pid, NULL, WNOHANG) == bench_proxy_pid)
+		{
+			bench_proxy_pid = 0;
+			break;
+		}
+
+		Bench_OutOfBand(s, &bench_proxy, "%c", A2A_PING);
+		alive = (poll(&pfd, 1, 100) > 0 && recv(s, (char *)data, sizeof(data), 0) > 0);
+	}
+
+	close(s);
+
+	return alive;
+}
+
+static void Bench_StartProxy(void)
+{
+	char path[128], port[16];
+	FILE *f;
+	int s, fd;
+
+	// let the kernel pick free port for the proxy
+	s = Bench_Socket(0);
+	opt_port = Bench_SocketPort(s);
+	close(s);
+
+	strlcpy(bench_dir, "/tmp/qwfwd-bench.XXXXXX", sizeof(bench_dir));
+	if (!mkdtemp(bench_dir))
+		Bench_Error("mkdtemp: %s", strerror(errno));
+
+	snprintf(path, sizeof(path), "%s/qwfwd.cfg", bench_dir);
+	if (!(f = fopen(path, "w")))
+		Bench_Error("can't write %s", path);
+
+	fprintf(f, "set masters_query 0\n");
+	fprintf(f, "set masters_heartbeat 0\n");
+	fprintf(f, "set masters_snapshot \"\"\n");
+	fprintf(f, "set maxclients %d\n", bench_clients_count + 16);
+	if (opt_workers)
+		fprintf(f, "set fwd_workers %d\n", opt_workers);
+	fprintf(f, "%s", opt_extra);
+	fclose(f);
+
+	snprintf(port, sizeof(port), "%d", opt_port);
+	snprintf(path, sizeof(path), "%s/qwfwd.log", bench_dir);
+
+	if ((bench_proxy_pid = fork()) < 0)
+		Bench_Error("fork: %s", strerror(errno));
+
+	if (!bench_proxy_pid)
+	{
+		if (chdir(bench_dir) < 0 || (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+			_exit(1);
+
+		dup2(fd, 1);
+		dup2(fd, 2);
+		close(fd);
+		execl(opt_binary, opt_binary, port, "127.0.0.1", (char *)NULL);
+		_exit(1);
+	}
+}
+
+static void Bench_StopProxy(void)
+{
+	char path[128];
+
+	if (!bench_proxy_pid)
+		return;
+
+	kill(bench_proxy_pid, SIGTERM);
+	waitpid(bench_proxy_pid, NULL, 0);
+	bench_proxy_pid = 0;
+
+	snprintf(path, sizeof(path), "%s/qwfwd.cfg", bench_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/qwfwd.log", bench_dir);
+	unlink(path);
+	rmdir(bench_dir);
+}
+
+//=============================================================================
+
+static void Bench_PrintLatency(const char *name, const bench_hist_t *h)
+{
+	printf("latency %-15s p50 %7.1f us, p99 %7.1f us, p999 %7.1f us (%llu samples)\n", name,
+		Bench_HistPercentile(h, 0.5) / 1000.0, Bench_HistPercentile(h, 0.99) / 1000.0,
+		Bench_HistPercentile(h, 0.999) / 1000.0, h->total);
+}
+
+static void Bench_Usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		"  -c <num>      QW clients (%d)\n"
+		"  -q <num>      Q3 clients (%d)\n"
+		"  -r <num>      packets per second per client, 0 is as fast as proxy can take (%d)\n"
+		"  -W <num>      packets in flight per client when rate is 0 (%d)\n"
+		"  -t <sec>      traffic duration (%d)\n"
+		"  -s <bytes>    client packet size (%d)\n"
+		"  -S <bytes>    server packet size (%d)\n"
+		"  -w <num>      fwd_workers of started proxy\n"
+		"  -e <command>  extra line for qwfwd.cfg of started proxy, may be repeated\n"
+		"  -b <path>     qwfwd binary to start (%s)\n"
+		"  -p <port>     do not start proxy, use one running on 127.0.0.1:<port>\n"
+		"  -P <pid>      process id of running proxy, to report cpu usage\n"
+		"  -R <file>     replay capture file instead of synthetic traffic, -c -q -r -t -s -S are ignored\n"
+		"  -x <speed>    replay speed, 10 is ten times faster than recorded, 0 is as fast as possible (%g)\n",
+		name, opt_qw, opt_q3, opt_rate, opt_window, opt_seconds, opt_client_size, opt_server_size, opt_binary, opt_speed);
+	exit(1);
+}
+
+static void Bench_ParseArgs(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc)
+			Bench_Usage(argv[0]);
+
+		switch (argv[i][1])
+		{
+			case 'c': opt_qw = atoi(argv[++i]); break;
+			case 'q': opt_q3 = atoi(argv[++i]); break;
+			case 'r': opt_rate = atoi(argv[++i]); break;
+			case 'W': opt_window = atoi(argv[++i]); break;
+			case 't': opt_seconds = atoi(argv[++i]); break;
+			case 's': opt_client_size = atoi(argv[++i]); break;
+			case 'S': opt_server_size = atoi(argv[++i]); break;
+			case 'w': opt_workers = atoi(argv[++i]); break;
+			case 'b': opt_binary = argv[++i]; break;
+			case 'p': opt_port = atoi(argv[++i]); break;
+			case 'P': opt_pid = atoi(argv[++i]); break;
+			case 'R': opt_replay = argv[++i]; break;
+			case 'x': opt_speed = atof(argv[++i]); break;
+			case 'e':
+				strlcat(opt_extra, argv[++i], sizeof(opt_extra));
+				strlcat(opt_extra, "\n", sizeof(opt_extra));
+				break;
+			default: Bench_Usage(argv[0]);
+		}
+	}
+
+	opt_client_size = bound(BENCH_PACKET_MIN, opt_client_size, MAX_MSGLEN);
+	opt_server_size = bound(BENCH_PACKET_MIN, opt_server_size, MAX_MSGLEN);
+	opt_window = max(1, opt_window);
+	opt_seconds = max(1, opt_seconds);
+
+	if (opt_qw < 0 || opt_q3 < 0 || opt_qw + opt_q3 < 1 || opt_rate < 0 || opt_speed < 0)
+		Bench_Usage(argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, connected, end;
+	double cpu_start, cpu_end, seconds;
+	unsigned long long forwarded;
+	bench_hist_t hist_total;
+	int i;
+
+	Bench_ParseArgs(argc, argv);
+
+	signal(SIGPIPE, SIG_IGN);
+	setbuf(stdout, NULL);
+	srand((unsigned)time(NULL));
+	Huff_Init();
+
+	if (opt_replay)
+	{
+		Bench_LoadCapture();
+	}
+	else
+	{
+		bench_clients_count = opt_qw + opt_q3;
+		bench_clients = Sys_malloc(bench_clients_count * sizeof(*bench_clients));
+		for (i = 0; i < bench_clients_count; i++)
+			bench_clients[i].proto = (i < opt_qw) ? pr_qw : pr_q3;
+	}
+
+	bench_pollfds = Sys_malloc(bench_clients_count * sizeof(*bench_pollfds));
+
+	for (i = 0; i < bench_clients_count; i++)
+	{
+		bench_clients[i].s = Bench_Socket(0);
+		bench_clients[i].qport = 1 + rand() % 0xfffe;
+		bench_pollfds[i].fd = bench_clients[i].s;
+		bench_pollfds[i].events = POLLIN;
+	}
+
+	bench_server_socket = Bench_Socket(0);
+	bench_server_port = Bench_SocketPort(bench_server_socket);
+	Sys_SemInit(&bench_server_done);
+	if (!Sys_CreateThread(Bench_ServerThread, NULL))
+		Bench_Error("can't start server thread");
+
+	if (!opt_port)
+		Bench_StartProxy();
+	else
+		bench_proxy_pid = 0;
+
+	memset(&bench_proxy, 0, sizeof(bench_proxy));
+	bench_proxy.sin_family = AF_INET;
+	bench_proxy.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bench_proxy.sin_port = htons((unsigned short)opt_port);
+
+	if (!Bench_ProxyAlive())
+		Bench_Error("proxy at 127.0.0.1:%d does not answer", opt_port);
+
+	if (opt_replay)
+	{
+		seconds = (bench_records[bench_records_count - 1].usec - bench_records[0].usec) / 1e6;
+		printf("replay: %d datagrams of %d peers, %.1f s recorded, ", bench_records_count, bench_clients_count, seconds);
+		if (opt_speed > 0)
+			printf("played at %gx\n", opt_speed);
+		else
+			printf("played as fast as possible\n");
+	}
+	else
+	{
+		printf("clients: %d qw, %d q3, ", opt_qw, opt_q3);
+		if (opt_rate)
+			printf("%d packets/s each, ", opt_rate);
+		else
+			printf("flood with %d packets in flight each, ", opt_window);
+		printf("%d s of traffic\n", opt_seconds);
+	}
+
+	// connect
+	start = Bench_Time();
+	connected = Bench_Connect(start);
+	seconds = (connected - start) / 1e9;
+	printf("connect: %d clients in %.3f s, %.1f connects/s\n", bench_clients_count, seconds,
+		seconds > 0 ? bench_clients_count / seconds : 0);
+
+	// proxy takes connect reply of the server a bit after stub server sent it
+	start = Bench_Time() + 100 * 1000000ull;
+	while (Bench_Time() < start)
+		Bench_Poll(start - Bench_Time());
+
+	// traffic
+	cpu_start = Bench_ProcessCPU(bench_proxy_pid ? bench_proxy_pid : opt_pid);
+	start = Bench_Time();
+	end = start + opt_seconds * 1000000000ull;
+	bench_sending = true;
+	if (opt_replay)
+		Bench_Replay(start);
+	else
+		Bench_Traffic(start, end);
+	bench_sending = false;
+	cpu_end = Bench_ProcessCPU(bench_proxy_pid ? bench_proxy_pid : opt_pid);
+
+	// whatever is still in flight
+	end = Bench_Time();
+	while (Bench_Time() < end + BENCH_DRAIN * 1000000ull)
+		Bench_Poll(end + BENCH_DRAIN * 1000000ull - Bench_Time());
+
+	for (i = 0; i < bench_clients_count; i++)
+		Bench_SendDrop(&bench_clients[i]);
+
+	Sys_AtomicStore(&bench_stop, 1);
+	Sys_SemWait(&bench_server_done);
+
+	// report
+	seconds = (end - start) / 1e9;
+	forwarded = server_received + client_received;
+	printf("client -> server: sent %llu, received %llu, lost %llu\n", client_sent, server_received, client_sent - server_received);
+	printf("server -> client: sent %llu, received %llu, lost %llu\n", server_sent, client_received, server_sent - client_received);
+	printf("forwarded: %llu packets, %.0f packets/s\n", forwarded, forwarded / seconds);
+	if (bench_unstamped)
+		printf("replayed without stamp: %llu datagrams, too small or qw string commands, not counted above\n", bench_unstamped);
+
+	memset(&hist_total, 0, sizeof(hist_total));
+	Bench_HistMerge(&hist_total, &hist_up);
+	Bench_HistMerge(&hist_total, &hist_down);
+	Bench_PrintLatency("client->server", &hist_up);
+	Bench_PrintLatency("server->client", &hist_down);
+	Bench_PrintLatency("total", &hist_total);
+
+	if (cpu_start >= 0 && cpu_end >= 0 && forwarded)
+		printf("cpu: %.2f s, %.2f us per packet\n", cpu_end - cpu_start, (cpu_end - cpu_start) * 1e6 / forwarded);
+	else
+		printf("cpu: unknown, use -P <pid> for proxy which was not started by bench\n");
+
+	Bench_StopProxy();
+
+	return 0;
+}
@@ -0,0 +1,756 @@
+/*
+	microbench.c - benchmarks of parsing and codec primitives the proxy uses on every packet.
+
+	Each benchmark runs its own loop, count of iterations is picked so one run takes about
+	MB_RUN_TIME, then run is repeated and the best and the median results are reported.
+	Allocations are counted by wrapping malloc() and friends at link time (see CMakeLists.txt),
+	so they are counted only where linker supports --wrap.
+
+	JSON output is meant to be saved per commit and diffed.
+
+	-c checks codecs instead: src/huff.c must give the same bytes as the old implementation
+	kept in huff_ref.c, for random, connect-like and garbage packets. Exit code is 1 on mismatch.
+*/
+
+#include "qwfwd.h"
+
+#define MB_RUN_TIME		20000000ull		// ns, how long one run should take
+#define MB_MAX_RUNS		32
+
+typedef void (*mb_func_t)(int count);
+
+typedef struct mb_bench_s
+{
+	const char		*name;
+	mb_func_t		func;
+	void			(*setup)(void);	// may be NULL
+} mb_bench_t;
+
+typedef struct mb_result_s
+{
+	double				best;		// ns/op
+	double				median;		// ns/op
+	double				allocs;		// allocations per op, negative if unknown
+	unsigned long long	count;		// iterations in one run
+	int					runs;
+} mb_result_t;
+
+static int				opt_runs = 7;
+static const char		*opt_filter;
+static const char		*opt_json;		// file name, "-" is stdout
+
+static volatile unsigned int mb_sink;	// results go here, so compiler can't throw away the work
+
+//=============================================================================
+// allocation counting
+
+#ifdef MICROBENCH_COUNT_ALLOCS
+
+static unsigned long long mb_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+	mb_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	mb_allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	mb_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	mb_allocs++;
+	return __real_strdup(s);
+}
+
+#endif // MICROBENCH_COUNT_ALLOCS
+
+static unsigned long long MB_Time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//=============================================================================
+// inputs, taken from real clients
+
+static const char mb_userinfo_qw[] =
+	"\\*client\\ezQuake 7462\\*z_ext\\511\\name\\Milton\\team\\red\\topcolor\\4\\bottomcolor\\4"
+	"\\skin\\base\\rate\\25000\\msg\\1\\noaim\\1\\spectator\\0\\chat\\2\\cl_pext_limits\\1"
+	"\\prx\\qw.foppa.dk:27501@nl.qw.example.org:28000";
+
+static const char mb_userinfo_q3[] =
+	"\\cg_predictItems\\1\\cl_anonymous\\0\\cl_guid\\0C2EC0A9B4F6B0F5E3B0D9AA6D2A1F87\\color1\\4\\color2\\5"
+	"\\handicap\\100\\headmodel\\sarge\\model\\sarge\\name\\Milton\\rate\\25000\\sex\\male\\snaps\\40"
+	"\\team_headmodel\\*james\\team_model\\james\\teamtask\\0\\protocol\\68\\qport\\45123\\challenge\\-1418613539"
+	"\\prx\\q3.example.org:27960";
+
+static char mb_connect_qw[MAX_MSGLEN];	// "connect 28 ..." built from mb_userinfo_qw
+
+//=============================================================================
+// info.c
+
+static const char *mb_info_keys[] = { "name", "prx", "rate", "nosuchkey" };
+
+static void MB_InfoValueForKey(int count)
+{
+	char buf[MAX_INFO_KEY * 4];
+	int i;
+
+	for (i = 0; i < count; i++)
+		mb_sink += Info_ValueForKey(mb_userinfo_qw, mb_info_keys[i & 3], buf, sizeof(buf))[0];
+}
+
+static void MB_InfoSetValueForKey(int count)
+{
+	char userinfo[MAX_INFO_STRING];
+	int i;
+
+	strlcpy(userinfo, mb_userinfo_qw, sizeof(userinfo));
+
+	// change the value back and forth, so string does not grow
+	for (i = 0; i < count; i++)
+		Info_SetValueForKey(userinfo, "name", (i & 1) ? "Milton" : "Anna", sizeof(userinfo));
+
+	mb_sink += userinfo[0];
+}
+
+static void MB_ValidateUserInfo(int count)
+{
+	char userinfo[MAX_INFO_STRING];
+	int i;
+
+	strlcpy(userinfo, mb_userinfo_qw, sizeof(userinfo));
+
+	for (i = 0; i < count; i++)
+		mb_sink += ValidateUserInfo(userinfo);
+}
+
+//=============================================================================
+// cmd.c and token.c
+
+static void MB_SetupConnect(void)
+{
+	snprintf(mb_connect_qw, sizeof(mb_connect_qw), "connect %d 45123 -1418613539 \"%s\"\n", QW_PROTOCOL_VERSION, mb_userinfo_qw);
+}
+
+static void MB_CmdTokenizeString(int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		Cmd_TokenizeString(mb_connect_qw);
+		mb_sink += Cmd_Argc();
+	}
+}
+
+static void MB_COMParse(int count)
+{
+	char *s;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		for (s = mb_connect_qw; (s = COM_Parse(s)); )
+			mb_sink += com_token[0];
+	}
+}
+
+//=============================================================================
+// msg.c
+
+static byte mb_msg_data[MAX_MSGLEN];
+
+// typical client packet: netchan header, qport, move command and a string command
+static void MB_WriteMessage(sizebuf_t *msg)
+{
+	MSG_WriteLong(msg, 0x12345);
+	MSG_WriteLong(msg, 0x12340);
+	MSG_WriteShort(msg, 45123);
+	MSG_WriteByte(msg, clc_stringcmd);
+	MSG_WriteString(msg, "say gl hf");
+	MSG_WriteChar(msg, -5);
+	MSG_WriteFloat(msg, 1.5f);
+	MSG_WriteShort(msg, 320);
+	MSG_WriteShort(msg, -320);
+	MSG_WriteByte(msg, 13);
+}
+
+static void MB_MSGWrite(int count)
+{
+	sizebuf_t msg;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		SZ_InitEx(&msg, mb_msg_data, sizeof(mb_msg_data), false);
+		MB_WriteMessage(&msg);
+		mb_sink += msg.cursize;
+	}
+}
+
+static void MB_SetupMSGRead(void)
+{
+	SZ_InitEx(&net_message, mb_msg_data, sizeof(mb_msg_data), false);
+	MB_WriteMessage(&net_message);
+}
+
+static void MB_MSGRead(int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		MSG_BeginReading();
+		mb_sink += MSG_ReadLong();
+		mb_sink += MSG_ReadLong();
+		mb_sink += MSG_ReadShort();
+		mb_sink += MSG_ReadByte();
+		mb_sink += MSG_ReadString()[0];
+		mb_sink += MSG_ReadChar();
+		mb_sink += (int)MSG_ReadFloat();
+		mb_sink += MSG_ReadShort();
+		mb_sink += MSG_ReadShort();
+		mb_sink += MSG_ReadByte();
+	}
+}
+
+//=============================================================================
+// huff.c
+
+static byte		mb_huff_plain[MAX_MSGLEN];	// q3 connect packet
+static int		mb_huff_plain_size;
+static byte		mb_huff_game[MAX_MSGLEN];	// something like game packet, mostly small numbers
+static int		mb_huff_game_size;
+static byte		mb_huff_encrypted[MAX_MSGLEN];
+static int		mb_huff_encrypted_size;
+static byte		mb_huff_compressed[MAX_MSGLEN];
+static int		mb_huff_compressed_size;
+
+// huff_ref.c, huff.c before table driven codec
+void HuffRef_Init(int *huffCounts);
+void HuffRef_EncryptPacket(sizebuf_t *msg, int offset);
+void HuffRef_DecryptPacket(sizebuf_t *msg, int offset);
+void HuffRef_CompressPacket(sizebuf_t *msg, int offset);
+void HuffRef_DecompressPacket(sizebuf_t *msg, int offset);
+
+static void MB_SetupHuff(void)
+{
+	char data[MAX_MSGLEN];
+	sizebuf_t msg;
+
+	snprintf(data, sizeof(data), "\xff\xff\xff\xff" "connect \"%s\"", mb_userinfo_q3);
+	SZ_InitEx(&msg, mb_huff_plain, sizeof(mb_huff_plain), true);
+	SZ_Print(&msg, data);
+	mb_huff_plain_size = msg.cursize;
+
+	SZ_InitEx(&msg, mb_huff_encrypted, sizeof(mb_huff_encrypted), true);
+	SZ_Write(&msg, mb_huff_plain, mb_huff_plain_size);
+	Huff_EncryptPacket(&msg, 12);
+	mb_huff_encrypted_size = msg.cursize;
+
+	// connect text would not compress with the static tree, it is made for game data
+	SZ_InitEx(&msg, mb_huff_game, sizeof(mb_huff_game), true);
+	MB_WriteMessage(&msg);
+	while (msg.cursize < 400)
+		MSG_WriteByte(&msg, (rand() % 8) ? rand() % 4 : rand() % 256);
+	mb_huff_game_size = msg.cursize;
+
+	SZ_InitEx(&msg, mb_huff_compressed, sizeof(mb_huff_compressed), true);
+	SZ_Write(&msg, mb_huff_game, mb_huff_game_size);
+	Huff_CompressPacket(&msg, 12);
+	mb_huff_compressed_size = msg.cursize;
+}
+
+// every op includes copy of the packet into work buffer, as packet is changed in place
+static void MB_Huff(int count, byte *data, int size, void (*func)(sizebuf_t *msg, int offset))
+{
+	byte buf[MAX_MSGLEN * 2];
+	sizebuf_t msg;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		SZ_InitEx(&msg, buf, sizeof(buf), true);
+		SZ_Write(&msg, data, size);
+		func(&msg, 12);
+		mb_sink += msg.cursize;
+	}
+}
+
+static void MB_HuffEncrypt(int count)
+{
+	MB_Huff(count, mb_huff_plain, mb_huff_plain_size, Huff_EncryptPacket);
+}
+
+static void MB_HuffDecrypt(int count)
+{
+	MB_Huff(count, mb_huff_encrypted, mb_huff_encrypted_size, Huff_DecryptPacket);
+}
+
+static void MB_HuffCompress(int count)
+{
+	MB_Huff(count, mb_huff_game, mb_huff_game_size, Huff_CompressPacket);
+}
+
+static void MB_HuffDecompress(int count)
+{
+	MB_Huff(count, mb_huff_compressed, mb_huff_compressed_size, Huff_DecompressPacket);
+}
+
+static void MB_HuffEncryptRef(int count)
+{
+	MB_Huff(count, mb_huff_plain, mb_huff_plain_size, HuffRef_EncryptPacket);
+}
+
+static void MB_HuffDecryptRef(int count)
+{
+	MB_Huff(count, mb_huff_encrypted, mb_huff_encrypted_size, HuffRef_DecryptPacket);
+}
+
+static void MB_HuffCompressRef(int count)
+{
+	MB_Huff(count, mb_huff_game, mb_huff_game_size, HuffRef_CompressPacket);
+}
+
+static void MB_HuffDecompressRef(int count)
+{
+	MB_Huff(count, mb_huff_compressed, mb_huff_compressed_size, HuffRef_DecompressPacket);
+}
+
+//=============================================================================
+// huff.c compatibility check
+
+#define MB_HUFF_CHECKS		20000				// packets per codec
+#define MB_HUFF_BUF			(MSG_BUF_SIZE + 1024)
+
+typedef void (*mb_huff_func_t)(sizebuf_t *msg, int offset);
+
+static int mb_huff_mismatches;
+
+// random bytes, userinfo text, small numbers (game data), text with some noise
+static void MB_HuffPacket(byte *data, int size, int kind)
+{
+	static const char text[] = "\\name\\player\\rate\\25000\\snaps\\20\\model\\sarge\\challenge\\12345\\protocol\\68\\qport\\4711";
+	int i;
+
+	for (i = 0; i < size; i++)
+	{
+		switch (kind)
+		{
+			case 0:  data[i] = rand() & 255; break;
+			case 1:  data[i] = text[rand() % (sizeof(text) - 1)]; break;
+			case 2:  data[i] = rand() % 4; break;
+			default: data[i] = (rand() % 8) ? text[i % (sizeof(text) - 1)] : rand() & 255; break;
+		}
+	}
+
+	memset(data, 0xff, 4); // connectionless header, codecs start at 12 anyway
+}
+
+// run codec on a copy of the packet, the rest of the buffer is zeroed, so both codecs see the same bytes if they read past the end
+static int MB_HuffRun(mb_huff_func_t func, const byte *data, int size, byte *out)
+{
+	sizebuf_t msg;
+
+	memset(out, 0, MB_HUFF_BUF);
+	memcpy(out, data, size);
+	SZ_InitEx(&msg, out, MB_HUFF_BUF - 256, true);
+	msg.cursize = size;
+	func(&msg, 12);
+
+	return msg.cursize;
+}
+
+// run old and new codec, new result goes to out
+static int MB_HuffCompare(const char *name, const char *what, int packet, mb_huff_func_t ref, mb_huff_func_t func, const byte *data, int size, byte *out)
+{
+	static byte expected[MB_HUFF_BUF];
+	int expected_size = MB_HuffRun(ref, data, size, expected);
+	int out_size = MB_HuffRun(func, data, size, out);
+
+	if (out_size != expected_size || memcmp(out, expected, out_size))
+	{
+		if (mb_huff_mismatches++ < 10)
+			printf("huff: %s %s differs, packet %d, %d bytes in, %d bytes out, expected %d\n", name, what, packet, size, out_size, expected_size);
+	}
+
+	return out_size;
+}
+
+// encode, decode and decode garbage, compare every result with the old code and check that we got packet back
+static void MB_HuffCheckCodec(const char *name, int packet, mb_huff_func_t ref_encode, mb_huff_func_t encode,
+	mb_huff_func_t ref_decode, mb_huff_func_t decode, byte *data, int size, int garbage_header)
+{
+	static byte encoded[MB_HUFF_BUF], decoded[MB_HUFF_BUF];
+	int encoded_size, decoded_size;
+
+	encoded_size = MB_HuffCompare(name, "encode", packet, ref_encode, encode, data, size, encoded);
+	decoded_size = MB_HuffCompare(name, "decode", packet, ref_decode, decode, encoded, encoded_size, decoded);
+
+	if (decoded_size != size || memcmp(decoded, data, size))
+	{
+		if (mb_huff_mismatches++ < 10)
+			printf("huff: %s round trip failed, packet %d\n", name, packet);
+	}
+
+	// random payload, header is kept sane, so the old code does not bail out with Sys_Error()
+	MB_HuffPacket(data + 12, size - 12, 0);
+	data[12] = rand() % garbage_header;
+	MB_HuffCompare(name, "decode of garbage", packet, ref_decode, decode, data, size, decoded);
+}
+
+static int MB_HuffCheck(void)
+{
+	static byte data[MB_HUFF_BUF];
+	int i, kind, size;
+
+	for (i = 0; i < MB_HUFF_CHECKS; i++)
+	{
+		kind = rand() % 4;
+
+		// dynamic tree is used for connect packets, they are not limited with MAX_MSGLEN, so every 10th one is big
+		size = 13 + rand() % ((i % 10) ? 600 : 3000);
+		MB_HuffPacket(data, size, kind);
+		MB_HuffCheckCodec("dynamic", i, HuffRef_EncryptPacket, Huff_EncryptPacket, HuffRef_DecryptPacket, Huff_DecryptPacket, data, size, 4);
+
+		size = 13 + rand() % 1400;
+		MB_HuffPacket(data, size, kind);
+		MB_HuffCheckCodec("static", i, HuffRef_CompressPacket, Huff_CompressPacket, HuffRef_DecompressPacket, Huff_DecompressPacket, data, size, 8);
+	}
+
+	printf("huff: %d packets per codec, %d mismatches\n", MB_HUFF_CHECKS, mb_huff_mismatches);
+
+	return mb_huff_mismatches;
+}
+
+//=============================================================================
+// ban.c
+
+#define MB_BAN_ADDRS	1024		// addresses we check, half of them banned
+
+static struct sockaddr_in	mb_ban_addrs[MB_BAN_ADDRS];
+static int					mb_bans;	// bans added so far, benchmarks go from small list to big one
+
+// ban /32 hosts from 10.0.0.0/8, every 16th ban is /24 network from 172.16.0.0/12,
+// all of them are prefixes, so lookup goes through the trie only, see MB_SetupBansOdd() for the rest
+static void MB_AddBans(int count)
+{
+	char cmd[64];
+	int i;
+
+	for (i = mb_bans; i < count; i++)
+	{
+		if (i % 16 == 15)
+			snprintf(cmd, sizeof(cmd), "addip 172.%d.%d.0/24\n", 16 + (i >> 12) % 16, (i >> 4) & 255);
+		else
+			snprintf(cmd, sizeof(cmd), "addip 10.%d.%d.%d/32\n", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+
+		Cmd_ExecuteString(cmd);
+	}
+
+	mb_bans = count;
+
+	// half of addresses banned ones, half not banned, mixed
+	for (i = 0; i < MB_BAN_ADDRS; i++)
+	{
+		int n = (count ? rand() % count : 0);
+		unsigned int ip;
+
+		if ((i & 1) && count)
+			ip = (n % 16 == 15) ? (172u << 24) | ((16u + (n >> 12) % 16) << 16) | (((n >> 4) & 255u) << 8) | (rand() & 255u)
+				: (10u << 24) | (unsigned int)n;
+		else
+			ip = (192u << 24) | (168u << 16) | (rand() & 0xffffu);
+
+		mb_ban_addrs[i].sin_family = AF_INET;
+		mb_ban_addrs[i].sin_addr.s_addr = htonl(ip);
+		mb_ban_addrs[i].sin_port = htons(27500);
+	}
+}
+
+static void MB_SetupBans0(void)		{ MB_AddBans(0); }
+static void MB_SetupBans100(void)	{ MB_AddBans(100); }
+static void MB_SetupBans1000(void)	{ MB_AddBans(1000); }
+static void MB_SetupBans10000(void)	{ MB_AddBans(10000); }
+static void MB_SetupBans100000(void){ MB_AddBans(100000); }
+
+#define MB_BAN_ODD	16	// filters of old syntax with zero octet in the middle
+
+// such filters are not prefixes, ban.c checks them one by one after the trie,
+// 11.0.x.y matches none of the addresses we check, so every lookup goes through all of them
+static void MB_SetupBansOdd(void)
+{
+	static qbool added;
+	char cmd[64];
+	int i;
+
+	MB_AddBans(100000);
+
+	for (i = 0; i < MB_BAN_ODD && !added; i++)
+	{
+		snprintf(cmd, sizeof(cmd), "addip 11.0.%d.%d\n", i + 1, i + 1);
+		Cmd_ExecuteString(cmd);
+	}
+
+	added = true;
+}
+
+static void MB_SVIsBanned(int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		mb_sink += SV_IsBanned(&mb_ban_addrs[i & (MB_BAN_ADDRS - 1)]);
+}
+
+//=============================================================================
+// net.c
+
+static struct sockaddr_in mb_addrs[4];
+
+static void MB_SetupAddresses(void)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		mb_addrs[i].sin_family = AF_INET;
+		mb_addrs[i].sin_addr.s_addr = htonl((i & 2) ? 0x7f000001 : 0xc0a80001);
+		mb_addrs[i].sin_port = htons((unsigned short)(27500 + (i & 1)));
+	}
+}
+
+static void MB_NETCompareAddress(int count)
+{
+	int i;
+
+	// same, other port, other address, both differ
+	for (i = 0; i < count; i++)
+		mb_sink += NET_CompareAddress(&mb_addrs[0], &mb_addrs[i & 3]);
+}
+
+//=============================================================================
+
+static const mb_bench_t mb_benches[] =
+{
+	{ "info_value_for_key",		MB_InfoValueForKey,		NULL },
+	{ "info_set_value_for_key",	MB_InfoSetValueForKey,	NULL },
+	{ "validate_userinfo",		MB_ValidateUserInfo,	NULL },
+	{ "cmd_tokenize_connect",	MB_CmdTokenizeString,	MB_SetupConnect },
+	{ "com_parse_connect",		MB_COMParse,			MB_SetupConnect },
+	{ "msg_write",				MB_MSGWrite,			NULL },
+	{ "msg_read",				MB_MSGRead,				MB_SetupMSGRead },
+	{ "huff_encrypt_packet",	MB_HuffEncrypt,			MB_SetupHuff },
+	{ "huff_decrypt_packet",	MB_HuffDecrypt,			MB_SetupHuff },
+	{ "huff_compress_packet",	MB_HuffCompress,		MB_SetupHuff },
+	{ "huff_decompress_packet",	MB_HuffDecompress,		MB_SetupHuff },
+	{ "huff_encrypt_packet_ref",	MB_HuffEncryptRef,		MB_SetupHuff },
+	{ "huff_decrypt_packet_ref",	MB_HuffDecryptRef,		MB_SetupHuff },
+	{ "huff_compress_packet_ref",	MB_HuffCompressRef,		MB_SetupHuff },
+	{ "huff_decompress_packet_ref",	MB_HuffDecompressRef,	MB_SetupHuff },
+	{ "sv_is_banned_0",			MB_SVIsBanned,			MB_SetupBans0 },
+	{ "sv_is_banned_100",		MB_SVIsBanned,			MB_SetupBans100 },
+	{ "sv_is_banned_1000",		MB_SVIsBanned,			MB_SetupBans1000 },
+	{ "sv_is_banned_10000",		MB_SVIsBanned,			MB_SetupBans10000 },
+	{ "sv_is_banned_100000",	MB_SVIsBanned,			MB_SetupBans100000 },
+	{ "sv_is_banned_odd_16",	MB_SVIsBanned,			MB_SetupBansOdd },
+	{ "net_compare_address",	MB_NETCompareAddress,	MB_SetupAddresses },
+	{ NULL, NULL, NULL }
+};
+
+static int MB_CompareDouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void MB_Run(const mb_bench_t *b, mb_result_t *r)
+{
+	double runs[MB_MAX_RUNS];
+	unsigned long long start, elapsed;
+	int i, count = 1;
+
+	if (b->setup)
+		b->setup();
+
+	// find count which takes about MB_RUN_TIME, this warms up caches as well
+	for (;;)
+	{
+		start = MB_Time();
+		b->func(count);
+		elapsed = MB_Time() - start;
+
+		if (elapsed >= MB_RUN_TIME / 4 || count >= (1 << 28))
+			break;
+
+		count *= 2;
+	}
+
+	count = (int)(count * (double)MB_RUN_TIME / (elapsed ? elapsed : 1));
+	count = count < 1 ? 1 : count;
+
+	r->allocs = -1;
+	r->count = count;
+	r->runs = opt_runs;
+
+	for (i = 0; i < opt_runs; i++)
+	{
+#ifdef MICROBENCH_COUNT_ALLOCS
+		unsigned long long allocs = mb_allocs;
+#endif
+
+		start = MB_Time();
+		b->func(count);
+		runs[i] = (double)(MB_Time() - start) / count;
+
+#ifdef MICROBENCH_COUNT_ALLOCS
+		r->allocs = (double)(mb_allocs - allocs) / count;
+#endif
+	}
+
+	qsort(runs, opt_runs, sizeof(runs[0]), MB_CompareDouble);
+	r->best = runs[0];
+	r->median = runs[opt_runs / 2];
+}
+
+static void MB_Usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		"  -r <num>     runs of each benchmark (%d)\n"
+		"  -f <text>    run only benchmarks with text in the name\n"
+		"  -j <file>    write results as JSON to file, - is stdout\n"
+		"  -l           list benchmarks\n"
+		"  -c           check huff.c against the old codec instead, exit code is 1 on mismatch\n",
+		name, opt_runs);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	mb_result_t results[sizeof(mb_benches) / sizeof(mb_benches[0])];
+	FILE *json = NULL;
+	int i, out, nul;
+	qbool first = true, check = false;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			opt_runs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			opt_filter = argv[++i];
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			opt_json = argv[++i];
+		else if (!strcmp(argv[i], "-c"))
+			check = true;
+		else if (!strcmp(argv[i], "-l"))
+		{
+			for (i = 0; mb_benches[i].name; i++)
+				printf("%s\n", mb_benches[i].name);
+			return 0;
+		}
+		else
+			MB_Usage(argv[0]);
+	}
+
+	opt_runs = (int)bound(1, opt_runs, MB_MAX_RUNS);
+
+	if (opt_json && !(json = strcmp(opt_json, "-") ? fopen(opt_json, "w") : stdout))
+	{
+		fprintf(stderr, "can't write %s\n", opt_json);
+		return 1;
+	}
+
+	// subsystems print to console during init, keep it out of results
+	out = dup(1);
+	if ((nul = open("/dev/null", O_WRONLY)) >= 0)
+	{
+		dup2(nul, 1);
+		close(nul);
+	}
+
+	srand(1); // the same inputs every time
+	Cbuf_Init();
+	Cmd_Init();
+	Cvar_Init();
+	developer = Cvar_Get("developer", "0", 0);
+	Huff_Init();
+	HuffRef_Init(NULL);
+	Ban_Init();
+
+	fflush(stdout);
+	if (out >= 0)
+	{
+		dup2(out, 1);
+		close(out);
+	}
+
+	if (check)
+		return MB_HuffCheck() ? 1 : 0;
+
+	if (json)
+		fprintf(json, "{\n\t\"benchmarks\": [\n");
+	if (json != stdout)
+		printf("%-28s %12s %12s %12s %12s\n", "benchmark", "best ns/op", "median ns/op", "allocs/op", "iterations");
+
+	for (i = 0; mb_benches[i].name; i++)
+	{
+		const mb_bench_t *b = &mb_benches[i];
+		mb_result_t *r = &results[i];
+
+		if (opt_filter && !strstr(b->name, opt_filter))
+			continue;
+
+		MB_Run(b, r);
+
+		if (json != stdout)
+		{
+			printf("%-28s %12.2f %12.2f ", b->name, r->best, r->median);
+			if (r->allocs < 0)
+				printf("%12s", "n/a");
+			else
+				printf("%12.3f", r->allocs);
+			printf(" %12llu\n", r->count);
+		}
+
+		if (json)
+		{
+			fprintf(json, "%s\t\t{ \"name\": \"%s\", \"ns_per_op\": %.3f, \"ns_per_op_median\": %.3f, \"allocs_per_op\": ",
+				first ? "" : ",\n", b->name, r->best, r->median);
+			if (r->allocs < 0)
+				fprintf(json, "null");
+			else
+				fprintf(json, "%.3f", r->allocs);
+			fprintf(json, ", \"iterations\": %llu, \"runs\": %d }", r->count, r->runs);
+			first = false;
+		}
+	}
+
+	if (json)
+	{
+		fprintf(json, "\n\t]\n}\n");
+		if (json != stdout)
+			fclose(json);
+	}
+
+	return 0;
+}
@@ -0,0 +1,1831 @@
+/*
+	sim.c - deterministic simulation of qwfwd.
+
+	Runs FWD_proc() of the proxy over in-memory network (see net_backend_t) with virtual clock (see Sys_SetVirtualClock()),
+	so thousands of peers and hours of proxy time take seconds, and each run gives exactly the same result.
+	Clients, game servers and master server are actors of the simulation, they and the proxy exchange datagrams
+	through the event queue, which carries actor timers as well. Proxy sleeps in net_backend->wait(),
+	that is where simulation runs events and moves the clock, so the proxy never waits for real.
+
+	Each scenario runs in own process, since the proxy keeps plenty of state in globals,
+	checks are done by actors while the proxy runs and once more when it quits.
+*/
+
+#include "qwfwd.h"
+#include <dirent.h>
+
+#define SIM_PROXY_IP		"10.0.0.1"
+#define SIM_PROXY_PORT		30000
+#define SIM_EPHEMERAL_PORT	40000		// peer sockets of the proxy get ports from here
+#define SIM_START			(3600 * 1000000ull)	// usec, virtual clock starts an hour in, so nothing sits near zero
+#define SIM_FRAME_COST		10			// usec, main loop of the proxy is not free, so the clock moves even if it does not sleep
+#define SIM_LATENCY			20000		// usec, one way
+#define SIM_HASH_SIZE		(1 << 16)	// must be power of two
+#define SIM_CHALLENGE		31337		// what simulated servers use as challenge
+#define SIM_RESEND			500			// ms, client asks for challenge again if it is not connected yet
+#define SIM_SETTLE			200			// ms, qw client waits after server saw connect, so the proxy gets the reply first
+#define SIM_PACKET_SIZE		32			// netchan packets of clients and servers
+#define SIM_PACKET_MIN		24			// smaller ones are drops and q3 probes of the proxy
+#define SIM_MAX_CHALLENGES	16
+#define SIM_MAX_FAILURES	8
+
+#define SIM_MS(ms)			((unsigned long long)(ms) * 1000)
+#define SIM_SEC(sec)		((unsigned long long)(sec) * 1000000)
+#define SIM_AT(ms)			(SIM_START + SIM_MS(ms))
+
+// proxy forward declaration, tools are unix only, so there is no WINAPI and DWORD is unsigned int
+unsigned int FWD_proc(void *lpParameter);
+
+typedef struct sim_event_s sim_event_t;
+typedef void (*sim_func_t)(sim_event_t *e);
+
+// timer if func is set, datagram otherwise, datagram of negative size is ICMP port unreachable
+struct sim_event_s
+{
+	unsigned long long	time;		// usec of virtual clock
+	unsigned long long	seq;		// events of the same time run in order they were added
+	sim_func_t			func;
+	void				*arg;
+	sim_event_t			*next;		// rx queue of the proxy socket
+	struct sockaddr_in	from;
+	struct sockaddr_in	to;
+	int					size;
+	byte				data[1];	// allocated with the event, always zero terminated
+};
+
+typedef enum
+{
+	se_proxy,		// socket of the proxy
+	se_client,
+	se_server,
+	se_master,
+	se_observer,	// asks the proxy for pingstatus
+} sim_endpoint_kind_t;
+
+typedef struct sim_endpoint_s
+{
+	qbool				used;
+	sim_endpoint_kind_t	kind;
+	struct sockaddr_in	addr;
+	void				*actor;
+	int					hash_next;		// next endpoint in the hash chain, 0 ends chain
+	int					free_next;		// next unused endpoint
+	// proxy sockets only
+	qbool				watched;
+	qbool				ready;			// in sim_ready list
+	unsigned int		handle;
+	sim_event_t			*rx_head, *rx_tail;
+	qbool				connected;		// gets datagrams only from remote
+	qbool				refused;		// got ICMP port unreachable, next recv fails
+	struct sockaddr_in	remote;
+} sim_endpoint_t;
+
+typedef enum
+{
+	sc_idle,
+	sc_challenge,	// waiting for challenge from proxy
+	sc_connect,		// waiting for connect reply from proxy
+	sc_connected,	// sending traffic
+	sc_stopped,
+} sim_client_state_t;
+
+typedef struct sim_client_s
+{
+	int					ep;
+	protocol_t			proto;
+	sim_client_state_t	state;
+	int					qport;
+	int					challenge;
+	struct sockaddr_in	server;			// what goes to prx key
+	unsigned int		interval;		// ms between packets
+	qbool				probe_only;		// only asks for challenge
+	qbool				drop;			// says drop when it stops, otherwise just goes silent
+	unsigned long long	stop_at;
+	unsigned long long	sent_at;		// last challenge or connect
+	unsigned long long	upstream_at;	// server saw connect, 0 if not yet
+	unsigned long long	replied_at;		// first challenge from the proxy, 0 if not yet
+	unsigned long long	last_arrival;	// last datagram of the client the proxy got
+	unsigned long long	told_at;		// proxy said it can't connect, 0 if it did not
+	unsigned int		seq;
+	unsigned int		sent, received;
+} sim_client_t;
+
+typedef struct sim_server_s
+{
+	int					ep;
+	int					ignore_challenges;	// do not answer that many first challenges
+	qbool				dead;			// does not answer anything
+	int					challenges;
+	unsigned long long	challenge_at[SIM_MAX_CHALLENGES];
+	int					connects;
+	unsigned int		received, sent;
+	// q3 disconnect probes of the proxy
+	int					probes;
+	int					probe_qport;
+	unsigned long long	first_probe, last_probe;
+	unsigned long long	probe_gap_min, probe_gap_max;
+	// pings of the query scheduler, seen when proxy sends them
+	int					pings;
+	unsigned long long	last_ping;
+	unsigned long long	ping_gap_min;
+} sim_server_t;
+
+typedef struct sim_scenario_s
+{
+	const char			*name;
+	void				(*config)(FILE *f);		// extra lines for qwfwd.cfg
+	void				(*setup)(void);			// actors and director timers
+	void				(*check)(void);			// final checks, after the proxy quit
+} sim_scenario_t;
+
+static int				opt_peers = 2000;
+static int				opt_bans = 10000;
+static unsigned int		opt_seed = 1;
+static const char		*opt_filter;
+static qbool			opt_verbose;
+
+static unsigned long long sim_now;
+static unsigned long long sim_seq;
+static unsigned long long sim_rand_state;
+static unsigned int		sim_jitter;			// usec, added to SIM_LATENCY
+static qbool			sim_wake;			// director queued a command, proxy should run it
+
+static sim_endpoint_t	*sim_ep;
+static int				sim_ep_count;		// including unused slot 0
+static int				sim_ep_size;
+static int				sim_ep_free;
+static int				sim_hash[SIM_HASH_SIZE];
+static int				sim_next_port = SIM_EPHEMERAL_PORT;
+
+static sim_event_t		**sim_heap;
+static int				sim_heap_count;
+static int				sim_heap_size;
+static int				*sim_ready;
+static int				sim_ready_count;
+
+static sim_client_t		*sim_clients;
+static int				sim_clients_count;
+static sim_server_t		*sim_servers;
+static int				sim_servers_count;
+static struct sockaddr_in sim_proxy;
+
+static unsigned long long sim_events, sim_packets;
+static FILE				*sim_report;
+static int				sim_failures;
+static char				sim_failure[SIM_MAX_FAILURES][256];
+static char				sim_summary[256];
+
+//=============================================================================
+// utilities
+
+static double Sim_WallTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// own generator, so the proxy use of rand() does not change what actors do
+static unsigned int Sim_Rand(void)
+{
+	sim_rand_state ^= sim_rand_state >> 12;
+	sim_rand_state ^= sim_rand_state << 25;
+	sim_rand_state ^= sim_rand_state >> 27;
+
+	return (unsigned int)((sim_rand_state * 2685821657736338717ull) >> 32);
+}
+
+static void Sim_Check(qbool ok, const char *fmt, ...)
+{
+	va_list argptr;
+
+	if (ok)
+		return;
+
+	if (sim_failures < SIM_MAX_FAILURES)
+	{
+		va_start(argptr, fmt);
+		vsnprintf(sim_failure[sim_failures], sizeof(sim_failure[0]), fmt, argptr);
+		va_end(argptr);
+	}
+
+	sim_failures++;
+}
+
+static void Sim_Addr(struct sockaddr_in *addr, int a, int b, int c, int d, int port)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl((a << 24) | (b << 16) | (c << 8) | d);
+	addr->sin_port = htons((unsigned short)port);
+}
+
+static double Sim_Ms(unsigned long long usec)
+{
+	return usec / 1000.0;
+}
+
+//=============================================================================
+// event queue, binary heap ordered by time and seq
+
+static qbool Sim_Before(sim_event_t *a, sim_event_t *b)
+{
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void Sim_Push(sim_event_t *e)
+{
+	int i, parent;
+
+	if (sim_heap_count == sim_heap_size)
+	{
+		sim_event_t **old = sim_heap;
+
+		sim_heap_size = sim_heap_size ? sim_heap_size * 2 : 1024;
+		sim_heap = Sys_malloc(sim_heap_size * sizeof(*sim_heap));
+		if (old)
+			memcpy(sim_heap, old, sim_heap_count * sizeof(*sim_heap));
+		Sys_free(old);
+	}
+
+	e->seq = sim_seq++;
+
+	for (i = sim_heap_count++; i > 0; i = parent)
+	{
+		parent = (i - 1) / 2;
+		if (!Sim_Before(e, sim_heap[parent]))
+			break;
+		sim_heap[i] = sim_heap[parent];
+	}
+
+	sim_heap[i] = e;
+}
+
+static sim_event_t *Sim_Pop(void)
+{
+	sim_event_t *top = sim_heap[0], *last = sim_heap[--sim_heap_count];
+	int i, child;
+
+	for (i = 0; (child = 2 * i + 1) < sim_heap_count; i = child)
+	{
+		if (child + 1 < sim_heap_count && Sim_Before(sim_heap[child + 1], sim_heap[child]))
+			child++;
+		if (!Sim_Before(sim_heap[child], last))
+			break;
+		sim_heap[i] = sim_heap[child];
+	}
+
+	if (sim_heap_count)
+		sim_heap[i] = last;
+
+	return top;
+}
+
+static void Sim_Timer(unsigned long long at, sim_func_t func, void *arg)
+{
+	sim_event_t *e = Sys_malloc(sizeof(*e));
+
+	e->time = at;
+	e->func = func;
+	e->arg = arg;
+
+	Sim_Push(e);
+}
+
+//=============================================================================
+// endpoints
+
+static unsigned int Sim_Hash(const struct sockaddr_in *addr)
+{
+	unsigned int h = addr->sin_addr.s_addr * 0x9E3779B1u ^ addr->sin_port * 0x85EBCA6Bu;
+
+	return (h ^ (h >> 16)) & (SIM_HASH_SIZE - 1);
+}
+
+static int Sim_Lookup(struct sockaddr_in *addr)
+{
+	int i;
+
+	for (i = sim_hash[Sim_Hash(addr)]; i; i = sim_ep[i].hash_next)
+	{
+		if (NET_CompareAddress(&sim_ep[i].addr, addr))
+			return i;
+	}
+
+	return 0;
+}
+
+// returns 0 if address is taken
+static int Sim_Endpoint(sim_endpoint_kind_t kind, struct sockaddr_in *addr, void *actor)
+{
+	sim_endpoint_t *ep;
+	unsigned int h;
+	int i;
+
+	if (Sim_Lookup(addr))
+		return 0;
+
+	if (sim_ep_free)
+	{
+		i = sim_ep_free;
+		sim_ep_free = sim_ep[i].free_next;
+	}
+	else
+	{
+		if (sim_ep_count == sim_ep_size)
+		{
+			sim_endpoint_t *old = sim_ep;
+			int *old_ready = sim_ready;
+
+			sim_ep_size = sim_ep_size ? sim_ep_size * 2 : 1024;
+			sim_ep = Sys_malloc(sim_ep_size * sizeof(*sim_ep));
+			sim_ready = Sys_malloc(sim_ep_size * sizeof(*sim_ready));
+			if (old)
+			{
+				memcpy(sim_ep, old, sim_ep_count * sizeof(*sim_ep));
+				memcpy(sim_ready, old_ready, sim_ready_count * sizeof(*sim_ready));
+			}
+			Sys_free(old);
+			Sys_free(old_ready);
+		}
+
+		i = sim_ep_count ? sim_ep_count : 1; // there is no endpoint 0, to the proxy that is stdin
+		sim_ep_count = i + 1;
+	}
+
+	ep = &sim_ep[i];
+	memset(ep, 0, sizeof(*ep));
+	ep->used = true;
+	ep->kind = kind;
+	ep->addr = *addr;
+	ep->actor = actor;
+
+	h = Sim_Hash(addr);
+	ep->hash_next = sim_hash[h];
+	sim_hash[h] = i;
+
+	return i;
+}
+
+static void Sim_RemoveEndpoint(int i)
+{
+	sim_endpoint_t *ep = &sim_ep[i];
+	sim_event_t *e;
+	int *link, j;
+
+	for (link = &sim_hash[Sim_Hash(&ep->addr)]; *link != i; link = &sim_ep[*link].hash_next)
+		;
+	*link = ep->hash_next;
+
+	while ((e = ep->rx_head))
+	{
+		ep->rx_head = e->next;
+		Sys_free(e);
+	}
+
+	for (j = 0; ep->ready && j < sim_ready_count; j++)
+	{
+		if (sim_ready[j] == i)
+			sim_ready[j] = sim_ready[--sim_ready_count];
+	}
+
+	ep->used = false;
+	ep->free_next = sim_ep_free;
+	sim_ep_free = i;
+}
+
+//=============================================================================
+// network
+
+static void Sim_Send(int from, struct sockaddr_in *to, const void *data, int size)
+{
+	sim_event_t *e = Sys_malloc(sizeof(*e) + size);
+
+	e->time = sim_now + SIM_LATENCY + (sim_jitter ? Sim_Rand() % sim_jitter : 0);
+	e->from = sim_ep[from].addr;
+	e->to = *to;
+	e->size = size;
+	memcpy(e->data, data, size);
+
+	Sim_Push(e);
+	sim_packets++;
+}
+
+static void Sim_OutOfBand(int from, struct sockaddr_in *to, const char *fmt, ...)
+{
+	va_list argptr;
+	char buf[MAX_MSGLEN];
+	int len;
+
+	memcpy(buf, "\xff\xff\xff\xff", 4);
+	va_start(argptr, fmt);
+	len = vsnprintf(buf + 4, sizeof(buf) - 4, fmt, argptr);
+	va_end(argptr);
+
+	Sim_Send(from, to, buf, 4 + len);
+}
+
+static void Sim_ClientPacket(sim_client_t *c, byte *data, int size);
+static void Sim_ServerPacket(sim_server_t *sv, struct sockaddr_in *from, byte *data, int size);
+static void Sim_MasterPacket(int ep, struct sockaddr_in *from, byte *data, int size);
+static void Sim_ObserverPacket(byte *data, int size);
+static void Sim_PingReplied(void);
+
+// mark proxy socket as readable
+static void Sim_Ready(int i)
+{
+	sim_endpoint_t *ep = &sim_ep[i];
+
+	if (ep->watched && !ep->ready)
+	{
+		ep->ready = true;
+		sim_ready[sim_ready_count++] = i;
+	}
+}
+
+// datagram reached its destination
+static void Sim_Deliver(sim_event_t *e)
+{
+	int to = Sim_Lookup(&e->to), from;
+	sim_endpoint_t *ep = &sim_ep[to];
+	struct sockaddr_in addr;
+
+	if (!to)
+	{
+		// nobody listens there, like kernel we tell it to connected socket only
+		if (e->size >= 0 && (from = Sim_Lookup(&e->from)) && sim_ep[from].connected)
+		{
+			addr = e->from;
+			e->from = e->to;
+			e->to = addr;
+			e->size = -1;
+			e->time = sim_now + SIM_LATENCY;
+			Sim_Push(e);
+			return;
+		}
+
+		Sys_free(e); // socket of the proxy was closed probably
+		return;
+	}
+
+	// connected socket hears from its remote only
+	if (ep->kind == se_proxy && ep->connected && !NET_CompareAddress(&ep->remote, &e->from))
+	{
+		Sys_free(e);
+		return;
+	}
+
+	if (e->size < 0)
+	{
+		ep->refused = true;
+		Sim_Ready(to);
+		Sys_free(e);
+		return;
+	}
+
+	switch (ep->kind)
+	{
+		case se_proxy:
+			// what proxy got from whom, for the checks
+			if ((from = Sim_Lookup(&e->from)))
+			{
+				if (sim_ep[from].kind == se_client)
+					((sim_client_t *)sim_ep[from].actor)->last_arrival = sim_now;
+				else if (sim_ep[from].kind == se_server && e->size == 1 && e->data[0] == A2A_ACK)
+					Sim_PingReplied();
+			}
+
+			if (ep->rx_tail)
+				ep->rx_tail->next = e;
+			else
+				ep->rx_head = e;
+			ep->rx_tail = e;
+
+			Sim_Ready(to);
+			return; // proxy frees it when it reads it
+
+		case se_client:
+			Sim_ClientPacket((sim_client_t *)ep->actor, e->data, e->size);
+			break;
+		case se_server:
+			Sim_ServerPacket((sim_server_t *)ep->actor, &e->from, e->data, e->size);
+			break;
+		case se_master:
+			Sim_MasterPacket(to, &e->from, e->data, e->size);
+			break;
+		case se_observer:
+			Sim_ObserverPacket(e->data, e->size);
+			break;
+	}
+
+	Sys_free(e);
+}
+
+static void Sim_Run(sim_event_t *e)
+{
+	sim_now = e->time;
+	Sys_SetVirtualClock(sim_now);
+	sim_events++;
+
+	if (!e->func)
+	{
+		Sim_Deliver(e);
+		return;
+	}
+
+	e->func(e);
+	Sys_free(e);
+}
+
+// director commands go to the proxy console
+static void Sim_Command(const char *fmt, ...)
+{
+	va_list argptr;
+	char text[1024];
+
+	va_start(argptr, fmt);
+	vsnprintf(text, sizeof(text), fmt, argptr);
+	va_end(argptr);
+
+	Cbuf_AddText(text);
+	sim_wake = true;
+}
+
+static void Sim_Quit(sim_event_t *e)
+{
+	ps.wanttoexit = true;
+}
+
+//=============================================================================
+// net_backend_t
+
+static int Sim_BackendOpen(const char *ip, int port, qbool do_bind)
+{
+	struct sockaddr_in addr;
+	int i, s;
+
+	Sim_Addr(&addr, 0, 0, 0, 0, 0);
+	addr.sin_addr.s_addr = (ip && *ip && inet_addr(ip) != INADDR_ANY) ? inet_addr(ip) : inet_addr(SIM_PROXY_IP);
+
+	if (do_bind)
+	{
+		addr.sin_port = htons((unsigned short)port);
+		if (!(s = Sim_Endpoint(se_proxy, &addr, NULL)))
+		{
+			Sys_Printf("Sim_BackendOpen: address is in use\n");
+			return INVALID_SOCKET;
+		}
+		return s;
+	}
+
+	for (i = SIM_EPHEMERAL_PORT; i < 65536; i++)
+	{
+		addr.sin_port = htons((unsigned short)sim_next_port);
+		sim_next_port = (sim_next_port < 65535) ? sim_next_port + 1 : SIM_EPHEMERAL_PORT;
+		if ((s = Sim_Endpoint(se_proxy, &addr, NULL)))
+			return s;
+	}
+
+	Sys_Printf("Sim_BackendOpen: out of ports\n");
+	return INVALID_SOCKET;
+}
+
+static void Sim_BackendClose(int s)
+{
+	Sim_RemoveEndpoint(s);
+}
+
+static int Sim_BackendRecv(int s, byte *data, int size, struct sockaddr_in *from)
+{
+	sim_endpoint_t *ep = &sim_ep[s];
+	sim_event_t *e = ep->rx_head;
+
+	// pending error comes before queued datagrams, as in linux
+	if (ep->refused)
+	{
+		ep->refused = false;
+		return -1;
+	}
+
+	if (!e)
+		return 0;
+
+	if (!(ep->rx_head = e->next))
+		ep->rx_tail = NULL;
+
+	size = min(size, e->size);
+	memcpy(data, e->data, size);
+	*from = e->from;
+	Sys_free(e);
+
+	return size;
+}
+
+static void Sim_PingSent(sim_server_t *sv);
+
+static void Sim_BackendSend(int s, int length, const void *data, struct sockaddr_in *to)
+{
+	int ep;
+
+	to = to ? to : &sim_ep[s].remote;
+	ep = Sim_Lookup(to);
+
+	// query scheduler checks see pings when they leave the proxy
+	if (ep && sim_ep[ep].kind == se_server && length == 6 && !memcmp(data, "\xff\xff\xff\xffk\n", 6))
+		Sim_PingSent((sim_server_t *)sim_ep[ep].actor);
+
+	Sim_Send(s, to, data, length);
+}
+
+static qbool Sim_BackendConnect(int s, struct sockaddr_in *to)
+{
+	sim_ep[s].connected = true;
+	sim_ep[s].remote = *to;
+
+	return true;
+}
+
+static qbool Sim_BackendWatch(int s, unsigned int handle)
+{
+	sim_endpoint_t *ep = &sim_ep[s];
+
+	ep->watched = true;
+	ep->handle = handle;
+
+	if (ep->rx_head || ep->refused)
+		Sim_Ready(s);
+
+	return true;
+}
+
+static void Sim_BackendUnwatch(int s)
+{
+	sim_ep[s].watched = false;
+}
+
+// run events until some socket of the proxy has something to read, or until it is time for the proxy to wake up
+static int Sim_BackendWait(unsigned int *handles, int max, int msec)
+{
+	unsigned long long deadline = sim_now + (msec > 0 ? SIM_MS(msec) : SIM_FRAME_COST);
+	sim_endpoint_t *ep;
+	int count = 0;
+
+	for (;;)
+	{
+		if (ps.wanttoexit)
+			return 0;
+
+		while (sim_ready_count && count < max)
+		{
+			ep = &sim_ep[sim_ready[--sim_ready_count]];
+			ep->ready = false;
+			if (ep->watched && (ep->rx_head || ep->refused))
+				handles[count++] = ep->handle;
+		}
+
+		if (count || sim_wake)
+		{
+			sim_wake = false;
+			return count;
+		}
+
+		if (!sim_heap_count || sim_heap[0]->time > deadline)
+			break;
+
+		Sim_Run(Sim_Pop());
+	}
+
+	sim_now = deadline;
+	Sys_SetVirtualClock(sim_now);
+
+	return 0;
+}
+
+static net_backend_t sim_backend =
+{
+	Sim_BackendOpen,
+	Sim_BackendClose,
+	Sim_BackendRecv,
+	Sim_BackendSend,
+	Sim_BackendConnect,
+	Sim_BackendWatch,
+	Sim_BackendUnwatch,
+	Sim_BackendWait,
+};
+
+//=============================================================================
+// clients
+
+static sim_client_t *Sim_ClientFromUserinfo(const char *s)
+{
+	const char *name = strstr(s, "\\name\\sim");
+	unsigned int i;
+
+	if (!name)
+		return NULL;
+
+	i = (unsigned int)atoi(name + sizeof("\\name\\sim") - 1);
+
+	return i < (unsigned int)sim_clients_count ? &sim_clients[i] : NULL;
+}
+
+static void Sim_ClientChallenge(sim_client_t *c)
+{
+	Sim_OutOfBand(c->ep, &sim_proxy, "getchallenge%s", c->proto == pr_qw ? "\n" : "");
+	c->state = sc_challenge;
+	c->sent_at = sim_now;
+}
+
+static void Sim_ClientConnect(sim_client_t *c)
+{
+	char data[MAX_MSGLEN], server[] = "xxx.xxx.xxx.xxx:xxxxx";
+	byte msg_data[MAX_MSGLEN];
+	sizebuf_t msg;
+
+	c->state = sc_connect;
+	c->sent_at = sim_now;
+	NET_AdrToString(&c->server, server, sizeof(server));
+
+	if (c->proto == pr_qw)
+	{
+		Sim_OutOfBand(c->ep, &sim_proxy, "connect %d %d %d \"\\name\\sim%d\\" QWFWD_PRX_KEY "\\%s\"\n",
+			QW_PROTOCOL_VERSION, c->qport, c->challenge, (int)(c - sim_clients), server);
+		return;
+	}
+
+	// the same way CL_SendConnectPacket_Q3() does it
+	snprintf(data, sizeof(data), "\xff\xff\xff\xff" "connect \"\\challenge\\%d\\qport\\%d\\protocol\\68\\name\\sim%d\\" QWFWD_PRX_KEY "\\%s\"",
+		c->challenge, c->qport, (int)(c - sim_clients), server);
+	SZ_InitEx(&msg, msg_data, sizeof(msg_data), true);
+	SZ_Print(&msg, data);
+	Huff_EncryptPacket(&msg, 12);
+
+	Sim_Send(c->ep, &sim_proxy, msg.data, msg.cursize);
+}
+
+static void Sim_ClientNetchan(sim_client_t *c)
+{
+	byte data[SIM_PACKET_SIZE];
+	unsigned int i = c - sim_clients;
+
+	memset(data, 0, sizeof(data));
+	c->seq++;
+	memcpy(data, &c->seq, 4);
+	if (c->proto == pr_qw)
+	{
+		data[8] = c->qport & 0xff;
+		data[9] = c->qport >> 8;
+	}
+	else
+	{
+		data[4] = c->qport & 0xff;
+		data[5] = c->qport >> 8;
+	}
+	memcpy(data + 12, &i, 4);
+
+	Sim_Send(c->ep, &sim_proxy, data, sizeof(data));
+	c->sent++;
+}
+
+static void Sim_ClientDrop(sim_client_t *c)
+{
+	byte data[16];
+	int i;
+
+	if (c->proto != pr_qw)
+		return; // q3 clients are detected as gone by the proxy itself
+
+	memset(data, 0, sizeof(data));
+	data[8] = c->qport & 0xff;
+	data[9] = c->qport >> 8;
+	data[10] = clc_stringcmd;
+	strlcpy((char *)data + 11, "drop", sizeof(data) - 11);
+
+	for (i = 0; i < 3; i++)
+		Sim_Send(c->ep, &sim_proxy, data, 11 + sizeof("drop"));
+}
+
+static void Sim_ClientThink(sim_event_t *e)
+{
+	sim_client_t *c = (sim_client_t *) e->arg;
+
+	if (sim_now >= c->stop_at)
+	{
+		if (c->drop)
+			Sim_ClientDrop(c);
+		c->state = sc_stopped;
+		return;
+	}
+
+	switch (c->state)
+	{
+		case sc_idle:
+			Sim_ClientChallenge(c);
+			break;
+		case sc_challenge:
+		case sc_connect:
+			if (sim_now - c->sent_at >= SIM_MS(SIM_RESEND))
+				Sim_ClientChallenge(c);
+			break;
+		case sc_connected:
+			// q3 client is told it is connected only when the proxy is connected to the server already
+			if (c->proto == pr_q3 || (c->upstream_at && sim_now - c->upstream_at >= SIM_MS(SIM_SETTLE)))
+				Sim_ClientNetchan(c);
+			break;
+		default:
+			break;
+	}
+
+	Sim_Timer(sim_now + SIM_MS(c->interval), Sim_ClientThink, c);
+}
+
+static void Sim_ClientConnectionless(sim_client_t *c, char *s)
+{
+	if (strstr(s, "proxy can't connect"))
+	{
+		c->told_at = c->told_at ? c->told_at : sim_now;
+		return;
+	}
+
+	if (c->proto == pr_qw)
+	{
+		if (s[0] == S2C_CHALLENGE && c->state == sc_challenge)
+		{
+			c->replied_at = c->replied_at ? c->replied_at : sim_now;
+			c->challenge = atoi(s + 1);
+			if (!c->probe_only)
+				Sim_ClientConnect(c);
+		}
+		else if (s[0] == S2C_CONNECTION && c->state == sc_connect)
+		{
+			c->state = sc_connected;
+		}
+		return;
+	}
+
+	if (!strncmp(s, "challengeResponse ", sizeof("challengeResponse ") - 1) && c->state == sc_challenge)
+	{
+		c->replied_at = c->replied_at ? c->replied_at : sim_now;
+		c->challenge = atoi(s + sizeof("challengeResponse ") - 1);
+		if (!c->probe_only)
+			Sim_ClientConnect(c);
+	}
+	else if (!strcmp(s, "connectResponse") && c->state == sc_connect)
+	{
+		c->state = sc_connected;
+	}
+}
+
+static void Sim_ClientPacket(sim_client_t *c, byte *data, int size)
+{
+	if (size >= 4 && *(int *)data == -1)
+	{
+		Sim_ClientConnectionless(c, (char *)data + 4);
+		return;
+	}
+
+	// echoes of what was sent just before client stopped count too
+	if (size >= SIM_PACKET_MIN && c->state >= sc_connected)
+		c->received++;
+}
+
+static sim_client_t *Sim_NewClient(protocol_t proto, struct sockaddr_in *addr, struct sockaddr_in *server,
+	unsigned long long start, unsigned int interval, unsigned long long stop)
+{
+	sim_client_t *c = &sim_clients[sim_clients_count++];
+
+	c->proto = proto;
+	c->qport = 1 + Sim_Rand() % 0xfffe;
+	if (server)
+		c->server = *server;
+	c->interval = interval;
+	c->stop_at = stop;
+
+	if (!(c->ep = Sim_Endpoint(se_client, addr, c)))
+		Sys_Error("Sim_NewClient: address is in use");
+
+	Sim_Timer(start, Sim_ClientThink, c);
+
+	return c;
+}
+
+//=============================================================================
+// servers
+
+static void Sim_ServerChallenge(sim_server_t *sv, struct sockaddr_in *from, protocol_t proto)
+{
+	if (sv->challenges < SIM_MAX_CHALLENGES)
+		sv->challenge_at[sv->challenges] = sim_now;
+	sv->challenges++;
+
+	if (sv->dead || sv->ignore_challenges > 0)
+	{
+		sv->ignore_challenges--;
+		return;
+	}
+
+	if (proto == pr_qw)
+		Sim_OutOfBand(sv->ep, from, "%c%d", S2C_CHALLENGE, SIM_CHALLENGE);
+	else
+		Sim_OutOfBand(sv->ep, from, "challengeResponse %d", SIM_CHALLENGE);
+}
+
+static void Sim_ServerConnect(sim_server_t *sv, struct sockaddr_in *from, byte *data, int size)
+{
+	sim_client_t *c;
+	sizebuf_t msg;
+	byte buf[MAX_MSGLEN * 2];
+
+	// q3 connect is compressed, see SV_ConnectionlessPacket() of the proxy
+	SZ_InitEx(&msg, buf, sizeof(buf) - 1, true);
+	SZ_Write(&msg, data, size);
+	if (msg.cursize > 12 && msg.data[12] < ' ')
+		Huff_DecryptPacket(&msg, 12);
+	msg.data[msg.cursize] = 0;
+
+	if (!(c = Sim_ClientFromUserinfo((char *)msg.data + 4)))
+		return;
+
+	if (c->proto == pr_qw)
+		Sim_OutOfBand(sv->ep, from, "%c", S2C_CONNECTION);
+	else
+		Sim_OutOfBand(sv->ep, from, "connectResponse");
+
+	sv->connects++;
+	c->upstream_at = c->upstream_at ? c->upstream_at : sim_now;
+}
+
+static void Sim_ServerProbe(sim_server_t *sv, byte *data)
+{
+	unsigned long long gap = sim_now - sv->last_probe;
+
+	if (sv->probes)
+	{
+		sv->probe_gap_min = (sv->probes == 1 || gap < sv->probe_gap_min) ? gap : sv->probe_gap_min;
+		sv->probe_gap_max = (gap > sv->probe_gap_max) ? gap : sv->probe_gap_max;
+	}
+	else
+	{
+		sv->first_probe = sim_now;
+	}
+
+	sv->probes++;
+	sv->last_probe = sim_now;
+	sv->probe_qport = data[4] | (data[5] << 8);
+}
+
+static void Sim_ServerPacket(sim_server_t *sv, struct sockaddr_in *from, byte *data, int size)
+{
+	char *s = (char *)data + 4;
+
+	if (size >= 4 && *(int *)data == -1)
+	{
+		// dead server still counts challenges it did not answer
+		if (!strcmp(s, "getchallenge\n"))
+			Sim_ServerChallenge(sv, from, pr_qw);
+		else if (!strcmp(s, "getchallenge"))
+			Sim_ServerChallenge(sv, from, pr_q3);
+		else if (sv->dead)
+			return;
+		else if (!strncmp(s, "connect ", sizeof("connect ") - 1))
+			Sim_ServerConnect(sv, from, data, size);
+		else if (!strcmp(s, "k\n"))
+			Sim_Send(sv->ep, from, "l", 1); // A2A_ACK
+		return;
+	}
+
+	if (sv->dead)
+		return;
+
+	if (size == 6 && !*(int *)data)
+	{
+		Sim_ServerProbe(sv, data);
+		return;
+	}
+
+	if (size < SIM_PACKET_MIN)
+		return; // drop of the client and such
+
+	// echo it back
+	sv->received++;
+	Sim_Send(sv->ep, from, data, size);
+	sv->sent++;
+}
+
+static sim_server_t *Sim_NewServer(struct sockaddr_in *addr)
+{
+	sim_server_t *sv = &sim_servers[sim_servers_count++];
+
+	if (!(sv->ep = Sim_Endpoint(se_server, addr, sv)))
+		Sys_Error("Sim_NewServer: address is in use");
+
+	return sv;
+}
+
+static void Sim_Alloc(int clients, int servers)
+{
+	sim_clients = Sys_malloc(max(clients, 1) * sizeof(*sim_clients));
+	sim_servers = Sys_malloc(max(servers, 1) * sizeof(*sim_servers));
+}
+
+//=============================================================================
+// scenario: peers table at scale
+
+#define SIM_PEERS_SERVERS	8			// qw servers, there is a quarter of that q3 servers
+#define SIM_PEERS_TRAFFIC	20000		// ms, clients stop after that
+
+static int sim_peers_gone;				// qw clients which say drop
+
+static void Sim_Peers_Config(FILE *f)
+{
+	fprintf(f, "set maxclients %d\n", opt_peers + 16);
+}
+
+static void Sim_Peers_Connected(sim_event_t *e)
+{
+	int i, connected = 0;
+
+	for (i = 0; i < sim_clients_count; i++)
+		connected += (sim_clients[i].state == sc_connected);
+
+	Sim_Check(connected == sim_clients_count, "%d of %d clients connected after 5 s", connected, sim_clients_count);
+	Sim_Check(FWD_peers_count() == sim_clients_count, "%d peers after 5 s, expected %d", FWD_peers_count(), sim_clients_count);
+}
+
+static void Sim_Peers_Count(sim_event_t *e)
+{
+	int expected = (int)(size_t)e->arg;
+
+	Sim_Check(FWD_peers_count() == expected, "%d peers %.0f s after clients stopped, expected %d",
+		FWD_peers_count(), Sim_Ms(sim_now - SIM_AT(SIM_PEERS_TRAFFIC)) / 1000, expected);
+}
+
+static void Sim_Peers_Setup(void)
+{
+	struct sockaddr_in addr;
+	sim_client_t *c;
+	int i, q3_servers = max(SIM_PEERS_SERVERS / 4, 1);
+
+	Sim_Alloc(opt_peers, SIM_PEERS_SERVERS + q3_servers);
+	sim_jitter = 10000;
+
+	for (i = 0; i < SIM_PEERS_SERVERS; i++)
+	{
+		Sim_Addr(&addr, 10, 2, 0, i + 1, 27500);
+		Sim_NewServer(&addr);
+	}
+
+	for (i = 0; i < q3_servers; i++)
+	{
+		Sim_Addr(&addr, 10, 2, 1, i + 1, 27960);
+		Sim_NewServer(&addr);
+	}
+
+	// every tenth client is q3, half of qw clients say drop when they stop, the rest just go silent
+	for (i = 0; i < opt_peers; i++)
+	{
+		Sim_Addr(&addr, 10, 1, (i >> 8) & 0xff, i & 0xff, 27001 + (i >> 16));
+		if (i % 10 == 9)
+		{
+			c = Sim_NewClient(pr_q3, &addr, &sim_ep[sim_servers[SIM_PEERS_SERVERS + i % q3_servers].ep].addr,
+				SIM_AT(i * 1000 / opt_peers), 100, SIM_AT(SIM_PEERS_TRAFFIC));
+		}
+		else
+		{
+			c = Sim_NewClient(pr_qw, &addr, &sim_ep[sim_servers[i % SIM_PEERS_SERVERS].ep].addr,
+				SIM_AT(i * 1000 / opt_peers), 100, SIM_AT(SIM_PEERS_TRAFFIC));
+			c->drop = !(i & 1);
+			sim_peers_gone += c->drop;
+		}
+	}
+
+	Sim_Timer(SIM_AT(5000), Sim_Peers_Connected, NULL);
+	// dropped peers are gone at once, silent ones live until timeout
+	Sim_Timer(SIM_AT(SIM_PEERS_TRAFFIC + 2000), Sim_Peers_Count, (void *)(size_t)(opt_peers - sim_peers_gone));
+	Sim_Timer(SIM_AT(SIM_PEERS_TRAFFIC + 14000), Sim_Peers_Count, (void *)(size_t)(opt_peers - sim_peers_gone));
+	Sim_Timer(SIM_AT(SIM_PEERS_TRAFFIC + 17000), Sim_Peers_Count, (void *)0);
+	Sim_Timer(SIM_AT(SIM_PEERS_TRAFFIC + 18000), Sim_Quit, NULL);
+}
+
+static void Sim_Peers_Check(void)
+{
+	unsigned long long client_sent = 0, client_received = 0, server_sent = 0, server_received = 0;
+	int i, silent = 0;
+
+	for (i = 0; i < sim_clients_count; i++)
+	{
+		client_sent += sim_clients[i].sent;
+		client_received += sim_clients[i].received;
+		silent += !sim_clients[i].received;
+	}
+
+	for (i = 0; i < sim_servers_count; i++)
+	{
+		server_sent += sim_servers[i].sent;
+		server_received += sim_servers[i].received;
+	}
+
+	Sim_Check(client_sent == server_received, "clients sent %llu packets, servers got %llu", client_sent, server_received);
+	Sim_Check(server_sent == client_received, "servers sent %llu packets, clients got %llu", server_sent, client_received);
+	Sim_Check(!silent, "%d clients got nothing back", silent);
+
+	snprintf(sim_summary, sizeof(sim_summary), "%d clients, %llu packets forwarded, %d dropped, %d timed out",
+		sim_clients_count, server_received + client_received, sim_peers_gone, sim_clients_count - sim_peers_gone);
+}
+
+//=============================================================================
+// scenario: challenge resend
+
+static void Sim_Challenge_Count(sim_event_t *e)
+{
+	Sim_Check(FWD_peers_count() == 2, "%d peers when unreachable server should have timed out, expected 2", FWD_peers_count());
+}
+
+static void Sim_Challenge_Setup(void)
+{
+	struct sockaddr_in addr;
+	sim_server_t *sv;
+	int i;
+
+	Sim_Alloc(3, 3);
+
+	// qw and q3 server ignore first challenges, third one never answers
+	Sim_Addr(&addr, 10, 2, 0, 1, 27500);
+	sv = Sim_NewServer(&addr);
+	sv->ignore_challenges = 2;
+	Sim_Addr(&addr, 10, 2, 1, 1, 27960);
+	sv = Sim_NewServer(&addr);
+	sv->ignore_challenges = 2;
+	Sim_Addr(&addr, 10, 2, 0, 2, 27500);
+	sv = Sim_NewServer(&addr);
+	sv->dead = true;
+
+	for (i = 0; i < 3; i++)
+	{
+		Sim_Addr(&addr, 10, 1, 0, i + 1, 27001);
+		Sim_NewClient(i == 1 ? pr_q3 : pr_qw, &addr, &sim_ep[sim_servers[i].ep].addr, SIM_AT(0), 100, SIM_AT(12000));
+	}
+
+	Sim_Timer(SIM_AT(20000), Sim_Challenge_Count, NULL);
+	Sim_Timer(SIM_AT(21000), Sim_Quit, NULL);
+}
+
+// returns min and max gap between challenges server got
+static void Sim_Challenge_Gaps(sim_server_t *sv, unsigned long long *gap_min, unsigned long long *gap_max)
+{
+	unsigned long long gap;
+	int i;
+
+	for (i = 1; i < sv->challenges && i < SIM_MAX_CHALLENGES; i++)
+	{
+		gap = sv->challenge_at[i] - sv->challenge_at[i - 1];
+		*gap_min = (!*gap_min || gap < *gap_min) ? gap : *gap_min;
+		*gap_max = (gap > *gap_max) ? gap : *gap_max;
+	}
+}
+
+static void Sim_Challenge_Check(void)
+{
+	unsigned long long gap_min = 0, gap_max = 0;
+	sim_server_t *sv;
+	sim_client_t *c;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		sv = &sim_servers[i];
+		c = &sim_clients[i];
+		Sim_Check(sv->challenges == 3, "%s server got %d challenges, expected 3", i ? "q3" : "qw", sv->challenges);
+		Sim_Check(sv->connects > 0, "%s server got no connect", i ? "q3" : "qw");
+		Sim_Check(c->received > 0, "%s client got no traffic after server answered", i ? "q3" : "qw");
+		Sim_Check(sv->challenge_at[0] - SIM_START < SIM_MS(1000), "%s: first challenge is not sent at once", i ? "q3" : "qw");
+		Sim_Challenge_Gaps(sv, &gap_min, &gap_max);
+	}
+
+	// unreachable server is asked until the peer times out
+	sv = &sim_servers[2];
+	Sim_Check(sv->challenges >= 5 && sv->challenges <= 6, "unreachable server got %d challenges, expected 5 or 6", sv->challenges);
+	Sim_Challenge_Gaps(sv, &gap_min, &gap_max);
+
+	Sim_Check(gap_min >= SIM_MS(3000) && gap_max <= SIM_MS(3010), "challenges are resent every %.1f-%.1f ms, expected 3000",
+		Sim_Ms(gap_min), Sim_Ms(gap_max));
+
+	snprintf(sim_summary, sizeof(sim_summary), "challenge resent every %.0f-%.0f ms, %d sent to unreachable server",
+		Sim_Ms(gap_min), Sim_Ms(gap_max), sv->challenges);
+}
+
+//=============================================================================
+// scenario: q3 disconnect probes
+
+#define SIM_PROBE_TRAFFIC	5000		// ms
+
+static void Sim_Probe_Count(sim_event_t *e)
+{
+	Sim_Check(FWD_peers_count() == 0, "%d peers after timeout, expected 0", FWD_peers_count());
+}
+
+static void Sim_Probe_Setup(void)
+{
+	struct sockaddr_in addr;
+
+	Sim_Alloc(2, 2);
+
+	Sim_Addr(&addr, 10, 2, 1, 1, 27960);
+	Sim_NewServer(&addr);
+	Sim_Addr(&addr, 10, 2, 0, 1, 27500);
+	Sim_NewServer(&addr);
+
+	// both go silent, only q3 one should be probed
+	Sim_Addr(&addr, 10, 1, 0, 1, 27001);
+	Sim_NewClient(pr_q3, &addr, &sim_ep[sim_servers[0].ep].addr, SIM_AT(0), 50, SIM_AT(SIM_PROBE_TRAFFIC));
+	Sim_Addr(&addr, 10, 1, 0, 2, 27001);
+	Sim_NewClient(pr_qw, &addr, &sim_ep[sim_servers[1].ep].addr, SIM_AT(0), 50, SIM_AT(SIM_PROBE_TRAFFIC));
+
+	Sim_Timer(SIM_AT(SIM_PROBE_TRAFFIC + 17000), Sim_Probe_Count, NULL);
+	Sim_Timer(SIM_AT(SIM_PROBE_TRAFFIC + 18000), Sim_Quit, NULL);
+}
+
+static void Sim_Probe_Check(void)
+{
+	sim_server_t *sv = &sim_servers[0];
+	sim_client_t *c = &sim_clients[0];
+	// when proxy sent probes, and when it heard from client last time
+	unsigned long long first = sv->first_probe - SIM_LATENCY, last = sv->last_probe - SIM_LATENCY;
+	unsigned long long silent = c->last_arrival - c->last_arrival % 1000; // proxy works with milliseconds
+	int expected = (15000 - 1001) / 50 + 1;
+
+	Sim_Check(sim_clients[0].received > 0 && sim_clients[1].received > 0, "clients got no traffic");
+	Sim_Check(sv->probes > 0, "q3 server got no probes");
+	Sim_Check(!sim_servers[1].probes, "qw server got %d probes", sim_servers[1].probes);
+	Sim_Check(sv->probe_qport == c->qport, "probe has qport %d, client has %d", sv->probe_qport, c->qport);
+	Sim_Check(first - silent > SIM_MS(1000) && first - silent <= SIM_MS(1010), "first probe %.1f ms after client went silent",
+		Sim_Ms(first - silent));
+	Sim_Check(sv->probe_gap_min >= SIM_MS(50) && sv->probe_gap_max <= SIM_MS(60), "probes every %.1f-%.1f ms, expected 50",
+		Sim_Ms(sv->probe_gap_min), Sim_Ms(sv->probe_gap_max));
+	Sim_Check(last - silent < SIM_MS(15000), "probe %.1f ms after client went silent, peer should be gone",
+		Sim_Ms(last - silent));
+	Sim_Check(abs(sv->probes - expected) <= 1, "%d probes, expected %d", sv->probes, expected);
+
+	snprintf(sim_summary, sizeof(sim_summary), "%d probes, first %.0f ms after client went silent, then every %.0f-%.0f ms",
+		sv->probes, Sim_Ms(first - silent), Sim_Ms(sv->probe_gap_min), Sim_Ms(sv->probe_gap_max));
+}
+
+//=============================================================================
+// scenario: ban engine at scale
+
+#define SIM_BANS_GROUP		20			// clients in each group
+#define SIM_BANS_CHUNK		200			// addip commands director queues at once
+#define SIM_BANS_EXPIRE		60			// seconds
+#define SIM_BANS_TIME		75000		// ms
+
+// clients of group A are not banned, of group B are in permanent ban list, of group C have expiring bans
+#define SIM_BANS_A			0
+#define SIM_BANS_B			SIM_BANS_GROUP
+#define SIM_BANS_C			(SIM_BANS_GROUP * 2)
+
+static int sim_bans_added;
+static unsigned long long sim_bans_expire;	// when expiring bans should be lifted
+static unsigned long long sim_bans_removed;	// when first client of group B was unbanned
+
+static int Sim_Bans_Index(int k)
+{
+	return k * (opt_bans / SIM_BANS_GROUP);
+}
+
+static void Sim_Bans_Add(sim_event_t *e)
+{
+	char text[SIM_BANS_CHUNK * 32];
+	int i, len = 0;
+
+	for (i = 0; i < SIM_BANS_CHUNK && sim_bans_added < opt_bans; i++, sim_bans_added++)
+		len += snprintf(text + len, sizeof(text) - len, "addip 10.9.%d.%d\n", (sim_bans_added >> 8) & 0xff, sim_bans_added & 0xff);
+
+	Cbuf_AddText(text);
+	sim_wake = true;
+
+	if (sim_bans_added < opt_bans)
+		Sim_Timer(sim_now + SIM_MS(10), Sim_Bans_Add, NULL);
+}
+
+static void Sim_Bans_Expiring(sim_event_t *e)
+{
+	int i;
+
+	for (i = 0; i < SIM_BANS_GROUP; i++)
+		Sim_Command("addip 10.8.0.%d ban +%d\n", i + 1, SIM_BANS_EXPIRE);
+
+	// bans are checked once per second of Sys_Time()
+	sim_bans_expire = sim_now - sim_now % SIM_SEC(1) + SIM_SEC(SIM_BANS_EXPIRE);
+}
+
+static void Sim_Bans_Remove(sim_event_t *e)
+{
+	int i = Sim_Bans_Index(0);
+
+	Sim_Command("removeip 10.9.%d.%d\n", (i >> 8) & 0xff, i & 0xff);
+	sim_bans_removed = sim_now;
+}
+
+static void Sim_Bans_Setup(void)
+{
+	struct sockaddr_in addr;
+	sim_client_t *c;
+	int i, k;
+
+	opt_bans = bound(SIM_BANS_GROUP, opt_bans, 65536);
+	Sim_Alloc(SIM_BANS_GROUP * 3, 0);
+
+	Sim_Timer(SIM_AT(10), Sim_Bans_Add, NULL);
+	Sim_Timer(SIM_AT(1000), Sim_Bans_Expiring, NULL);
+	Sim_Timer(SIM_AT(30000), Sim_Bans_Remove, NULL);
+
+	// clients only ask for challenge, the proxy does not answer if they are banned
+	for (k = 0; k < SIM_BANS_GROUP; k++)
+	{
+		Sim_Addr(&addr, 10, 1, 0, k + 1, 27001);
+		c = Sim_NewClient(pr_qw, &addr, NULL, SIM_AT(2000), 100, SIM_AT(SIM_BANS_TIME));
+		c->probe_only = true;
+	}
+
+	for (k = 0; k < SIM_BANS_GROUP; k++)
+	{
+		i = Sim_Bans_Index(k);
+		Sim_Addr(&addr, 10, 9, (i >> 8) & 0xff, i & 0xff, 27001);
+		c = Sim_NewClient(pr_qw, &addr, NULL, SIM_AT(2000), 100, SIM_AT(SIM_BANS_TIME));
+		c->probe_only = true;
+	}
+
+	for (k = 0; k < SIM_BANS_GROUP; k++)
+	{
+		Sim_Addr(&addr, 10, 8, 0, k + 1, 27001);
+		c = Sim_NewClient(pr_qw, &addr, NULL, SIM_AT(2000), 100, SIM_AT(SIM_BANS_TIME));
+		c->probe_only = true;
+	}
+
+	Sim_Timer(SIM_AT(SIM_BANS_TIME + 1000), Sim_Quit, NULL);
+}
+
+static void Sim_Bans_Check(void)
+{
+	unsigned long long lifted = 0;
+	sim_client_t *c;
+	int k;
+
+	for (k = 0; k < SIM_BANS_GROUP; k++)
+	{
+		c = &sim_clients[SIM_BANS_A + k];
+		Sim_Check(c->replied_at && c->replied_at - SIM_AT(2000) < SIM_MS(100), "client which is not banned got no challenge in time");
+
+		c = &sim_clients[SIM_BANS_B + k];
+		if (!k)
+			Sim_Check(c->replied_at > sim_bans_removed && c->replied_at - sim_bans_removed < SIM_MS(1000), "removeip did not work");
+		else
+			Sim_Check(!c->replied_at, "banned client got challenge");
+
+		c = &sim_clients[SIM_BANS_C + k];
+		Sim_Check(c->replied_at >= sim_bans_expire, "client got challenge %.0f ms before its ban expired", Sim_Ms(sim_bans_expire - c->replied_at));
+		Sim_Check(c->replied_at && c->replied_at < sim_bans_expire + SIM_MS(1500), "expired ban was not lifted in time");
+		lifted = max(lifted, c->replied_at - sim_bans_expire);
+	}
+
+	snprintf(sim_summary, sizeof(sim_summary), "%d bans, expired bans lifted within %.0f ms", opt_bans, Sim_Ms(lifted));
+}
+
+//=============================================================================
+// scenario: query scheduler
+
+#define SIM_QUERY_TIME		(2 * 3600)	// seconds
+#define SIM_QUERY_RATE		50			// masters_ping_rate
+#define SIM_QUERY_INFLIGHT	8			// masters_ping_inflight
+#define SIM_QUERY_INTERVAL	60			// masters_ping_interval
+#define SIM_QUERY_TIMEOUT	1000		// ms, QW_SERVER_PING_TIMEOUT of the proxy
+#define SIM_QUERY_WINDOW	(SIM_QUERY_RATE + 2)	// rate per second plus burst of one ping, plus one
+#define SIM_MASTER_BATCH	200			// servers per master reply
+#define SIM_PINGSTATUS_SLOT	8
+
+static int sim_query_masters;			// queries master got
+static int sim_query_inflight;			// pings which proxy waits reply for, as far as we can tell
+static int sim_query_inflight_max;
+static unsigned long long sim_query_pings;
+static unsigned long long sim_query_window[SIM_QUERY_WINDOW];	// when last pings were sent
+static int sim_query_listed;			// pingstatus entries of live servers
+static int sim_query_ping;				// and pings they have
+
+static void Sim_Query_Config(FILE *f)
+{
+	fprintf(f, "set masters_query 1\n");
+	fprintf(f, "set masters \"10.3.0.1:27000\"\n");
+	fprintf(f, "set masters_ping_rate %d\n", SIM_QUERY_RATE);
+	fprintf(f, "set masters_ping_inflight %d\n", SIM_QUERY_INFLIGHT);
+	fprintf(f, "set masters_ping_interval %d\n", SIM_QUERY_INTERVAL);
+}
+
+static void Sim_MasterPacket(int ep, struct sockaddr_in *from, byte *data, int size)
+{
+	byte reply[6 + SIM_MASTER_BATCH * 6];
+	struct sockaddr_in *addr;
+	int i, len = 6;
+
+	if (size < 2 || memcmp(data, "c\n", 2))
+		return;
+
+	sim_query_masters++;
+	memcpy(reply, "\xff\xff\xff\xff\x64\x0a", 6);
+
+	for (i = 0; i < sim_servers_count; i++)
+	{
+		addr = &sim_ep[sim_servers[i].ep].addr;
+		memcpy(reply + len, &addr->sin_addr, 4);
+		memcpy(reply + len + 4, &addr->sin_port, 2);
+		len += 6;
+
+		if (len == sizeof(reply) || i == sim_servers_count - 1)
+		{
+			Sim_Send(ep, from, reply, len);
+			len = 6;
+		}
+	}
+}
+
+static void Sim_Query_Timeout(sim_event_t *e)
+{
+	sim_query_inflight--;
+}
+
+static void Sim_PingSent(sim_server_t *sv)
+{
+	unsigned long long gap = sim_now - sv->last_ping;
+
+	if (sv->pings)
+		sv->ping_gap_min = (sv->pings == 1 || gap < sv->ping_gap_min) ? gap : sv->ping_gap_min;
+	sv->pings++;
+	sv->last_ping = sim_now;
+
+	// no more than rate plus burst in any second
+	sim_query_window[sim_query_pings++ % SIM_QUERY_WINDOW] = sim_now;
+	if (sim_query_pings >= SIM_QUERY_WINDOW)
+	{
+		gap = sim_now - sim_query_window[sim_query_pings % SIM_QUERY_WINDOW];
+		Sim_Check(gap >= SIM_SEC(1), "%d pings in %.1f ms, masters_ping_rate is %d", SIM_QUERY_WINDOW, Sim_Ms(gap), SIM_QUERY_RATE);
+	}
+
+	// proxy forgets the ping at timeout, its timer works with whole milliseconds
+	sim_query_inflight++;
+	sim_query_inflight_max = max(sim_query_inflight_max, sim_query_inflight);
+	if (sv->dead)
+		Sim_Timer(sim_now - sim_now % 1000 + SIM_MS(SIM_QUERY_TIMEOUT), Sim_Query_Timeout, NULL);
+}
+
+static void Sim_PingReplied(void)
+{
+	sim_query_inflight--;
+}
+
+static void Sim_ObserverPacket(byte *data, int size)
+{
+	struct sockaddr_in addr;
+	int i, ep, ping;
+
+	for (i = 5; i + SIM_PINGSTATUS_SLOT <= size; i += SIM_PINGSTATUS_SLOT)
+	{
+		Sim_Addr(&addr, 0, 0, 0, 0, data[i + 4] | (data[i + 5] << 8));
+		memcpy(&addr.sin_addr, data + i, 4);
+		ping = data[i + 6] | (data[i + 7] << 8);
+
+		if (!(ep = Sim_Lookup(&addr)) || sim_ep[ep].kind != se_server || ((sim_server_t *)sim_ep[ep].actor)->dead)
+			continue;
+
+		Sim_Check(ping == 2 * SIM_LATENCY / 1000, "server has ping %d, expected %d", ping, 2 * SIM_LATENCY / 1000);
+		sim_query_listed++;
+		sim_query_ping = ping;
+	}
+}
+
+static void Sim_Query_PingStatus(sim_event_t *e)
+{
+	Sim_OutOfBand((int)(size_t)e->arg, &sim_proxy, "pingstatus");
+}
+
+static void Sim_Query_Setup(void)
+{
+	struct sockaddr_in addr;
+	sim_server_t *sv;
+	int i, observer;
+
+	Sim_Alloc(0, opt_peers);
+
+	Sim_Addr(&addr, 10, 3, 0, 1, 27000);
+	Sim_Endpoint(se_master, &addr, NULL);
+	Sim_Addr(&addr, 10, 5, 0, 1, 27001);
+	observer = Sim_Endpoint(se_observer, &addr, NULL);
+
+	// every fourth server is dead
+	for (i = 0; i < opt_peers; i++)
+	{
+		Sim_Addr(&addr, 10, 4, (i >> 8) & 0xff, i & 0xff, 27500 + (i >> 16));
+		sv = Sim_NewServer(&addr);
+		sv->dead = (i % 4 == 3);
+	}
+
+	Sim_Timer(SIM_START + SIM_SEC(SIM_QUERY_TIME) - SIM_SEC(1), Sim_Query_PingStatus, (void *)(size_t)observer);
+	Sim_Timer(SIM_START + SIM_SEC(SIM_QUERY_TIME), Sim_Quit, NULL);
+}
+
+static void Sim_Query_Check(void)
+{
+	int i, live_min = 0, dead_max = 0, unpinged = 0;
+	unsigned long long gap_min = 0;
+	sim_server_t *sv;
+
+	for (i = 0; i < sim_servers_count; i++)
+	{
+		sv = &sim_servers[i];
+		unpinged += !sv->pings;
+
+		if (sv->dead)
+		{
+			dead_max = max(dead_max, sv->pings);
+			continue;
+		}
+
+		live_min = (!live_min || sv->pings < live_min) ? sv->pings : live_min;
+		if (sv->pings > 1)
+			gap_min = (!gap_min || sv->ping_gap_min < gap_min) ? sv->ping_gap_min : gap_min;
+	}
+
+	Sim_Check(sim_query_masters >= SIM_QUERY_TIME / 1800, "master was queried %d times in %d s", sim_query_masters, SIM_QUERY_TIME);
+	Sim_Check(!unpinged, "%d servers were never pinged", unpinged);
+	Sim_Check(sim_query_inflight_max <= SIM_QUERY_INFLIGHT, "%d pings in flight, masters_ping_inflight is %d", sim_query_inflight_max, SIM_QUERY_INFLIGHT);
+	Sim_Check(gap_min >= SIM_SEC(SIM_QUERY_INTERVAL), "live server pinged again after %.1f s, masters_ping_interval is %d",
+		Sim_Ms(gap_min) / 1000, SIM_QUERY_INTERVAL);
+	Sim_Check(live_min >= SIM_QUERY_TIME / SIM_QUERY_INTERVAL / 2, "some live server was pinged only %d times", live_min);
+	Sim_Check(dead_max < live_min, "dead server was pinged %d times, live one %d times", dead_max, live_min);
+	Sim_Check(sim_query_listed > 0, "no live servers in pingstatus");
+
+	snprintf(sim_summary, sizeof(sim_summary), "%d servers, %llu pings, %d in flight at most, live ones pinged every %.1f s or later",
+		sim_servers_count, sim_query_pings, sim_query_inflight_max, Sim_Ms(gap_min) / 1000);
+}
+
+//=============================================================================
+// scenario: server port is unreachable
+
+#define SIM_REFUSED_DOWN	5000		// ms, live server goes away
+
+static void Sim_Refused_Count(sim_event_t *e)
+{
+	int expected = (int)(size_t)e->arg;
+
+	Sim_Check(FWD_peers_count() == expected, "%d peers %.0f ms in, expected %d", FWD_peers_count(), Sim_Ms(sim_now - SIM_START), expected);
+}
+
+static void Sim_Refused_Down(sim_event_t *e)
+{
+	Sim_RemoveEndpoint(sim_servers[0].ep);
+}
+
+static void Sim_Refused_Setup(void)
+{
+	struct sockaddr_in addr, nobody;
+	sim_server_t *sv;
+
+	Sim_Alloc(4, 2);
+
+	Sim_Addr(&addr, 10, 2, 0, 1, 27500);
+	Sim_NewServer(&addr);
+	Sim_Addr(&addr, 10, 2, 1, 1, 27960);
+	sv = Sim_NewServer(&addr);
+	sv->dead = true;
+	Sim_Addr(&nobody, 10, 2, 0, 2, 27500);
+
+	// first client plays until its server goes away, next two go where nobody listens, last one to silent server.
+	// clients which go nowhere stop soon, each challenge they ask for again would make new peer
+	Sim_Addr(&addr, 10, 1, 0, 1, 27001);
+	Sim_NewClient(pr_qw, &addr, &sim_ep[sim_servers[0].ep].addr, SIM_AT(0), 100, SIM_AT(SIM_REFUSED_DOWN + 1000));
+	Sim_Addr(&addr, 10, 1, 0, 2, 27001);
+	Sim_NewClient(pr_qw, &addr, &nobody, SIM_AT(0), 100, SIM_AT(400));
+	Sim_Addr(&addr, 10, 1, 0, 3, 27001);
+	Sim_NewClient(pr_q3, &addr, &nobody, SIM_AT(0), 100, SIM_AT(400));
+	Sim_Addr(&addr, 10, 1, 0, 4, 27001);
+	Sim_NewClient(pr_q3, &addr, &sim_ep[sim_servers[1].ep].addr, SIM_AT(0), 100, SIM_AT(400));
+
+	Sim_Timer(SIM_AT(1000), Sim_Refused_Count, (void *)2);
+	Sim_Timer(SIM_AT(SIM_REFUSED_DOWN), Sim_Refused_Down, NULL);
+	// next datagram of the client is refused, peer is gone after round trip, not after timeout
+	Sim_Timer(SIM_AT(SIM_REFUSED_DOWN + 200), Sim_Refused_Count, (void *)1);
+	Sim_Timer(SIM_AT(16000), Sim_Refused_Count, (void *)0);
+	Sim_Timer(SIM_AT(17000), Sim_Quit, NULL);
+}
+
+static void Sim_Refused_Check(void)
+{
+	sim_client_t *c;
+	int i;
+
+	Sim_Check(sim_clients[0].received > 0, "client got no traffic before its server went away");
+	Sim_Check(!sim_clients[3].told_at, "client of silent server was told proxy can't connect");
+
+	for (i = 1; i < 3; i++)
+	{
+		c = &sim_clients[i];
+		Sim_Check(c->told_at && c->told_at - SIM_START < SIM_MS(200), "%s client was not told in time that proxy can't connect",
+			c->proto == pr_qw ? "qw" : "q3");
+	}
+
+	c = &sim_clients[1];
+	snprintf(sim_summary, sizeof(sim_summary), "clients told proxy can't connect %.0f ms after they asked, peer of server which went away dropped",
+		c->told_at ? Sim_Ms(c->told_at - SIM_START) : 0.0);
+}
+
+//=============================================================================
+
+static sim_scenario_t sim_scenarios[] =
+{
+	{ "peers",		Sim_Peers_Config,	Sim_Peers_Setup,		Sim_Peers_Check },
+	{ "challenge",	NULL,				Sim_Challenge_Setup,	Sim_Challenge_Check },
+	{ "q3probe",	NULL,				Sim_Probe_Setup,		Sim_Probe_Check },
+	{ "bans",		NULL,				Sim_Bans_Setup,			Sim_Bans_Check },
+	{ "query",		Sim_Query_Config,	Sim_Query_Setup,		Sim_Query_Check },
+	{ "refused",	NULL,				Sim_Refused_Setup,		Sim_Refused_Check },
+};
+
+static void Sim_RemoveDir(const char *dir)
+{
+	char path[512];
+	struct dirent *d;
+	DIR *dp;
+
+	if ((dp = opendir(dir)))
+	{
+		while ((d = readdir(dp)))
+		{
+			if (d->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+			unlink(path);
+		}
+		closedir(dp);
+	}
+
+	rmdir(dir);
+}
+
+// runs in child process, returns exit code
+static int Sim_Scenario(const sim_scenario_t *sc)
+{
+	char dir[64], path[128];
+	fwd_params_t params;
+	double wall;
+	FILE *f;
+	int i, fd;
+
+	strlcpy(dir, "/tmp/qwfwd-sim.XXXXXX", sizeof(dir));
+	if (!mkdtemp(dir))
+	{
+		printf("%-10s FAIL  mkdtemp: %s\n", sc->name, strerror(errno));
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/qwfwd.cfg", dir);
+	if (!(f = fopen(path, "w")))
+	{
+		printf("%-10s FAIL  can't write %s\n", sc->name, path);
+		return 1;
+	}
+
+	fprintf(f, "set masters_query 0\n");
+	fprintf(f, "set masters_heartbeat 0\n");
+	fprintf(f, "set masters_snapshot \"\"\n");
+	fprintf(f, "set dns_threads 0\n");
+	if (sc->config)
+		sc->config(f);
+	fclose(f);
+
+	if (chdir(dir) < 0)
+		return 1;
+
+	// proxy talks a lot, report goes to saved stdout
+	fflush(stdout);
+	sim_report = fdopen(dup(1), "w");
+	if (!opt_verbose && (fd = open("/dev/null", O_WRONLY)) >= 0)
+	{
+		dup2(fd, 1);
+		close(fd);
+	}
+
+	srand(opt_seed);
+	sim_rand_state = 0x9E3779B97F4A7C15ull * (opt_seed + 1);
+	sim_now = SIM_START;
+	Sys_SetVirtualClock(sim_now);
+	Sim_Addr(&sim_proxy, 0, 0, 0, 0, SIM_PROXY_PORT);
+	sim_proxy.sin_addr.s_addr = inet_addr(SIM_PROXY_IP);
+	net_backend = &sim_backend;
+
+	sc->setup();
+
+	memset(&params, 0, sizeof(params));
+	strlcpy(params.ip, SIM_PROXY_IP, sizeof(params.ip));
+	params.port = SIM_PROXY_PORT;
+
+	wall = Sim_WallTime();
+	FWD_proc(&params);
+	wall = Sim_WallTime() - wall;
+
+	sc->check();
+	Sim_RemoveDir(dir);
+
+	fprintf(sim_report, "%-10s %s  %s\n", sc->name, sim_failures ? "FAIL" : "PASS", sim_summary);
+	fprintf(sim_report, "%-10s       %.1f s simulated in %.2f s, %llu events, %llu datagrams\n", "",
+		Sim_Ms(sim_now - SIM_START) / 1000, wall, sim_events, sim_packets);
+	for (i = 0; i < sim_failures && i < SIM_MAX_FAILURES; i++)
+		fprintf(sim_report, "%-10s       %s\n", "", sim_failure[i]);
+	if (sim_failures > SIM_MAX_FAILURES)
+		fprintf(sim_report, "%-10s       and %d more\n", "", sim_failures - SIM_MAX_FAILURES);
+	fclose(sim_report);
+
+	return sim_failures ? 1 : 0;
+}
+
+static void Sim_Usage(const char *name)
+{
+	int i;
+
+	printf("Usage: %s [options]\n"
+		"  -n <num>      clients of peers scenario, servers of query scenario (%d)\n"
+		"  -b <num>      bans of bans scenario (%d)\n"
+		"  -s <num>      seed (%u)\n"
+		"  -f <text>     run scenarios which names contain text\n"
+		"  -v            show what proxy prints\n"
+		"scenarios:",
+		name, opt_peers, opt_bans, opt_seed);
+	for (i = 0; i < (int)(sizeof(sim_scenarios) / sizeof(sim_scenarios[0])); i++)
+		printf(" %s", sim_scenarios[i].name);
+	printf("\n");
+	exit(1);
+}
+
+static void Sim_ParseArgs(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-v"))
+			opt_verbose = true;
+		else if (i + 1 >= argc)
+			Sim_Usage(argv[0]);
+		else if (!strcmp(argv[i], "-n"))
+			opt_peers = bound(1, atoi(argv[++i]), 1 << 20);
+		else if (!strcmp(argv[i], "-b"))
+			opt_bans = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s"))
+			opt_seed = (unsigned int)strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-f"))
+			opt_filter = argv[++i];
+		else
+			Sim_Usage(argv[0]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i, status, run = 0, failed = 0;
+	pid_t pid;
+
+	Sim_ParseArgs(argc, argv);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < (int)(sizeof(sim_scenarios) / sizeof(sim_scenarios[0])); i++)
+	{
+		if (opt_filter && !strstr(sim_scenarios[i].name, opt_filter))
+			continue;
+
+		run++;
+		fflush(stdout);
+
+		if ((pid = fork()) < 0)
+		{
+			printf("fork: %s\n", strerror(errno));
+			return 1;
+		}
+
+		if (!pid)
+			_exit(Sim_Scenario(&sim_scenarios[i]));
+
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		{
+			printf("%-10s FAIL  crashed%s\n", sim_scenarios[i].name, WIFSIGNALED(status) ? " with signal" : "");
+			failed++;
+		}
+		else if (WEXITSTATUS(status))
+		{
+			failed++;
+		}
+	}
+
+	printf("%d of %d scenarios passed\n", run - failed, run);
+
+	return failed ? 1 : 0;
+}